@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "mqtt_broker.h"
+
+
+/*******************************************************
+ CONSTANTS
+ *******************************************************/
+
+#define BROKER_PORT             1883
+#define STATS_PERIOD_S          10
+
+/*******************************************************
+ LOCAL VARIABLES
+ *******************************************************/
+
+static volatile sig_atomic_t Stop = 0;
+
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+static void on_signal(int sig)
+{
+    (void) sig;
+
+    Stop = 1;
+}
+
+/**
+ * @brief Runs the host broker until SIGINT and prints its rates
+ */
+int main(int argc, char *argv[])
+{
+    uint16_t port = BROKER_PORT;
+    uint32_t period_s = STATS_PERIOD_S;
+    mqtt_broker_stats_t last = { 0 };
+    mqtt_broker_t *broker;
+    int opt;
+
+    while((opt = getopt(argc, argv, "p:s:h")) != -1)
+    {
+        switch(opt) {
+        case 'p':
+            port = (uint16_t)atoi(optarg);
+            break;
+
+        case 's':
+            period_s = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        default:
+            fprintf(stderr,
+                    "Usage: %s [-p port] [-s s]\n"
+                    "  -p   TCP port, default %u, 0 for any free one\n"
+                    "  -s   Statistics period in s, default %u, 0 for none\n",
+                    argv[0], BROKER_PORT, STATS_PERIOD_S);
+            return 1;
+        }
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    broker = mqtt_broker_start(port);
+    if(broker == NULL)
+    {
+        fprintf(stderr, "Port %u not available\n", port);
+        return 1;
+    }
+    printf("Listening on port %u\n", mqtt_broker_port(broker));
+    fflush(stdout);
+
+    for(uint32_t elapsed_s = 1; !Stop; ++elapsed_s)
+    {
+        mqtt_broker_stats_t stats;
+
+        sleep(1);
+        if(period_s == 0 || elapsed_s % period_s != 0)
+        {
+            continue;
+        }
+
+        mqtt_broker_stats(broker, &stats);
+        printf("clients %u, sessions %u, queued %u, retained %u, in %.1f msg/s, out %.1f msg/s, dropped %llu\n",
+               stats.clients, stats.sessions, stats.queued, stats.retained,
+               (double)(stats.msg_in - last.msg_in) / period_s,
+               (double)(stats.msg_out - last.msg_out) / period_s,
+               (unsigned long long)stats.dropped);
+        fflush(stdout);
+        last = stats;
+    }
+
+    mqtt_broker_stop(broker);
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include <string.h>
+#include <stdatomic.h>
+
+#include "sdkconfig.h"
+
+#include "hal_host.h"
+#include "lvgl_helpers.h"
+
+
+/*******************************************************
+ LOCAL VARIABLES
+ *******************************************************/
+
+static lv_color_t   Frame[LV_VER_RES_MAX][LV_HOR_RES_MAX];
+static uint32_t     Flushes = 0;
+
+// Point pressed by display_host_touch()
+static atomic_int   Touch_x = 0;
+static atomic_int   Touch_y = 0;
+static atomic_bool  Touch_pressed = false;
+
+
+/****************************************
+ EXTERNAL FUNCTIONS
+*****************************************/
+
+/**
+ * @brief No bus to set up, the pen interrupt line idles high
+ */
+void lvgl_driver_init(void)
+{
+#ifdef CONFIG_LV_TOUCH_DETECT_IRQ
+    hal_host_gpio_drive(CONFIG_LV_TOUCH_PIN_IRQ, 1);
+#endif
+}
+
+/**
+ * @brief Copies the rendered area into the frame buffer
+ *
+ * @param drv       Display driver
+ * @param area      Rendered area
+ * @param color_map Pixels of the area, row by row
+ */
+void disp_driver_flush(lv_disp_drv_t *drv, const lv_area_t *area, lv_color_t *color_map)
+{
+    int32_t width = lv_area_get_width(area);
+
+    for(int32_t y = area->y1; y <= area->y2; ++y)
+    {
+        if(y >= 0 && y < LV_VER_RES_MAX && area->x1 >= 0 && area->x2 < LV_HOR_RES_MAX)
+        {
+            memcpy(&Frame[y][area->x1], color_map, width * sizeof(lv_color_t));
+        }
+        color_map += width;
+    }
+
+    Flushes++;
+    lv_disp_flush_ready(drv);
+}
+
+/**
+ * @brief Reads the point pressed by display_host_touch()
+ *
+ * @param drv   Input driver
+ * @param data  Output: point and state
+ * @return false, no more data to read
+ */
+bool touch_driver_read(lv_indev_drv_t *drv, lv_indev_data_t *data)
+{
+    (void) drv;
+
+    data->point.x = (lv_coord_t)atomic_load(&Touch_x);
+    data->point.y = (lv_coord_t)atomic_load(&Touch_y);
+    data->state = atomic_load(&Touch_pressed) ? LV_INDEV_STATE_PR : LV_INDEV_STATE_REL;
+
+    return false;
+}
+
+/**
+ * @brief Gets the frame buffer
+ *
+ * @param flushes Output: number of flushes so far, may be NULL
+ * @return Pixels, LV_HOR_RES_MAX per row
+ */
+const lv_color_t *display_host_frame(uint32_t *flushes)
+{
+    if(flushes != NULL)
+    {
+        *flushes = Flushes;
+    }
+
+    return &Frame[0][0];
+}
+
+/**
+ * @brief Presses or releases the panel at a point in screen coordinates,
+ *        with the pen interrupt of the controller
+ *
+ * @param x         Column
+ * @param y         Row
+ * @param pressed   true while touched
+ */
+void display_host_touch(lv_coord_t x, lv_coord_t y, bool pressed)
+{
+    atomic_store(&Touch_x, x);
+    atomic_store(&Touch_y, y);
+    atomic_store(&Touch_pressed, pressed);
+
+#ifdef CONFIG_LV_TOUCH_DETECT_IRQ
+    // Low while the panel is touched
+    hal_host_gpio_drive(CONFIG_LV_TOUCH_PIN_IRQ, pressed ? 0 : 1);
+#endif
+}
@@ -0,0 +1,757 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "sdkconfig.h"
+
+#include "mqtt_lite.h"
+#include "mqtt_broker.h"
+#include "percentile.h"
+#include "dev_state.h"
+#include "wqtt_client.h"
+
+
+/*******************************************************
+ CONSTANTS
+ *******************************************************/
+
+#define DEVICES                 50      // Each firmware process takes 1-2% of a core idle
+#define GROUP_SIZE              10
+#define DURATION_S              30
+#define COMMAND_RATE            20      // Commands per second, all classes
+#define ONLINE_TIMEOUT_MS       30000
+#define DRAIN_MS                3000    // After the last command, for the answers in flight
+#define TOPIC_MAX               96
+#define PING_SLOTS              4096    // Pings in flight at most
+
+#define HOST_BINARY             "smartRelay_host"
+
+/*******************************************************
+ TYPES DEFINITIONS
+ *******************************************************/
+
+// Command classes, each one owns the fields it changes so every command is
+// a change the devices report
+typedef enum {
+    CLASS_DEVICE = 0,       // Heater and Light of one device, on its own topics
+    CLASS_GROUP,            // Fan level of a group of devices
+    CLASS_BROADCAST,        // LED of every device
+    CLASS_PING,             // Ping on the device topic, answered on tele/Pong
+    CLASS_CNT
+} class_t;
+
+// One slot per tenth of the command rate
+static const class_t Schedule[] = {
+    CLASS_DEVICE, CLASS_DEVICE, CLASS_PING, CLASS_DEVICE, CLASS_GROUP,
+    CLASS_DEVICE, CLASS_DEVICE, CLASS_PING, CLASS_DEVICE, CLASS_BROADCAST
+};
+
+#define SCHEDULE_CNT            (sizeof(Schedule) / sizeof(Schedule[0]))
+
+// Latency samples of a class, in us
+typedef struct {
+    uint32_t *  sample;
+    size_t      count;
+    size_t      size;
+    uint32_t    sent;               // Expected answers, one per device reached
+    uint32_t    superseded;         // Overtaken by the next command on the field
+} class_stats_t;
+
+// A field change sent to a device and not seen in its snapshot yet
+typedef struct {
+    bool        pending;
+    uint8_t     value;
+    class_t     cls;
+    int64_t     sent_us;
+} expect_t;
+
+typedef struct {
+    pid_t       pid;
+    char        id[16];             // Device id, the MAC in hex
+    bool        online;
+    int64_t     online_us;
+    uint8_t     state[DEV_FIELD_CNT];   // Last snapshot
+    expect_t    expect[DEV_FIELD_CNT];
+    uint32_t    msg_seen;           // Published on the device namespace, controller commands included
+    uint32_t    bytes_seen;
+    uint32_t    msg_sent;           // Controller commands on the device namespace
+    uint32_t    bytes_sent;
+} device_t;
+
+/*******************************************************
+ FUNCTION PROTOTYPES
+ *******************************************************/
+
+static void usage(const char *name);
+static int64_t now_us(void);
+static void stats_add(class_stats_t *stats, uint32_t latency_us);
+static device_t *device_find(const char *id, size_t len);
+static void on_snapshot(device_t *dev, const uint8_t *data, size_t len, int64_t rx_us);
+static void on_pong(const uint8_t *data, size_t len, int64_t rx_us);
+static void *reader_thread(void *arg);
+static void expect_set(device_t *dev, dev_field_t field, uint8_t value, class_t cls, int64_t sent_us);
+static void publish(device_t *dev, const char *ns, const char *name, const char *payload);
+static void send_command(class_t cls, uint32_t seq);
+static bool devices_start(const char *binary, const char *broker, uint32_t run_s);
+static void devices_stop(void);
+static void report(double run_s, const mqtt_broker_stats_t *before, const mqtt_broker_stats_t *after);
+
+/*******************************************************
+ LOCAL VARIABLES
+ *******************************************************/
+
+static const char *     Class_names[CLASS_CNT] = {
+    [CLASS_DEVICE]      = "device",
+    [CLASS_GROUP]       = "group",
+    [CLASS_BROADCAST]   = "broadcast",
+    [CLASS_PING]        = "ping"
+};
+
+static device_t *       Devices;
+static uint32_t         Device_cnt = DEVICES;
+static uint32_t         Group_size = GROUP_SIZE;
+static uint32_t         Online_cnt = 0;
+
+// Guards the devices, the pings and the statistics, shared with the reader
+static pthread_mutex_t  Lock = PTHREAD_MUTEX_INITIALIZER;
+static class_stats_t    Stats[CLASS_CNT];
+static int64_t          Ping_sent_us[PING_SLOTS];
+static uint32_t         Ping_seq[PING_SLOTS];
+
+static mqtt_lite_t      Controller;
+static atomic_bool      Stop = false;
+static char             Broadcast_ns[TOPIC_MAX];
+
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-n devices] [-g size] [-d s] [-r rate] [-x binary] [-b host:port]\n"
+            "  -n   Simulated devices, default %u\n"
+            "  -g   Devices per command group, default %u\n"
+            "  -d   Duration of the command traffic in s, default %u\n"
+            "  -r   Commands per second, default %u\n"
+            "  -x   Firmware binary, default " HOST_BINARY " next to this tool\n"
+            "  -b   External broker, default: one in this process\n",
+            name, DEVICES, GROUP_SIZE, DURATION_S, COMMAND_RATE);
+}
+
+static int64_t now_us(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void stats_add(class_stats_t *stats, uint32_t latency_us)
+{
+    if(stats->count == stats->size)
+    {
+        stats->size = stats->size ? stats->size * 2 : 1024;
+        stats->sample = realloc(stats->sample, stats->size * sizeof(stats->sample[0]));
+    }
+
+    stats->sample[stats->count++] = latency_us;
+}
+
+/**
+ * @brief Finds a device by the id level of a topic. Lock held.
+ */
+static device_t *device_find(const char *id, size_t len)
+{
+    unsigned long idx;
+    char hex[5];
+
+    // The devices are numbered in the last two bytes of their MAC
+    if(len != 12)
+    {
+        return NULL;
+    }
+
+    memcpy(hex, id + 8, 4);
+    hex[4] = '\0';
+    idx = strtoul(hex, NULL, 16);
+
+    if(idx == 0 || idx > Device_cnt || memcmp(Devices[idx - 1].id, id, len) != 0)
+    {
+        return NULL;
+    }
+
+    return &Devices[idx - 1];
+}
+
+/**
+ * @brief Retained snapshot "<version>:<digit per field>": the first one tells
+ *        the device is online, each one confirms the changes it shows. Lock held.
+ */
+static void on_snapshot(device_t *dev, const uint8_t *data, size_t len, int64_t rx_us)
+{
+    const uint8_t *digits = memchr(data, ':', len);
+
+    if(digits == NULL || (size_t)(data + len - digits - 1) != DEV_FIELD_CNT)
+    {
+        return;
+    }
+    digits++;
+
+    if(!dev->online)
+    {
+        dev->online = true;
+        dev->online_us = rx_us;
+        Online_cnt++;
+    }
+
+    for(int field = 0; field < DEV_FIELD_CNT; ++field)
+    {
+        expect_t *expect = &dev->expect[field];
+
+        dev->state[field] = digits[field] - '0';
+
+        if(expect->pending && dev->state[field] == expect->value)
+        {
+            expect->pending = false;
+            stats_add(&Stats[expect->cls], (uint32_t)(rx_us - expect->sent_us));
+        }
+    }
+}
+
+/**
+ * @brief Ping answer, its payload is the sequence number. Lock held.
+ */
+static void on_pong(const uint8_t *data, size_t len, int64_t rx_us)
+{
+    char str[16];
+    uint32_t seq;
+
+    if(len == 0 || len >= sizeof(str))
+    {
+        return;
+    }
+
+    memcpy(str, data, len);
+    str[len] = '\0';
+    seq = (uint32_t)strtoul(str, NULL, 10);
+
+    if(Ping_sent_us[seq % PING_SLOTS] != 0 && Ping_seq[seq % PING_SLOTS] == seq)
+    {
+        stats_add(&Stats[CLASS_PING], (uint32_t)(rx_us - Ping_sent_us[seq % PING_SLOTS]));
+        Ping_sent_us[seq % PING_SLOTS] = 0;
+    }
+}
+
+/**
+ * @brief Reads every message of the fleet: "<prefix>/<id>/<rest>"
+ */
+static void *reader_thread(void *arg)
+{
+    size_t prefix_len = strlen(CONFIG_WQTT_TOPIC_PREFIX) + 1;
+    mqtt_lite_packet_t pkt;
+
+    (void) arg;
+
+    while(!atomic_load(&Stop))
+    {
+        const char *id;
+        const char *rest;
+        size_t rest_len;
+        device_t *dev;
+        int64_t rx_us;
+        int ret;
+
+        ret = mqtt_lite_read(&Controller, 100, &pkt);
+        if(ret < 0)
+        {
+            fprintf(stderr, "Controller disconnected\n");
+            break;
+        }
+
+        // Nothing read: pkt still holds the previous packet
+        if(ret == 0 || pkt.type != MQTT_LITE_PUBLISH || pkt.topic_len <= prefix_len)
+        {
+            continue;
+        }
+
+        rx_us = now_us();
+        id = pkt.topic + prefix_len;
+        rest = memchr(id, '/', pkt.topic_len - prefix_len);
+        if(rest == NULL)
+        {
+            continue;
+        }
+        rest++;
+        rest_len = pkt.topic + pkt.topic_len - rest;
+
+        pthread_mutex_lock(&Lock);
+
+        // Group and broadcast commands of the controller are not in a device namespace
+        dev = device_find(id, rest - id - 1);
+        if(dev != NULL)
+        {
+            dev->msg_seen++;
+            dev->bytes_seen += pkt.topic_len + pkt.payload_len;
+
+            if(rest_len == strlen(State_topic) && memcmp(rest, State_topic, rest_len) == 0)
+            {
+                on_snapshot(dev, pkt.payload, pkt.payload_len, rx_us);
+            } else if(rest_len == strlen(Pong_topic) && memcmp(rest, Pong_topic, rest_len) == 0) {
+                on_pong(pkt.payload, pkt.payload_len, rx_us);
+            }
+        }
+
+        pthread_mutex_unlock(&Lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Waits for a field change in the snapshots of a device. Lock held.
+ */
+static void expect_set(device_t *dev, dev_field_t field, uint8_t value, class_t cls, int64_t sent_us)
+{
+    expect_t *expect = &dev->expect[field];
+
+    if(expect->pending)
+    {
+        Stats[expect->cls].superseded++;
+    }
+
+    expect->pending = true;
+    expect->value = value;
+    expect->cls = cls;
+    expect->sent_us = sent_us;
+    Stats[cls].sent++;
+}
+
+/**
+ * @brief Publishes a command, counted for the device if it is in its namespace
+ *
+ * @param dev   Addressed device, NULL for a group or broadcast command
+ * @param ns    Namespace, "<prefix>/.../"
+ */
+static void publish(device_t *dev, const char *ns, const char *name, const char *payload)
+{
+    char topic[TOPIC_MAX + 16];    // A command name after the namespace
+    int len;
+
+    len = snprintf(topic, sizeof(topic), "%s%s", ns, name);
+    mqtt_lite_publish(&Controller, topic, payload, strlen(payload), 1, false);
+
+    if(dev != NULL)
+    {
+        pthread_mutex_lock(&Lock);
+        dev->msg_sent++;
+        dev->bytes_sent += len + strlen(payload);
+        pthread_mutex_unlock(&Lock);
+    }
+}
+
+/**
+ * @brief Sends one command of a class. The new values follow the last
+ *        snapshots, so each one is a change even after an overcurrent trip.
+ *
+ * @param cls   Command class
+ * @param seq   Sequence number of the command
+ */
+static void send_command(class_t cls, uint32_t seq)
+{
+    device_t *dev = &Devices[(seq / SCHEDULE_CNT) % Device_cnt];
+    char ns[TOPIC_MAX];
+    char payload[16];
+    dev_field_t field;
+    uint32_t group;
+    uint8_t value;
+    int64_t sent_us;
+
+    snprintf(ns, sizeof(ns), "%s/%s/", CONFIG_WQTT_TOPIC_PREFIX, dev->id);
+
+    switch(cls) {
+    case CLASS_DEVICE:
+        field = (seq % 2) ? DEV_LIGHT : DEV_HEATER;
+
+        pthread_mutex_lock(&Lock);
+        value = (dev->state[field] == HW_ON) ? HW_OFF : HW_ON;
+        expect_set(dev, field, value, cls, now_us());
+        pthread_mutex_unlock(&Lock);
+
+        snprintf(payload, sizeof(payload), "%u", value);
+        publish(dev, ns, (field == DEV_LIGHT) ? Light_topic : Heater_topic, payload);
+        break;
+
+    case CLASS_GROUP:
+        // Every level in turn, the group members not at it already change
+        group = (seq / SCHEDULE_CNT) % ((Device_cnt + Group_size - 1) / Group_size);
+        value = HW_LVL_OFF + (seq / SCHEDULE_CNT / 7) % (HW_LVL_VERY_HIGH - HW_LVL_OFF + 1);
+        snprintf(ns, sizeof(ns), "%s/%s/g%u/", CONFIG_WQTT_TOPIC_PREFIX, Group_namespace, group);
+        sent_us = now_us();
+
+        pthread_mutex_lock(&Lock);
+        for(uint32_t idx = group * Group_size; idx < (group + 1) * Group_size && idx < Device_cnt; ++idx)
+        {
+            if(Devices[idx].state[DEV_FAN] != value)
+            {
+                expect_set(&Devices[idx], DEV_FAN, value, cls, sent_us);
+            }
+        }
+        pthread_mutex_unlock(&Lock);
+
+        snprintf(payload, sizeof(payload), "%u", value);
+        publish(NULL, ns, Fan_topic, payload);
+        break;
+
+    case CLASS_BROADCAST:
+        value = (seq / SCHEDULE_CNT) % 2 ? HW_ON : HW_OFF;
+        sent_us = now_us();
+
+        pthread_mutex_lock(&Lock);
+        for(uint32_t idx = 0; idx < Device_cnt; ++idx)
+        {
+            if(Devices[idx].state[DEV_LED] != value)
+            {
+                expect_set(&Devices[idx], DEV_LED, value, cls, sent_us);
+            }
+        }
+        pthread_mutex_unlock(&Lock);
+
+        snprintf(payload, sizeof(payload), "%u", value);
+        publish(NULL, Broadcast_ns, LED_topic, payload);
+        break;
+
+    case CLASS_PING:
+        pthread_mutex_lock(&Lock);
+        Ping_seq[seq % PING_SLOTS] = seq;
+        Ping_sent_us[seq % PING_SLOTS] = now_us();
+        Stats[CLASS_PING].sent++;
+        pthread_mutex_unlock(&Lock);
+
+        snprintf(payload, sizeof(payload), "%u", seq);
+        publish(dev, ns, Ping_topic, payload);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Starts one firmware process per device, MAC 02:00:00:00:<number>
+ *
+ * @param binary    smartRelay_host
+ * @param broker    "host:port"
+ * @param run_s     Run time of the processes, in case this tool dies
+ * @return false if a process could not be started
+ */
+static bool devices_start(const char *binary, const char *broker, uint32_t run_s)
+{
+    char run[16];
+
+    snprintf(run, sizeof(run), "%u", run_s);
+
+    for(uint32_t idx = 0; idx < Device_cnt; ++idx)
+    {
+        device_t *dev = &Devices[idx];
+        uint32_t number = idx + 1;
+        char group[16];
+        char mac[24];
+        pid_t pid;
+
+        snprintf(mac, sizeof(mac), "02:00:00:00:%02x:%02x", (number >> 8) & 0xFF, number & 0xFF);
+        snprintf(dev->id, sizeof(dev->id), "02000000%02x%02x", (number >> 8) & 0xFF, number & 0xFF);
+        snprintf(group, sizeof(group), "g%u", idx / Group_size);
+
+        pid = fork();
+        if(pid < 0)
+        {
+            perror("fork");
+            return false;
+        }
+
+        if(pid == 0)
+        {
+            int null_fd = open("/dev/null", O_WRONLY);
+
+            // The firmware prints every command it receives
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            execl(binary, binary, "-b", broker, "-m", mac, "-g", group, "-l", "0", "-t", run, (char *)NULL);
+            _exit(127);
+        }
+
+        dev->pid = pid;
+    }
+
+    return true;
+}
+
+static void devices_stop(void)
+{
+    for(uint32_t idx = 0; idx < Device_cnt; ++idx)
+    {
+        if(Devices[idx].pid > 0)
+        {
+            kill(Devices[idx].pid, SIGTERM);
+        }
+    }
+
+    for(uint32_t idx = 0; idx < Device_cnt; ++idx)
+    {
+        if(Devices[idx].pid > 0)
+        {
+            waitpid(Devices[idx].pid, NULL, 0);
+        }
+    }
+}
+
+/**
+ * @brief Prints the latencies, the broker rates and the per-device rates
+ *
+ * @param run_s     Time from the start of the commands to the end of the drain
+ * @param before    Broker counters at the start, NULL for an external broker
+ * @param after     Broker counters at the end
+ */
+static void report(double run_s, const mqtt_broker_stats_t *before, const mqtt_broker_stats_t *after)
+{
+    uint32_t *msg_rate = calloc(Device_cnt, sizeof(uint32_t));
+    uint32_t *byte_rate = calloc(Device_cnt, sizeof(uint32_t));
+
+    printf("\n%-10s %8s %8s %8s %8s %8s %8s\n", "command", "sent", "answered", "lost", "p50 us", "p99 us", "max us");
+    for(int cls = 0; cls < CLASS_CNT; ++cls)
+    {
+        class_stats_t *stats = &Stats[cls];
+        uint32_t lost = stats->sent - stats->superseded - (uint32_t)stats->count;
+
+        printf("%-10s %8u %8zu %8u %8u %8u %8u\n", Class_names[cls], stats->sent, stats->count, lost,
+               percentile(stats->sample, stats->count, 500),
+               percentile(stats->sample, stats->count, 990),
+               percentile(stats->sample, stats->count, 1000));
+    }
+
+    if(before != NULL)
+    {
+        // A reconnect is a device or the controller dropped on the way
+        printf("\nbroker: in %.0f msg/s, out %.0f msg/s, in %.1f kB/s, out %.1f kB/s, dropped %llu, %u reconnects\n",
+               (double)(after->msg_in - before->msg_in) / run_s,
+               (double)(after->msg_out - before->msg_out) / run_s,
+               (double)(after->bytes_in - before->bytes_in) / run_s / 1000,
+               (double)(after->bytes_out - before->bytes_out) / run_s / 1000,
+               (unsigned long long)(after->dropped - before->dropped),
+               after->connects - (Device_cnt + 1));
+    }
+
+    // Messages the devices published, the controller commands taken out
+    for(uint32_t idx = 0; idx < Device_cnt; ++idx)
+    {
+        msg_rate[idx] = (uint32_t)((Devices[idx].msg_seen - Devices[idx].msg_sent) * 60 / run_s);
+        byte_rate[idx] = (uint32_t)((Devices[idx].bytes_seen - Devices[idx].bytes_sent) * 60 / run_s);
+    }
+
+    printf("per device: p50 %u msg/min, p99 %u msg/min, max %u msg/min, p50 %u bytes/min\n",
+           percentile(msg_rate, Device_cnt, 500),
+           percentile(msg_rate, Device_cnt, 990),
+           percentile(msg_rate, Device_cnt, 1000),
+           percentile(byte_rate, Device_cnt, 500));
+
+    free(msg_rate);
+    free(byte_rate);
+}
+
+/**
+ * @brief Fleet simulator: one firmware process per device against a local
+ *        broker, a controller sending device, group and broadcast commands
+ *        and pings. Reports the end-to-end latencies, the broker throughput
+ *        and the per-device message rates, to size a broker.
+ *
+ *        A command is answered when the retained snapshot of the device
+ *        shows the change, a ping when its Pong arrives.
+ */
+int main(int argc, char *argv[])
+{
+    uint32_t duration_s = DURATION_S;
+    uint32_t rate = COMMAND_RATE;
+    char binary[PATH_MAX];
+    char broker_addr[64] = "";
+    char filter[TOPIC_MAX];
+    char *host = "127.0.0.1";
+    uint16_t port;
+    mqtt_broker_t *broker = NULL;
+    mqtt_broker_stats_t before;
+    mqtt_broker_stats_t after;
+    uint32_t lost = 0;
+    int64_t start_us;
+    int64_t run_us;
+    pthread_t reader;
+    char *sep;
+    int opt;
+
+    snprintf(binary, sizeof(binary), "%s/%s", dirname(strdup(argv[0])), HOST_BINARY);
+
+    while((opt = getopt(argc, argv, "n:g:d:r:x:b:h")) != -1)
+    {
+        switch(opt) {
+        case 'n':
+            Device_cnt = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        case 'g':
+            Group_size = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        case 'd':
+            duration_s = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        case 'r':
+            rate = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        case 'x':
+            snprintf(binary, sizeof(binary), "%s", optarg);
+            break;
+
+        case 'b':
+            snprintf(broker_addr, sizeof(broker_addr), "%s", optarg);
+            break;
+
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(Device_cnt == 0 || Device_cnt > 0xFFFF || Group_size == 0 || rate == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(broker_addr[0] == '\0')
+    {
+        broker = mqtt_broker_start(0);
+        if(broker == NULL)
+        {
+            fprintf(stderr, "Broker not started\n");
+            return 1;
+        }
+        port = mqtt_broker_port(broker);
+        snprintf(broker_addr, sizeof(broker_addr), "%s:%u", host, port);
+    } else {
+        sep = strrchr(broker_addr, ':');
+        if(sep == NULL)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        host = strndup(broker_addr, sep - broker_addr);
+        port = (uint16_t)atoi(sep + 1);
+    }
+
+    const mqtt_lite_opts_t opts = {
+        .client_id = "fleet-controller",
+        .clean_session = true,
+        .keepalive_s = 60
+    };
+
+    if(!mqtt_lite_connect(&Controller, host, port, &opts, NULL))
+    {
+        fprintf(stderr, "Controller not connected to %s\n", broker_addr);
+        return 1;
+    }
+    pthread_create(&reader, NULL, reader_thread, NULL);
+
+    snprintf(filter, sizeof(filter), "%s/+/#", CONFIG_WQTT_TOPIC_PREFIX);
+    mqtt_lite_subscribe(&Controller, filter, 0);
+    snprintf(Broadcast_ns, sizeof(Broadcast_ns), "%s/%s/", CONFIG_WQTT_TOPIC_PREFIX, Broadcast_namespace);
+
+    // Snapshots retained from an earlier run arrive before the devices start
+    usleep(200 * 1000);
+
+    Devices = calloc(Device_cnt, sizeof(Devices[0]));
+    start_us = now_us();
+    if(!devices_start(binary, broker_addr, duration_s + (ONLINE_TIMEOUT_MS + DRAIN_MS) / 1000 + 10))
+    {
+        devices_stop();
+        return 1;
+    }
+
+    for(bool online = false; !online; )
+    {
+        pthread_mutex_lock(&Lock);
+        online = (Online_cnt == Device_cnt);
+        pthread_mutex_unlock(&Lock);
+
+        if(!online && now_us() - start_us > ONLINE_TIMEOUT_MS * 1000LL)
+        {
+            fprintf(stderr, "%u of %u devices online after %u ms\n", Online_cnt, Device_cnt, ONLINE_TIMEOUT_MS);
+            devices_stop();
+            return 1;
+        }
+        usleep(10 * 1000);
+    }
+
+    printf("%u devices in %u groups online in %lld ms, %u commands/s for %u s\n",
+           Device_cnt, (Device_cnt + Group_size - 1) / Group_size,
+           (long long)(now_us() - start_us) / 1000, rate, duration_s);
+    fflush(stdout);
+
+    if(broker != NULL)
+    {
+        mqtt_broker_stats(broker, &before);
+    }
+    start_us = now_us();
+
+    for(uint32_t seq = 0; seq < duration_s * rate; ++seq)
+    {
+        int64_t due_us = start_us + (int64_t)seq * 1000000 / rate;
+        int64_t wait_us = due_us - now_us();
+
+        if(wait_us > 0)
+        {
+            usleep(wait_us);
+        }
+
+        send_command(Schedule[seq % SCHEDULE_CNT], seq);
+    }
+
+    usleep(DRAIN_MS * 1000);
+    run_us = now_us() - start_us;
+
+    if(broker != NULL)
+    {
+        mqtt_broker_stats(broker, &after);
+    }
+
+    pthread_mutex_lock(&Lock);
+    report(run_us / 1e6, (broker != NULL) ? &before : NULL, &after);
+    for(int cls = 0; cls < CLASS_CNT; ++cls)
+    {
+        lost += Stats[cls].sent - Stats[cls].superseded - (uint32_t)Stats[cls].count;
+    }
+    pthread_mutex_unlock(&Lock);
+
+    atomic_store(&Stop, true);
+    pthread_join(reader, NULL);
+    mqtt_lite_close(&Controller);
+    devices_stop();
+
+    if(broker != NULL)
+    {
+        mqtt_broker_stop(broker);
+    }
+
+    return (lost == 0) ? 0 : 1;
+}
@@ -0,0 +1,1663 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "hal.h"
+#include "hal_host.h"
+
+
+/*******************************************************
+ CONSTANTS
+ *******************************************************/
+
+#define GPIO_CNT                64
+#define LOAD_MAX                8
+#define TIMER_MAX               8
+#define NVS_ENTRY_MAX           32
+#define NVS_NAME_MAX            16      // NVS limit, terminator included
+#define LOG_TAG_MAX             16
+
+#define ADC_POLL_US             1000    // Samples are synthesized in steps of this length
+#define ADC_MAX_LAG_US          1000000 // Older samples are dropped like a DMA overrun
+#define ADC_NOISE_LSB           2
+
+#define MAINS_NOMINAL_HALF_US   10000
+#define ZERO_PULSE_US           200     // Width of the detector pulse
+
+/*******************************************************
+ TYPES
+ *******************************************************/
+
+struct hal_task {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    uint32_t        notified;
+    hal_task_fn_t   fn;
+    char            name[16];
+};
+
+struct hal_mutex {
+    pthread_mutex_t lock;
+};
+
+struct hal_signal {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    bool            given;
+};
+
+// One-shot alarm timer, the handler runs in the timer thread
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pthread_t       thread;
+    bool            armed;
+    int64_t         alarm_us;       // hal_time_us() time
+    hal_timer_isr_t isr;
+    void *          arg;
+} oneshot_t;
+
+typedef struct {
+    hal_timer_cb_t  cb;
+    void *          arg;
+    const char *    name;
+    uint32_t        period_us;
+    int64_t         next_us;
+} periodic_t;
+
+typedef struct {
+    int                     pin;
+    hal_host_load_kind_t    kind;
+    bool                    active_low;
+    uint32_t                rms_ma;
+    uint32_t                operate_us;     // HAL_HOST_LOAD_RELAY, coil on to contact closed
+    uint32_t                release_us;     // HAL_HOST_LOAD_RELAY, coil off to contact open
+    bool                    triac_latched;  // HAL_HOST_LOAD_TRIAC
+    bool                    coil;           // HAL_HOST_LOAD_RELAY
+    bool                    contact;
+    int64_t                 coil_us;        // Last coil change
+} load_t;
+
+typedef enum {
+    NVS_TYPE_U32 = 0,
+    NVS_TYPE_BLOB
+} nvs_type_t;
+
+typedef struct {
+    char        space[NVS_NAME_MAX];
+    char        key[NVS_NAME_MAX];
+    nvs_type_t  type;
+    size_t      size;
+    uint8_t *   data;
+} nvs_entry_t;
+
+/*******************************************************
+ FUNCTION PROTOTYPES
+ *******************************************************/
+
+static int64_t monotonic_us(void);
+static struct timespec deadline(int64_t time_us);
+static void cond_init(pthread_cond_t *cond);
+static uint32_t random_next(void);
+static void isr_enter(void);
+static void isr_exit(void);
+static void gpio_write(int pin, int level);
+static void load_pin_changed(int pin, int level, int64_t now_us);
+static void oneshot_start(oneshot_t *timer, hal_timer_isr_t isr, void *arg);
+static void oneshot_arm(oneshot_t *timer, int64_t alarm_us);
+static void *oneshot_thread(void *arg);
+static void *periodic_thread(void *arg);
+static void *mains_thread(void *arg);
+static void *task_entry(void *arg);
+static uint32_t adc_nominal_mv(uint32_t raw, const void *ctx);
+static uint16_t adc_sample(int64_t time_us);
+static nvs_entry_t *nvs_find(const char *space, const char *key);
+static bool nvs_store(const char *space, const char *key, nvs_type_t type, const void *data, size_t size);
+static hal_log_level_t log_level_get(const char *tag);
+
+/*******************************************************
+ LOCAL VARIABLES
+ *******************************************************/
+
+static int64_t          Boot_us;
+
+// Interrupt handlers of all sources run one at a time, like on one core
+static pthread_mutex_t  Isr_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// GPIO
+static atomic_int       Gpio_level[GPIO_CNT];
+static hal_gpio_isr_t   Gpio_isr[GPIO_CNT];
+static void *           Gpio_isr_arg[GPIO_CNT];
+static hal_edge_t       Gpio_isr_edge[GPIO_CNT];
+static _Atomic(hal_host_gpio_hook_t) Gpio_hook = NULL;
+static uint32_t         Pwm_duty[16];
+
+// Board: mains and loads
+static pthread_mutex_t  Board_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   Mains_cond;
+static bool             Mains_started = false;
+static int              Mains_pin = -1;
+static uint32_t         Mains_half_us = 0;          // 0: no edges
+static uint32_t         Mains_jitter_us = 0;
+static uint32_t         Wave_half_us = MAINS_NOMINAL_HALF_US;
+static int64_t          Wave_zero_us = 0;           // Last zero crossing of the waveform
+static bool             Wave_negative = false;      // Polarity of the half-cycle after it
+static load_t           Loads[LOAD_MAX];
+static size_t           Load_cnt = 0;
+static uint32_t         Fault_ma = 0;
+static uint32_t         Random_state = 0x2545F491;
+
+// Current sensor
+static bool             Adc_calibrated = true;
+static uint32_t         Adc_rate_hz = 20000;
+static int64_t          Adc_start_us = 0;
+static uint64_t         Adc_index = 0;              // Next sample
+
+// Timers
+static int64_t          Phase_epoch_us = 0;
+static oneshot_t        Phase_timer;
+static oneshot_t        Relay_timer;
+static pthread_mutex_t  Periodic_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   Periodic_cond;
+static periodic_t       Periodic[TIMER_MAX];
+static size_t           Periodic_cnt = 0;
+
+// Tasks
+static __thread struct hal_task *Self = NULL;
+
+// NVS
+static pthread_mutex_t  Nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static nvs_entry_t      Nvs[NVS_ENTRY_MAX];
+static uint32_t         Nvs_writes = 0;
+
+// System
+static uint8_t          Mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static pthread_mutex_t  Log_lock = PTHREAD_MUTEX_INITIALIZER;
+static hal_log_level_t  Log_default = HAL_LOG_INFO;
+static const char *     Log_tag[LOG_TAG_MAX];
+static hal_log_level_t  Log_tag_level[LOG_TAG_MAX];
+static size_t           Log_tag_cnt = 0;
+
+static const char *TAG = "HAL";
+
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+/**
+ * @brief Sets the boot time and the condition variables before main()
+ */
+__attribute__((constructor))
+static void hal_host_boot(void)
+{
+    Boot_us = monotonic_us();
+
+    cond_init(&Mains_cond);
+    cond_init(&Periodic_cond);
+
+    for(int pin = 0; pin < GPIO_CNT; ++pin)
+    {
+        atomic_init(&Gpio_level[pin], 0);
+    }
+}
+
+/**
+ * @brief Reads the monotonic clock
+ *
+ * @return Time in us
+ */
+static int64_t monotonic_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Converts a hal_time_us() time into an absolute CLOCK_MONOTONIC time
+ *
+ * @param time_us Time since boot
+ * @return Absolute time for the timed waits
+ */
+static struct timespec deadline(int64_t time_us)
+{
+    int64_t abs_us = Boot_us + time_us;
+    struct timespec ts = {
+        .tv_sec = abs_us / 1000000,
+        .tv_nsec = (abs_us % 1000000) * 1000
+    };
+
+    return ts;
+}
+
+/**
+ * @brief Creates a condition variable waiting on CLOCK_MONOTONIC
+ *
+ * @param cond Condition variable
+ */
+static void cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/**
+ * @brief xorshift32, Board_lock is held
+ *
+ * @return Pseudo random number
+ */
+static uint32_t random_next(void)
+{
+    Random_state ^= Random_state << 13;
+    Random_state ^= Random_state >> 17;
+    Random_state ^= Random_state << 5;
+
+    return Random_state;
+}
+
+/**
+ * @brief Starts a simulated interrupt handler
+ */
+static void isr_enter(void)
+{
+    pthread_mutex_lock(&Isr_lock);
+}
+
+/**
+ * @brief Ends a simulated interrupt handler
+ */
+static void isr_exit(void)
+{
+    pthread_mutex_unlock(&Isr_lock);
+}
+
+/**
+ * @brief Changes the level of a pin and lets the board follow it
+ *
+ * @param pin   GPIO number
+ * @param level 0 or 1
+ */
+static void gpio_write(int pin, int level)
+{
+    hal_host_gpio_hook_t hook;
+    int64_t now_us;
+
+    if(pin < 0 || pin >= GPIO_CNT)
+    {
+        return;
+    }
+
+    level = (level != 0);
+    if(atomic_exchange(&Gpio_level[pin], level) == level)
+    {
+        return;
+    }
+
+    now_us = hal_time_us();
+    load_pin_changed(pin, level, now_us);
+
+    hook = atomic_load(&Gpio_hook);
+    if(hook != NULL)
+    {
+        hook(pin, level, now_us);
+    }
+}
+
+/**
+ * @brief Updates the loads driven by a pin
+ *
+ * @param pin       GPIO number
+ * @param level     New level
+ * @param now_us    Time of the change
+ */
+static void load_pin_changed(int pin, int level, int64_t now_us)
+{
+    pthread_mutex_lock(&Board_lock);
+
+    for(size_t idx = 0; idx < Load_cnt; ++idx)
+    {
+        load_t *load = &Loads[idx];
+        bool on = ((level != 0) != load->active_low);
+
+        if(load->pin != pin)
+        {
+            continue;
+        }
+
+        if(load->kind == HAL_HOST_LOAD_TRIAC && on)
+        {
+            load->triac_latched = true;
+        }
+        else if(load->kind == HAL_HOST_LOAD_RELAY)
+        {
+            load->coil = on;
+            load->coil_us = now_us;
+        }
+    }
+
+    pthread_mutex_unlock(&Board_lock);
+}
+
+/**
+ * @brief Starts a one-shot timer thread with the alarm disabled
+ *
+ * @param timer Timer
+ * @param isr   Alarm handler
+ * @param arg   Handler argument
+ */
+static void oneshot_start(oneshot_t *timer, hal_timer_isr_t isr, void *arg)
+{
+    pthread_mutex_init(&timer->lock, NULL);
+    cond_init(&timer->cond);
+    timer->armed = false;
+    timer->isr = isr;
+    timer->arg = arg;
+
+    pthread_create(&timer->thread, NULL, oneshot_thread, timer);
+    pthread_detach(timer->thread);
+}
+
+/**
+ * @brief Arms a one-shot timer, replacing a pending alarm
+ *
+ * @param timer     Timer
+ * @param alarm_us  hal_time_us() time of the alarm
+ */
+static void oneshot_arm(oneshot_t *timer, int64_t alarm_us)
+{
+    pthread_mutex_lock(&timer->lock);
+    timer->alarm_us = alarm_us;
+    timer->armed = true;
+    pthread_cond_signal(&timer->cond);
+    pthread_mutex_unlock(&timer->lock);
+}
+
+/**
+ * @brief One-shot timer thread: calls the handler as an interrupt once the
+ *        alarm time is reached
+ *
+ * @param arg Timer
+ * @return Never returns
+ */
+static void *oneshot_thread(void *arg)
+{
+    oneshot_t *timer = arg;
+    struct timespec ts;
+
+    pthread_mutex_lock(&timer->lock);
+
+    while(1)
+    {
+        if(!timer->armed)
+        {
+            pthread_cond_wait(&timer->cond, &timer->lock);
+            continue;
+        }
+
+        if(hal_time_us() < timer->alarm_us)
+        {
+            ts = deadline(timer->alarm_us);
+            pthread_cond_timedwait(&timer->cond, &timer->lock, &ts);
+            continue;
+        }
+
+        timer->armed = false;
+        pthread_mutex_unlock(&timer->lock);
+
+        isr_enter();
+        timer->isr(timer->arg);
+        isr_exit();
+
+        pthread_mutex_lock(&timer->lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Timer task: calls the periodic callbacks one after the other
+ *
+ * @param arg Not used
+ * @return Never returns
+ */
+static void *periodic_thread(void *arg)
+{
+    struct timespec ts;
+    periodic_t *next;
+
+    (void) arg;
+
+    pthread_mutex_lock(&Periodic_lock);
+
+    while(1)
+    {
+        next = &Periodic[0];
+        for(size_t idx = 1; idx < Periodic_cnt; ++idx)
+        {
+            if(Periodic[idx].next_us < next->next_us)
+            {
+                next = &Periodic[idx];
+            }
+        }
+
+        if(hal_time_us() < next->next_us)
+        {
+            ts = deadline(next->next_us);
+            pthread_cond_timedwait(&Periodic_cond, &Periodic_lock, &ts);
+            continue;
+        }
+
+        next->next_us += next->period_us;
+        pthread_mutex_unlock(&Periodic_lock);
+
+        next->cb(next->arg);
+
+        pthread_mutex_lock(&Periodic_lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Mains thread: follows the waveform zero crossings and pulses the
+ *        detector pin at every one of them, late by up to the jitter
+ *
+ * @param arg Not used
+ * @return Never returns
+ */
+static void *mains_thread(void *arg)
+{
+    struct timespec ts;
+    int64_t zero_us;
+    uint32_t delay_us;
+    int pin;
+
+    (void) arg;
+
+    pthread_mutex_lock(&Board_lock);
+
+    while(1)
+    {
+        zero_us = Wave_zero_us + Wave_half_us;
+
+        if(hal_time_us() < zero_us)
+        {
+            ts = deadline(zero_us);
+            pthread_cond_timedwait(&Mains_cond, &Board_lock, &ts);
+            continue;
+        }
+
+        Wave_zero_us = zero_us;
+        Wave_negative = !Wave_negative;
+
+        if(Mains_half_us != 0)
+        {
+            Wave_half_us = Mains_half_us;
+        }
+
+        // TRIACs stop conducting when the current crosses zero
+        for(size_t idx = 0; idx < Load_cnt; ++idx)
+        {
+            Loads[idx].triac_latched = false;
+        }
+
+        pin = Mains_pin;
+        delay_us = (Mains_jitter_us != 0) ? random_next() % (Mains_jitter_us + 1) : 0;
+
+        if(Mains_half_us == 0 || pin < 0)
+        {
+            continue;
+        }
+
+        pthread_mutex_unlock(&Board_lock);
+
+        ts = deadline(zero_us + delay_us);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        hal_host_gpio_drive(pin, 1);
+
+        ts = deadline(zero_us + delay_us + ZERO_PULSE_US);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        hal_host_gpio_drive(pin, 0);
+
+        pthread_mutex_lock(&Board_lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Entry of every task thread
+ *
+ * @param arg Task
+ * @return NULL
+ */
+static void *task_entry(void *arg)
+{
+    Self = arg;
+    Self->fn(NULL);
+
+    return NULL;
+}
+
+/**
+ * @brief Nominal transfer of the ADC at 11 dB, used as the calibration
+ *
+ * @param raw Raw ADC code
+ * @param ctx Not used
+ * @return Voltage in mV
+ */
+static uint32_t adc_nominal_mv(uint32_t raw, const void *ctx)
+{
+    (void) ctx;
+
+    return raw * HAL_HOST_ADC_FULL_SCALE_MV / HAL_HOST_ADC_MAX_RAW;
+}
+
+/**
+ * @brief Synthesizes one sample of the current sensor
+ *
+ * @param time_us Sample time
+ * @return Raw ADC code
+ */
+static uint16_t adc_sample(int64_t time_us)
+{
+    double rms_ma = Fault_ma;
+    double wave;
+    double mv;
+    int32_t raw;
+
+    pthread_mutex_lock(&Board_lock);
+
+    for(size_t idx = 0; idx < Load_cnt; ++idx)
+    {
+        load_t *load = &Loads[idx];
+        bool on;
+
+        switch(load->kind) {
+        case HAL_HOST_LOAD_TRIAC:
+            on = load->triac_latched;
+            break;
+
+        case HAL_HOST_LOAD_RELAY:
+            if(load->contact != load->coil &&
+               time_us - load->coil_us >= (load->coil ? load->operate_us : load->release_us))
+            {
+                load->contact = load->coil;
+            }
+            on = load->contact;
+            break;
+
+        default:
+            on = ((atomic_load(&Gpio_level[load->pin]) != 0) != load->active_low);
+            break;
+        }
+
+        if(on)
+        {
+            rms_ma += load->rms_ma;
+        }
+    }
+
+    // The waveform runs on past a late zero crossing with the right sign
+    wave = sin(M_PI * (double)(time_us - Wave_zero_us) / Wave_half_us);
+    if(Wave_negative)
+    {
+        wave = -wave;
+    }
+
+    mv = HAL_HOST_SENSOR_OFFSET_MV + rms_ma * M_SQRT2 * wave * HAL_HOST_SENSOR_MV_PER_A / 1000;
+    raw = (int32_t)(mv * HAL_HOST_ADC_MAX_RAW / HAL_HOST_ADC_FULL_SCALE_MV);
+    raw += (int32_t)(random_next() % (2 * ADC_NOISE_LSB + 1)) - ADC_NOISE_LSB;
+
+    pthread_mutex_unlock(&Board_lock);
+
+    if(raw < 0)
+    {
+        raw = 0;
+    }
+    if(raw > HAL_HOST_ADC_MAX_RAW)
+    {
+        raw = HAL_HOST_ADC_MAX_RAW;
+    }
+
+    return (uint16_t)raw;
+}
+
+/**
+ * @brief Finds an NVS entry, Nvs_lock is held
+ *
+ * @param space Namespace
+ * @param key   Key
+ * @return Entry, NULL if not stored
+ */
+static nvs_entry_t *nvs_find(const char *space, const char *key)
+{
+    for(size_t idx = 0; idx < NVS_ENTRY_MAX; ++idx)
+    {
+        if(Nvs[idx].data != NULL && strcmp(Nvs[idx].space, space) == 0 && strcmp(Nvs[idx].key, key) == 0)
+        {
+            return &Nvs[idx];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Stores a value
+ *
+ * @param space Namespace
+ * @param key   Key
+ * @param type  Value type
+ * @param data  Value
+ * @param size  Value size
+ * @return true if stored
+ */
+static bool nvs_store(const char *space, const char *key, nvs_type_t type, const void *data, size_t size)
+{
+    nvs_entry_t *entry;
+    uint8_t *copy;
+
+    if(strlen(space) >= NVS_NAME_MAX || strlen(key) >= NVS_NAME_MAX || (copy = malloc(size ? size : 1)) == NULL)
+    {
+        return false;
+    }
+    memcpy(copy, data, size);
+
+    pthread_mutex_lock(&Nvs_lock);
+
+    entry = nvs_find(space, key);
+    for(size_t idx = 0; entry == NULL && idx < NVS_ENTRY_MAX; ++idx)
+    {
+        if(Nvs[idx].data == NULL)
+        {
+            entry = &Nvs[idx];
+            strcpy(entry->space, space);
+            strcpy(entry->key, key);
+        }
+    }
+
+    if(entry == NULL)
+    {
+        pthread_mutex_unlock(&Nvs_lock);
+        free(copy);
+        HAL_LOGE(TAG, "NVS full, %s/%s not written", space, key);
+        return false;
+    }
+
+    free(entry->data);
+    entry->data = copy;
+    entry->size = size;
+    entry->type = type;
+    Nvs_writes++;
+
+    pthread_mutex_unlock(&Nvs_lock);
+
+    return true;
+}
+
+/**
+ * @brief Gets the log level of a tag, Log_lock is held
+ *
+ * @param tag Log tag
+ * @return Most verbose level printed
+ */
+static hal_log_level_t log_level_get(const char *tag)
+{
+    for(size_t idx = 0; idx < Log_tag_cnt; ++idx)
+    {
+        if(strcmp(Log_tag[idx], tag) == 0)
+        {
+            return Log_tag_level[idx];
+        }
+    }
+
+    return Log_default;
+}
+
+/****************************************
+ EXTERNAL FUNCTIONS
+*****************************************/
+
+/**
+ * @brief Configures a pin as a push/pull output
+ *
+ * @param pin GPIO number
+ */
+void hal_gpio_output(int pin)
+{
+    (void) pin;
+}
+
+/**
+ * @brief Configures a pin as an input
+ *
+ * @param pin GPIO number
+ */
+void hal_gpio_input(int pin)
+{
+    (void) pin;
+}
+
+/**
+ * @brief Drives an output pin
+ *
+ * @param pin   GPIO number
+ * @param level 0 or 1
+ */
+void hal_gpio_set_level(int pin, uint32_t level)
+{
+    gpio_write(pin, level != 0);
+}
+
+/**
+ * @brief Drives several output pins, the pins in set_mask first
+ *
+ * @param set_mask      Pins to drive high, bit N is GPIO N
+ * @param clear_mask    Pins to drive low
+ */
+void hal_gpio_write_mask(uint64_t set_mask, uint64_t clear_mask)
+{
+    for(int pin = 0; pin < GPIO_CNT; ++pin)
+    {
+        if(set_mask & (1ULL << pin))
+        {
+            gpio_write(pin, 1);
+        }
+    }
+
+    for(int pin = 0; pin < GPIO_CNT; ++pin)
+    {
+        if(clear_mask & (1ULL << pin))
+        {
+            gpio_write(pin, 0);
+        }
+    }
+}
+
+/**
+ * @brief Reads a pin
+ *
+ * @param pin GPIO number
+ * @return 0 or 1
+ */
+int hal_gpio_get_level(int pin)
+{
+    if(pin < 0 || pin >= GPIO_CNT)
+    {
+        return 0;
+    }
+
+    return atomic_load(&Gpio_level[pin]);
+}
+
+/**
+ * @brief Attaches an edge interrupt handler to a pin
+ *
+ * @param pin   GPIO number
+ * @param edge  Edge that triggers the handler
+ * @param isr   Handler
+ * @param arg   Handler argument
+ */
+void hal_gpio_isr(int pin, hal_edge_t edge, hal_gpio_isr_t isr, void *arg)
+{
+    if(pin < 0 || pin >= GPIO_CNT)
+    {
+        return;
+    }
+
+    isr_enter();
+    Gpio_isr_edge[pin] = edge;
+    Gpio_isr_arg[pin] = arg;
+    Gpio_isr[pin] = isr;
+    isr_exit();
+}
+
+/**
+ * @brief Configures a PWM output with 0 duty
+ *
+ * @param channel   PWM channel
+ * @param pin       GPIO number
+ * @param freq_hz   PWM frequency
+ */
+void hal_pwm_init(int channel, int pin, uint32_t freq_hz)
+{
+    (void) pin;
+    (void) freq_hz;
+
+    hal_pwm_set(channel, 0);
+}
+
+/**
+ * @brief Sets the duty of a PWM output
+ *
+ * @param channel       PWM channel
+ * @param duty_permille 0 .. 1000
+ */
+void hal_pwm_set(int channel, uint32_t duty_permille)
+{
+    if(channel >= 0 && channel < (int)(sizeof(Pwm_duty) / sizeof(Pwm_duty[0])))
+    {
+        Pwm_duty[channel] = (duty_permille > 1000) ? 1000 : duty_permille;
+    }
+}
+
+/**
+ * @brief Time since the start of the process
+ *
+ * @return Time in us
+ */
+int64_t hal_time_us(void)
+{
+    return monotonic_us() - Boot_us;
+}
+
+/**
+ * @brief Time since the start of the process, wraps after 49 days
+ *
+ * @return Time in ms
+ */
+uint32_t hal_time_ms(void)
+{
+    return (uint32_t)(hal_time_us() / 1000);
+}
+
+/**
+ * @brief Cycle counter of a 1 GHz core, for timing short code paths
+ *
+ * @return Nanoseconds, wraps
+ */
+uint32_t hal_cpu_cycles(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/**
+ * @brief Builds the raw-to-mV table of the simulated ADC, always from its
+ *        nominal transfer
+ *
+ * @param lut Output: calibration table
+ * @return true     unless hal_host_adc_calibrated(false) simulates a chip
+ *                  without eFuse calibration
+ */
+bool hal_adc_calibrate(adc_lut_t *lut)
+{
+    adc_lut_init(lut, adc_nominal_mv, NULL);
+
+    if(!Adc_calibrated)
+    {
+        HAL_LOGW(TAG, "eFuse not burnt, nominal ADC reference");
+    }
+
+    return Adc_calibrated;
+}
+
+/**
+ * @brief Starts sampling the simulated current sensor
+ *
+ * @param sample_rate_hz Sample rate
+ */
+void hal_adc_start(uint32_t sample_rate_hz)
+{
+    Adc_rate_hz = sample_rate_hz;
+    Adc_start_us = hal_time_us();
+    Adc_index = 0;
+}
+
+/**
+ * @brief Waits until a frame of samples is due and synthesizes it from the
+ *        loads that are on
+ *
+ * @param samples       Output: raw ADC codes
+ * @param max_samples   Room in samples, up to HAL_ADC_FRAME_SAMPLES are used
+ * @return Number of samples written
+ */
+size_t hal_adc_read(uint16_t *samples, size_t max_samples)
+{
+    const struct timespec poll = { .tv_nsec = ADC_POLL_US * 1000 };
+    size_t count = 0;
+    int64_t now_us;
+    int64_t sample_us;
+
+    if(max_samples > HAL_ADC_FRAME_SAMPLES)
+    {
+        max_samples = HAL_ADC_FRAME_SAMPLES;
+    }
+
+    while(count < max_samples)
+    {
+        now_us = hal_time_us();
+
+        // A reader that fell far behind loses samples like on a DMA overrun
+        if(now_us - Adc_start_us > ADC_MAX_LAG_US + (int64_t)(Adc_index * 1000000 / Adc_rate_hz))
+        {
+            Adc_index = (uint64_t)(now_us - Adc_start_us) * Adc_rate_hz / 1000000;
+        }
+
+        while(count < max_samples)
+        {
+            sample_us = Adc_start_us + (int64_t)(Adc_index * 1000000 / Adc_rate_hz);
+            if(sample_us > now_us)
+            {
+                break;
+            }
+
+            samples[count++] = adc_sample(sample_us);
+            Adc_index++;
+        }
+
+        if(count < max_samples)
+        {
+            nanosleep(&poll, NULL);
+        }
+    }
+
+    return count;
+}
+
+/**
+ * @brief Starts the free running phase timer with the alarm disabled
+ *
+ * @param isr Alarm handler
+ * @param arg Handler argument
+ */
+void hal_phase_timer_init(hal_timer_isr_t isr, void *arg)
+{
+    Phase_epoch_us = hal_time_us();
+    oneshot_start(&Phase_timer, isr, arg);
+}
+
+/**
+ * @brief Reads the phase timer
+ *
+ * @return Time in us since hal_phase_timer_init()
+ */
+uint64_t hal_phase_timer_now_us(void)
+{
+    return (uint64_t)(hal_time_us() - Phase_epoch_us);
+}
+
+/**
+ * @brief Arms the one-shot alarm of the phase timer
+ *
+ * @param alarm_us Absolute phase timer time
+ */
+void hal_phase_timer_alarm(uint64_t alarm_us)
+{
+    oneshot_arm(&Phase_timer, Phase_epoch_us + (int64_t)alarm_us);
+}
+
+/**
+ * @brief Starts the relay switching timer with the alarm disabled
+ *
+ * @param isr Alarm handler
+ * @param arg Handler argument
+ */
+void hal_relay_timer_init(hal_timer_isr_t isr, void *arg)
+{
+    oneshot_start(&Relay_timer, isr, arg);
+}
+
+/**
+ * @brief Arms the one-shot alarm of the relay timer
+ *
+ * @param delay_us Time from now
+ */
+void hal_relay_timer_alarm_after(uint32_t delay_us)
+{
+    oneshot_arm(&Relay_timer, hal_time_us() + delay_us);
+}
+
+/**
+ * @brief Calls a function periodically from the timer thread
+ *
+ * @param cb        Callback, must not block
+ * @param arg       Callback argument
+ * @param name      Timer name
+ * @param period_us Period
+ */
+void hal_timer_periodic(hal_timer_cb_t cb, void *arg, const char *name, uint32_t period_us)
+{
+    pthread_t thread;
+
+    pthread_mutex_lock(&Periodic_lock);
+
+    if(Periodic_cnt == TIMER_MAX)
+    {
+        pthread_mutex_unlock(&Periodic_lock);
+        HAL_LOGE(TAG, "Timer %s not created", name);
+        return;
+    }
+
+    Periodic[Periodic_cnt] = (periodic_t) {
+        .cb = cb,
+        .arg = arg,
+        .name = name,
+        .period_us = period_us,
+        .next_us = hal_time_us() + period_us
+    };
+
+    if(Periodic_cnt++ == 0)
+    {
+        pthread_create(&thread, NULL, periodic_thread, NULL);
+        pthread_detach(thread);
+    }
+
+    pthread_cond_signal(&Periodic_cond);
+    pthread_mutex_unlock(&Periodic_lock);
+}
+
+/**
+ * @brief Creates a task as a thread. The stack size, the priority and the
+ *        core are not simulated.
+ *
+ * @param fn            Task function, called with a NULL argument
+ * @param name          Task name
+ * @param stack_bytes   Stack size
+ * @param priority      Priority
+ * @param core          Core or HAL_CORE_ANY
+ * @return Task, NULL if it can't be created
+ */
+hal_task_t hal_task_create(hal_task_fn_t fn, const char *name, uint32_t stack_bytes, int priority, int core)
+{
+    struct hal_task *task = calloc(1, sizeof(*task));
+
+    (void) stack_bytes;
+    (void) priority;
+    (void) core;
+
+    if(task == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init(&task->lock, NULL);
+    cond_init(&task->cond);
+    task->fn = fn;
+    snprintf(task->name, sizeof(task->name), "%s", name);
+
+    if(pthread_create(&task->thread, NULL, task_entry, task) != 0)
+    {
+        HAL_LOGE(TAG, "Task %s not created", name);
+        free(task);
+        return NULL;
+    }
+
+    pthread_setname_np(task->thread, task->name);
+    pthread_detach(task->thread);
+
+    return task;
+}
+
+/**
+ * @brief Gets the calling task, threads not created by hal_task_create()
+ *        get one on the first call
+ *
+ * @return Task
+ */
+hal_task_t hal_task_self(void)
+{
+    if(Self == NULL)
+    {
+        Self = calloc(1, sizeof(*Self));
+        pthread_mutex_init(&Self->lock, NULL);
+        cond_init(&Self->cond);
+        Self->thread = pthread_self();
+    }
+
+    return Self;
+}
+
+/**
+ * @brief Wakes a task waiting in hal_task_wait(). Notifications given while
+ *        the task runs are not lost, they end its next wait at once.
+ *
+ * @param task Task
+ */
+void hal_task_notify(hal_task_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notified++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+}
+
+/**
+ * @brief hal_task_notify() for interrupt handlers
+ *
+ * @param task Task
+ */
+void hal_task_notify_from_isr(hal_task_t task)
+{
+    hal_task_notify(task);
+}
+
+/**
+ * @brief Waits for a notification of the calling task
+ *
+ * @param timeout_ms Longest wait or HAL_WAIT_FOREVER
+ * @return true if notified, false on timeout
+ */
+bool hal_task_wait(uint32_t timeout_ms)
+{
+    struct hal_task *task = hal_task_self();
+    struct timespec ts = deadline(hal_time_us() + (int64_t)timeout_ms * 1000);
+    bool notified;
+
+    pthread_mutex_lock(&task->lock);
+
+    while(task->notified == 0)
+    {
+        if(timeout_ms == HAL_WAIT_FOREVER)
+        {
+            pthread_cond_wait(&task->cond, &task->lock);
+        }
+        else if(pthread_cond_timedwait(&task->cond, &task->lock, &ts) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+
+    notified = (task->notified != 0);
+    task->notified = 0;
+
+    pthread_mutex_unlock(&task->lock);
+
+    return notified;
+}
+
+/**
+ * @brief Ends the calling task
+ */
+void hal_task_exit(void)
+{
+    pthread_exit(NULL);
+}
+
+/**
+ * @brief Creates a mutex
+ *
+ * @return Mutex
+ */
+hal_mutex_t hal_mutex_create(void)
+{
+    struct hal_mutex *mutex = malloc(sizeof(*mutex));
+
+    if(mutex != NULL)
+    {
+        pthread_mutex_init(&mutex->lock, NULL);
+    }
+
+    return mutex;
+}
+
+/**
+ * @brief Takes a mutex, waiting as long as needed
+ *
+ * @param mutex Mutex
+ */
+void hal_mutex_lock(hal_mutex_t mutex)
+{
+    pthread_mutex_lock(&mutex->lock);
+}
+
+/**
+ * @brief Gives a mutex back
+ *
+ * @param mutex Mutex
+ */
+void hal_mutex_unlock(hal_mutex_t mutex)
+{
+    pthread_mutex_unlock(&mutex->lock);
+}
+
+/**
+ * @brief Enters a critical section shared by tasks and interrupt handlers
+ *
+ * @param lock Lock
+ */
+void hal_spin_lock(hal_spinlock_t *lock)
+{
+    pthread_mutex_lock(lock);
+}
+
+/**
+ * @brief Leaves a critical section
+ *
+ * @param lock Lock
+ */
+void hal_spin_unlock(hal_spinlock_t *lock)
+{
+    pthread_mutex_unlock(lock);
+}
+
+/**
+ * @brief Creates a binary event, not given yet
+ *
+ * @return Event
+ */
+hal_signal_t hal_signal_create(void)
+{
+    struct hal_signal *signal = calloc(1, sizeof(*signal));
+
+    if(signal != NULL)
+    {
+        pthread_mutex_init(&signal->lock, NULL);
+        cond_init(&signal->cond);
+    }
+
+    return signal;
+}
+
+/**
+ * @brief Gives an event
+ *
+ * @param signal Event
+ */
+void hal_signal_give(hal_signal_t signal)
+{
+    pthread_mutex_lock(&signal->lock);
+    signal->given = true;
+    pthread_cond_signal(&signal->cond);
+    pthread_mutex_unlock(&signal->lock);
+}
+
+/**
+ * @brief Waits for an event and takes it
+ *
+ * @param signal        Event
+ * @param timeout_ms    Longest wait or HAL_WAIT_FOREVER
+ * @return true if given, false on timeout
+ */
+bool hal_signal_wait(hal_signal_t signal, uint32_t timeout_ms)
+{
+    struct timespec ts = deadline(hal_time_us() + (int64_t)timeout_ms * 1000);
+    bool given;
+
+    pthread_mutex_lock(&signal->lock);
+
+    while(!signal->given)
+    {
+        if(timeout_ms == HAL_WAIT_FOREVER)
+        {
+            pthread_cond_wait(&signal->cond, &signal->lock);
+        }
+        else if(pthread_cond_timedwait(&signal->cond, &signal->lock, &ts) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+
+    given = signal->given;
+    signal->given = false;
+
+    pthread_mutex_unlock(&signal->lock);
+
+    return given;
+}
+
+/**
+ * @brief The simulated NVS is kept in memory and starts empty
+ */
+void hal_nvs_init(void)
+{
+}
+
+/**
+ * @brief Reads a number from NVS
+ *
+ * @param space NVS namespace
+ * @param key   Key
+ * @param value Output: stored number
+ * @return true if the key is stored as a number
+ */
+bool hal_nvs_get_u32(const char *space, const char *key, uint32_t *value)
+{
+    nvs_entry_t *entry;
+    bool found = false;
+
+    pthread_mutex_lock(&Nvs_lock);
+
+    entry = nvs_find(space, key);
+    if(entry != NULL && entry->type == NVS_TYPE_U32)
+    {
+        memcpy(value, entry->data, sizeof(*value));
+        found = true;
+    }
+
+    pthread_mutex_unlock(&Nvs_lock);
+
+    return found;
+}
+
+/**
+ * @brief Writes a number to NVS
+ *
+ * @param space NVS namespace
+ * @param key   Key
+ * @param value Number
+ * @return true if written
+ */
+bool hal_nvs_set_u32(const char *space, const char *key, uint32_t value)
+{
+    return nvs_store(space, key, NVS_TYPE_U32, &value, sizeof(value));
+}
+
+/**
+ * @brief Reads a blob from NVS
+ *
+ * @param space NVS namespace
+ * @param key   Key
+ * @param data  Output: stored blob
+ * @param size  Expected blob size
+ * @return true if a blob of exactly this size is stored
+ */
+bool hal_nvs_get_blob(const char *space, const char *key, void *data, size_t size)
+{
+    nvs_entry_t *entry;
+    bool found = false;
+
+    pthread_mutex_lock(&Nvs_lock);
+
+    entry = nvs_find(space, key);
+    if(entry != NULL && entry->type == NVS_TYPE_BLOB && entry->size == size)
+    {
+        memcpy(data, entry->data, size);
+        found = true;
+    }
+
+    pthread_mutex_unlock(&Nvs_lock);
+
+    return found;
+}
+
+/**
+ * @brief Writes a blob to NVS
+ *
+ * @param space NVS namespace
+ * @param key   Key
+ * @param data  Blob
+ * @param size  Blob size
+ * @return true if written
+ */
+bool hal_nvs_set_blob(const char *space, const char *key, const void *data, size_t size)
+{
+    return nvs_store(space, key, NVS_TYPE_BLOB, data, size);
+}
+
+/**
+ * @brief Runs a handler when the process exits normally
+ *
+ * @param handler Handler
+ */
+void hal_on_shutdown(void (*handler)(void))
+{
+    atexit(handler);
+}
+
+/**
+ * @brief Reads the simulated station MAC address
+ *
+ * @param mac Output: address
+ */
+void hal_read_mac(uint8_t mac[6])
+{
+    memcpy(mac, Mac, sizeof(Mac));
+}
+
+/**
+ * @brief Allocates a buffer, any memory is DMA capable here
+ *
+ * @param size Buffer size
+ * @return Buffer, NULL if out of memory
+ */
+void *hal_malloc_dma(size_t size)
+{
+    return malloc(size);
+}
+
+/**
+ * @brief Sets the log level of a tag, "*" sets the default of all tags
+ *
+ * @param tag   Log tag
+ * @param level Most verbose level printed
+ */
+void hal_log_level_set(const char *tag, hal_log_level_t level)
+{
+    pthread_mutex_lock(&Log_lock);
+
+    if(strcmp(tag, "*") == 0)
+    {
+        Log_default = level;
+        Log_tag_cnt = 0;
+    }
+    else
+    {
+        size_t idx;
+
+        for(idx = 0; idx < Log_tag_cnt && strcmp(Log_tag[idx], tag) != 0; ++idx)
+        {
+        }
+
+        if(idx < LOG_TAG_MAX)
+        {
+            Log_tag[idx] = tag;
+            Log_tag_level[idx] = level;
+            Log_tag_cnt += (idx == Log_tag_cnt);
+        }
+    }
+
+    pthread_mutex_unlock(&Log_lock);
+}
+
+/**
+ * @brief Prints a log line to stderr in the ESP-IDF format
+ *
+ * @param level Level of the message
+ * @param tag   Log tag
+ * @param fmt   printf format
+ */
+void hal_log(hal_log_level_t level, const char *tag, const char *fmt, ...)
+{
+    static const char Letter[] = { 'N', 'E', 'W', 'I', 'D', 'V' };
+    va_list args;
+
+    pthread_mutex_lock(&Log_lock);
+
+    if(level <= log_level_get(tag))
+    {
+        fprintf(stderr, "%c (%u) %s: ", Letter[level], hal_time_ms(), tag);
+        va_start(args, fmt);
+        vfprintf(stderr, fmt, args);
+        va_end(args);
+        fputc('\n', stderr);
+    }
+
+    pthread_mutex_unlock(&Log_lock);
+}
+
+/**
+ * @brief Starts or changes the mains seen by the zero-cross detector
+ *
+ * @param zero_pin  Detector input
+ * @param freq_mhz  Mains frequency in mHz, 0 for a detector without edges
+ * @param jitter_us Largest delay of an edge after the zero crossing
+ */
+void hal_host_mains(int zero_pin, uint32_t freq_mhz, uint32_t jitter_us)
+{
+    pthread_t thread;
+
+    pthread_mutex_lock(&Board_lock);
+
+    Mains_pin = zero_pin;
+    Mains_half_us = (freq_mhz != 0) ? 500000000UL / freq_mhz : 0;
+    Mains_jitter_us = jitter_us;
+
+    if(!Mains_started)
+    {
+        Mains_started = true;
+        Wave_zero_us = hal_time_us();
+        pthread_create(&thread, NULL, mains_thread, NULL);
+        pthread_detach(thread);
+    }
+
+    pthread_cond_signal(&Mains_cond);
+    pthread_mutex_unlock(&Board_lock);
+}
+
+/**
+ * @brief Gets the time of the last zero crossing of the waveform, the
+ *        detector edge follows it by up to the jitter
+ *
+ * @return Time in us of hal_time_us()
+ */
+int64_t hal_host_mains_zero_us(void)
+{
+    int64_t zero_us;
+
+    pthread_mutex_lock(&Board_lock);
+    zero_us = Wave_zero_us;
+    pthread_mutex_unlock(&Board_lock);
+
+    return zero_us;
+}
+
+/**
+ * @brief Connects a load to an output pin
+ *
+ * @param pin           GPIO number
+ * @param kind          How the pin switches the load
+ * @param active_low    The load is on while the pin is low
+ * @param rms_ma        Current of the load while on
+ * @param operate_us    HAL_HOST_LOAD_RELAY: time from the coil on to the contact closed
+ * @param release_us    HAL_HOST_LOAD_RELAY: time from the coil off to the contact open
+ */
+void hal_host_load(int pin, hal_host_load_kind_t kind, bool active_low, uint32_t rms_ma,
+                   uint32_t operate_us, uint32_t release_us)
+{
+    pthread_mutex_lock(&Board_lock);
+
+    if(Load_cnt < LOAD_MAX)
+    {
+        Loads[Load_cnt++] = (load_t) {
+            .pin = pin,
+            .kind = kind,
+            .active_low = active_low,
+            .rms_ma = rms_ma,
+            .operate_us = operate_us,
+            .release_us = release_us
+        };
+    }
+
+    pthread_mutex_unlock(&Board_lock);
+}
+
+/**
+ * @brief Adds a fault current on top of the loads, 0 clears it
+ *
+ * @param rms_ma Fault current
+ */
+void hal_host_fault(uint32_t rms_ma)
+{
+    pthread_mutex_lock(&Board_lock);
+    Fault_ma = rms_ma;
+    pthread_mutex_unlock(&Board_lock);
+}
+
+/**
+ * @brief Simulates a chip with or without eFuse ADC calibration
+ *
+ * @param calibrated Result of the next hal_adc_calibrate()
+ */
+void hal_host_adc_calibrated(bool calibrated)
+{
+    Adc_calibrated = calibrated;
+}
+
+/**
+ * @brief Drives an input pin from outside, edges run their handler as an
+ *        interrupt
+ *
+ * @param pin   GPIO number
+ * @param level 0 or 1
+ */
+void hal_host_gpio_drive(int pin, int level)
+{
+    hal_edge_t edge;
+
+    if(pin < 0 || pin >= GPIO_CNT)
+    {
+        return;
+    }
+
+    level = (level != 0);
+    if(atomic_exchange(&Gpio_level[pin], level) == level)
+    {
+        return;
+    }
+
+    edge = level ? HAL_EDGE_RISING : HAL_EDGE_FALLING;
+
+    isr_enter();
+    if(Gpio_isr[pin] != NULL && Gpio_isr_edge[pin] == edge)
+    {
+        Gpio_isr[pin](Gpio_isr_arg[pin]);
+    }
+    isr_exit();
+}
+
+/**
+ * @brief Installs a hook called after every output pin change
+ *
+ * @param hook Hook, NULL removes it
+ */
+void hal_host_gpio_hook(hal_host_gpio_hook_t hook)
+{
+    atomic_store(&Gpio_hook, hook);
+}
+
+/**
+ * @brief Sets the MAC address returned by hal_read_mac()
+ *
+ * @param mac Address
+ */
+void hal_host_set_mac(const uint8_t mac[6])
+{
+    memcpy(Mac, mac, sizeof(Mac));
+}
+
+/**
+ * @brief Counts the NVS writes since the start, flash wear of the target
+ *
+ * @return Writes
+ */
+uint32_t hal_host_nvs_writes(void)
+{
+    uint32_t writes;
+
+    pthread_mutex_lock(&Nvs_lock);
+    writes = Nvs_writes;
+    pthread_mutex_unlock(&Nvs_lock);
+
+    return writes;
+}
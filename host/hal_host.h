@@ -0,0 +1,69 @@
+#ifndef _HAL_HOST_H_
+#define _HAL_HOST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+#include "hal.h"
+
+/**********************************
+ CONSTANTS AND MACROS
+***********************************/
+
+#define HAL_HOST_ADC_FULL_SCALE_MV  3100    // 11 dB attenuation
+#define HAL_HOST_ADC_MAX_RAW        4095
+#define HAL_HOST_SENSOR_OFFSET_MV   (HAL_HOST_ADC_FULL_SCALE_MV / 2)
+#define HAL_HOST_SENSOR_MV_PER_A    CONFIG_CURRENT_SENSOR_MV_PER_A
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+typedef enum {
+    HAL_HOST_LOAD_SWITCH = 0,   // Conducts while the pin is at its on level
+    HAL_HOST_LOAD_TRIAC,        // Latched by a gate pulse until the next zero crossing
+    HAL_HOST_LOAD_RELAY         // Contact follows the coil after the operate or release time
+} hal_host_load_kind_t;
+
+/**
+ * @brief Called after every output pin change, from the writing thread
+ *
+ * @param pin   GPIO number
+ * @param level New level
+ * @param now_us hal_time_us() of the write
+ */
+typedef void (*hal_host_gpio_hook_t)(int pin, int level, int64_t now_us);
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+/*
+ * Simulated board behind hal.h. Interrupt handlers run in one thread per
+ * source and are serialized like on a single core. The mains, the loads and
+ * the current sensor are synthesized in real time from the pin levels.
+ */
+
+// Mains zero-cross detector on a GPIO input, freq_mhz 0 stops the edges
+void        hal_host_mains(int zero_pin, uint32_t freq_mhz, uint32_t jitter_us);
+int64_t     hal_host_mains_zero_us(void);
+
+// Current drawn by the load on a pin, in mA RMS of the Current scale
+void        hal_host_load(int pin, hal_host_load_kind_t kind, bool active_low, uint32_t rms_ma,
+                          uint32_t operate_us, uint32_t release_us);
+void        hal_host_fault(uint32_t rms_ma);
+void        hal_host_adc_calibrated(bool calibrated);
+
+// Pins
+void        hal_host_gpio_drive(int pin, int level);
+void        hal_host_gpio_hook(hal_host_gpio_hook_t hook);
+
+// Identity, storage and network
+void        hal_host_set_mac(const uint8_t mac[6]);
+uint32_t    hal_host_nvs_writes(void);
+void        hal_host_mqtt_broker(const char *host, uint16_t port);
+void        hal_host_mqtt_offline(uint32_t ms);
+void        hal_host_mqtt_uplink(uint32_t bytes_per_s);
+
+#endif // _HAL_HOST_H_
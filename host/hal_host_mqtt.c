@@ -0,0 +1,316 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "hal.h"
+#include "hal_host.h"
+#include "mqtt_lite.h"
+
+
+/*******************************************************
+ CONSTANTS
+ *******************************************************/
+
+#define MQTT_KEEPALIVE_S        120     // esp-mqtt default
+#define MQTT_READ_POLL_MS       1000
+#define MQTT_RETRY_MIN_MS       250
+#define MQTT_RETRY_MAX_MS       8000
+#define MQTT_HOST_MAX           128
+#define MQTT_PUBLISH_OVERHEAD   4       // Fixed header and topic length of a QoS 0 PUBLISH
+
+/*******************************************************
+ FUNCTION PROTOTYPES
+ *******************************************************/
+
+static void broker_address(char *host, size_t size, uint16_t *port);
+static void dispatch(hal_mqtt_event_id_t id, const mqtt_lite_packet_t *pkt);
+static void *client_thread(void *arg);
+
+/*******************************************************
+ LOCAL VARIABLES
+ *******************************************************/
+
+static const char *TAG = "HAL MQTT";
+
+static hal_mqtt_cfg_t       Cfg;
+static hal_mqtt_handler_t   Handler = NULL;
+static mqtt_lite_t          Client;
+static atomic_bool          Connected = false;
+
+// Set by hal_host_mqtt_broker(), replaces the address of the configuration
+static char                 Broker_host[MQTT_HOST_MAX];
+static uint16_t             Broker_port = 0;
+
+// Set by hal_host_mqtt_offline(), no connection before this time
+static atomic_llong         Offline_until_us = 0;
+
+// Set by hal_host_mqtt_uplink(), 0 - as fast as the socket
+static atomic_uint          Uplink_bytes_per_s = 0;
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+/**
+ * @brief Picks the broker address: the override, else the configured URI
+ *
+ * @param host Output: host name
+ * @param size Room in host
+ * @param port Output: port
+ */
+static void broker_address(char *host, size_t size, uint16_t *port)
+{
+    const char *uri = Cfg.uri;
+    const char *sep;
+
+    if(Broker_host[0] != '\0')
+    {
+        snprintf(host, size, "%s", Broker_host);
+        *port = Broker_port;
+        return;
+    }
+
+    if(strncmp(uri, "mqtt://", 7) == 0)
+    {
+        uri += 7;
+    }
+
+    *port = (Cfg.port != 0) ? Cfg.port : 1883;
+
+    sep = strchr(uri, ':');
+    if(sep != NULL)
+    {
+        *port = (uint16_t)atoi(sep + 1);
+        snprintf(host, size, "%.*s", (int)(sep - uri), uri);
+    } else {
+        snprintf(host, size, "%s", uri);
+    }
+}
+
+/**
+ * @brief Hands an event to the application handler
+ *
+ * @param id    Event
+ * @param pkt   Packet of the event, may be NULL
+ */
+static void dispatch(hal_mqtt_event_id_t id, const mqtt_lite_packet_t *pkt)
+{
+    hal_mqtt_event_t event = {
+        .id = id
+    };
+
+    if(pkt != NULL)
+    {
+        event.msg_id = pkt->msg_id;
+        event.session_present = pkt->session_present;
+        event.topic = pkt->topic;
+        event.topic_len = (int)pkt->topic_len;
+        event.data = (const char *)pkt->payload;
+        event.data_len = (int)pkt->payload_len;
+    }
+
+    Handler(&event);
+}
+
+/**
+ * @brief MQTT client task: connects, reconnects with a growing delay and
+ *        dispatches the received packets
+ *
+ * @param arg Not used
+ * @return Never returns
+ */
+static void *client_thread(void *arg)
+{
+    const mqtt_lite_opts_t opts = {
+        .client_id = Cfg.client_id,
+        .username = Cfg.username,
+        .password = Cfg.password,
+        .clean_session = Cfg.clean_session,
+        .keepalive_s = MQTT_KEEPALIVE_S
+    };
+    uint32_t retry_ms = MQTT_RETRY_MIN_MS;
+    char host[MQTT_HOST_MAX];
+    uint16_t port;
+    mqtt_lite_packet_t pkt;
+    int ret;
+
+    (void) arg;
+
+    while(1)
+    {
+        int64_t offline_us = atomic_load(&Offline_until_us) - hal_time_us();
+
+        if(offline_us > 0)
+        {
+            usleep((useconds_t)offline_us);
+        }
+
+        broker_address(host, sizeof(host), &port);
+
+        memset(&pkt, 0, sizeof(pkt));
+        if(!mqtt_lite_connect(&Client, host, port, &opts, &pkt.session_present))
+        {
+            HAL_LOGW(TAG, "No connection to %s:%u, retry in %u ms", host, port, retry_ms);
+            usleep(retry_ms * 1000);
+            retry_ms = (retry_ms * 2 > MQTT_RETRY_MAX_MS) ? MQTT_RETRY_MAX_MS : retry_ms * 2;
+            continue;
+        }
+
+        retry_ms = MQTT_RETRY_MIN_MS;
+        atomic_store(&Connected, true);
+        dispatch(HAL_MQTT_CONNECTED, &pkt);
+
+        while((ret = mqtt_lite_read(&Client, MQTT_READ_POLL_MS, &pkt)) >= 0)
+        {
+            if(ret == 0)
+            {
+                continue;
+            }
+
+            switch(pkt.type) {
+            case MQTT_LITE_PUBLISH:
+                dispatch(HAL_MQTT_DATA, &pkt);
+                break;
+
+            case MQTT_LITE_PUBACK:
+                dispatch(HAL_MQTT_PUBLISHED, &pkt);
+                break;
+
+            case MQTT_LITE_SUBACK:
+                dispatch(HAL_MQTT_SUBSCRIBED, &pkt);
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        atomic_store(&Connected, false);
+        close(Client.conn.fd);
+        dispatch(HAL_MQTT_DISCONNECTED, NULL);
+    }
+
+    return NULL;
+}
+
+/****************************************
+ EXTERNAL FUNCTIONS
+*****************************************/
+
+/**
+ * @brief Starts the MQTT client task
+ *
+ * @param cfg       Connection, the strings must stay valid
+ * @param handler   Event handler
+ * @return true if started
+ */
+bool hal_mqtt_start(const hal_mqtt_cfg_t *cfg, hal_mqtt_handler_t handler)
+{
+    pthread_t thread;
+
+    Cfg = *cfg;
+    Handler = handler;
+
+    if(pthread_create(&thread, NULL, client_thread, NULL) != 0)
+    {
+        return false;
+    }
+
+    pthread_setname_np(thread, "mqtt_task");
+    pthread_detach(thread);
+
+    return true;
+}
+
+/**
+ * @brief Publishes a message
+ *
+ * @param topic     Topic
+ * @param data      Payload
+ * @param len       Payload length
+ * @param qos       0 or 1
+ * @param retain    Retain flag
+ * @return Message id, 0 for QoS 0, -1 if not connected
+ */
+int hal_mqtt_publish(const char *topic, const void *data, size_t len, int qos, bool retain)
+{
+    uint32_t uplink = atomic_load(&Uplink_bytes_per_s);
+    int msg_id;
+
+    if(!atomic_load(&Connected))
+    {
+        return -1;
+    }
+
+    msg_id = mqtt_lite_publish(&Client, topic, data, len, qos, retain);
+
+    // The caller is blocked until the packet is out on the link
+    if(msg_id >= 0 && uplink != 0)
+    {
+        usleep((useconds_t)((strlen(topic) + len + MQTT_PUBLISH_OVERHEAD) * 1000000ull / uplink));
+    }
+
+    return msg_id;
+}
+
+/**
+ * @brief Subscribes to a topic filter
+ *
+ * @param filter    Topic filter
+ * @param qos       Largest QoS of the deliveries
+ * @return Message id, -1 if not connected
+ */
+int hal_mqtt_subscribe(const char *filter, int qos)
+{
+    if(!atomic_load(&Connected))
+    {
+        return -1;
+    }
+
+    return mqtt_lite_subscribe(&Client, filter, qos);
+}
+
+/**
+ * @brief Connects the MQTT client to this broker instead of the configured one
+ *
+ * @param host Host name or address
+ * @param port Port
+ */
+void hal_host_mqtt_broker(const char *host, uint16_t port)
+{
+    snprintf(Broker_host, sizeof(Broker_host), "%s", host);
+    Broker_port = port;
+}
+
+/**
+ * @brief Slows the link down: a publish returns once its packet would be
+ *        sent at this rate, like over a weak Wi-Fi link
+ *
+ * @param bytes_per_s Rate of the link, 0 for the socket rate
+ */
+void hal_host_mqtt_uplink(uint32_t bytes_per_s)
+{
+    atomic_store(&Uplink_bytes_per_s, bytes_per_s);
+}
+
+/**
+ * @brief Drops the connection like a lost network would, the client
+ *        connects again after the given time
+ *
+ * @param ms Time without a connection
+ */
+void hal_host_mqtt_offline(uint32_t ms)
+{
+    atomic_store(&Offline_until_us, hal_time_us() + (int64_t)ms * 1000);
+
+    if(atomic_load(&Connected))
+    {
+        shutdown(Client.conn.fd, SHUT_RDWR);
+    }
+}
@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "sdkconfig.h"
+
+#include "hal.h"
+#include "percentile.h"
+#include "fixture.h"
+#include "wqtt_client.h"
+
+
+/*******************************************************
+ CONSTANTS
+ *******************************************************/
+
+#define ROUNDS                  50
+#define GAP_MS                  300     // Beyond the turn-on spacing, no load waits for another
+#define ACTUATION_TIMEOUT_MS    2000
+
+// Telemetry load: a current that changes every millisecond by more than the deadband
+#define LOAD_PERIOD_US          1000
+#define LOAD_LOW_MA             20
+#define LOAD_HIGH_MA            80
+
+/*******************************************************
+ TYPES DEFINITIONS
+ *******************************************************/
+
+// One command of a round and the pin change it causes
+typedef struct {
+    const char *    name;
+    const char *    payload;
+    int             pin;            // -1: nothing to see at the pin
+    int             level;
+} command_t;
+
+/*******************************************************
+ FUNCTION PROTOTYPES
+ *******************************************************/
+
+static void on_pin(int pin, int level, int64_t now_us);
+static void on_message(const mqtt_lite_packet_t *pkt, const char *name, size_t name_len);
+static bool wait_pin(int64_t *pin_us);
+static void sleep_ms(uint32_t ms);
+static void *load_thread(void *arg);
+static uint32_t run_pass(const char *name, uint32_t rounds, uint32_t gap_ms);
+
+/*******************************************************
+ LOCAL VARIABLES
+ *******************************************************/
+
+/* A round switches every load on and off again, one load at a time so the
+ * turn-on scheduler never holds one. The Fan stops firing at a zero
+ * crossing without a pin change, only its turn-on is measured. */
+static const command_t Round[] = {
+    { "Heater", "1", FIXTURE_HEATER_PIN,    1 },
+    { "Heater", "0", FIXTURE_HEATER_PIN,    0 },
+    { "Light",  "1", FIXTURE_LIGHT_PIN,     1 },
+    { "Light",  "0", FIXTURE_LIGHT_PIN,     0 },
+    { "LED",    "1", FIXTURE_LED_PIN,       0 },
+    { "LED",    "0", FIXTURE_LED_PIN,       1 },
+    { "Fan",    "3", FIXTURE_FAN_PIN,       1 },
+    { "Fan",    "1", -1,                    0 }
+};
+
+#define ROUND_CNT               (sizeof(Round) / sizeof(Round[0]))
+
+static pthread_mutex_t  Pin_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   Pin_cond = PTHREAD_COND_INITIALIZER;
+static int              Expect_pin = -1;
+static int              Expect_level = 0;
+static int64_t          Seen_us = 0;
+
+static atomic_bool      Load_stop = false;
+static atomic_uint      Current_messages = 0;
+
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+/**
+ * @brief GPIO hook: takes the first change to the awaited level
+ */
+static void on_pin(int pin, int level, int64_t now_us)
+{
+    pthread_mutex_lock(&Pin_lock);
+    if(pin == Expect_pin && level == Expect_level && Seen_us == 0)
+    {
+        Seen_us = now_us;
+        pthread_cond_signal(&Pin_cond);
+    }
+    pthread_mutex_unlock(&Pin_lock);
+}
+
+/**
+ * @brief Counts the Current messages the device publishes
+ */
+static void on_message(const mqtt_lite_packet_t *pkt, const char *name, size_t name_len)
+{
+    (void) pkt;
+
+    if(name_len == strlen(Current_topic) && memcmp(name, Current_topic, name_len) == 0)
+    {
+        atomic_fetch_add(&Current_messages, 1);
+    }
+}
+
+/**
+ * @brief Waits for the awaited pin change
+ *
+ * @param pin_us Output: time of the change
+ * @return false on timeout
+ */
+static bool wait_pin(int64_t *pin_us)
+{
+    struct timespec deadline;
+    bool seen;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ACTUATION_TIMEOUT_MS / 1000;
+
+    pthread_mutex_lock(&Pin_lock);
+    while(Seen_us == 0)
+    {
+        if(pthread_cond_timedwait(&Pin_cond, &Pin_lock, &deadline) != 0)
+        {
+            break;
+        }
+    }
+    seen = (Seen_us != 0);
+    *pin_us = Seen_us;
+    Expect_pin = -1;
+    pthread_mutex_unlock(&Pin_lock);
+
+    return seen;
+}
+
+static void sleep_ms(uint32_t ms)
+{
+    usleep(ms * 1000);
+}
+
+/**
+ * @brief Telemetry load: posts a current alternating between two values and
+ *        growing energy totals, like a far noisier sensor than the board's
+ */
+static void *load_thread(void *arg)
+{
+    uint32_t step = 0;
+
+    (void) arg;
+
+    while(!atomic_load(&Load_stop))
+    {
+        wqtt_client_set_current((step & 1) ? LOAD_HIGH_MA : LOAD_LOW_MA);
+        wqtt_client_set_Energy(HW_HEATER, step / 1000);
+        step++;
+        usleep(LOAD_PERIOD_US);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Runs the rounds and prints the latency of every command
+ *
+ * @param name      Pass name, printed above the table
+ * @param rounds    Rounds of commands
+ * @param gap_ms    Gap between commands
+ * @return Commands without a pin change
+ */
+static uint32_t run_pass(const char *name, uint32_t rounds, uint32_t gap_ms)
+{
+    uint32_t *latency_us[ROUND_CNT];
+    uint32_t missed = 0;
+    uint32_t messages = atomic_load(&Current_messages);
+    uint32_t dropped = wqtt_client_get_Telemetry_dropped();
+    int64_t start_us = hal_time_us();
+
+    for(size_t cmd = 0; cmd < ROUND_CNT; ++cmd)
+    {
+        latency_us[cmd] = calloc(rounds, sizeof(uint32_t));
+    }
+
+    for(uint32_t round = 0; round < rounds; ++round)
+    {
+        for(size_t cmd = 0; cmd < ROUND_CNT; ++cmd)
+        {
+            int64_t sent_us;
+            int64_t pin_us;
+
+            pthread_mutex_lock(&Pin_lock);
+            Expect_pin = Round[cmd].pin;
+            Expect_level = Round[cmd].level;
+            Seen_us = 0;
+            pthread_mutex_unlock(&Pin_lock);
+
+            sent_us = hal_time_us();
+            fixture_command(NULL, Round[cmd].name, Round[cmd].payload);
+
+            if(Round[cmd].pin >= 0)
+            {
+                if(wait_pin(&pin_us))
+                {
+                    latency_us[cmd][round] = (uint32_t)(pin_us - sent_us);
+                } else {
+                    fprintf(stderr, "%s %s: no pin change in %u ms\n",
+                            Round[cmd].name, Round[cmd].payload, ACTUATION_TIMEOUT_MS);
+                    missed++;
+                }
+            }
+
+            sleep_ms(gap_ms);
+        }
+    }
+
+    printf("%s: %.1f Current messages/s, %u telemetry events dropped\n", name,
+           (atomic_load(&Current_messages) - messages) * 1e6 / (double)(hal_time_us() - start_us),
+           wqtt_client_get_Telemetry_dropped() - dropped);
+    printf("%-8s %-4s %8s %8s %8s\n", "topic", "cmd", "p50 us", "p99 us", "max us");
+    for(size_t cmd = 0; cmd < ROUND_CNT; ++cmd)
+    {
+        if(Round[cmd].pin >= 0)
+        {
+            printf("%-8s %-4s %8u %8u %8u\n", Round[cmd].name, Round[cmd].payload,
+                   percentile(latency_us[cmd], rounds, 500),
+                   percentile(latency_us[cmd], rounds, 990),
+                   percentile(latency_us[cmd], rounds, 1000));
+        }
+        free(latency_us[cmd]);
+    }
+
+    return missed;
+}
+
+/**
+ * @brief Round trip of the load commands: publishes each command through the
+ *        host broker and times it up to the pin change it causes. The firmware
+ *        runs in this process, so both ends share hal_time_us().
+ *
+ *        Unlike the device-side latency histogram, the zero-cross aligned
+ *        relay and the first gate pulse of the Fan are included. The rounds
+ *        run once idle and once under telemetry load.
+ */
+int main(int argc, char *argv[])
+{
+    uint32_t rounds = ROUNDS;
+    uint32_t gap_ms = GAP_MS;
+    uint32_t missed = 0;
+    pthread_t load;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:g:h")) != -1)
+    {
+        switch(opt) {
+        case 'n':
+            rounds = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        case 'g':
+            gap_ms = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        default:
+            fprintf(stderr,
+                    "Usage: %s [-n rounds] [-g ms]\n"
+                    "  -n   Rounds of commands, default %u\n"
+                    "  -g   Gap between commands in ms, default %u\n",
+                    argv[0], ROUNDS, GAP_MS);
+            return 1;
+        }
+    }
+
+    // The firmware on the simulated board, talking to the local broker
+    const fixture_cfg_t cfg = {
+        .mac = { 0x02, 0x00, 0x00, 0x00, 0x12, 0x34 },
+        .client_id = "latency-harness",
+        .on_pin = on_pin,
+        .on_message = on_message
+    };
+
+    if(!fixture_start(&cfg))
+    {
+        return 1;
+    }
+
+    missed += run_pass("idle", rounds, gap_ms);
+
+    // The same rounds while the publisher is kept busy
+    pthread_create(&load, NULL, load_thread, NULL);
+    missed += run_pass("\ntelemetry load", rounds, gap_ms);
+    atomic_store(&Load_stop, true);
+    pthread_join(load, NULL);
+
+    fixture_stop();
+
+    // Shutdown handlers of the firmware run here
+    exit(missed == 0 ? 0 : 1);
+}
@@ -0,0 +1,46 @@
+/**
+ * @file lvgl_helpers.h
+ *
+ * Host stand-in of the lvgl_esp32_drivers helpers: the display is a frame
+ * buffer in memory, the touch controller reports the point a test presses.
+ */
+
+#ifndef LVGL_HELPERS_H
+#define LVGL_HELPERS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************
+ *      INCLUDES
+ *********************/
+#include <stdbool.h>
+
+#include "lvgl.h"
+
+/*********************
+ *      DEFINES
+ *********************/
+
+#define DISP_BUF_SIZE           (LV_HOR_RES_MAX * 40)
+
+#define TOUCH_CONTROLLER_NONE   0
+
+/**********************
+ * GLOBAL PROTOTYPES
+ **********************/
+
+void lvgl_driver_init(void);
+void disp_driver_flush(lv_disp_drv_t *drv, const lv_area_t *area, lv_color_t *color_map);
+bool touch_driver_read(lv_indev_drv_t *drv, lv_indev_data_t *data);
+
+// Host only
+const lv_color_t *display_host_frame(uint32_t *flushes);
+void display_host_touch(lv_coord_t x, lv_coord_t y, bool pressed);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* LVGL_HELPERS_H */
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "sdkconfig.h"
+
+#include "hal.h"
+#include "hal_host.h"
+#include "wqtt_client.h"
+
+
+/*******************************************************
+ CONSTANTS
+ *******************************************************/
+
+// Pins and loads of the board, as wired by hw_ctrl.c
+#define LOAD1_PIN               22      // Heater
+#define LOAD2_PIN               13      // Fan, TRIAC
+#define LOAD3_PIN               17      // Light, relay
+#define ZERO_PIN                16
+
+#define LOAD1_MA                60
+#define LOAD2_MA                20
+#define LOAD3_MA                15
+
+#define MAINS_FREQ_MHZ          50000
+#define MAINS_JITTER_US         50
+
+/*******************************************************
+ FUNCTION PROTOTYPES
+ *******************************************************/
+
+void app_main(void);
+
+static void usage(const char *name);
+static bool parse_mac(const char *text, uint8_t mac[6]);
+static void on_signal(int sig);
+
+/*******************************************************
+ LOCAL VARIABLES
+ *******************************************************/
+
+static volatile sig_atomic_t Stop = 0;
+
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-b host:port] [-m mac] [-g group] [-f mHz] [-j us] [-t s] [-l level]\n"
+            "  -b   MQTT broker, default: the configured one\n"
+            "  -m   Station MAC, xx:xx:xx:xx:xx:xx\n"
+            "  -g   Command group, default: the configured one\n"
+            "  -f   Mains frequency in mHz, default %u\n"
+            "  -j   Zero-cross detector jitter in us, default %u\n"
+            "  -t   Run time in s, default: until SIGINT\n"
+            "  -l   Log level after the boot, 0 (none) .. 5 (verbose)\n",
+            name, MAINS_FREQ_MHZ, MAINS_JITTER_US);
+}
+
+static bool parse_mac(const char *text, uint8_t mac[6])
+{
+    unsigned int byte[6];
+
+    if(sscanf(text, "%x:%x:%x:%x:%x:%x", &byte[0], &byte[1], &byte[2], &byte[3], &byte[4], &byte[5]) != 6)
+    {
+        return false;
+    }
+
+    for(int idx = 0; idx < 6; ++idx)
+    {
+        mac[idx] = (uint8_t)byte[idx];
+    }
+
+    return true;
+}
+
+static void on_signal(int sig)
+{
+    (void) sig;
+
+    Stop = 1;
+}
+
+/**
+ * @brief Runs the firmware on the simulated board. Normal exits run the
+ *        shutdown handlers, like a restart of the target.
+ */
+int main(int argc, char *argv[])
+{
+    uint32_t freq_mhz = MAINS_FREQ_MHZ;
+    uint32_t jitter_us = MAINS_JITTER_US;
+    uint32_t run_s = 0;
+    int log_level = -1;
+    uint8_t mac[6];
+    char *sep;
+    int opt;
+
+    while((opt = getopt(argc, argv, "b:m:g:f:j:t:l:h")) != -1)
+    {
+        switch(opt) {
+        case 'b':
+            sep = strrchr(optarg, ':');
+            if(sep == NULL)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            *sep = '\0';
+            hal_host_mqtt_broker(optarg, (uint16_t)atoi(sep + 1));
+            break;
+
+        case 'm':
+            if(!parse_mac(optarg, mac))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            hal_host_set_mac(mac);
+            break;
+
+        case 'g':
+            wqtt_client_set_group(optarg);
+            break;
+
+        case 'f':
+            freq_mhz = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        case 'j':
+            jitter_us = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        case 't':
+            run_s = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+
+        case 'l':
+            log_level = atoi(optarg);
+            break;
+
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    hal_host_load(LOAD1_PIN, HAL_HOST_LOAD_SWITCH, false, LOAD1_MA, 0, 0);
+    hal_host_load(LOAD2_PIN, HAL_HOST_LOAD_TRIAC, false, LOAD2_MA, 0, 0);
+    hal_host_load(LOAD3_PIN, HAL_HOST_LOAD_RELAY, false, LOAD3_MA, CONFIG_RELAY_OPERATE_US, CONFIG_RELAY_RELEASE_US);
+    hal_host_mains(ZERO_PIN, freq_mhz, jitter_us);
+
+    app_main();
+
+    if(log_level >= 0)
+    {
+        hal_log_level_set("*", (hal_log_level_t)log_level);
+    }
+
+    for(uint32_t elapsed_s = 0; !Stop && (run_s == 0 || elapsed_s < run_s); ++elapsed_s)
+    {
+        sleep(1);
+    }
+
+    // Shutdown handlers run here
+    exit(0);
+}
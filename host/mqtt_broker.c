@@ -0,0 +1,983 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "mqtt_lite.h"
+#include "mqtt_broker.h"
+
+
+/*******************************************************
+ CONSTANTS
+ *******************************************************/
+
+#define BROKER_CLIENTS_MAX      512
+#define BROKER_SESSIONS_MAX     1024
+#define BROKER_SUBS_MAX         16      // Filters of one session
+#define BROKER_FILTER_MAX       128
+#define BROKER_CLIENT_ID_MAX    64
+#define BROKER_QUEUE_MAX        256     // QoS 1 messages held for an offline session, power of two
+#define BROKER_RETAINED_MAX     4096
+#define BROKER_POLL_MS          50
+#define BROKER_SEND_TIMEOUT_MS  1000    // A client that does not read is dropped
+#define BROKER_CONNECT_TIMEOUT_MS 10000 // From the TCP connection to CONNECT
+#define BROKER_LISTEN_BACKLOG   128
+
+// CONNACK return codes
+#define CONNACK_ACCEPTED        0
+#define CONNACK_ID_REJECTED     2
+#define CONNACK_UNAVAILABLE     3
+
+#define SUBACK_FAILURE          0x80
+
+/*******************************************************
+ TYPES DEFINITIONS
+ *******************************************************/
+
+// Published message, topic and payload follow the header
+typedef struct {
+    size_t      topic_len;
+    size_t      len;
+    uint8_t     qos;
+    char        data[];
+} broker_msg_t;
+
+typedef struct {
+    bool            used;
+    bool            clean;
+    char            client_id[BROKER_CLIENT_ID_MAX];
+    int             client;                 // Index in clients, -1 while offline
+    uint16_t        next_id;
+    struct {
+        char        filter[BROKER_FILTER_MAX];
+        uint8_t     qos;
+    } subs[BROKER_SUBS_MAX];
+    size_t          sub_cnt;
+    broker_msg_t *  queue[BROKER_QUEUE_MAX];
+    size_t          queue_head;
+    size_t          queue_cnt;
+} session_t;
+
+typedef struct {
+    bool                used;
+    bool                closing;            // Closed at the end of the loop pass
+    mqtt_lite_conn_t    conn;
+    int                 session;            // -1 until CONNECT
+    int64_t             accepted_ms;
+    int64_t             last_rx_ms;
+    uint16_t            keepalive_s;
+} client_t;
+
+struct mqtt_broker {
+    int                 listen_fd;
+    uint16_t            port;
+    pthread_t           thread;
+    atomic_bool         stop;
+    uint32_t            anon_cnt;
+
+    pthread_mutex_t     stats_lock;
+    mqtt_broker_stats_t stats;
+
+    client_t            clients[BROKER_CLIENTS_MAX];
+    struct pollfd       pfd[BROKER_CLIENTS_MAX + 1];    // The listening socket first
+    int                 pfd_client[BROKER_CLIENTS_MAX + 1];
+    session_t           sessions[BROKER_SESSIONS_MAX];
+    broker_msg_t *      retained[BROKER_RETAINED_MAX];
+    size_t              retained_cnt;
+};
+
+/*******************************************************
+ FUNCTION PROTOTYPES
+ *******************************************************/
+
+static uint16_t get16(const uint8_t *buf);
+static broker_msg_t *msg_new(const char *topic, size_t topic_len, const void *data, size_t len, uint8_t qos);
+static bool topic_match(const char *filter, const char *topic, size_t topic_len);
+static void stats_add(mqtt_broker_t *broker, uint64_t *counter, uint64_t value);
+static bool client_send(mqtt_broker_t *broker, client_t *client, const uint8_t *data, size_t len);
+static void client_fail(mqtt_broker_t *broker, client_t *client);
+static void client_detach(mqtt_broker_t *broker, client_t *client);
+static void client_close(mqtt_broker_t *broker, client_t *client);
+static void session_free(mqtt_broker_t *broker, session_t *session);
+static void session_enqueue(mqtt_broker_t *broker, session_t *session, const broker_msg_t *msg);
+static bool session_online(mqtt_broker_t *broker, const session_t *session);
+static void deliver(mqtt_broker_t *broker, session_t *session, const broker_msg_t *msg, uint8_t qos, bool retain);
+static void route(mqtt_broker_t *broker, const broker_msg_t *msg);
+static void retain(mqtt_broker_t *broker, const broker_msg_t *msg);
+static void on_connect(mqtt_broker_t *broker, client_t *client, const mqtt_lite_packet_t *pkt);
+static void on_subscribe(mqtt_broker_t *broker, client_t *client, const mqtt_lite_packet_t *pkt);
+static void on_publish(mqtt_broker_t *broker, client_t *client, const mqtt_lite_packet_t *pkt);
+static void on_packet(mqtt_broker_t *broker, client_t *client, const mqtt_lite_packet_t *pkt);
+static void on_accept(mqtt_broker_t *broker);
+static void *broker_thread(void *arg);
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+static uint16_t get16(const uint8_t *buf)
+{
+    return ((uint16_t)buf[0] << 8) | buf[1];
+}
+
+/**
+ * @brief Copies a message
+ *
+ * @return Message, NULL if out of memory
+ */
+static broker_msg_t *msg_new(const char *topic, size_t topic_len, const void *data, size_t len, uint8_t qos)
+{
+    broker_msg_t *msg = malloc(sizeof(*msg) + topic_len + len);
+
+    if(msg != NULL)
+    {
+        msg->topic_len = topic_len;
+        msg->len = len;
+        msg->qos = qos;
+        memcpy(msg->data, topic, topic_len);
+        memcpy(&msg->data[topic_len], data, len);
+    }
+
+    return msg;
+}
+
+/**
+ * @brief Matches a topic against a subscription filter
+ *
+ * @param filter    Filter, + matches one level and a final # any number,
+ *                  its parent level included
+ * @param topic     Topic name, not terminated
+ * @param topic_len Topic length
+ * @return true if the topic matches
+ */
+static bool topic_match(const char *filter, const char *topic, size_t topic_len)
+{
+    size_t pos = 0;
+
+    // Wildcards at the first level do not match the broker topics
+    if(topic_len > 0 && topic[0] == '$' && (filter[0] == '+' || filter[0] == '#'))
+    {
+        return false;
+    }
+
+    while(*filter != '\0')
+    {
+        if(*filter == '#')
+        {
+            return true;
+        }
+
+        if(*filter == '+')
+        {
+            while(pos < topic_len && topic[pos] != '/')
+            {
+                pos++;
+            }
+            filter++;
+            continue;
+        }
+
+        if(pos >= topic_len || topic[pos] != *filter)
+        {
+            return pos == topic_len && strcmp(filter, "/#") == 0;
+        }
+        pos++;
+        filter++;
+    }
+
+    return pos == topic_len;
+}
+
+static void stats_add(mqtt_broker_t *broker, uint64_t *counter, uint64_t value)
+{
+    pthread_mutex_lock(&broker->stats_lock);
+    *counter += value;
+    pthread_mutex_unlock(&broker->stats_lock);
+}
+
+/**
+ * @brief Sends a packet, a client that can't take it is dropped
+ *
+ * @return true if sent
+ */
+static bool client_send(mqtt_broker_t *broker, client_t *client, const uint8_t *data, size_t len)
+{
+    if(client->closing)
+    {
+        return false;
+    }
+
+    if(!mqtt_lite_conn_send(&client->conn, data, len))
+    {
+        client_fail(broker, client);
+        return false;
+    }
+
+    stats_add(broker, &broker->stats.bytes_out, len);
+
+    return true;
+}
+
+/**
+ * @brief Drops a client: the session is offline from now on and the socket
+ *        is closed at the end of the loop pass, the packet being handled
+ *        may still use it
+ */
+static void client_fail(mqtt_broker_t *broker, client_t *client)
+{
+    client_detach(broker, client);
+    client->closing = true;
+}
+
+/**
+ * @brief Takes a client off its session, a clean session ends with it
+ */
+static void client_detach(mqtt_broker_t *broker, client_t *client)
+{
+    session_t *session;
+
+    if(client->session < 0)
+    {
+        return;
+    }
+
+    session = &broker->sessions[client->session];
+    session->client = -1;
+    client->session = -1;
+
+    pthread_mutex_lock(&broker->stats_lock);
+    broker->stats.clients--;
+    pthread_mutex_unlock(&broker->stats_lock);
+
+    if(session->clean)
+    {
+        session_free(broker, session);
+    }
+}
+
+static void client_close(mqtt_broker_t *broker, client_t *client)
+{
+    client_detach(broker, client);
+    close(client->conn.fd);
+    pthread_mutex_destroy(&client->conn.send_lock);
+    client->used = false;
+}
+
+/**
+ * @brief Ends a session with its subscriptions and its queue
+ */
+static void session_free(mqtt_broker_t *broker, session_t *session)
+{
+    pthread_mutex_lock(&broker->stats_lock);
+    broker->stats.sessions--;
+    broker->stats.queued -= (uint32_t)session->queue_cnt;
+    pthread_mutex_unlock(&broker->stats_lock);
+
+    while(session->queue_cnt > 0)
+    {
+        free(session->queue[session->queue_head]);
+        session->queue_head = (session->queue_head + 1) % BROKER_QUEUE_MAX;
+        session->queue_cnt--;
+    }
+
+    session->used = false;
+}
+
+/**
+ * @brief Holds a QoS 1 message for an offline session, the oldest one is
+ *        dropped on a full queue
+ */
+static void session_enqueue(mqtt_broker_t *broker, session_t *session, const broker_msg_t *msg)
+{
+    broker_msg_t *copy = msg_new(msg->data, msg->topic_len, &msg->data[msg->topic_len], msg->len, 1);
+
+    if(copy == NULL)
+    {
+        stats_add(broker, &broker->stats.dropped, 1);
+        return;
+    }
+
+    if(session->queue_cnt == BROKER_QUEUE_MAX)
+    {
+        free(session->queue[session->queue_head]);
+        session->queue_head = (session->queue_head + 1) % BROKER_QUEUE_MAX;
+        session->queue_cnt--;
+        stats_add(broker, &broker->stats.dropped, 1);
+    } else {
+        pthread_mutex_lock(&broker->stats_lock);
+        broker->stats.queued++;
+        pthread_mutex_unlock(&broker->stats_lock);
+    }
+
+    session->queue[(session->queue_head + session->queue_cnt) % BROKER_QUEUE_MAX] = copy;
+    session->queue_cnt++;
+}
+
+static bool session_online(mqtt_broker_t *broker, const session_t *session)
+{
+    return session->client >= 0 && !broker->clients[session->client].closing;
+}
+
+/**
+ * @brief Sends a message to the client of a session
+ *
+ * @param qos       QoS granted to this delivery
+ * @param retain    Retain flag, set for the retained messages sent on a
+ *                  subscription
+ */
+static void deliver(mqtt_broker_t *broker, session_t *session, const broker_msg_t *msg, uint8_t qos, bool retain)
+{
+    uint8_t packet[MQTT_LITE_PACKET_MAX];
+    uint16_t msg_id = 0;
+    size_t len;
+
+    // The client was dropped by an earlier send
+    if(!session_online(broker, session))
+    {
+        stats_add(broker, &broker->stats.dropped, 1);
+        return;
+    }
+
+    if(qos > 0)
+    {
+        if(++session->next_id == 0)
+        {
+            session->next_id = 1;
+        }
+        msg_id = session->next_id;
+    }
+
+    len = mqtt_lite_publish_encode(packet, sizeof(packet), msg->data, msg->topic_len,
+                                   &msg->data[msg->topic_len], msg->len, qos, retain, msg_id);
+
+    if(len == 0 || !client_send(broker, &broker->clients[session->client], packet, len))
+    {
+        stats_add(broker, &broker->stats.dropped, 1);
+        return;
+    }
+
+    stats_add(broker, &broker->stats.msg_out, 1);
+}
+
+/**
+ * @brief Forwards a message to every session with a matching filter, the
+ *        highest QoS of its matching filters applies
+ */
+static void route(mqtt_broker_t *broker, const broker_msg_t *msg)
+{
+    for(size_t idx = 0; idx < BROKER_SESSIONS_MAX; ++idx)
+    {
+        session_t *session = &broker->sessions[idx];
+        int sub_qos = -1;
+        uint8_t qos;
+
+        if(!session->used)
+        {
+            continue;
+        }
+
+        for(size_t sub = 0; sub < session->sub_cnt; ++sub)
+        {
+            if(session->subs[sub].qos > sub_qos &&
+               topic_match(session->subs[sub].filter, msg->data, msg->topic_len))
+            {
+                sub_qos = session->subs[sub].qos;
+            }
+        }
+
+        if(sub_qos < 0)
+        {
+            continue;
+        }
+
+        qos = (msg->qos < sub_qos) ? msg->qos : (uint8_t)sub_qos;
+
+        if(session_online(broker, session))
+        {
+            deliver(broker, session, msg, qos, false);
+        } else if(qos == 1 && !session->clean) {
+            session_enqueue(broker, session, msg);
+        }
+    }
+}
+
+/**
+ * @brief Stores or replaces the retained message of a topic, an empty
+ *        payload removes it
+ */
+static void retain(mqtt_broker_t *broker, const broker_msg_t *msg)
+{
+    size_t idx;
+
+    for(idx = 0; idx < broker->retained_cnt; ++idx)
+    {
+        broker_msg_t *old = broker->retained[idx];
+
+        if(old->topic_len == msg->topic_len && memcmp(old->data, msg->data, msg->topic_len) == 0)
+        {
+            free(old);
+            broker->retained[idx] = broker->retained[--broker->retained_cnt];
+            break;
+        }
+    }
+
+    if(msg->len > 0 && broker->retained_cnt < BROKER_RETAINED_MAX)
+    {
+        broker_msg_t *copy = msg_new(msg->data, msg->topic_len, &msg->data[msg->topic_len], msg->len, msg->qos);
+
+        if(copy != NULL)
+        {
+            broker->retained[broker->retained_cnt++] = copy;
+        }
+    }
+
+    pthread_mutex_lock(&broker->stats_lock);
+    broker->stats.retained = (uint32_t)broker->retained_cnt;
+    pthread_mutex_unlock(&broker->stats_lock);
+}
+
+/**
+ * @brief CONNECT: opens or resumes the session of the client id. A client
+ *        already connected with the same id is dropped.
+ */
+static void on_connect(mqtt_broker_t *broker, client_t *client, const mqtt_lite_packet_t *pkt)
+{
+    const uint8_t *buf = pkt->payload;
+    size_t len = pkt->payload_len;
+    char client_id[BROKER_CLIENT_ID_MAX];
+    uint8_t connack[4] = { MQTT_LITE_CONNACK << 4, 2, 0, CONNACK_ACCEPTED };
+    session_t *session = NULL;
+    size_t pos;
+    size_t id_len;
+    bool clean;
+
+    if(client->session >= 0 || len < 2)
+    {
+        client_fail(broker, client);
+        return;
+    }
+
+    // Protocol name, level, flags and keep alive, then the client id
+    pos = 2 + get16(buf);
+    if(pos + 6 > len)
+    {
+        client_fail(broker, client);
+        return;
+    }
+    clean = (buf[pos + 1] & 0x02) != 0;
+    client->keepalive_s = get16(&buf[pos + 2]);
+    pos += 4;
+    id_len = get16(&buf[pos]);
+    pos += 2;
+
+    if(pos + id_len > len || id_len >= sizeof(client_id))
+    {
+        client_fail(broker, client);
+        return;
+    }
+    memcpy(client_id, &buf[pos], id_len);
+    client_id[id_len] = '\0';
+
+    if(id_len == 0)
+    {
+        if(!clean)
+        {
+            connack[3] = CONNACK_ID_REJECTED;
+            client_send(broker, client, connack, sizeof(connack));
+            client_fail(broker, client);
+            return;
+        }
+        snprintf(client_id, sizeof(client_id), "anonymous-%u", ++broker->anon_cnt);
+    }
+
+    for(size_t idx = 0; idx < BROKER_SESSIONS_MAX; ++idx)
+    {
+        if(broker->sessions[idx].used && strcmp(broker->sessions[idx].client_id, client_id) == 0)
+        {
+            session = &broker->sessions[idx];
+            break;
+        }
+    }
+
+    // Take over: the previous connection goes, a clean session with it
+    if(session != NULL && session->client >= 0)
+    {
+        client_t *old = &broker->clients[session->client];
+
+        client_fail(broker, old);
+        if(!session->used)
+        {
+            session = NULL;
+        }
+    }
+
+    if(session != NULL && clean)
+    {
+        session_free(broker, session);
+        session = NULL;
+    }
+
+    if(session != NULL)
+    {
+        connack[2] = 1;
+    } else {
+        for(size_t idx = 0; idx < BROKER_SESSIONS_MAX; ++idx)
+        {
+            if(!broker->sessions[idx].used)
+            {
+                session = &broker->sessions[idx];
+                memset(session, 0, sizeof(*session));
+                session->used = true;
+                snprintf(session->client_id, sizeof(session->client_id), "%s", client_id);
+                pthread_mutex_lock(&broker->stats_lock);
+                broker->stats.sessions++;
+                pthread_mutex_unlock(&broker->stats_lock);
+                break;
+            }
+        }
+
+        if(session == NULL)
+        {
+            connack[3] = CONNACK_UNAVAILABLE;
+            client_send(broker, client, connack, sizeof(connack));
+            client_fail(broker, client);
+            return;
+        }
+    }
+
+    session->clean = clean;
+    session->client = (int)(client - broker->clients);
+    client->session = (int)(session - broker->sessions);
+
+    pthread_mutex_lock(&broker->stats_lock);
+    broker->stats.connects++;
+    broker->stats.clients++;
+    pthread_mutex_unlock(&broker->stats_lock);
+
+    if(!client_send(broker, client, connack, sizeof(connack)))
+    {
+        return;
+    }
+
+    // Messages published while the session was offline, in order
+    while(session->queue_cnt > 0 && session_online(broker, session))
+    {
+        broker_msg_t *msg = session->queue[session->queue_head];
+
+        session->queue_head = (session->queue_head + 1) % BROKER_QUEUE_MAX;
+        session->queue_cnt--;
+        pthread_mutex_lock(&broker->stats_lock);
+        broker->stats.queued--;
+        pthread_mutex_unlock(&broker->stats_lock);
+
+        deliver(broker, session, msg, 1, false);
+        free(msg);
+    }
+}
+
+/**
+ * @brief SUBSCRIBE: adds or replaces the filters, then sends the retained
+ *        messages that match them. QoS 2 is granted as 1.
+ */
+static void on_subscribe(mqtt_broker_t *broker, client_t *client, const mqtt_lite_packet_t *pkt)
+{
+    session_t *session = &broker->sessions[client->session];
+    const uint8_t *buf = pkt->payload;
+    size_t len = pkt->payload_len;
+    uint8_t suback[4 + 64];
+    size_t code_cnt = 0;
+    size_t first_new = session->sub_cnt;
+    size_t pos = 0;
+
+    while(pos + 2 < len && code_cnt < sizeof(suback) - 4)
+    {
+        size_t filter_len = get16(&buf[pos]);
+        uint8_t qos;
+        size_t sub;
+
+        if(pos + 2 + filter_len + 1 > len)
+        {
+            client_fail(broker, client);
+            return;
+        }
+        qos = buf[pos + 2 + filter_len] > 1 ? 1 : buf[pos + 2 + filter_len];
+
+        for(sub = 0; sub < session->sub_cnt; ++sub)
+        {
+            if(strlen(session->subs[sub].filter) == filter_len &&
+               memcmp(session->subs[sub].filter, &buf[pos + 2], filter_len) == 0)
+            {
+                break;
+            }
+        }
+
+        if(filter_len == 0 || filter_len >= BROKER_FILTER_MAX ||
+           (sub == session->sub_cnt && session->sub_cnt == BROKER_SUBS_MAX))
+        {
+            suback[4 + code_cnt++] = SUBACK_FAILURE;
+        } else {
+            if(sub == session->sub_cnt)
+            {
+                memcpy(session->subs[sub].filter, &buf[pos + 2], filter_len);
+                session->subs[sub].filter[filter_len] = '\0';
+                session->sub_cnt++;
+            } else if(sub < first_new) {
+                // Replaced: its retained messages are sent again
+                first_new = sub;
+            }
+            session->subs[sub].qos = qos;
+            suback[4 + code_cnt++] = qos;
+        }
+
+        pos += 2 + filter_len + 1;
+    }
+
+    suback[0] = MQTT_LITE_SUBACK << 4;
+    suback[1] = (uint8_t)(2 + code_cnt);
+    suback[2] = (uint8_t)(pkt->msg_id >> 8);
+    suback[3] = (uint8_t)pkt->msg_id;
+
+    if(!client_send(broker, client, suback, 4 + code_cnt))
+    {
+        return;
+    }
+
+    for(size_t idx = 0; idx < broker->retained_cnt; ++idx)
+    {
+        broker_msg_t *msg = broker->retained[idx];
+
+        for(size_t sub = first_new; sub < session->sub_cnt; ++sub)
+        {
+            if(topic_match(session->subs[sub].filter, msg->data, msg->topic_len))
+            {
+                uint8_t qos = (msg->qos < session->subs[sub].qos) ? msg->qos : session->subs[sub].qos;
+
+                deliver(broker, session, msg, qos, true);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief PUBLISH: acknowledges a QoS 1 message, updates the retained one and
+ *        forwards it
+ */
+static void on_publish(mqtt_broker_t *broker, client_t *client, const mqtt_lite_packet_t *pkt)
+{
+    uint8_t qos = (pkt->flags >> 1) & 0x03;
+    broker_msg_t *msg;
+
+    stats_add(broker, &broker->stats.msg_in, 1);
+
+    // No QoS 2, no wildcards in topic names
+    if(qos > 1 || pkt->topic_len == 0 ||
+       memchr(pkt->topic, '+', pkt->topic_len) != NULL || memchr(pkt->topic, '#', pkt->topic_len) != NULL)
+    {
+        client_fail(broker, client);
+        return;
+    }
+
+    if(qos == 1)
+    {
+        uint8_t puback[4] = { MQTT_LITE_PUBACK << 4, 2, (uint8_t)(pkt->msg_id >> 8), (uint8_t)pkt->msg_id };
+
+        client_send(broker, client, puback, sizeof(puback));
+    }
+
+    msg = msg_new(pkt->topic, pkt->topic_len, pkt->payload, pkt->payload_len, qos);
+    if(msg == NULL)
+    {
+        stats_add(broker, &broker->stats.dropped, 1);
+        return;
+    }
+
+    if(pkt->flags & 0x01)
+    {
+        retain(broker, msg);
+    }
+
+    route(broker, msg);
+    free(msg);
+}
+
+static void on_packet(mqtt_broker_t *broker, client_t *client, const mqtt_lite_packet_t *pkt)
+{
+    static const uint8_t pingresp[2] = { MQTT_LITE_PINGRESP << 4, 0 };
+
+    if(pkt->type != MQTT_LITE_CONNECT && client->session < 0)
+    {
+        client_fail(broker, client);
+        return;
+    }
+
+    switch(pkt->type) {
+    case MQTT_LITE_CONNECT:
+        on_connect(broker, client, pkt);
+        break;
+
+    case MQTT_LITE_SUBSCRIBE:
+        on_subscribe(broker, client, pkt);
+        break;
+
+    case MQTT_LITE_PUBLISH:
+        on_publish(broker, client, pkt);
+        break;
+
+    case MQTT_LITE_PUBACK:
+        // Nothing is sent again, nothing to release
+        break;
+
+    case MQTT_LITE_PINGREQ:
+        client_send(broker, client, pingresp, sizeof(pingresp));
+        break;
+
+    case MQTT_LITE_DISCONNECT:
+    default:
+        client_fail(broker, client);
+        break;
+    }
+}
+
+static void on_accept(mqtt_broker_t *broker)
+{
+    struct timeval timeout = { .tv_sec = BROKER_SEND_TIMEOUT_MS / 1000,
+                               .tv_usec = (BROKER_SEND_TIMEOUT_MS % 1000) * 1000 };
+    int one = 1;
+    int fd;
+
+    fd = accept(broker->listen_fd, NULL, NULL);
+    if(fd < 0)
+    {
+        return;
+    }
+
+    for(size_t idx = 0; idx < BROKER_CLIENTS_MAX; ++idx)
+    {
+        client_t *client = &broker->clients[idx];
+
+        if(!client->used)
+        {
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+            client->used = true;
+            client->closing = false;
+            client->session = -1;
+            client->keepalive_s = 0;
+            client->accepted_ms = mqtt_lite_now_ms();
+            client->last_rx_ms = client->accepted_ms;
+            mqtt_lite_conn_init(&client->conn, fd);
+            return;
+        }
+    }
+
+    close(fd);
+}
+
+/**
+ * @brief Serves the listening socket and every connection
+ */
+static void *broker_thread(void *arg)
+{
+    mqtt_broker_t *broker = arg;
+    struct pollfd *pfd = broker->pfd;
+    int *pfd_client = broker->pfd_client;
+
+    while(!atomic_load(&broker->stop))
+    {
+        size_t pfd_cnt = 1;
+        int64_t now_ms;
+
+        pfd[0].fd = broker->listen_fd;
+        pfd[0].events = POLLIN;
+        for(size_t idx = 0; idx < BROKER_CLIENTS_MAX; ++idx)
+        {
+            if(broker->clients[idx].used)
+            {
+                pfd[pfd_cnt].fd = broker->clients[idx].conn.fd;
+                pfd[pfd_cnt].events = POLLIN;
+                pfd_client[pfd_cnt] = (int)idx;
+                pfd_cnt++;
+            }
+        }
+
+        if(poll(pfd, pfd_cnt, BROKER_POLL_MS) < 0)
+        {
+            continue;
+        }
+        now_ms = mqtt_lite_now_ms();
+
+        for(size_t idx = 1; idx < pfd_cnt; ++idx)
+        {
+            client_t *client = &broker->clients[pfd_client[idx]];
+            mqtt_lite_packet_t pkt;
+            int ret;
+
+            if(pfd[idx].revents == 0 || client->closing)
+            {
+                continue;
+            }
+
+            // Every packet already received, the next read returns 0
+            while(!client->closing && (ret = mqtt_lite_conn_read(&client->conn, 0, &pkt)) != 0)
+            {
+                if(ret < 0)
+                {
+                    client_fail(broker, client);
+                    break;
+                }
+                client->last_rx_ms = now_ms;
+                stats_add(broker, &broker->stats.bytes_in, client->conn.rx_used);
+                on_packet(broker, client, &pkt);
+            }
+        }
+
+        if(pfd[0].revents & POLLIN)
+        {
+            on_accept(broker);
+        }
+
+        for(size_t idx = 0; idx < BROKER_CLIENTS_MAX; ++idx)
+        {
+            client_t *client = &broker->clients[idx];
+
+            if(!client->used)
+            {
+                continue;
+            }
+
+            // One and a half keep alive periods without a packet
+            if(client->session < 0 ? now_ms - client->accepted_ms > BROKER_CONNECT_TIMEOUT_MS
+                                   : (client->keepalive_s != 0 &&
+                                      now_ms - client->last_rx_ms > client->keepalive_s * 1500LL))
+            {
+                client->closing = true;
+            }
+
+            if(client->closing)
+            {
+                client_close(broker, client);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*******************************************************
+ GLOBAL FUNCTION DEFINITIONS
+ *******************************************************/
+
+/**
+ * @brief Starts a broker on all the interfaces
+ *
+ * @param port TCP port, 0 for any free one
+ * @return Broker, NULL if the port can't be bound
+ */
+mqtt_broker_t *mqtt_broker_start(uint16_t port)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY),
+                                .sin_port = htons(port) };
+    socklen_t addr_len = sizeof(addr);
+    mqtt_broker_t *broker;
+    int one = 1;
+
+    broker = calloc(1, sizeof(*broker));
+    if(broker == NULL)
+    {
+        return NULL;
+    }
+
+    broker->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(broker->listen_fd < 0)
+    {
+        free(broker);
+        return NULL;
+    }
+
+    setsockopt(broker->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if(bind(broker->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+       listen(broker->listen_fd, BROKER_LISTEN_BACKLOG) != 0 ||
+       getsockname(broker->listen_fd, (struct sockaddr *)&addr, &addr_len) != 0)
+    {
+        close(broker->listen_fd);
+        free(broker);
+        return NULL;
+    }
+
+    broker->port = ntohs(addr.sin_port);
+    atomic_init(&broker->stop, false);
+    pthread_mutex_init(&broker->stats_lock, NULL);
+
+    if(pthread_create(&broker->thread, NULL, broker_thread, broker) != 0)
+    {
+        close(broker->listen_fd);
+        free(broker);
+        return NULL;
+    }
+
+    return broker;
+}
+
+/**
+ * @brief Gets the port the broker listens on
+ */
+uint16_t mqtt_broker_port(const mqtt_broker_t *broker)
+{
+    return broker->port;
+}
+
+/**
+ * @brief Copies the counters
+ */
+void mqtt_broker_stats(mqtt_broker_t *broker, mqtt_broker_stats_t *stats)
+{
+    pthread_mutex_lock(&broker->stats_lock);
+    *stats = broker->stats;
+    pthread_mutex_unlock(&broker->stats_lock);
+}
+
+/**
+ * @brief Closes every connection and frees the broker, the sessions are lost
+ */
+void mqtt_broker_stop(mqtt_broker_t *broker)
+{
+    atomic_store(&broker->stop, true);
+    pthread_join(broker->thread, NULL);
+
+    for(size_t idx = 0; idx < BROKER_CLIENTS_MAX; ++idx)
+    {
+        if(broker->clients[idx].used)
+        {
+            client_close(broker, &broker->clients[idx]);
+        }
+    }
+
+    for(size_t idx = 0; idx < BROKER_SESSIONS_MAX; ++idx)
+    {
+        if(broker->sessions[idx].used)
+        {
+            session_free(broker, &broker->sessions[idx]);
+        }
+    }
+
+    for(size_t idx = 0; idx < broker->retained_cnt; ++idx)
+    {
+        free(broker->retained[idx]);
+    }
+
+    close(broker->listen_fd);
+    pthread_mutex_destroy(&broker->stats_lock);
+    free(broker);
+}
@@ -0,0 +1,46 @@
+#ifndef _MQTT_BROKER_H_
+#define _MQTT_BROKER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+/**
+ * @brief Broker counters since the start
+ */
+typedef struct {
+    uint32_t    connects;           // Accepted CONNECT packets
+    uint32_t    clients;            // Connected now
+    uint32_t    sessions;           // Clean and persistent ones, connected or not
+    uint32_t    queued;             // QoS 1 messages held for offline sessions now
+    uint32_t    retained;           // Retained messages now
+    uint64_t    msg_in;             // PUBLISH received
+    uint64_t    msg_out;            // PUBLISH sent
+    uint64_t    bytes_in;           // All packets
+    uint64_t    bytes_out;
+    uint64_t    dropped;            // Messages lost on a full queue or a failed send
+} mqtt_broker_stats_t;
+
+typedef struct mqtt_broker mqtt_broker_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+/*
+ * MQTT 3.1.1 broker for the host tools: QoS 0 and 1, clean and persistent
+ * sessions, retained messages and the + and # wildcards. One thread serves
+ * every connection. Messages in flight when a connection drops are not
+ * sent again, QoS 1 only holds the messages published while a persistent
+ * session is offline.
+ */
+
+mqtt_broker_t * mqtt_broker_start(uint16_t port);
+uint16_t        mqtt_broker_port(const mqtt_broker_t *broker);
+void            mqtt_broker_stats(mqtt_broker_t *broker, mqtt_broker_stats_t *stats);
+void            mqtt_broker_stop(mqtt_broker_t *broker);
+
+#endif // _MQTT_BROKER_H_
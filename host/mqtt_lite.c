@@ -0,0 +1,576 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "mqtt_lite.h"
+
+
+/*******************************************************
+ CONSTANTS
+ *******************************************************/
+
+#define CONNACK_TIMEOUT_MS      5000
+#define HEADER_MAX              5       // Type byte and up to 4 length bytes
+
+/*******************************************************
+ FUNCTION PROTOTYPES
+ *******************************************************/
+
+static size_t put_len(uint8_t *out, size_t len);
+static size_t put_str(uint8_t *out, const char *str, size_t len);
+static bool parse(const uint8_t *buf, size_t len, mqtt_lite_packet_t *pkt);
+static uint16_t next_msg_id(mqtt_lite_t *client);
+static bool client_send(mqtt_lite_t *client, const uint8_t *data, size_t len);
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+/**
+ * @brief Encodes the remaining length of a fixed header
+ *
+ * @param out Output: 1 to 4 bytes
+ * @param len Remaining length
+ * @return Bytes written
+ */
+static size_t put_len(uint8_t *out, size_t len)
+{
+    size_t pos = 0;
+
+    do {
+        out[pos] = len & 0x7F;
+        len >>= 7;
+        if(len != 0)
+        {
+            out[pos] |= 0x80;
+        }
+        pos++;
+    } while(len != 0);
+
+    return pos;
+}
+
+/**
+ * @brief Encodes a length-prefixed string
+ *
+ * @param out Output
+ * @param str String
+ * @param len String length
+ * @return Bytes written
+ */
+static size_t put_str(uint8_t *out, const char *str, size_t len)
+{
+    out[0] = (uint8_t)(len >> 8);
+    out[1] = (uint8_t)len;
+    memcpy(&out[2], str, len);
+
+    return len + 2;
+}
+
+/**
+ * @brief Decodes the variable header and the payload of a packet
+ *
+ * @param buf Packet body, after the fixed header
+ * @param len Body length
+ * @param pkt In: type and flags. Output: the decoded fields.
+ * @return false if the packet is malformed
+ */
+static bool parse(const uint8_t *buf, size_t len, mqtt_lite_packet_t *pkt)
+{
+    size_t pos;
+
+    switch(pkt->type) {
+    case MQTT_LITE_CONNACK:
+        if(len < 2)
+        {
+            return false;
+        }
+        pkt->session_present = buf[0] & 0x01;
+        pkt->rc = buf[1];
+        break;
+
+    case MQTT_LITE_PUBLISH:
+        if(len < 2)
+        {
+            return false;
+        }
+        pkt->topic_len = ((size_t)buf[0] << 8) | buf[1];
+        pkt->topic = (const char *)&buf[2];
+        pos = 2 + pkt->topic_len;
+
+        if(((pkt->flags >> 1) & 0x03) != 0)
+        {
+            if(pos + 2 > len)
+            {
+                return false;
+            }
+            pkt->msg_id = ((uint16_t)buf[pos] << 8) | buf[pos + 1];
+            pos += 2;
+        }
+
+        if(pos > len)
+        {
+            return false;
+        }
+        pkt->payload = &buf[pos];
+        pkt->payload_len = len - pos;
+        break;
+
+    case MQTT_LITE_PUBACK:
+    case MQTT_LITE_SUBACK:
+    case MQTT_LITE_SUBSCRIBE:
+        if(len < 2)
+        {
+            return false;
+        }
+        pkt->msg_id = ((uint16_t)buf[0] << 8) | buf[1];
+        pkt->payload = &buf[2];
+        pkt->payload_len = len - 2;
+        break;
+
+    default:
+        pkt->payload = buf;
+        pkt->payload_len = len;
+        break;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Allocates a packet identifier, never 0
+ *
+ * @param client Client
+ * @return Identifier
+ */
+static uint16_t next_msg_id(mqtt_lite_t *client)
+{
+    uint16_t id;
+
+    pthread_mutex_lock(&client->id_lock);
+    if(++client->next_id == 0)
+    {
+        client->next_id = 1;
+    }
+    id = client->next_id;
+    pthread_mutex_unlock(&client->id_lock);
+
+    return id;
+}
+
+/**
+ * @brief Sends a packet and notes the time for the keepalive
+ *
+ * @param client    Client
+ * @param data      Packet
+ * @param len       Packet length
+ * @return true if sent
+ */
+static bool client_send(mqtt_lite_t *client, const uint8_t *data, size_t len)
+{
+    if(!mqtt_lite_conn_send(&client->conn, data, len))
+    {
+        return false;
+    }
+
+    client->last_tx_ms = mqtt_lite_now_ms();
+
+    return true;
+}
+
+/****************************************
+ EXTERNAL FUNCTIONS
+*****************************************/
+
+/**
+ * @brief Monotonic time
+ *
+ * @return Time in ms
+ */
+int64_t mqtt_lite_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Starts a packet stream on a connected socket
+ *
+ * @param conn  Stream
+ * @param fd    Socket
+ */
+void mqtt_lite_conn_init(mqtt_lite_conn_t *conn, int fd)
+{
+    conn->fd = fd;
+    conn->rx_len = 0;
+    conn->rx_used = 0;
+    pthread_mutex_init(&conn->send_lock, NULL);
+}
+
+/**
+ * @brief Reads the next packet
+ *
+ * @param conn          Stream
+ * @param timeout_ms    Longest wait, 0 to take only a packet already received
+ * @param pkt           Output: packet, valid until the next read
+ * @return 1 with a packet, 0 on timeout, -1 if the connection is closed or
+ *         the stream is malformed
+ */
+int mqtt_lite_conn_read(mqtt_lite_conn_t *conn, int timeout_ms, mqtt_lite_packet_t *pkt)
+{
+    int64_t end_ms = mqtt_lite_now_ms() + timeout_ms;
+    struct pollfd pfd = { .fd = conn->fd, .events = POLLIN };
+
+    // Drop the packet returned last
+    memmove(conn->rx, &conn->rx[conn->rx_used], conn->rx_len - conn->rx_used);
+    conn->rx_len -= conn->rx_used;
+    conn->rx_used = 0;
+
+    while(1)
+    {
+        size_t body_len = 0;
+        size_t hdr_len = 1;
+        bool complete = false;
+        int wait_ms;
+        ssize_t got;
+
+        // Fixed header: the length is complete once a byte has no continuation bit
+        while(hdr_len < conn->rx_len && hdr_len < HEADER_MAX)
+        {
+            body_len |= (size_t)(conn->rx[hdr_len] & 0x7F) << (7 * (hdr_len - 1));
+            if((conn->rx[hdr_len++] & 0x80) == 0)
+            {
+                complete = true;
+                break;
+            }
+        }
+
+        if(!complete && hdr_len == HEADER_MAX)
+        {
+            return -1;
+        }
+
+        if(complete)
+        {
+            if(hdr_len + body_len > MQTT_LITE_PACKET_MAX)
+            {
+                return -1;
+            }
+
+            if(conn->rx_len >= hdr_len + body_len)
+            {
+                memset(pkt, 0, sizeof(*pkt));
+                pkt->type = conn->rx[0] >> 4;
+                pkt->flags = conn->rx[0] & 0x0F;
+                conn->rx_used = hdr_len + body_len;
+
+                return parse(&conn->rx[hdr_len], body_len, pkt) ? 1 : -1;
+            }
+        }
+
+        wait_ms = (int)(end_ms - mqtt_lite_now_ms());
+        if(poll(&pfd, 1, wait_ms > 0 ? wait_ms : 0) <= 0)
+        {
+            return 0;
+        }
+
+        got = recv(conn->fd, &conn->rx[conn->rx_len], sizeof(conn->rx) - conn->rx_len, 0);
+        if(got <= 0)
+        {
+            return -1;
+        }
+        conn->rx_len += (size_t)got;
+    }
+}
+
+/**
+ * @brief Sends bytes, whole packets are not interleaved between threads
+ *
+ * @param conn  Stream
+ * @param data  Bytes
+ * @param len   Number of bytes
+ * @return true if sent
+ */
+bool mqtt_lite_conn_send(mqtt_lite_conn_t *conn, const uint8_t *data, size_t len)
+{
+    size_t sent = 0;
+    ssize_t ret;
+
+    pthread_mutex_lock(&conn->send_lock);
+
+    while(sent < len)
+    {
+        ret = send(conn->fd, &data[sent], len - sent, MSG_NOSIGNAL);
+        if(ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(ret <= 0)
+        {
+            break;
+        }
+        sent += (size_t)ret;
+    }
+
+    pthread_mutex_unlock(&conn->send_lock);
+
+    return sent == len;
+}
+
+/**
+ * @brief Encodes a PUBLISH packet
+ *
+ * @param out       Output buffer
+ * @param size      Room in out
+ * @param topic     Topic, not terminated
+ * @param topic_len Topic length
+ * @param data      Payload
+ * @param len       Payload length
+ * @param qos       0 or 1
+ * @param retain    Retain flag
+ * @param msg_id    Packet identifier, QoS 1 only
+ * @return Packet length, 0 if it does not fit
+ */
+size_t mqtt_lite_publish_encode(uint8_t *out, size_t size, const char *topic, size_t topic_len,
+                                const void *data, size_t len, int qos, bool retain, uint16_t msg_id)
+{
+    size_t body = 2 + topic_len + len + (qos > 0 ? 2 : 0);
+    size_t pos;
+
+    if(body + HEADER_MAX > size)
+    {
+        return 0;
+    }
+
+    out[0] = (MQTT_LITE_PUBLISH << 4) | ((qos > 0) ? 0x02 : 0) | (retain ? 0x01 : 0);
+    pos = 1 + put_len(&out[1], body);
+    pos += put_str(&out[pos], topic, topic_len);
+
+    if(qos > 0)
+    {
+        out[pos++] = (uint8_t)(msg_id >> 8);
+        out[pos++] = (uint8_t)msg_id;
+    }
+
+    memcpy(&out[pos], data, len);
+
+    return pos + len;
+}
+
+/**
+ * @brief Opens a TCP connection and an MQTT session
+ *
+ * @param client            Client
+ * @param host              Broker host name or address
+ * @param port              Broker port
+ * @param opts              Session options
+ * @param session_present   Output: the broker resumed a stored session, may be NULL
+ * @return true if the broker accepted the connection
+ */
+bool mqtt_lite_connect(mqtt_lite_t *client, const char *host, uint16_t port,
+                       const mqtt_lite_opts_t *opts, bool *session_present)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *addrs;
+    struct addrinfo *addr;
+    char port_str[8];
+    uint8_t pkt[512];
+    size_t pos = 0;
+    size_t body;
+    mqtt_lite_packet_t ack;
+    int one = 1;
+    int fd = -1;
+
+    snprintf(port_str, sizeof(port_str), "%u", port);
+    if(getaddrinfo(host, port_str, &hints, &addrs) != 0)
+    {
+        return false;
+    }
+
+    for(addr = addrs; addr != NULL; addr = addr->ai_next)
+    {
+        fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if(fd >= 0 && connect(fd, addr->ai_addr, addr->ai_addrlen) == 0)
+        {
+            break;
+        }
+        if(fd >= 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    mqtt_lite_conn_init(&client->conn, fd);
+    pthread_mutex_init(&client->id_lock, NULL);
+    client->keepalive_s = opts->keepalive_s;
+
+    body = 10 + 2 + strlen(opts->client_id);
+    if(opts->username != NULL)
+    {
+        body += 2 + strlen(opts->username) + 2 + strlen(opts->password ? opts->password : "");
+    }
+    if(body + HEADER_MAX > sizeof(pkt))
+    {
+        close(fd);
+        return false;
+    }
+
+    pkt[pos++] = MQTT_LITE_CONNECT << 4;
+    pos += put_len(&pkt[pos], body);
+    pos += put_str(&pkt[pos], "MQTT", 4);
+    pkt[pos++] = 4;     // Protocol level 3.1.1
+    pkt[pos++] = (opts->clean_session ? 0x02 : 0) | (opts->username != NULL ? 0xC0 : 0);
+    pkt[pos++] = (uint8_t)(opts->keepalive_s >> 8);
+    pkt[pos++] = (uint8_t)opts->keepalive_s;
+    pos += put_str(&pkt[pos], opts->client_id, strlen(opts->client_id));
+    if(opts->username != NULL)
+    {
+        const char *password = opts->password ? opts->password : "";
+
+        pos += put_str(&pkt[pos], opts->username, strlen(opts->username));
+        pos += put_str(&pkt[pos], password, strlen(password));
+    }
+
+    if(!client_send(client, pkt, pos) ||
+       mqtt_lite_conn_read(&client->conn, CONNACK_TIMEOUT_MS, &ack) != 1 ||
+       ack.type != MQTT_LITE_CONNACK || ack.rc != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    if(session_present != NULL)
+    {
+        *session_present = ack.session_present;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Sends DISCONNECT and closes the connection
+ *
+ * @param client Client
+ */
+void mqtt_lite_close(mqtt_lite_t *client)
+{
+    const uint8_t pkt[] = { MQTT_LITE_DISCONNECT << 4, 0 };
+
+    mqtt_lite_conn_send(&client->conn, pkt, sizeof(pkt));
+    close(client->conn.fd);
+}
+
+/**
+ * @brief Publishes a message
+ *
+ * @param client    Client
+ * @param topic     Topic
+ * @param data      Payload
+ * @param len       Payload length
+ * @param qos       0 or 1
+ * @param retain    Retain flag
+ * @return Packet identifier, 0 for QoS 0, -1 if not sent
+ */
+int mqtt_lite_publish(mqtt_lite_t *client, const char *topic, const void *data, size_t len, int qos, bool retain)
+{
+    uint8_t pkt[MQTT_LITE_PACKET_MAX];
+    uint16_t msg_id = (qos > 0) ? next_msg_id(client) : 0;
+    size_t pkt_len = mqtt_lite_publish_encode(pkt, sizeof(pkt), topic, strlen(topic), data, len, qos, retain, msg_id);
+
+    if(pkt_len == 0 || !client_send(client, pkt, pkt_len))
+    {
+        return -1;
+    }
+
+    return msg_id;
+}
+
+/**
+ * @brief Subscribes to one topic filter
+ *
+ * @param client    Client
+ * @param filter    Topic filter, wildcards allowed
+ * @param qos       Largest QoS of the deliveries
+ * @return Packet identifier, -1 if not sent
+ */
+int mqtt_lite_subscribe(mqtt_lite_t *client, const char *filter, int qos)
+{
+    uint8_t pkt[HEADER_MAX + 2 + 2 + 256 + 1];
+    uint16_t msg_id = next_msg_id(client);
+    size_t filter_len = strlen(filter);
+    size_t pos = 0;
+
+    if(filter_len > 256)
+    {
+        return -1;
+    }
+
+    pkt[pos++] = (MQTT_LITE_SUBSCRIBE << 4) | 0x02;
+    pos += put_len(&pkt[pos], 2 + 2 + filter_len + 1);
+    pkt[pos++] = (uint8_t)(msg_id >> 8);
+    pkt[pos++] = (uint8_t)msg_id;
+    pos += put_str(&pkt[pos], filter, filter_len);
+    pkt[pos++] = (uint8_t)qos;
+
+    return client_send(client, pkt, pos) ? msg_id : -1;
+}
+
+/**
+ * @brief Reads the next packet, acknowledges QoS 1 messages and keeps the
+ *        connection alive
+ *
+ * @param client        Client
+ * @param timeout_ms    Longest wait
+ * @param pkt           Output: packet, valid until the next read
+ * @return 1 with a packet, 0 on timeout, -1 if the connection is lost
+ */
+int mqtt_lite_read(mqtt_lite_t *client, int timeout_ms, mqtt_lite_packet_t *pkt)
+{
+    static const uint8_t ping[] = { MQTT_LITE_PINGREQ << 4, 0 };
+    uint8_t ack[4];
+    int ret;
+
+    if(client->keepalive_s != 0 &&
+       mqtt_lite_now_ms() - client->last_tx_ms >= client->keepalive_s * 1000 / 2 &&
+       !client_send(client, ping, sizeof(ping)))
+    {
+        return -1;
+    }
+
+    ret = mqtt_lite_conn_read(&client->conn, timeout_ms, pkt);
+
+    if(ret == 1 && pkt->type == MQTT_LITE_PUBLISH && ((pkt->flags >> 1) & 0x03) != 0)
+    {
+        ack[0] = MQTT_LITE_PUBACK << 4;
+        ack[1] = 2;
+        ack[2] = (uint8_t)(pkt->msg_id >> 8);
+        ack[3] = (uint8_t)pkt->msg_id;
+
+        if(!client_send(client, ack, sizeof(ack)))
+        {
+            return -1;
+        }
+    }
+
+    return ret;
+}
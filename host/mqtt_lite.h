@@ -0,0 +1,97 @@
+#ifndef _MQTT_LITE_H_
+#define _MQTT_LITE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <pthread.h>
+
+/**********************************
+ CONSTANTS AND MACROS
+***********************************/
+
+#define MQTT_LITE_PACKET_MAX    8192    // Largest packet, fixed header included
+
+// Control packet types
+#define MQTT_LITE_CONNECT       1
+#define MQTT_LITE_CONNACK       2
+#define MQTT_LITE_PUBLISH       3
+#define MQTT_LITE_PUBACK        4
+#define MQTT_LITE_SUBSCRIBE     8
+#define MQTT_LITE_SUBACK        9
+#define MQTT_LITE_PINGREQ       12
+#define MQTT_LITE_PINGRESP      13
+#define MQTT_LITE_DISCONNECT    14
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+/**
+ * @brief Received packet, the pointers are valid until the next read
+ */
+typedef struct {
+    uint8_t         type;
+    uint8_t         flags;              // Low nibble of the fixed header
+    uint16_t        msg_id;             // PUBLISH with QoS 1, PUBACK, SUBACK
+    bool            session_present;    // CONNACK
+    uint8_t         rc;                 // CONNACK return code
+    const char *    topic;              // PUBLISH
+    size_t          topic_len;
+    const uint8_t * payload;            // PUBLISH
+    size_t          payload_len;
+} mqtt_lite_packet_t;
+
+/**
+ * @brief Packet stream of one TCP connection
+ */
+typedef struct {
+    int             fd;
+    pthread_mutex_t send_lock;
+    uint8_t         rx[MQTT_LITE_PACKET_MAX];
+    size_t          rx_len;             // Bytes in rx
+    size_t          rx_used;            // Bytes of the packet returned last
+} mqtt_lite_conn_t;
+
+typedef struct {
+    const char *    client_id;
+    const char *    username;           // NULL: none
+    const char *    password;
+    bool            clean_session;
+    uint16_t        keepalive_s;
+} mqtt_lite_opts_t;
+
+/**
+ * @brief MQTT 3.1.1 client, QoS 0 and 1. One thread reads, any thread
+ *        publishes.
+ */
+typedef struct {
+    mqtt_lite_conn_t    conn;
+    pthread_mutex_t     id_lock;
+    uint16_t            next_id;
+    uint16_t            keepalive_s;
+    int64_t             last_tx_ms;
+} mqtt_lite_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+// Packet streams, shared with the broker
+void    mqtt_lite_conn_init(mqtt_lite_conn_t *conn, int fd);
+int     mqtt_lite_conn_read(mqtt_lite_conn_t *conn, int timeout_ms, mqtt_lite_packet_t *pkt);
+bool    mqtt_lite_conn_send(mqtt_lite_conn_t *conn, const uint8_t *data, size_t len);
+size_t  mqtt_lite_publish_encode(uint8_t *out, size_t size, const char *topic, size_t topic_len,
+                                 const void *data, size_t len, int qos, bool retain, uint16_t msg_id);
+int64_t mqtt_lite_now_ms(void);
+
+// Client
+bool    mqtt_lite_connect(mqtt_lite_t *client, const char *host, uint16_t port,
+                          const mqtt_lite_opts_t *opts, bool *session_present);
+void    mqtt_lite_close(mqtt_lite_t *client);
+int     mqtt_lite_publish(mqtt_lite_t *client, const char *topic, const void *data, size_t len, int qos, bool retain);
+int     mqtt_lite_subscribe(mqtt_lite_t *client, const char *filter, int qos);
+int     mqtt_lite_read(mqtt_lite_t *client, int timeout_ms, mqtt_lite_packet_t *pkt);
+
+#endif // _MQTT_LITE_H_
@@ -0,0 +1,45 @@
+#include <stdlib.h>
+
+#include "percentile.h"
+
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+static int compare(const void *a, const void *b)
+{
+    uint32_t left = *(const uint32_t *)a;
+    uint32_t right = *(const uint32_t *)b;
+
+    return (left > right) - (left < right);
+}
+
+/*******************************************************
+ GLOBAL FUNCTION DEFINITIONS
+ *******************************************************/
+
+/**
+ * @brief Gets a percentile, nearest rank
+ *
+ * @param values    Samples, sorted in place
+ * @param count     Number of samples
+ * @param permille  500 for the median, 990 for p99
+ * @return Smallest sample with at least permille of the samples at or below
+ *         it, 0 without samples
+ */
+uint32_t percentile(uint32_t *values, size_t count, uint32_t permille)
+{
+    size_t rank;
+
+    if(count == 0)
+    {
+        return 0;
+    }
+
+    qsort(values, count, sizeof(values[0]), compare);
+
+    rank = (count * permille + 999) / 1000;
+
+    return values[rank > 0 ? rank - 1 : 0];
+}
@@ -0,0 +1,18 @@
+#ifndef _PERCENTILE_H_
+#define _PERCENTILE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+/*
+ * Exact percentiles of the samples collected by the host tools, where the
+ * log2 buckets of histogram.h are too coarse to compare two runs.
+ */
+
+uint32_t    percentile(uint32_t *values, size_t count, uint32_t permille);
+
+#endif // _PERCENTILE_H_
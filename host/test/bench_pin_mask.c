@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "hal.h"
+#include "hal_host.h"
+#include "pin_mask.h"
+
+
+/*
+ * Switching a group of N channels: one set/clear mask write against one pin
+ * write per channel. Besides the cost, the skew is the time from the first
+ * to the last pin change of the group, as the loads see it.
+ */
+
+#define GROUPS          20000
+#define CHANNELS_MAX    32
+
+
+static int64_t First_us;
+static int64_t Last_us;
+
+
+static void on_pin(int pin, int level, int64_t now_us)
+{
+    (void) pin;
+    (void) level;
+
+    if(First_us == 0)
+    {
+        First_us = now_us;
+    }
+    Last_us = now_us;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+int main(void)
+{
+    hal_host_gpio_hook(on_pin);
+
+    for(uint32_t channels = 4; channels <= CHANNELS_MAX; channels *= 2)
+    {
+        int64_t mask_skew_us = 0;
+        int64_t pin_skew_us = 0;
+        double mask_ns = 0;
+        double pin_ns = 0;
+        double start_ns;
+
+        for(uint32_t group = 0; group < GROUPS; ++group)
+        {
+            bool level = (group & 1) == 0;
+            pin_mask_t mask;
+
+            First_us = 0;
+            start_ns = now_ns();
+            pin_mask_init(&mask);
+            for(uint32_t pin = 0; pin < channels; ++pin)
+            {
+                pin_mask_add(&mask, pin, level);
+            }
+            hal_gpio_write_mask(mask.set, mask.clear);
+            mask_ns += now_ns() - start_ns;
+            mask_skew_us = (Last_us - First_us > mask_skew_us) ? Last_us - First_us : mask_skew_us;
+
+            First_us = 0;
+            start_ns = now_ns();
+            for(uint32_t pin = 0; pin < channels; ++pin)
+            {
+                hal_gpio_set_level((int)(CHANNELS_MAX + pin), level);
+            }
+            pin_ns += now_ns() - start_ns;
+            pin_skew_us = (Last_us - First_us > pin_skew_us) ? Last_us - First_us : pin_skew_us;
+        }
+
+        printf("%2u channels: mask %.0f ns/group, max skew %lld us | per pin %.0f ns/group, max skew %lld us\n",
+               channels, mask_ns / GROUPS, (long long)mask_skew_us, pin_ns / GROUPS, (long long)pin_skew_us);
+    }
+
+    return 0;
+}
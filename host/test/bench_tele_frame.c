@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "tele_frame.h"
+
+
+/*
+ * The telemetry frame of wqtt_client in JSON and in CBOR: message size,
+ * encoding cost on the device and decoding cost on a controller.
+ */
+
+#define FRAMES          1000000
+#define BUF_SIZE        192
+
+
+static const char *Keys[] = { "ts", "I", "Eh", "Ef", "El", "fz", "zj", "zm", "H", "F", "L", "D" };
+
+#define KEY_CNT         (sizeof(Keys) / sizeof(Keys[0]))
+
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// Typical values: a timestamp, currents in mA, energies in Wh, mains in mHz
+static void frame_fill(tele_frame_t *frame, uint32_t step)
+{
+    static const uint32_t base[KEY_CNT] = { 0, 350, 12000, 800, 150, 50000, 40, 0, 1, 3, 0, 1 };
+
+    tele_frame_reset(frame);
+    tele_frame_add(frame, Keys[0], 1000 * step);
+    for(uint32_t idx = 1; idx < KEY_CNT; ++idx)
+    {
+        tele_frame_add(frame, Keys[idx], base[idx] + (step % 7));
+    }
+}
+
+static void bench(const char *name, tele_frame_format_t format)
+{
+    static uint8_t buf[BUF_SIZE];
+    tele_frame_t frame;
+    tele_frame_decoded_t decoded;
+    uint32_t checksum = 0;
+    uint32_t errors = 0;
+    double encode_ns = 0;
+    double decode_ns = 0;
+    double start;
+    size_t bytes = 0;
+    size_t len;
+
+    for(uint32_t step = 0; step < FRAMES; ++step)
+    {
+        frame_fill(&frame, step);
+
+        start = now_ns();
+        len = tele_frame_encode(&frame, format, buf, sizeof(buf));
+        encode_ns += now_ns() - start;
+        bytes += len;
+
+        start = now_ns();
+        errors += !tele_frame_decode(&decoded, format, buf, len);
+        decode_ns += now_ns() - start;
+        checksum += decoded.frame.field[1].value;
+    }
+
+    printf("%-5s %5.1f bytes/frame, encode %6.1f ns, decode %6.1f ns, %u errors (checksum %u)\n",
+           name, (double)bytes / FRAMES, encode_ns / FRAMES, decode_ns / FRAMES, errors, checksum);
+}
+
+int main(void)
+{
+    printf("%u frames of %u metrics\n", FRAMES, (unsigned)KEY_CNT);
+    bench("JSON", TELE_FRAME_JSON);
+    bench("CBOR", TELE_FRAME_CBOR);
+
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "hal.h"
+#include "hal_host.h"
+#include "lf_queue.h"
+#include "mqtt_broker.h"
+#include "percentile.h"
+
+
+/*
+ * Lateness of the callbacks of the timer task over a weak link. Every
+ * telemetry period publishes the Current and the three Energy totals, either
+ * from the timer callback itself like before the queued publisher, or
+ * through a queue drained by a publisher task like wqtt_client does now. A
+ * second timer ticks every millisecond like the LVGL tick: with blocking
+ * publishes it waits behind them.
+ */
+
+#define TELEMETRY_PERIOD_US 100000  // RMS window
+#define TICK_PERIOD_US      1000    // LVGL tick
+#define MESSAGES_PER_PERIOD 4       // Current and the Energy of three loads
+#define UPLINK_BYTES_PER_S  12500   // 100 kbit/s
+#define RUN_MS              5000
+#define CONNECT_TIMEOUT_MS  5000
+
+#define SAMPLE_MAX          (RUN_MS * 1000 / TICK_PERIOD_US + 64)
+#define QUEUE_SIZE          32      // Power of two
+
+
+typedef enum {
+    MODE_IDLE = 0,
+    MODE_BLOCKING,
+    MODE_QUEUED
+} publish_mode_t;
+
+// Lateness of the callbacks of one timer against its period
+typedef struct {
+    const char *    name;
+    uint32_t        period_us;
+    int64_t         last_us;
+    uint32_t        samples[SAMPLE_MAX];
+    size_t          count;
+} lateness_t;
+
+static lateness_t       Telemetry = { .name = "telemetry", .period_us = TELEMETRY_PERIOD_US };
+static lateness_t       Tick = { .name = "tick", .period_us = TICK_PERIOD_US };
+
+static atomic_int       Mode = MODE_IDLE;
+static atomic_bool      Connected = false;
+static lf_queue_cell_t  Cells[QUEUE_SIZE];
+static lf_queue_t       Queue = LF_QUEUE_INITIALIZER(Cells);
+static hal_task_t       Publisher;
+static uint32_t         Published;
+
+static const char *     Topics[MESSAGES_PER_PERIOD] = {
+    "smartRelay/02000000ab12/tele/Current",
+    "smartRelay/02000000ab12/tele/Energy/Heater",
+    "smartRelay/02000000ab12/tele/Energy/Fan",
+    "smartRelay/02000000ab12/tele/Energy/Light"
+};
+
+
+static void lateness_add(lateness_t *late, int64_t now_us)
+{
+    int64_t late_us;
+
+    if(atomic_load(&Mode) == MODE_IDLE)
+    {
+        late->last_us = 0;
+        return;
+    }
+
+    if(late->last_us != 0 && late->count < SAMPLE_MAX)
+    {
+        late_us = now_us - late->last_us - late->period_us;
+        late->samples[late->count++] = (uint32_t)(late_us < 0 ? -late_us : late_us);
+    }
+    late->last_us = now_us;
+}
+
+static void publish(uint32_t idx, uint32_t value)
+{
+    char str[16];
+
+    snprintf(str, sizeof(str), "%u", value);
+    if(hal_mqtt_publish(Topics[idx], str, strlen(str), 0, false) >= 0)
+    {
+        Published++;
+    }
+}
+
+static void telemetry_cb(void *arg)
+{
+    static uint32_t value = 0;
+    lf_queue_item_t item = { 0 };
+
+    (void) arg;
+
+    lateness_add(&Telemetry, hal_time_us());
+    value++;
+
+    for(uint32_t idx = 0; idx < MESSAGES_PER_PERIOD; ++idx)
+    {
+        switch(atomic_load(&Mode)) {
+        case MODE_BLOCKING:
+            publish(idx, value);
+            break;
+
+        case MODE_QUEUED:
+            item.arg = (uint16_t)idx;
+            item.value = value;
+            lf_queue_push(&Queue, &item);
+            hal_task_notify(Publisher);
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+static void tick_cb(void *arg)
+{
+    (void) arg;
+
+    lateness_add(&Tick, hal_time_us());
+}
+
+static void publisher_task(void *arg)
+{
+    lf_queue_item_t item;
+
+    (void) arg;
+
+    while(1)
+    {
+        hal_task_wait(100);
+
+        while(lf_queue_pop(&Queue, &item))
+        {
+            publish(item.arg, item.value);
+        }
+    }
+}
+
+static void mqtt_handler(const hal_mqtt_event_t *event)
+{
+    if(event->id == HAL_MQTT_CONNECTED)
+    {
+        atomic_store(&Connected, true);
+    }
+}
+
+static void report(const char *mode, lateness_t *late)
+{
+    printf("%-9s %-10s %6zu %8u %8u %8u\n", mode, late->name, late->count,
+           percentile(late->samples, late->count, 500),
+           percentile(late->samples, late->count, 990),
+           percentile(late->samples, late->count, 1000));
+    late->count = 0;
+}
+
+static void run(const char *name, publish_mode_t mode)
+{
+    Published = 0;
+    atomic_store(&Mode, mode);
+    usleep(RUN_MS * 1000);
+    atomic_store(&Mode, MODE_IDLE);
+    usleep(TELEMETRY_PERIOD_US);
+
+    report(name, &Telemetry);
+    report(name, &Tick);
+    printf("%-9s %u messages\n", name, Published);
+}
+
+int main(void)
+{
+    const hal_mqtt_cfg_t cfg = {
+        .uri = "mqtt://127.0.0.1",
+        .client_id = "bench-timer-publish",
+        .clean_session = true
+    };
+    mqtt_broker_t *broker;
+
+    hal_log_level_set("*", HAL_LOG_WARN);
+
+    broker = mqtt_broker_start(0);
+    if(broker == NULL)
+    {
+        fprintf(stderr, "Broker not started\n");
+        return 1;
+    }
+
+    hal_host_mqtt_broker("127.0.0.1", mqtt_broker_port(broker));
+    hal_host_mqtt_uplink(UPLINK_BYTES_PER_S);
+    hal_mqtt_start(&cfg, mqtt_handler);
+
+    for(uint32_t waited_ms = 0; !atomic_load(&Connected); waited_ms += 10)
+    {
+        if(waited_ms >= CONNECT_TIMEOUT_MS)
+        {
+            fprintf(stderr, "Not connected\n");
+            return 1;
+        }
+        usleep(10 * 1000);
+    }
+
+    Publisher = hal_task_create(publisher_task, "publisher", 4096, 5, 0);
+    hal_timer_periodic(telemetry_cb, NULL, "telemetry", TELEMETRY_PERIOD_US);
+    hal_timer_periodic(tick_cb, NULL, "tick", TICK_PERIOD_US);
+
+    printf("%u messages of %u ms over %u B/s, timer lateness:\n", MESSAGES_PER_PERIOD,
+           TELEMETRY_PERIOD_US / 1000, UPLINK_BYTES_PER_S);
+    printf("%-9s %-10s %6s %8s %8s %8s\n", "publish", "timer", "n", "p50 us", "p99 us", "max us");
+
+    run("blocking", MODE_BLOCKING);
+    run("queued", MODE_QUEUED);
+
+    mqtt_broker_stop(broker);
+
+    return 0;
+}
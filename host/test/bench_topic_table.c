@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "topic_table.h"
+
+
+/*
+ * Dispatch cost with many topics: the hash table against the former chain
+ * of topic compares, on random incoming topics of a 60 topic device.
+ */
+
+#define TOPICS          60
+#define LOOKUPS         10000000
+
+
+static char Names[TOPICS][32];
+static topic_route_t Routes[TOPICS];
+static uint32_t Handled;
+
+
+static bool parse_any(const char *data, size_t len, uint32_t *value)
+{
+    (void) data;
+
+    *value = (uint32_t)len;
+    return true;
+}
+
+static void handle_any(uint32_t value)
+{
+    Handled += value;
+}
+
+// The is_topic_equals chain, with the length check it was missing
+static const topic_route_t *chain_find(const char *topic, size_t len)
+{
+    for(size_t idx = 0; idx < TOPICS; ++idx)
+    {
+        if(strlen(Routes[idx].topic) == len && memcmp(Routes[idx].topic, topic, len) == 0)
+        {
+            return &Routes[idx];
+        }
+    }
+
+    return NULL;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+int main(void)
+{
+    static uint8_t order[LOOKUPS];
+    topic_table_t table;
+    const topic_route_t *route;
+    uint64_t found;
+    double start_ns;
+
+    for(size_t idx = 0; idx < TOPICS; ++idx)
+    {
+        snprintf(Names[idx], sizeof(Names[idx]), "relay/channel%02u/state", (unsigned)idx);
+        Routes[idx] = (topic_route_t){ Names[idx], parse_any, handle_any };
+    }
+
+    if(!topic_table_init(&table, Routes, TOPICS))
+    {
+        fprintf(stderr, "topic_table_init failed\n");
+        return 1;
+    }
+
+    srand(5);
+    for(size_t idx = 0; idx < LOOKUPS; ++idx)
+    {
+        order[idx] = (uint8_t)(rand() % TOPICS);
+    }
+
+    found = 0;
+    start_ns = now_ns();
+    for(size_t idx = 0; idx < LOOKUPS; ++idx)
+    {
+        const char *topic = Names[order[idx]];
+
+        route = chain_find(topic, strlen(topic));
+        if(route != NULL && route->parse("1", 1, &Handled))
+        {
+            route->handle(1);
+            found++;
+        }
+    }
+    printf("chain  %u topics: %.1f ns/dispatch (%llu)\n", TOPICS, (now_ns() - start_ns) / LOOKUPS,
+           (unsigned long long)found);
+
+    found = 0;
+    start_ns = now_ns();
+    for(size_t idx = 0; idx < LOOKUPS; ++idx)
+    {
+        const char *topic = Names[order[idx]];
+
+        found += topic_table_dispatch(&table, topic, strlen(topic), "1", 1);
+    }
+    printf("table  %u topics: %.1f ns/dispatch (%llu)\n", TOPICS, (now_ns() - start_ns) / LOOKUPS,
+           (unsigned long long)found);
+
+    return 0;
+}
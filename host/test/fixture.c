@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sdkconfig.h"
+
+#include "hal.h"
+#include "dev_state.h"
+#include "wqtt_client.h"
+#include "fixture.h"
+
+
+/*******************************************************
+ FUNCTION PROTOTYPES
+ *******************************************************/
+
+void app_main(void);
+
+static void on_pin(int pin, int level, int64_t now_us);
+static void *reader_thread(void *arg);
+
+/*******************************************************
+ LOCAL VARIABLES
+ *******************************************************/
+
+static fixture_cfg_t    Cfg;
+static mqtt_broker_t *  Broker;
+static mqtt_lite_t      Controller;
+static pthread_t        Reader;
+static atomic_bool      Stop = false;
+static char             Device_ns[FIXTURE_TOPIC_MAX];
+
+static atomic_uint      Pin_changes[64];
+
+// Digits of the last snapshot, one per field
+static pthread_mutex_t  Snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static char             Snapshot[DEV_FIELD_CNT + 1];
+
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+static void on_pin(int pin, int level, int64_t now_us)
+{
+    atomic_fetch_add(&Pin_changes[pin], 1);
+
+    if(Cfg.on_pin != NULL)
+    {
+        Cfg.on_pin(pin, level, now_us);
+    }
+}
+
+/**
+ * @brief Reads the device namespace: keeps the retained snapshot
+ *        "<version>:<digit per field>" and hands every message to the test
+ */
+static void *reader_thread(void *arg)
+{
+    size_t ns_len = strlen(Device_ns);
+    size_t state_len = strlen(State_topic);
+    mqtt_lite_packet_t pkt;
+
+    (void) arg;
+
+    while(!atomic_load(&Stop))
+    {
+        const char *name;
+        size_t name_len;
+        int ret;
+
+        ret = mqtt_lite_read(&Controller, 100, &pkt);
+        if(ret < 0)
+        {
+            break;
+        }
+
+        // Nothing read: pkt still holds the previous packet
+        if(ret == 0 || pkt.type != MQTT_LITE_PUBLISH || pkt.topic_len <= ns_len)
+        {
+            continue;
+        }
+
+        name = pkt.topic + ns_len;
+        name_len = pkt.topic_len - ns_len;
+
+        if(name_len == state_len && memcmp(name, State_topic, state_len) == 0)
+        {
+            const uint8_t *digits = memchr(pkt.payload, ':', pkt.payload_len);
+
+            if(digits != NULL && (size_t)(pkt.payload + pkt.payload_len - digits - 1) == DEV_FIELD_CNT)
+            {
+                pthread_mutex_lock(&Snapshot_lock);
+                memcpy(Snapshot, digits + 1, DEV_FIELD_CNT);
+                pthread_mutex_unlock(&Snapshot_lock);
+            }
+        }
+
+        if(Cfg.on_message != NULL)
+        {
+            Cfg.on_message(&pkt, name, name_len);
+        }
+    }
+
+    return NULL;
+}
+
+/****************************************
+ EXTERNAL FUNCTIONS
+*****************************************/
+
+/**
+ * @brief Starts the broker, the board and the firmware, connects the
+ *        controller and waits until the device is online and settled
+ *
+ * @param cfg Device and controller
+ * @return false if something did not start or no snapshot came in time
+ */
+bool fixture_start(const fixture_cfg_t *cfg)
+{
+    const mqtt_lite_opts_t opts = {
+        .client_id = cfg->client_id,
+        .clean_session = true,
+        .keepalive_s = 60
+    };
+    char filter[FIXTURE_TOPIC_MAX + 1];
+
+    Cfg = *cfg;
+
+    Broker = mqtt_broker_start(0);
+    if(Broker == NULL)
+    {
+        fprintf(stderr, "Broker not started\n");
+        return false;
+    }
+
+    hal_host_set_mac(Cfg.mac);
+    hal_host_mqtt_broker("127.0.0.1", mqtt_broker_port(Broker));
+    hal_host_load(FIXTURE_HEATER_PIN, HAL_HOST_LOAD_SWITCH, false, FIXTURE_HEATER_MA, 0, 0);
+    hal_host_load(FIXTURE_FAN_PIN, HAL_HOST_LOAD_TRIAC, false, FIXTURE_FAN_MA, 0, 0);
+    hal_host_load(FIXTURE_LIGHT_PIN, HAL_HOST_LOAD_RELAY, false, FIXTURE_LIGHT_MA,
+                  CONFIG_RELAY_OPERATE_US, CONFIG_RELAY_RELEASE_US);
+    hal_host_mains(FIXTURE_ZERO_PIN, Cfg.mains_freq_mhz ? Cfg.mains_freq_mhz : FIXTURE_MAINS_FREQ_MHZ,
+                   FIXTURE_MAINS_JITTER_US);
+    hal_host_gpio_hook(on_pin);
+
+    app_main();
+    hal_log_level_set("*", HAL_LOG_WARN);
+
+    snprintf(Device_ns, sizeof(Device_ns), "%s/%02x%02x%02x%02x%02x%02x/", CONFIG_WQTT_TOPIC_PREFIX,
+             Cfg.mac[0], Cfg.mac[1], Cfg.mac[2], Cfg.mac[3], Cfg.mac[4], Cfg.mac[5]);
+
+    if(!mqtt_lite_connect(&Controller, "127.0.0.1", mqtt_broker_port(Broker), &opts, NULL))
+    {
+        fprintf(stderr, "Controller not connected\n");
+        return false;
+    }
+    pthread_create(&Reader, NULL, reader_thread, NULL);
+
+    snprintf(filter, sizeof(filter), "%s#", Device_ns);
+    mqtt_lite_subscribe(&Controller, filter, 0);
+
+    // The retained snapshot tells the device is online
+    for(uint32_t waited_ms = 0; ; waited_ms += 10)
+    {
+        pthread_mutex_lock(&Snapshot_lock);
+        bool online = (Snapshot[0] != '\0');
+        pthread_mutex_unlock(&Snapshot_lock);
+
+        if(online)
+        {
+            break;
+        }
+
+        if(waited_ms >= FIXTURE_CONNECT_TIMEOUT_MS)
+        {
+            fprintf(stderr, "No snapshot from the device\n");
+            return false;
+        }
+        usleep(10 * 1000);
+    }
+    usleep(FIXTURE_SETTLE_MS * 1000);
+
+    return true;
+}
+
+/**
+ * @brief Stops the controller, the firmware keeps running until the exit
+ */
+void fixture_stop(void)
+{
+    atomic_store(&Stop, true);
+    pthread_join(Reader, NULL);
+    mqtt_lite_close(&Controller);
+}
+
+void fixture_command(const char *ns, const char *name, const char *payload)
+{
+    char topic[2 * FIXTURE_TOPIC_MAX];
+
+    snprintf(topic, sizeof(topic), "%s%s", (ns != NULL) ? ns : Device_ns, name);
+    mqtt_lite_publish(&Controller, topic, payload, strlen(payload), 1, false);
+}
+
+const char *fixture_device_ns(void)
+{
+    return Device_ns;
+}
+
+mqtt_broker_t *fixture_broker(void)
+{
+    return Broker;
+}
+
+uint32_t fixture_pin_changes(int pin)
+{
+    return atomic_load(&Pin_changes[pin]);
+}
+
+bool fixture_snapshot_is(const char *digits)
+{
+    bool equal;
+
+    pthread_mutex_lock(&Snapshot_lock);
+    equal = (strcmp(Snapshot, digits) == 0);
+    pthread_mutex_unlock(&Snapshot_lock);
+
+    return equal;
+}
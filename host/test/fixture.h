@@ -0,0 +1,79 @@
+#ifndef _FIXTURE_H_
+#define _FIXTURE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "hal_host.h"
+#include "mqtt_lite.h"
+#include "mqtt_broker.h"
+
+/**********************************
+ CONSTANTS AND MACROS
+***********************************/
+
+// Pins and loads of the board, as wired by hw_ctrl.c
+#define FIXTURE_HEATER_PIN          22
+#define FIXTURE_FAN_PIN             13      // TRIAC
+#define FIXTURE_LIGHT_PIN           17      // Relay
+#define FIXTURE_LED_PIN             27      // Active low
+#define FIXTURE_ZERO_PIN            16
+
+#define FIXTURE_HEATER_MA           60
+#define FIXTURE_FAN_MA              20
+#define FIXTURE_LIGHT_MA            15
+
+#define FIXTURE_MAINS_FREQ_MHZ      50000
+#define FIXTURE_MAINS_JITTER_US     50
+
+#define FIXTURE_SETTLE_MS           400     // Beyond the relay timing and the broker round trips
+#define FIXTURE_CONNECT_TIMEOUT_MS  10000
+#define FIXTURE_TOPIC_MAX           96
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+/**
+ * @brief Message of the device namespace seen by the controller, from its reader thread
+ *
+ * @param pkt       The PUBLISH packet
+ * @param name      Topic below the device namespace, e.g. "Heater" or "tele/State"
+ * @param name_len  Length of name
+ */
+typedef void (*fixture_message_t)(const mqtt_lite_packet_t *pkt, const char *name, size_t name_len);
+
+typedef struct {
+    uint8_t             mac[6];
+    const char *        client_id;      // Of the controller
+    uint32_t            mains_freq_mhz; // 0: FIXTURE_MAINS_FREQ_MHZ
+    hal_host_gpio_hook_t on_pin;        // Optional, after the pin change is counted
+    fixture_message_t   on_message;     // Optional
+} fixture_cfg_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+/*
+ * The firmware on the simulated board against a host broker in the same
+ * process, and a controller connected to it that sees every message of the
+ * device namespace. Both ends share hal_time_us().
+ */
+
+// Starts everything and waits for the retained snapshot of the device
+bool            fixture_start(const fixture_cfg_t *cfg);
+void            fixture_stop(void);
+
+// Publishes a QoS 1 command, on the device namespace when ns is NULL
+void            fixture_command(const char *ns, const char *name, const char *payload);
+
+const char *    fixture_device_ns(void);
+mqtt_broker_t * fixture_broker(void);
+uint32_t        fixture_pin_changes(int pin);
+
+// Digits of the last snapshot, one per state field
+bool            fixture_snapshot_is(const char *digits);
+
+#endif // _FIXTURE_H_
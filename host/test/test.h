@@ -0,0 +1,95 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**********************************
+ CONSTANTS AND MACROS
+***********************************/
+
+/*
+ * Minimal test harness: every test file is one executable, run by ctest.
+ * A failed check is reported and counted, the remaining checks still run.
+ */
+
+#define TEST_CHECK(cond) \
+    test_check((cond), __FILE__, __LINE__, #cond)
+
+#define TEST_EQ(actual, expected) \
+    test_check_eq((long long)(actual), (long long)(expected), __FILE__, __LINE__, #actual)
+
+#define TEST_NEAR(actual, expected, tolerance) \
+    test_check_near((long long)(actual), (long long)(expected), (long long)(tolerance), __FILE__, __LINE__, #actual)
+
+#define TEST_RUN(fn) \
+    do { \
+        unsigned before_ = Test_failures; \
+        fn(); \
+        printf("%s %s\n", (Test_failures == before_) ? "PASS" : "FAIL", #fn); \
+    } while(0)
+
+/**********************************
+ LOCAL VARIABLES
+***********************************/
+
+static unsigned Test_failures = 0;
+
+/**********************************
+ FUNCTIONS
+***********************************/
+
+static inline bool test_check(bool ok, const char *file, int line, const char *expr)
+{
+    if(!ok)
+    {
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+        Test_failures++;
+    }
+
+    return ok;
+}
+
+static inline bool test_check_eq(long long actual, long long expected, const char *file, int line, const char *expr)
+{
+    if(actual != expected)
+    {
+        fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", file, line, expr, actual, expected);
+        Test_failures++;
+        return false;
+    }
+
+    return true;
+}
+
+static inline bool test_check_near(long long actual, long long expected, long long tolerance,
+                                   const char *file, int line, const char *expr)
+{
+    long long diff = (actual > expected) ? actual - expected : expected - actual;
+
+    if(diff > tolerance)
+    {
+        fprintf(stderr, "%s:%d: %s is %lld, expected %lld +/- %lld\n", file, line, expr, actual, expected, tolerance);
+        Test_failures++;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Exit status of a test executable
+ */
+static inline int test_result(void)
+{
+    if(Test_failures != 0)
+    {
+        fprintf(stderr, "%u check(s) failed\n", Test_failures);
+        return 1;
+    }
+
+    return 0;
+}
+
+#endif // _TEST_H_
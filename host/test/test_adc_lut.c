@@ -0,0 +1,103 @@
+#include "test.h"
+#include "adc_lut.h"
+
+
+/*
+ * Reference: the linear characterization of esp_adc_cal on the ESP32,
+ * mV = (raw * coeff_a + 32768) / 65536 + coeff_b
+ */
+typedef struct {
+    uint32_t    coeff_a;
+    uint32_t    coeff_b;
+} lin_chars_t;
+
+static const lin_chars_t Chars_11db = { 53076, 142 };   // Vref 1100 mV, 11 dB
+
+
+static uint32_t ref_linear(uint32_t raw, const void *ctx)
+{
+    const lin_chars_t *chars = ctx;
+
+    return (raw * chars->coeff_a + 32768) / 65536 + chars->coeff_b;
+}
+
+static uint32_t ref_steep(uint32_t raw, const void *ctx)
+{
+    (void) ctx;
+
+    return raw * 20;
+}
+
+static adc_lut_t Lut;
+
+
+static void test_matches_reference(void)
+{
+    uint16_t raw[ADC_LUT_SIZE];
+    uint16_t mv[ADC_LUT_SIZE];
+
+    for(uint32_t code = 0; code < ADC_LUT_SIZE; ++code)
+    {
+        raw[code] = (uint16_t)code;
+    }
+
+    adc_lut_init(&Lut, ref_linear, &Chars_11db);
+    adc_lut_convert(&Lut, raw, mv, ADC_LUT_SIZE);
+
+    for(uint32_t code = 0; code < ADC_LUT_SIZE; ++code)
+    {
+        if(!TEST_EQ(mv[code], ref_linear(code, &Chars_11db)))
+        {
+            break;
+        }
+    }
+
+    TEST_EQ(mv[0], 142);
+    TEST_EQ(mv[4095], 3458);
+}
+
+static void test_in_place(void)
+{
+    uint16_t buf[] = { 0, 1000, 2048, 4095 };
+
+    adc_lut_init(&Lut, ref_linear, &Chars_11db);
+    adc_lut_convert(&Lut, buf, buf, 4);
+
+    TEST_EQ(buf[0], ref_linear(0, &Chars_11db));
+    TEST_EQ(buf[1], ref_linear(1000, &Chars_11db));
+    TEST_EQ(buf[2], ref_linear(2048, &Chars_11db));
+    TEST_EQ(buf[3], ref_linear(4095, &Chars_11db));
+}
+
+// Corrupted codes wrap into the table instead of reading past it
+static void test_out_of_range_codes_masked(void)
+{
+    uint16_t raw[] = { 0x1000, 0xF005, 0xFFFF };
+    uint16_t mv[3];
+
+    adc_lut_init(&Lut, ref_linear, &Chars_11db);
+    adc_lut_convert(&Lut, raw, mv, 3);
+
+    TEST_EQ(mv[0], Lut.mv[0]);
+    TEST_EQ(mv[1], Lut.mv[5]);
+    TEST_EQ(mv[2], Lut.mv[4095]);
+}
+
+static void test_saturates(void)
+{
+    adc_lut_init(&Lut, ref_steep, NULL);
+
+    TEST_EQ(Lut.mv[3276], 65520);
+    TEST_EQ(Lut.mv[3277], UINT16_MAX);
+    TEST_EQ(Lut.mv[4095], UINT16_MAX);
+}
+
+int main(void)
+{
+    TEST_RUN(test_matches_reference);
+    TEST_RUN(test_in_place);
+    TEST_RUN(test_out_of_range_codes_masked);
+    TEST_RUN(test_saturates);
+
+    return test_result();
+}
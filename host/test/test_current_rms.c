@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "test.h"
+#include "current_rms.h"
+
+
+#define SAMPLE_RATE_HZ      20000
+#define WINDOW_SAMPLES      2000        // 5 cycles of 50 Hz
+#define OFFSET_MV           1550
+
+
+static uint16_t Samples[65536];
+
+
+static void sine(uint16_t *samples, size_t count, double amplitude_mv, double freq_hz)
+{
+    for(size_t idx = 0; idx < count; ++idx)
+    {
+        samples[idx] = (uint16_t)lround(OFFSET_MV + amplitude_mv * sin(2 * M_PI * freq_hz * idx / SAMPLE_RATE_HZ));
+    }
+}
+
+static void test_dc_only(void)
+{
+    current_rms_result_t result;
+
+    for(size_t idx = 0; idx < WINDOW_SAMPLES; ++idx)
+    {
+        Samples[idx] = OFFSET_MV;
+    }
+
+    current_rms_calc(Samples, WINDOW_SAMPLES, &result);
+    TEST_EQ(result.mean, OFFSET_MV);
+    TEST_EQ(result.rms, 0);
+}
+
+static void test_sine(void)
+{
+    current_rms_result_t result;
+
+    sine(Samples, WINDOW_SAMPLES, 1000, 50);
+    current_rms_calc(Samples, WINDOW_SAMPLES, &result);
+
+    TEST_NEAR(result.mean, OFFSET_MV, 1);
+    TEST_NEAR(result.rms, 707, 1);
+}
+
+static void test_square(void)
+{
+    current_rms_result_t result;
+
+    for(size_t idx = 0; idx < WINDOW_SAMPLES; ++idx)
+    {
+        Samples[idx] = (idx % 400 < 200) ? OFFSET_MV + 500 : OFFSET_MV - 500;
+    }
+
+    current_rms_calc(Samples, WINDOW_SAMPLES, &result);
+    TEST_EQ(result.mean, OFFSET_MV);
+    TEST_EQ(result.rms, 500);
+}
+
+static void test_empty(void)
+{
+    current_rms_result_t result = { 1, 1 };
+
+    current_rms_calc(Samples, 0, &result);
+    TEST_EQ(result.mean, 0);
+    TEST_EQ(result.rms, 0);
+}
+
+// 65536 full scale samples: the sums must not overflow
+static void test_largest_window(void)
+{
+    current_rms_result_t result;
+
+    for(size_t idx = 0; idx < 65536; ++idx)
+    {
+        Samples[idx] = (idx & 1) ? 4095 : 0;
+    }
+
+    current_rms_calc(Samples, 65536, &result);
+    TEST_EQ(result.mean, 2047);
+    TEST_EQ(result.rms, 2047);
+}
+
+// Feeding in frames of any size gives the window result of the whole block
+static void test_streaming_matches_block(void)
+{
+    current_rms_t acc;
+    current_rms_result_t block;
+    current_rms_result_t stream;
+    size_t total = 3 * WINDOW_SAMPLES;
+    size_t pos = 0;
+    uint32_t windows = 0;
+
+    srand(7);
+    sine(Samples, total, 1200, 50);
+    current_rms_init(&acc, WINDOW_SAMPLES);
+
+    while(pos < total)
+    {
+        size_t frame = 1 + (size_t)(rand() % 300);
+        size_t end = (pos + frame > total) ? total : pos + frame;
+
+        while(pos < end)
+        {
+            pos += current_rms_feed(&acc, &Samples[pos], end - pos);
+
+            if(current_rms_ready(&acc))
+            {
+                current_rms_take(&acc, &stream);
+                current_rms_calc(&Samples[windows * WINDOW_SAMPLES], WINDOW_SAMPLES, &block);
+
+                TEST_EQ(stream.mean, block.mean);
+                TEST_EQ(stream.rms, block.rms);
+                windows++;
+            }
+        }
+    }
+
+    TEST_EQ(windows, 3);
+}
+
+static void test_feed_stops_at_window_end(void)
+{
+    current_rms_t acc;
+
+    sine(Samples, 500, 100, 50);
+    current_rms_init(&acc, 300);
+
+    TEST_EQ(current_rms_feed(&acc, Samples, 200), 200);
+    TEST_CHECK(!current_rms_ready(&acc));
+    TEST_EQ(current_rms_feed(&acc, &Samples[200], 300), 100);
+    TEST_CHECK(current_rms_ready(&acc));
+    TEST_EQ(current_rms_feed(&acc, &Samples[300], 200), 0);
+}
+
+// 55 Hz mains: the nominal window ends mid-cycle, one fitted to the period does not
+static void test_window_follows_mains(void)
+{
+    current_rms_t acc;
+    current_rms_result_t result;
+    uint32_t fitted = (uint32_t)lround(SAMPLE_RATE_HZ * 5 / 55.0);
+
+    sine(Samples, 2 * WINDOW_SAMPLES, 1000, 55);
+
+    current_rms_init(&acc, WINDOW_SAMPLES);
+    current_rms_feed(&acc, Samples, WINDOW_SAMPLES);
+    current_rms_take(&acc, &result);
+    TEST_CHECK(abs((int)result.mean - OFFSET_MV) > 20);
+
+    current_rms_set_window(&acc, fitted);
+    TEST_EQ(current_rms_feed(&acc, Samples, WINDOW_SAMPLES), fitted);
+    TEST_CHECK(current_rms_ready(&acc));
+    current_rms_take(&acc, &result);
+    TEST_NEAR(result.mean, OFFSET_MV, 2);
+    TEST_NEAR(result.rms, 707, 2);
+}
+
+int main(void)
+{
+    TEST_RUN(test_dc_only);
+    TEST_RUN(test_sine);
+    TEST_RUN(test_square);
+    TEST_RUN(test_empty);
+    TEST_RUN(test_largest_window);
+    TEST_RUN(test_streaming_matches_block);
+    TEST_RUN(test_feed_stops_at_window_end);
+    TEST_RUN(test_window_follows_mains);
+
+    return test_result();
+}
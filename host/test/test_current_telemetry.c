@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "sdkconfig.h"
+
+#include "test.h"
+#include "hal.h"
+#include "fixture.h"
+#include "wqtt_client.h"
+
+
+/*
+ * The Current messages the firmware sends to the host broker while the loads
+ * of the board are switched one at a time, 15 to 60 mA per step, and while
+ * they run unchanged with the Fan phase controlled. Every step is published
+ * soon with the new total, the noise of a steady current is not. Messages per
+ * hour are compared with the 3600 of the former 1 Hz publisher.
+ */
+
+#define STEP_MS             (CONFIG_TURN_ON_SPACING_MS + FIXTURE_SETTLE_MS)
+#define STEP_PUBLISH_MAX_MS 1000    // From the command to the message of the new total
+#define STEADY_MS           10000
+#define TOLERANCE_MA        6       // Of a published total, the deadband of the policy
+#define STEPS_PER_HOUR      12      // A load switched every 5 minutes
+#define HOUR_MS             (60 * 60 * 1000)
+
+#define SAMPLE_MAX          256
+
+
+// Current messages seen by the controller
+typedef struct {
+    int64_t     time_ms;
+    uint32_t    value;
+} sample_t;
+
+static pthread_mutex_t  Samples_lock = PTHREAD_MUTEX_INITIALIZER;
+static sample_t         Samples[SAMPLE_MAX];
+static size_t           Sample_cnt;
+
+// Messages of the steps so far
+static uint32_t         Step_messages;
+static uint32_t         Step_cnt;
+
+
+static int64_t now_ms(void)
+{
+    return hal_time_us() / 1000;
+}
+
+static void on_message(const mqtt_lite_packet_t *pkt, const char *name, size_t name_len)
+{
+    char str[16];
+
+    if(name_len != strlen(Current_topic) || memcmp(name, Current_topic, name_len) != 0 ||
+       pkt->payload_len >= sizeof(str))
+    {
+        return;
+    }
+
+    memcpy(str, pkt->payload, pkt->payload_len);
+    str[pkt->payload_len] = '\0';
+
+    pthread_mutex_lock(&Samples_lock);
+    if(Sample_cnt < SAMPLE_MAX)
+    {
+        Samples[Sample_cnt].time_ms = now_ms();
+        Samples[Sample_cnt].value = (uint32_t)strtoul(str, NULL, 10);
+        Sample_cnt++;
+    }
+    pthread_mutex_unlock(&Samples_lock);
+}
+
+static size_t sample_count(void)
+{
+    size_t count;
+
+    pthread_mutex_lock(&Samples_lock);
+    count = Sample_cnt;
+    pthread_mutex_unlock(&Samples_lock);
+
+    return count;
+}
+
+static bool near(uint32_t value, uint32_t expected_ma)
+{
+    return value + TOLERANCE_MA >= expected_ma && value <= expected_ma + TOLERANCE_MA;
+}
+
+/**
+ * @brief Switches one load and checks the new total is published once, or
+ *        twice after an RMS window across the switching, within
+ *        STEP_PUBLISH_MAX_MS
+ *
+ * @param name          Load topic
+ * @param payload       New state
+ * @param expected_ma   Total current of the loads after the step
+ */
+static void step(const char *name, const char *payload, uint32_t expected_ma)
+{
+    size_t first = sample_count();
+    int64_t start_ms = now_ms();
+    int64_t published_ms = -1;
+    uint32_t last = 0;
+    size_t count;
+
+    fixture_command(NULL, name, payload);
+    usleep(STEP_MS * 1000);
+
+    pthread_mutex_lock(&Samples_lock);
+    count = Sample_cnt - first;
+    for(size_t idx = first; idx < Sample_cnt; ++idx)
+    {
+        if(published_ms < 0 && near(Samples[idx].value, expected_ma))
+        {
+            published_ms = Samples[idx].time_ms - start_ms;
+        }
+        last = Samples[idx].value;
+    }
+    pthread_mutex_unlock(&Samples_lock);
+
+    TEST_CHECK(count >= 1 && count <= 2);
+    TEST_CHECK(near(last, expected_ma));
+    TEST_CHECK(published_ms >= 0 && published_ms <= STEP_PUBLISH_MAX_MS);
+    printf("%-6s %s: %3u mA, published %3u mA after %lld ms, %zu message(s)\n",
+           name, payload, expected_ma, last, (long long)published_ms, count);
+
+    Step_messages += count;
+    Step_cnt++;
+}
+
+static void test_steps_published(void)
+{
+    step("Light", "1", FIXTURE_LIGHT_MA);
+    step("Heater", "1", FIXTURE_LIGHT_MA + FIXTURE_HEATER_MA);
+    step("Fan", "5", FIXTURE_LIGHT_MA + FIXTURE_HEATER_MA + FIXTURE_FAN_MA);
+    step("Light", "0", FIXTURE_HEATER_MA + FIXTURE_FAN_MA);
+    step("Heater", "0", FIXTURE_FAN_MA);
+    step("Fan", "1", 0);
+}
+
+// Every load running, the Fan at a phase controlled level
+static void test_steady_not_published(void)
+{
+    size_t first;
+    size_t steady;
+    uint32_t per_hour;
+
+    fixture_command(NULL, "Light", "1");
+    fixture_command(NULL, "Heater", "1");
+    fixture_command(NULL, "Fan", "3");
+    usleep((3 * CONFIG_TURN_ON_SPACING_MS + FIXTURE_SETTLE_MS) * 1000);
+
+    first = sample_count();
+    usleep(STEADY_MS * 1000);
+    steady = sample_count() - first;
+
+    TEST_EQ(steady, 0);
+
+    per_hour = (uint32_t)(steady * HOUR_MS / STEADY_MS);
+    printf("messages/hour: steady %u, a step every 5 min %u (1 Hz publisher: 3600)\n",
+           per_hour, per_hour + STEPS_PER_HOUR * Step_messages / Step_cnt);
+}
+
+int main(void)
+{
+    const fixture_cfg_t cfg = {
+        .mac = { 0x02, 0x00, 0x00, 0x00, 0xc0, 0x0e },
+        .client_id = "current-telemetry-test",
+        .on_message = on_message
+    };
+
+    if(!TEST_CHECK(fixture_start(&cfg)))
+    {
+        return test_result();
+    }
+
+    TEST_RUN(test_steps_published);
+    TEST_RUN(test_steady_not_published);
+
+    fixture_stop();
+
+    return test_result();
+}
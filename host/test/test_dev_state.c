@@ -0,0 +1,232 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "test.h"
+#include "dev_state.h"
+
+
+#define THREADS             4
+#define SETS_PER_THREAD     20000
+#define LOG_SIZE            (THREADS * SETS_PER_THREAD * 2 + 64)
+
+
+typedef struct {
+    uint8_t     field;
+    uint8_t     value;
+    uint8_t     origin;
+} delivery_t;
+
+// Deliveries per sink, written under the store lock
+static delivery_t Log[DEV_SINK_CNT][LOG_SIZE];
+static uint32_t Log_len[DEV_SINK_CNT];
+static uint32_t Flush_cnt[DEV_SINK_CNT];
+static int Last_sink = -1;
+static bool Sink_order_ok = true;
+
+
+static void record(dev_sink_t sink, dev_field_t field, uint32_t value, dev_origin_t origin)
+{
+    if(Log_len[sink] < LOG_SIZE)
+    {
+        Log[sink][Log_len[sink]++] = (delivery_t){ (uint8_t)field, (uint8_t)value, (uint8_t)origin };
+    }
+
+    // Within a change the sinks run in slot order
+    if((int)sink < Last_sink)
+    {
+        Sink_order_ok = false;
+    }
+    Last_sink = sink;
+}
+
+static void hw_sink(dev_field_t field, uint32_t value, dev_origin_t origin)     { record(DEV_SINK_HW, field, value, origin); }
+static void mqtt_sink(dev_field_t field, uint32_t value, dev_origin_t origin)   { record(DEV_SINK_MQTT, field, value, origin); }
+static void ui_sink(dev_field_t field, uint32_t value, dev_origin_t origin)     { record(DEV_SINK_UI, field, value, origin); }
+
+static void hw_flush(void)  { Flush_cnt[DEV_SINK_HW]++; Last_sink = -1; }
+static void ui_flush(void)  { Flush_cnt[DEV_SINK_UI]++; Last_sink = -1; }
+
+static void clear_logs(void)
+{
+    memset(Log_len, 0, sizeof(Log_len));
+    memset(Flush_cnt, 0, sizeof(Flush_cnt));
+    Last_sink = -1;
+}
+
+
+static void test_subscribe_replays_state(void)
+{
+    dev_state_subscribe(DEV_SINK_HW, hw_sink, hw_flush);
+
+    TEST_EQ(Log_len[DEV_SINK_HW], DEV_FIELD_CNT);
+    TEST_EQ(Flush_cnt[DEV_SINK_HW], 1);
+    TEST_EQ(Log[DEV_SINK_HW][DEV_FAN].value, HW_LVL_OFF);
+    TEST_EQ(Log[DEV_SINK_HW][DEV_FAN].origin, DEV_ORIGIN_RESTORE);
+
+    dev_state_subscribe(DEV_SINK_MQTT, mqtt_sink, NULL);
+    dev_state_subscribe(DEV_SINK_UI, ui_sink, ui_flush);
+    TEST_EQ(Log_len[DEV_SINK_UI], DEV_FIELD_CNT);
+}
+
+static void test_set_delivers_once(void)
+{
+    dev_state_snapshot_t before;
+    dev_state_snapshot_t after;
+
+    clear_logs();
+    dev_state_snapshot(&before);
+
+    TEST_CHECK(dev_state_set(DEV_LIGHT, HW_ON, DEV_ORIGIN_UI));
+    dev_state_snapshot(&after);
+
+    TEST_EQ(after.version, before.version + 1);
+    TEST_EQ(dev_state_get(DEV_LIGHT), HW_ON);
+
+    for(int sink = 0; sink < DEV_SINK_CNT; ++sink)
+    {
+        TEST_EQ(Log_len[sink], 1);
+        TEST_EQ(Log[sink][0].field, DEV_LIGHT);
+        TEST_EQ(Log[sink][0].value, HW_ON);
+        TEST_EQ(Log[sink][0].origin, DEV_ORIGIN_UI);
+    }
+    TEST_EQ(Flush_cnt[DEV_SINK_HW], 1);
+
+    // Unchanged and invalid values are not delivered
+    TEST_CHECK(!dev_state_set(DEV_LIGHT, HW_ON, DEV_ORIGIN_MQTT));
+    TEST_CHECK(!dev_state_set(DEV_LIGHT, 2, DEV_ORIGIN_MQTT));
+    TEST_CHECK(!dev_state_set(DEV_FAN, 0, DEV_ORIGIN_MQTT));
+    TEST_CHECK(!dev_state_set(DEV_FIELD_CNT, 1, DEV_ORIGIN_MQTT));
+    dev_state_snapshot(&before);
+
+    TEST_EQ(before.version, after.version);
+    TEST_EQ(Log_len[DEV_SINK_UI], 1);
+    TEST_CHECK(Sink_order_ok);
+}
+
+static void test_group_is_one_version(void)
+{
+    dev_state_snapshot_t before;
+    dev_state_snapshot_t after;
+    const dev_change_t changes[] = {
+        { DEV_HEATER, HW_ON },
+        { DEV_FAN, HW_LVL_LOW },
+        { DEV_LED, 7 },                 // Invalid, skipped
+        { DEV_FAN, HW_LVL_HIGH }        // The last valid value wins
+    };
+
+    clear_logs();
+    dev_state_snapshot(&before);
+
+    TEST_EQ(dev_state_set_group(changes, 4, DEV_ORIGIN_MQTT), 2);
+    dev_state_snapshot(&after);
+
+    TEST_EQ(after.version, before.version + 1);
+    TEST_EQ(after.value[DEV_FAN], HW_LVL_HIGH);
+    TEST_EQ(after.value[DEV_HEATER], HW_ON);
+
+    for(int sink = 0; sink < DEV_SINK_CNT; ++sink)
+    {
+        TEST_EQ(Log_len[sink], 2);
+    }
+    TEST_EQ(Flush_cnt[DEV_SINK_HW], 1);
+    TEST_EQ(Flush_cnt[DEV_SINK_UI], 1);
+
+    // An empty group changes nothing
+    TEST_EQ(dev_state_set_group(changes, 0, DEV_ORIGIN_MQTT), 0);
+}
+
+static atomic_uint Changed_total;
+
+static void *setter(void *arg)
+{
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    uint32_t changed = 0;
+
+    for(uint32_t idx = 0; idx < SETS_PER_THREAD; ++idx)
+    {
+        dev_field_t field = (dev_field_t)(rand_r(&seed) % DEV_FIELD_CNT);
+        uint32_t value = (field == DEV_FAN) ? HW_LVL_OFF + rand_r(&seed) % 5 : rand_r(&seed) % 2;
+
+        if(idx % 8 == 0)
+        {
+            dev_change_t group[2] = { { field, value }, { DEV_LED, rand_r(&seed) % 2 } };
+
+            changed += dev_state_set_group(group, 2, DEV_ORIGIN_MQTT);
+        }
+        else
+        {
+            changed += dev_state_set(field, value, DEV_ORIGIN_UI);
+        }
+    }
+
+    atomic_fetch_add(&Changed_total, changed);
+    return NULL;
+}
+
+/* Concurrent setters: every sink sees every change exactly once, all sinks
+ * see them in the same order, and the last delivery of each field is the
+ * stored value. */
+static void test_concurrent_consistency(void)
+{
+    pthread_t threads[THREADS];
+    uint8_t last[DEV_FIELD_CNT];
+    bool same_order = true;
+
+    clear_logs();
+
+    for(uintptr_t idx = 0; idx < THREADS; ++idx)
+    {
+        pthread_create(&threads[idx], NULL, setter, (void *)(idx + 1));
+    }
+    for(int idx = 0; idx < THREADS; ++idx)
+    {
+        pthread_join(threads[idx], NULL);
+    }
+
+    for(int sink = 0; sink < DEV_SINK_CNT; ++sink)
+    {
+        TEST_EQ(Log_len[sink], atomic_load(&Changed_total));
+    }
+
+    for(uint32_t idx = 0; idx < Log_len[DEV_SINK_HW]; ++idx)
+    {
+        if(memcmp(&Log[DEV_SINK_HW][idx], &Log[DEV_SINK_UI][idx], sizeof(delivery_t)) != 0 ||
+           memcmp(&Log[DEV_SINK_HW][idx], &Log[DEV_SINK_MQTT][idx], sizeof(delivery_t)) != 0)
+        {
+            same_order = false;
+            break;
+        }
+    }
+    TEST_CHECK(same_order);
+    TEST_CHECK(Sink_order_ok);
+
+    // Replay the HW log from the state before the run: it ends at the store
+    memset(last, 0xFF, sizeof(last));
+    for(uint32_t idx = 0; idx < Log_len[DEV_SINK_HW]; ++idx)
+    {
+        last[Log[DEV_SINK_HW][idx].field] = Log[DEV_SINK_HW][idx].value;
+    }
+    for(int field = 0; field < DEV_FIELD_CNT; ++field)
+    {
+        if(last[field] != 0xFF)
+        {
+            TEST_EQ(last[field], dev_state_get((dev_field_t)field));
+        }
+    }
+
+    printf("concurrent: %u changes delivered to %u sinks\n", Log_len[DEV_SINK_HW], DEV_SINK_CNT);
+}
+
+int main(void)
+{
+    dev_state_init();
+
+    TEST_RUN(test_subscribe_replays_state);
+    TEST_RUN(test_set_delivers_once);
+    TEST_RUN(test_group_is_one_version);
+    TEST_RUN(test_concurrent_consistency);
+
+    return test_result();
+}
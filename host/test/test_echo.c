@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "sdkconfig.h"
+
+#include "test.h"
+#include "fixture.h"
+#include "wqtt_client.h"
+
+
+/*
+ * The firmware on the simulated board against the host broker. A controller
+ * listens to the state topics of the device: a command on the device topic
+ * of a load is its state already and is not published again, a broadcast or
+ * a Loads command is, and the echo of that publication does not drive the
+ * load a second time.
+ */
+
+#define TOPIC_MAX           96
+
+// State messages of the device topics seen by the controller, and their last payload
+typedef struct {
+    const char *    name;
+    atomic_uint     count;
+    atomic_char     last;
+} state_topic_t;
+
+static state_topic_t    States[] = {
+    { .name = "Heater" },
+    { .name = "Light" }
+};
+
+#define STATE_CNT           (sizeof(States) / sizeof(States[0]))
+
+
+static void on_message(const mqtt_lite_packet_t *pkt, const char *name, size_t name_len)
+{
+    for(size_t idx = 0; idx < STATE_CNT; ++idx)
+    {
+        if(name_len == strlen(States[idx].name) && memcmp(name, States[idx].name, name_len) == 0)
+        {
+            atomic_store(&States[idx].last, pkt->payload_len ? (char)pkt->payload[0] : '\0');
+            atomic_fetch_add(&States[idx].count, 1);
+        }
+    }
+}
+
+static void command(const char *ns, const char *name, const char *payload)
+{
+    fixture_command(ns, name, payload);
+    usleep(FIXTURE_SETTLE_MS * 1000);
+}
+
+static void counts(uint32_t *state, uint32_t *pin, uint32_t *echo)
+{
+    state[0] = atomic_load(&States[0].count);
+    state[1] = atomic_load(&States[1].count);
+    pin[0] = fixture_pin_changes(FIXTURE_HEATER_PIN);
+    pin[1] = fixture_pin_changes(FIXTURE_LIGHT_PIN);
+    *echo = wqtt_client_get_Echo_suppressed();
+}
+
+// The controller's own command is the only message on the topic
+static void test_device_command_not_published(void)
+{
+    uint32_t state[2], pin[2], echo;
+
+    counts(state, pin, &echo);
+    command(NULL, "Heater", "1");
+
+    TEST_EQ(atomic_load(&States[0].count), state[0] + 1);
+    TEST_EQ(fixture_pin_changes(FIXTURE_HEATER_PIN), pin[0] + 1);
+    TEST_EQ(wqtt_client_get_Echo_suppressed(), echo);
+}
+
+// The state topic follows a broadcast, the echo is dropped
+static void test_broadcast_command_published(void)
+{
+    char all_ns[TOPIC_MAX];
+    uint32_t state[2], pin[2], echo;
+
+    snprintf(all_ns, sizeof(all_ns), "%s/%s/", CONFIG_WQTT_TOPIC_PREFIX, Broadcast_namespace);
+
+    counts(state, pin, &echo);
+    command(all_ns, "Light", "1");
+
+    TEST_EQ(atomic_load(&States[1].count), state[1] + 1);
+    TEST_EQ(atomic_load(&States[1].last), '1');
+    TEST_EQ(fixture_pin_changes(FIXTURE_LIGHT_PIN), pin[1] + 1);
+    TEST_EQ(wqtt_client_get_Echo_suppressed(), echo + 1);
+
+    // Nothing left in the echo queue: a command from elsewhere still applies
+    command(NULL, "Light", "0");
+    TEST_EQ(fixture_pin_changes(FIXTURE_LIGHT_PIN), pin[1] + 2);
+    TEST_EQ(wqtt_client_get_Echo_suppressed(), echo + 1);
+}
+
+// Every field a Loads command changes is published on its state topic
+static void test_loads_command_published(void)
+{
+    uint32_t state[2], pin[2], echo;
+
+    counts(state, pin, &echo);
+    command(NULL, "Loads", "0-1-");
+
+    TEST_EQ(atomic_load(&States[0].count), state[0] + 1);
+    TEST_EQ(atomic_load(&States[0].last), '0');
+    TEST_EQ(atomic_load(&States[1].count), state[1] + 1);
+    TEST_EQ(atomic_load(&States[1].last), '1');
+    TEST_EQ(fixture_pin_changes(FIXTURE_HEATER_PIN), pin[0] + 1);
+    TEST_EQ(fixture_pin_changes(FIXTURE_LIGHT_PIN), pin[1] + 1);
+    TEST_EQ(wqtt_client_get_Echo_suppressed(), echo + 2);
+}
+
+// A state is a single digit, a longer payload is rejected whole
+static void test_malformed_command_ignored(void)
+{
+    uint32_t state[2], pin[2], echo;
+
+    counts(state, pin, &echo);
+    command(NULL, "Heater", "1garbage");
+    command(NULL, "Light", "00");
+
+    TEST_EQ(fixture_pin_changes(FIXTURE_HEATER_PIN), pin[0]);
+    TEST_EQ(fixture_pin_changes(FIXTURE_LIGHT_PIN), pin[1]);
+}
+
+int main(void)
+{
+    const fixture_cfg_t cfg = {
+        .mac = { 0x02, 0x00, 0x00, 0x00, 0x0e, 0xc0 },
+        .client_id = "echo-test",
+        .on_message = on_message
+    };
+
+    if(!TEST_CHECK(fixture_start(&cfg)))
+    {
+        return test_result();
+    }
+
+    TEST_RUN(test_device_command_not_published);
+    TEST_RUN(test_broadcast_command_published);
+    TEST_RUN(test_loads_command_published);
+    TEST_RUN(test_malformed_command_ignored);
+
+    fixture_stop();
+
+    return test_result();
+}
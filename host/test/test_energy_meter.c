@@ -0,0 +1,163 @@
+#include "test.h"
+#include "energy_meter.h"
+
+
+#define CHECKPOINT_WH       10
+#define CHECKPOINT_MIN      60
+#define STEP_MS             100         // One RMS window of hw_ctrl
+#define MS_PER_HOUR         (60 * 60 * 1000UL)
+
+
+static void test_integrates_wh(void)
+{
+    energy_meter_t meter;
+
+    energy_meter_init(&meter, CHECKPOINT_WH, CHECKPOINT_MIN, 0);
+
+    // 1 kW for one hour in 100 ms steps
+    for(uint32_t step = 0; step < MS_PER_HOUR / STEP_MS; ++step)
+    {
+        energy_meter_add(&meter, 0, 1000000, STEP_MS);
+    }
+
+    TEST_EQ(energy_meter_get_wh(&meter, 0), 1000);
+    TEST_EQ(energy_meter_get_wh(&meter, 1), 0);
+
+    // Sub-Wh steps are not lost
+    for(uint32_t step = 0; step < 36000; ++step)
+    {
+        energy_meter_add(&meter, 1, 1000, STEP_MS);
+    }
+    TEST_EQ(energy_meter_get_wh(&meter, 1), 1);
+
+    energy_meter_add(&meter, ENERGY_METER_CHANNELS, 1000000, STEP_MS);
+    TEST_EQ(energy_meter_get_wh(&meter, ENERGY_METER_CHANNELS), 0);
+}
+
+// A shared reading is split by the weights, none of it is lost to rounding
+static void test_shared_by_weight(void)
+{
+    energy_meter_t meter;
+    const uint32_t weight[ENERGY_METER_CHANNELS] = { 70, 0, 20 };
+    const uint32_t none[ENERGY_METER_CHANNELS] = { 0, 0, 0 };
+    uint64_t sum_uj;
+
+    energy_meter_init(&meter, CHECKPOINT_WH, CHECKPOINT_MIN, 0);
+
+    // 900 W for one hour in 100 ms steps
+    for(uint32_t step = 0; step < MS_PER_HOUR / STEP_MS; ++step)
+    {
+        energy_meter_add_shared(&meter, weight, 900000, STEP_MS);
+    }
+
+    TEST_EQ(energy_meter_get_wh(&meter, 0), 700);
+    TEST_EQ(energy_meter_get_wh(&meter, 1), 0);
+    TEST_EQ(energy_meter_get_wh(&meter, 2), 200);
+
+    // Shares that don't divide evenly
+    energy_meter_init(&meter, CHECKPOINT_WH, CHECKPOINT_MIN, 0);
+    energy_meter_add_shared(&meter, (const uint32_t[]){ 1, 1, 1 }, 1000, 1);
+    sum_uj = meter.total_uj[0] + meter.total_uj[1] + meter.total_uj[2];
+    TEST_EQ(sum_uj, 1000);
+
+    // Every load off: the reading is not counted
+    energy_meter_add_shared(&meter, none, 1000000, STEP_MS);
+    sum_uj = meter.total_uj[0] + meter.total_uj[1] + meter.total_uj[2];
+    TEST_EQ(sum_uj, 1000);
+}
+
+static void test_restore(void)
+{
+    energy_meter_t meter;
+    uint64_t totals[ENERGY_METER_CHANNELS] = { 5 * ENERGY_METER_UJ_PER_WH, 0, 12 * ENERGY_METER_UJ_PER_WH };
+
+    energy_meter_init(&meter, CHECKPOINT_WH, CHECKPOINT_MIN, 0);
+    energy_meter_restore(&meter, totals);
+
+    TEST_EQ(energy_meter_get_wh(&meter, 0), 5);
+    TEST_EQ(energy_meter_get_wh(&meter, 2), 12);
+
+    // Restored totals are already saved
+    TEST_CHECK(!energy_meter_checkpoint_due(&meter, 10 * MS_PER_HOUR));
+}
+
+static void test_checkpoint_policy(void)
+{
+    energy_meter_t meter;
+
+    energy_meter_init(&meter, CHECKPOINT_WH, CHECKPOINT_MIN, 0);
+
+    // Idle: never
+    TEST_CHECK(!energy_meter_checkpoint_due(&meter, 100 * MS_PER_HOUR));
+
+    // A little energy: only once it is old enough
+    energy_meter_add(&meter, 2, 1000, 1000);
+    TEST_CHECK(!energy_meter_checkpoint_due(&meter, MS_PER_HOUR - 1));
+    TEST_CHECK(energy_meter_checkpoint_due(&meter, MS_PER_HOUR));
+
+    energy_meter_checkpoint_done(&meter, MS_PER_HOUR);
+    TEST_CHECK(!energy_meter_checkpoint_due(&meter, 2 * MS_PER_HOUR));
+
+    // checkpoint_wh on one channel: at once
+    energy_meter_add(&meter, 1, 36000000, 1000);
+    TEST_CHECK(energy_meter_checkpoint_due(&meter, MS_PER_HOUR + 1));
+}
+
+/* A week of a household profile in 100 ms steps, checkpoints written like
+ * hw_ctrl does. The flash write count is bounded by the energy and the age
+ * limit, not by the update rate: 6 million updates per channel. */
+static void test_week_flash_writes(void)
+{
+    energy_meter_t meter;
+    uint32_t writes = 0;
+    uint32_t sum_wh = 0;
+    uint64_t now_ms = 0;
+
+    energy_meter_init(&meter, CHECKPOINT_WH, CHECKPOINT_MIN, 0);
+
+    for(uint32_t day = 0; day < 7; ++day)
+    {
+        for(uint64_t ms = 0; ms < 24 * MS_PER_HOUR; ms += STEP_MS)
+        {
+            uint32_t hour = (uint32_t)(ms / MS_PER_HOUR);
+            bool heater = (hour >= 6 && hour < 8) || (hour >= 18 && hour < 20);
+            bool fan = (hour >= 12 && hour < 18);
+            bool light = (hour >= 19 && hour < 23);
+
+            energy_meter_add(&meter, 0, heater ? 1500000 : 0, STEP_MS);
+            energy_meter_add(&meter, 1, fan ? 40000 : 0, STEP_MS);
+            energy_meter_add(&meter, 2, light ? 15000 : 0, STEP_MS);
+            now_ms += STEP_MS;
+
+            if(energy_meter_checkpoint_due(&meter, (uint32_t)now_ms))
+            {
+                energy_meter_checkpoint_done(&meter, (uint32_t)now_ms);
+                writes++;
+            }
+        }
+    }
+
+    for(uint32_t ch = 0; ch < ENERGY_METER_CHANNELS; ++ch)
+    {
+        sum_wh += energy_meter_get_wh(&meter, ch);
+    }
+
+    TEST_EQ(energy_meter_get_wh(&meter, 0), 7 * 4 * 1500);
+    TEST_EQ(energy_meter_get_wh(&meter, 1), 7 * 6 * 40);
+    TEST_EQ(energy_meter_get_wh(&meter, 2), 7 * 4 * 15);
+
+    // At most one per checkpoint_wh of any channel, plus one per age limit
+    TEST_CHECK(writes <= sum_wh / CHECKPOINT_WH + 7 * 24 * 60 / CHECKPOINT_MIN);
+    printf("week: %u flash writes for %u Wh (%.1f per day)\n", writes, sum_wh, writes / 7.0);
+}
+
+int main(void)
+{
+    TEST_RUN(test_integrates_wh);
+    TEST_RUN(test_shared_by_weight);
+    TEST_RUN(test_restore);
+    TEST_RUN(test_checkpoint_policy);
+    TEST_RUN(test_week_flash_writes);
+
+    return test_result();
+}
@@ -0,0 +1,64 @@
+#include "test.h"
+#include "histogram.h"
+
+
+static void test_buckets(void)
+{
+    histogram_t hist;
+
+    histogram_reset(&hist);
+    histogram_add(&hist, 0);
+    histogram_add(&hist, 1);
+    histogram_add(&hist, 2);
+    histogram_add(&hist, 3);
+    histogram_add(&hist, 4);
+    histogram_add(&hist, UINT32_MAX);
+
+    TEST_EQ(hist.bucket[0], 1);
+    TEST_EQ(hist.bucket[1], 1);
+    TEST_EQ(hist.bucket[2], 2);
+    TEST_EQ(hist.bucket[3], 1);
+    TEST_EQ(hist.bucket[HISTOGRAM_BUCKETS - 1], 1);
+    TEST_EQ(hist.count, 6);
+    TEST_EQ(hist.max, UINT32_MAX);
+}
+
+static void test_percentiles(void)
+{
+    histogram_t hist;
+
+    histogram_reset(&hist);
+    TEST_EQ(histogram_percentile(&hist, 500), 0);
+
+    // 99 values of 100 us and one of 5000 us
+    for(int idx = 0; idx < 99; ++idx)
+    {
+        histogram_add(&hist, 100);
+    }
+    histogram_add(&hist, 5000);
+
+    // Upper bound of the bucket of 100: [64, 128)
+    TEST_EQ(histogram_percentile(&hist, 500), 127);
+    TEST_EQ(histogram_percentile(&hist, 990), 127);
+    TEST_EQ(histogram_percentile(&hist, 1000), 5000);
+}
+
+// A bucket bound above the largest value reports the value
+static void test_percentile_capped_by_max(void)
+{
+    histogram_t hist;
+
+    histogram_reset(&hist);
+    histogram_add(&hist, 70);
+
+    TEST_EQ(histogram_percentile(&hist, 500), 70);
+}
+
+int main(void)
+{
+    TEST_RUN(test_buckets);
+    TEST_RUN(test_percentiles);
+    TEST_RUN(test_percentile_capped_by_max);
+
+    return test_result();
+}
@@ -0,0 +1,142 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include "test.h"
+#include "lf_queue.h"
+
+
+#define PRODUCERS           4
+#define ITEMS_PER_PRODUCER  200000
+
+
+static void test_fifo_and_bounds(void)
+{
+    static lf_queue_cell_t cells[4];
+    lf_queue_t queue = LF_QUEUE_INITIALIZER(cells);
+    lf_queue_item_t item;
+
+    TEST_CHECK(!lf_queue_pop(&queue, &item));
+
+    for(uint32_t idx = 0; idx < 4; ++idx)
+    {
+        item = (lf_queue_item_t){ .type = 1, .arg = (uint16_t)idx, .value = idx * 10 };
+        TEST_CHECK(lf_queue_push(&queue, &item));
+    }
+
+    // Full: the push fails and nothing is overwritten
+    TEST_CHECK(!lf_queue_push(&queue, &item));
+
+    for(uint32_t idx = 0; idx < 4; ++idx)
+    {
+        TEST_CHECK(lf_queue_pop(&queue, &item));
+        TEST_EQ(item.arg, idx);
+        TEST_EQ(item.value, idx * 10);
+    }
+
+    TEST_CHECK(!lf_queue_pop(&queue, &item));
+}
+
+// Positions keep growing: many laps over a small ring
+static void test_wraps(void)
+{
+    static lf_queue_cell_t cells[2];
+    lf_queue_t queue = LF_QUEUE_INITIALIZER(cells);
+    lf_queue_item_t item;
+
+    for(uint32_t idx = 0; idx < 100000; ++idx)
+    {
+        item.value = idx;
+        TEST_CHECK(lf_queue_push(&queue, &item));
+        TEST_CHECK(lf_queue_pop(&queue, &item));
+        if(!TEST_EQ(item.value, idx))
+        {
+            break;
+        }
+    }
+}
+
+/*
+ * Stress: producer threads push UI updates of their own field, the consumer
+ * applies them like guiTask does. Every item arrives once, in the order of
+ * its producer, and the applied state ends at the last pushed value.
+ */
+
+static lf_queue_cell_t Stress_cells[64];
+static lf_queue_t Stress_queue = LF_QUEUE_INITIALIZER(Stress_cells);
+static atomic_uint Full_retries;
+
+static void *producer(void *arg)
+{
+    uint16_t field = (uint16_t)(uintptr_t)arg;
+    lf_queue_item_t item = { .type = field };
+
+    for(uint32_t seq = 1; seq <= ITEMS_PER_PRODUCER; ++seq)
+    {
+        item.value = seq;
+        while(!lf_queue_push(&Stress_queue, &item))
+        {
+            atomic_fetch_add(&Full_retries, 1);
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+static void test_stress_producers(void)
+{
+    pthread_t threads[PRODUCERS];
+    uint32_t state[PRODUCERS] = { 0 };
+    uint32_t received = 0;
+    uint32_t out_of_order = 0;
+    uint32_t bad_field = 0;
+    lf_queue_item_t item;
+
+    for(uintptr_t idx = 0; idx < PRODUCERS; ++idx)
+    {
+        pthread_create(&threads[idx], NULL, producer, (void *)idx);
+    }
+
+    while(received < PRODUCERS * ITEMS_PER_PRODUCER)
+    {
+        if(!lf_queue_pop(&Stress_queue, &item))
+        {
+            sched_yield();
+            continue;
+        }
+
+        received++;
+        if(item.type >= PRODUCERS)
+        {
+            bad_field++;
+            continue;
+        }
+
+        if(item.value != state[item.type] + 1)
+        {
+            out_of_order++;
+        }
+        state[item.type] = item.value;
+    }
+
+    for(int idx = 0; idx < PRODUCERS; ++idx)
+    {
+        pthread_join(threads[idx], NULL);
+        TEST_EQ(state[idx], ITEMS_PER_PRODUCER);
+    }
+
+    TEST_EQ(bad_field, 0);
+    TEST_EQ(out_of_order, 0);
+    TEST_CHECK(!lf_queue_pop(&Stress_queue, &item));
+    printf("stress: %u items from %u producers, %u full-queue retries\n",
+           received, PRODUCERS, atomic_load(&Full_retries));
+}
+
+int main(void)
+{
+    TEST_RUN(test_fifo_and_bounds);
+    TEST_RUN(test_wraps);
+    TEST_RUN(test_stress_producers);
+
+    return test_result();
+}
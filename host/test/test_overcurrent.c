@@ -0,0 +1,150 @@
+#include <math.h>
+
+#include "test.h"
+#include "overcurrent.h"
+#include "isqrt.h"
+
+
+#define HALF_CYCLE_SAMPLES  200         // 20 kHz, 50 Hz
+#define OFFSET_MV           1550
+#define SWING_MV            1550        // ADC full scale around the offset
+#define RMS_MAX_MV          (SWING_MV * 707 / 1000)
+#define PEAK_MAX_MV         (SWING_MV * 95 / 100)
+
+
+static uint16_t Samples[10 * HALF_CYCLE_SAMPLES];
+
+
+// A sine as the ADC sees it: clipped to its range
+static void sine(double amplitude_mv, size_t count)
+{
+    for(size_t idx = 0; idx < count; ++idx)
+    {
+        double mv = OFFSET_MV + amplitude_mv * sin(M_PI * idx / HALF_CYCLE_SAMPLES);
+
+        mv = (mv < 0) ? 0 : (mv > OFFSET_MV + SWING_MV) ? OFFSET_MV + SWING_MV : mv;
+        Samples[idx] = (uint16_t)lround(mv);
+    }
+}
+
+static size_t feed_all(overcurrent_t *oc, size_t count)
+{
+    return overcurrent_feed(oc, Samples, count);
+}
+
+
+static void test_isqrt64(void)
+{
+    TEST_EQ(isqrt64(0), 0);
+    TEST_EQ(isqrt64(1), 1);
+    TEST_EQ(isqrt64(15), 3);
+    TEST_EQ(isqrt64(16), 4);
+    TEST_EQ(isqrt64(1000000), 1000);
+    TEST_EQ(isqrt64(999999), 999);
+    TEST_EQ(isqrt64((uint64_t)4294967295u * 4294967295u), 4294967295u);
+    TEST_EQ(isqrt64(UINT64_MAX), 4294967295u);
+}
+
+static void test_disabled_until_set_up(void)
+{
+    overcurrent_t oc;
+
+    overcurrent_init(&oc, HALF_CYCLE_SAMPLES);
+    sine(1500, 4 * HALF_CYCLE_SAMPLES);
+
+    // No offset measured, no limit
+    TEST_EQ(feed_all(&oc, 4 * HALF_CYCLE_SAMPLES), 4 * HALF_CYCLE_SAMPLES);
+    overcurrent_set_limits(&oc, 100, 100);
+    TEST_EQ(feed_all(&oc, 4 * HALF_CYCLE_SAMPLES), 4 * HALF_CYCLE_SAMPLES);
+
+    overcurrent_set_offset(&oc, OFFSET_MV);
+    overcurrent_set_limits(&oc, 0, 0);
+    TEST_EQ(feed_all(&oc, 4 * HALF_CYCLE_SAMPLES), 4 * HALF_CYCLE_SAMPLES);
+    TEST_CHECK(!overcurrent_tripped(&oc));
+}
+
+static void test_peak_trip(void)
+{
+    overcurrent_t oc;
+    overcurrent_trip_t trip;
+    size_t used;
+
+    overcurrent_init(&oc, HALF_CYCLE_SAMPLES);
+    overcurrent_set_offset(&oc, OFFSET_MV);
+    overcurrent_set_limits(&oc, 500, 10000);
+
+    sine(1000, HALF_CYCLE_SAMPLES);
+    used = feed_all(&oc, HALF_CYCLE_SAMPLES);
+
+    // sin() reaches 0.5 at 1/6 of the half-cycle
+    TEST_CHECK(overcurrent_tripped(&oc));
+    TEST_NEAR(used, HALF_CYCLE_SAMPLES / 6, 2);
+
+    // Tripped: nothing more is consumed until the trip is taken
+    TEST_EQ(overcurrent_feed(&oc, &Samples[used], HALF_CYCLE_SAMPLES - used), 0);
+
+    overcurrent_take(&oc, &trip);
+    TEST_EQ(trip.kind, OVERCURRENT_PEAK);
+    TEST_CHECK(trip.value > 500);
+    TEST_EQ(trip.samples, used);
+    TEST_CHECK(!overcurrent_tripped(&oc));
+}
+
+static void test_rms_trip(void)
+{
+    overcurrent_t oc;
+    overcurrent_trip_t trip;
+
+    overcurrent_init(&oc, HALF_CYCLE_SAMPLES);
+    overcurrent_set_offset(&oc, OFFSET_MV);
+
+    // Below the limit: 700 mV RMS against 800
+    overcurrent_set_limits(&oc, PEAK_MAX_MV, 800);
+    sine(990, 4 * HALF_CYCLE_SAMPLES);
+    TEST_EQ(feed_all(&oc, 4 * HALF_CYCLE_SAMPLES), 4 * HALF_CYCLE_SAMPLES);
+    TEST_CHECK(!overcurrent_tripped(&oc));
+
+    // Above: at the end of the first full half-cycle
+    overcurrent_set_limits(&oc, PEAK_MAX_MV, 600);
+    TEST_EQ(feed_all(&oc, 4 * HALF_CYCLE_SAMPLES), HALF_CYCLE_SAMPLES);
+    overcurrent_take(&oc, &trip);
+    TEST_EQ(trip.kind, OVERCURRENT_RMS);
+    TEST_NEAR(trip.value, 700, 2);
+    TEST_EQ(trip.samples, HALF_CYCLE_SAMPLES);
+}
+
+/* Limits clamped to the sensor range still trip: a current far beyond the
+ * range is clipped by the ADC, its peak reaches the clamped peak limit and
+ * its RMS the clamped RMS limit. */
+static void test_clamped_limits_trip_on_clipping(void)
+{
+    overcurrent_t oc;
+    overcurrent_trip_t trip;
+
+    overcurrent_init(&oc, HALF_CYCLE_SAMPLES);
+    overcurrent_set_offset(&oc, OFFSET_MV);
+    sine(5 * SWING_MV, HALF_CYCLE_SAMPLES);
+
+    overcurrent_set_limits(&oc, PEAK_MAX_MV, RMS_MAX_MV);
+    feed_all(&oc, HALF_CYCLE_SAMPLES);
+    overcurrent_take(&oc, &trip);
+    TEST_EQ(trip.kind, OVERCURRENT_PEAK);
+
+    // Without the peak check: the clipped half-cycle is beyond the RMS limit
+    overcurrent_set_limits(&oc, UINT16_MAX, RMS_MAX_MV);
+    TEST_EQ(feed_all(&oc, HALF_CYCLE_SAMPLES), HALF_CYCLE_SAMPLES);
+    overcurrent_take(&oc, &trip);
+    TEST_EQ(trip.kind, OVERCURRENT_RMS);
+    TEST_CHECK(trip.value > RMS_MAX_MV);
+}
+
+int main(void)
+{
+    TEST_RUN(test_isqrt64);
+    TEST_RUN(test_disabled_until_set_up);
+    TEST_RUN(test_peak_trip);
+    TEST_RUN(test_rms_trip);
+    TEST_RUN(test_clamped_limits_trip_on_clipping);
+
+    return test_result();
+}
@@ -0,0 +1,105 @@
+#include "test.h"
+#include "phase_ctrl.h"
+
+
+#define HALF_PERIOD_US      10000
+
+
+static void test_level_to_delay(void)
+{
+    TEST_EQ(phase_ctrl_level_to_delay_us(HW_LVL_OFF, HALF_PERIOD_US), 0);
+    TEST_EQ(phase_ctrl_level_to_delay_us(HW_LVL_LOW, HALF_PERIOD_US), 6320);
+    TEST_EQ(phase_ctrl_level_to_delay_us(HW_LVL_MEDIUM, HALF_PERIOD_US), 5000);
+    TEST_EQ(phase_ctrl_level_to_delay_us(HW_LVL_HIGH, HALF_PERIOD_US), 3680);
+
+    // Full power still waits for the TRIAC to be able to latch
+    TEST_EQ(phase_ctrl_level_to_delay_us(HW_LVL_VERY_HIGH, HALF_PERIOD_US), PHASE_CTRL_MIN_DELAY_US);
+
+    // The delay follows the half-period: 60 Hz mains
+    TEST_EQ(phase_ctrl_level_to_delay_us(HW_LVL_MEDIUM, 8333), 4166);
+
+    // Never fired closer to the next crossing than the guard
+    TEST_EQ(phase_ctrl_level_to_delay_us(HW_LVL_LOW, 1000), 1000 - PHASE_CTRL_GUARD_US);
+
+    // Out of range levels are not fired
+    TEST_EQ(phase_ctrl_level_to_delay_us((hw_electr_lvl_t)0, HALF_PERIOD_US), 0);
+    TEST_EQ(phase_ctrl_level_to_delay_us((hw_electr_lvl_t)6, HALF_PERIOD_US), 0);
+}
+
+static void test_set_level_clamps(void)
+{
+    phase_ctrl_t ctrl;
+
+    phase_ctrl_init(&ctrl);
+    TEST_EQ(ctrl.level, HW_LVL_OFF);
+
+    phase_ctrl_set_level(&ctrl, (hw_electr_lvl_t)0);
+    TEST_EQ(ctrl.level, HW_LVL_OFF);
+
+    phase_ctrl_set_level(&ctrl, (hw_electr_lvl_t)9);
+    TEST_EQ(ctrl.level, HW_LVL_VERY_HIGH);
+}
+
+static void test_gate_pulse_sequence(void)
+{
+    phase_ctrl_t ctrl;
+    uint64_t alarm_us = 0;
+    bool gate_on = false;
+
+    phase_ctrl_init(&ctrl);
+    phase_ctrl_set_level(&ctrl, HW_LVL_MEDIUM);
+
+    TEST_CHECK(phase_ctrl_on_zero_cross(&ctrl, 1000, HALF_PERIOD_US, &alarm_us));
+    TEST_EQ(alarm_us, 6000);
+
+    TEST_CHECK(phase_ctrl_on_alarm(&ctrl, 6000, &gate_on, &alarm_us));
+    TEST_CHECK(gate_on);
+    TEST_EQ(alarm_us, 6000 + PHASE_CTRL_GATE_PULSE_US);
+
+    TEST_CHECK(!phase_ctrl_on_alarm(&ctrl, alarm_us, &gate_on, &alarm_us));
+    TEST_CHECK(!gate_on);
+    TEST_EQ(ctrl.stage, PHASE_STAGE_IDLE);
+}
+
+static void test_off_is_never_fired(void)
+{
+    phase_ctrl_t ctrl;
+    uint64_t alarm_us = 0;
+
+    phase_ctrl_init(&ctrl);
+
+    for(uint64_t zero_us = 0; zero_us < 100 * HALF_PERIOD_US; zero_us += HALF_PERIOD_US)
+    {
+        TEST_CHECK(!phase_ctrl_on_zero_cross(&ctrl, zero_us, HALF_PERIOD_US, &alarm_us));
+    }
+}
+
+static void test_zero_cross_ends_the_pulse(void)
+{
+    phase_ctrl_t ctrl;
+    uint64_t alarm_us;
+    bool gate_on;
+
+    phase_ctrl_init(&ctrl);
+    phase_ctrl_set_level(&ctrl, HW_LVL_VERY_HIGH);
+
+    TEST_CHECK(phase_ctrl_on_zero_cross(&ctrl, 0, HALF_PERIOD_US, &alarm_us));
+    TEST_CHECK(phase_ctrl_on_alarm(&ctrl, alarm_us, &gate_on, &alarm_us));
+
+    // An early edge restarts the half-cycle, the late pulse end only releases the gate
+    phase_ctrl_set_level(&ctrl, HW_LVL_OFF);
+    TEST_CHECK(!phase_ctrl_on_zero_cross(&ctrl, 200, HALF_PERIOD_US, &alarm_us));
+    TEST_CHECK(!phase_ctrl_on_alarm(&ctrl, 250, &gate_on, &alarm_us));
+    TEST_CHECK(!gate_on);
+}
+
+int main(void)
+{
+    TEST_RUN(test_level_to_delay);
+    TEST_RUN(test_set_level_clamps);
+    TEST_RUN(test_gate_pulse_sequence);
+    TEST_RUN(test_off_is_never_fired);
+    TEST_RUN(test_zero_cross_ends_the_pulse);
+
+    return test_result();
+}
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "sdkconfig.h"
+
+#include "test.h"
+#include "hal.h"
+#include "fixture.h"
+#include "percentile.h"
+#include "phase_ctrl.h"
+
+
+/*
+ * Firing points of the phase controlled Fan of the firmware against the
+ * simulated mains. Every rising gate edge is compared with the zero crossing
+ * of the waveform plus the delay of the level: the error is the edge jitter
+ * of the zero-cross detector, the mains period as measured by the firmware
+ * and the latency of its timers, at 50 and at 60 Hz.
+ */
+
+#define FAN_LEVEL           HW_LVL_MEDIUM
+#define FAN_PAYLOAD         "3"
+#define MEASURE_MS          2000
+#define FOLLOW_MS           1000    // The zero-cross monitor takes a new frequency
+#define ERROR_P50_MAX_US    (PHASE_CTRL_GUARD_US / 2)    // The tail is the host scheduler's
+
+#define EDGE_MAX            512
+
+
+static atomic_uint      Half_us;        // Of the simulated mains, 0 while not measuring
+static uint32_t         Errors_us[EDGE_MAX];
+static atomic_uint      Edge_cnt;
+
+
+/**
+ * @brief GPIO hook: error of every rising gate edge
+ */
+static void on_pin(int pin, int level, int64_t now_us)
+{
+    uint32_t half_us = atomic_load(&Half_us);
+    int64_t ideal_us;
+    int64_t error_us;
+    uint32_t idx;
+
+    if(pin != FIXTURE_FAN_PIN || level == 0 || half_us == 0)
+    {
+        return;
+    }
+
+    ideal_us = hal_host_mains_zero_us() + phase_ctrl_level_to_delay_us(FAN_LEVEL, half_us);
+    error_us = now_us - ideal_us;
+
+    idx = atomic_fetch_add(&Edge_cnt, 1);
+    if(idx < EDGE_MAX)
+    {
+        Errors_us[idx] = (uint32_t)(error_us < 0 ? -error_us : error_us);
+    }
+}
+
+/**
+ * @brief Runs the mains at a frequency and checks the firing points
+ *
+ * @param freq_mhz Mains frequency
+ */
+static void measure(uint32_t freq_mhz)
+{
+    uint32_t half_us = 500000000UL / freq_mhz;
+    uint32_t count;
+    uint32_t p50;
+
+    hal_host_mains(FIXTURE_ZERO_PIN, freq_mhz, FIXTURE_MAINS_JITTER_US);
+    usleep(FOLLOW_MS * 1000);
+
+    atomic_store(&Edge_cnt, 0);
+    atomic_store(&Half_us, half_us);
+    usleep(MEASURE_MS * 1000);
+    atomic_store(&Half_us, 0);
+
+    count = atomic_load(&Edge_cnt);
+    if(count > EDGE_MAX)
+    {
+        count = EDGE_MAX;
+    }
+
+    // One firing per half-cycle
+    TEST_CHECK(count + 10 >= MEASURE_MS * 1000 / half_us);
+
+    p50 = percentile(Errors_us, count, 500);
+    TEST_CHECK(p50 <= ERROR_P50_MAX_US);
+    printf("%2u Hz: %u firings, error p50 %u us, p99 %u us, max %u us (edge jitter up to %u us)\n",
+           freq_mhz / 1000, count, p50, percentile(Errors_us, count, 990),
+           percentile(Errors_us, count, 1000), FIXTURE_MAINS_JITTER_US);
+}
+
+static void test_firing_at_50_hz(void)
+{
+    measure(50000);
+}
+
+static void test_firing_at_60_hz(void)
+{
+    measure(60000);
+}
+
+int main(void)
+{
+    const fixture_cfg_t cfg = {
+        .mac = { 0x02, 0x00, 0x00, 0x00, 0xf1, 0x4e },
+        .client_id = "phase-jitter-test",
+        .on_pin = on_pin
+    };
+
+    if(!TEST_CHECK(fixture_start(&cfg)))
+    {
+        return test_result();
+    }
+
+    fixture_command(NULL, "Fan", FAN_PAYLOAD);
+
+    TEST_RUN(test_firing_at_50_hz);
+    TEST_RUN(test_firing_at_60_hz);
+
+    fixture_stop();
+
+    return test_result();
+}
@@ -0,0 +1,107 @@
+#include <stdlib.h>
+
+#include "test.h"
+#include "pin_mask.h"
+
+
+#define PIN_CNT     40          // ESP32 GPIOs
+
+
+// Output register after one set and one clear write
+static uint64_t write_register(uint64_t out, const pin_mask_t *mask)
+{
+    return (out | mask->set) & ~mask->clear;
+}
+
+static void test_empty(void)
+{
+    pin_mask_t mask;
+
+    pin_mask_init(&mask);
+    TEST_CHECK(pin_mask_empty(&mask));
+
+    pin_mask_add(&mask, 5, false);
+    TEST_CHECK(!pin_mask_empty(&mask));
+}
+
+static void test_levels(void)
+{
+    pin_mask_t mask;
+
+    pin_mask_init(&mask);
+    pin_mask_add(&mask, 22, true);
+    pin_mask_add(&mask, 27, false);
+
+    TEST_EQ(mask.set, 1ULL << 22);
+    TEST_EQ(mask.clear, 1ULL << 27);
+}
+
+// Pins above 31 are in the second register of the ESP32
+static void test_high_pins(void)
+{
+    pin_mask_t mask;
+
+    pin_mask_init(&mask);
+    pin_mask_add(&mask, 33, true);
+    pin_mask_add(&mask, 39, false);
+
+    TEST_EQ(mask.set, 1ULL << 33);
+    TEST_EQ(mask.clear, 1ULL << 39);
+}
+
+// A pin changed twice in one group ends at its last level, never in both masks
+static void test_last_level_wins(void)
+{
+    pin_mask_t mask;
+
+    pin_mask_init(&mask);
+    pin_mask_add(&mask, 17, true);
+    pin_mask_add(&mask, 17, false);
+    TEST_EQ(mask.set, 0);
+    TEST_EQ(mask.clear, 1ULL << 17);
+
+    pin_mask_add(&mask, 17, true);
+    TEST_EQ(mask.set, 1ULL << 17);
+    TEST_EQ(mask.clear, 0);
+}
+
+// Random groups give the register the per-pin writes would give, pins not in
+// the group keep their level
+static void test_groups_match_pin_writes(void)
+{
+    srand(9);
+
+    for(uint32_t group = 0; group < 10000; ++group)
+    {
+        uint64_t out = ((uint64_t)rand() << 32) ^ (uint64_t)rand();
+        uint64_t expected = out;
+        uint32_t changes = 1 + (uint32_t)(rand() % 16);
+        pin_mask_t mask;
+
+        pin_mask_init(&mask);
+        for(uint32_t change = 0; change < changes; ++change)
+        {
+            uint32_t pin = (uint32_t)(rand() % PIN_CNT);
+            bool level = rand() & 1;
+
+            pin_mask_add(&mask, pin, level);
+            expected = level ? (expected | (1ULL << pin)) : (expected & ~(1ULL << pin));
+        }
+
+        if(!TEST_EQ(mask.set & mask.clear, 0) || !TEST_EQ(write_register(out, &mask), expected))
+        {
+            break;
+        }
+    }
+}
+
+int main(void)
+{
+    TEST_RUN(test_empty);
+    TEST_RUN(test_levels);
+    TEST_RUN(test_high_pins);
+    TEST_RUN(test_last_level_wins);
+    TEST_RUN(test_groups_match_pin_writes);
+
+    return test_result();
+}
@@ -0,0 +1,167 @@
+#include <stdlib.h>
+
+#include "test.h"
+#include "relay_sched.h"
+
+
+#define HALF_PERIOD_US      10000
+#define OFFSET_US           1000
+#define OPERATE_US          8000
+#define RELEASE_US          4000
+#define TIMEOUT_US          100000
+#define ALARM_LATENCY_US    50
+
+
+/* A relay model: the contact follows the coil after the operate time when
+ * closing and after the shorter release time when opening. The zero
+ * crossings come every half-period from 0 on. */
+typedef struct {
+    relay_sched_t   sched;
+    uint64_t        now_us;
+    uint64_t        alarm_us;
+    bool            armed;
+    uint64_t        contact_us;     // Last contact movement
+} bench_t;
+
+static void bench_init(bench_t *bench)
+{
+    relay_sched_init(&bench->sched, OFFSET_US, OPERATE_US, RELEASE_US, TIMEOUT_US, false);
+    bench->now_us = 0;
+    bench->armed = false;
+    bench->contact_us = 0;
+}
+
+// Runs the zero crossings and the alarm up to end_us
+static void bench_run(bench_t *bench, uint64_t end_us, uint32_t latency_us)
+{
+    uint64_t zero_us = (bench->now_us / HALF_PERIOD_US + 1) * HALF_PERIOD_US;
+    bool on;
+
+    while(1)
+    {
+        if(bench->armed && bench->alarm_us + latency_us <= zero_us && bench->alarm_us + latency_us <= end_us)
+        {
+            bench->armed = false;
+            bench->now_us = bench->alarm_us + latency_us;
+            if(relay_sched_on_alarm(&bench->sched, bench->now_us, &on))
+            {
+                bench->contact_us = bench->now_us + (on ? OPERATE_US : RELEASE_US);
+            }
+            continue;
+        }
+
+        if(zero_us > end_us)
+        {
+            break;
+        }
+
+        bench->now_us = zero_us;
+        if(relay_sched_on_zero_cross(&bench->sched, zero_us, HALF_PERIOD_US, &bench->alarm_us))
+        {
+            bench->armed = true;
+        }
+        zero_us += HALF_PERIOD_US;
+    }
+
+    bench->now_us = end_us;
+}
+
+static void test_closes_and_opens_at_the_offset(void)
+{
+    bench_t bench;
+    int32_t error_us;
+
+    bench_init(&bench);
+
+    // Closing: the coil goes operate_us ahead of the aimed point
+    TEST_CHECK(relay_sched_request(&bench.sched, true, 500));
+    bench_run(&bench, 30000, 0);
+    TEST_EQ(bench.contact_us, 2 * HALF_PERIOD_US + OFFSET_US);
+    TEST_CHECK(relay_sched_take_error(&bench.sched, &error_us));
+    TEST_EQ(error_us, 0);
+
+    // Opening: release_us ahead, not the operate time
+    TEST_CHECK(relay_sched_request(&bench.sched, false, 35000));
+    bench_run(&bench, 60000, 0);
+    TEST_EQ(bench.contact_us, 5 * HALF_PERIOD_US + OFFSET_US);
+    TEST_CHECK(relay_sched_take_error(&bench.sched, &error_us));
+    TEST_EQ(error_us, 0);
+}
+
+// Only the alarm latency reaches the contacts, in both directions
+static void test_alignment_error_is_the_alarm_latency(void)
+{
+    bench_t bench;
+    uint32_t max_error_us = 0;
+    int32_t error_us;
+
+    srand(5);
+    bench_init(&bench);
+
+    for(uint32_t step = 0; step < 1000; ++step)
+    {
+        uint32_t latency_us = (uint32_t)(rand() % (ALARM_LATENCY_US + 1));
+        uint64_t request_us = bench.now_us + (uint32_t)(rand() % HALF_PERIOD_US);
+        uint64_t aimed_us;
+
+        bench_run(&bench, request_us, latency_us);
+        TEST_CHECK(relay_sched_request(&bench.sched, step % 2 == 0, request_us));
+        bench_run(&bench, request_us + 4 * HALF_PERIOD_US, latency_us);
+
+        aimed_us = (bench.contact_us - OFFSET_US + HALF_PERIOD_US / 2) / HALF_PERIOD_US * HALF_PERIOD_US + OFFSET_US;
+        if(!TEST_NEAR(bench.contact_us, aimed_us, ALARM_LATENCY_US))
+        {
+            break;
+        }
+
+        TEST_CHECK(relay_sched_take_error(&bench.sched, &error_us));
+        TEST_EQ(error_us, bench.contact_us - aimed_us);
+        if((uint32_t)error_us > max_error_us)
+        {
+            max_error_us = (uint32_t)error_us;
+        }
+    }
+
+    printf("relay alignment: max %u us for %u us of alarm latency\n", max_error_us, ALARM_LATENCY_US);
+}
+
+static void test_opposite_request_cancels(void)
+{
+    bench_t bench;
+
+    bench_init(&bench);
+
+    TEST_CHECK(relay_sched_request(&bench.sched, true, 500));
+    TEST_CHECK(!relay_sched_request(&bench.sched, false, 600));
+    bench_run(&bench, 50000, 0);
+
+    TEST_CHECK(!bench.sched.on);
+    TEST_EQ(bench.contact_us, 0);
+}
+
+static void test_no_zero_crossing_times_out(void)
+{
+    relay_sched_t sched;
+    bool on = false;
+    int32_t error_us;
+
+    relay_sched_init(&sched, OFFSET_US, OPERATE_US, RELEASE_US, TIMEOUT_US, false);
+    TEST_CHECK(relay_sched_request(&sched, true, 1000));
+
+    TEST_CHECK(!relay_sched_poll(&sched, 1000 + TIMEOUT_US - 1, &on));
+    TEST_CHECK(relay_sched_poll(&sched, 1000 + TIMEOUT_US, &on));
+    TEST_CHECK(on);
+
+    // Unaligned: no error to report
+    TEST_CHECK(!relay_sched_take_error(&sched, &error_us));
+}
+
+int main(void)
+{
+    TEST_RUN(test_closes_and_opens_at_the_offset);
+    TEST_RUN(test_alignment_error_is_the_alarm_latency);
+    TEST_RUN(test_opposite_request_cancels);
+    TEST_RUN(test_no_zero_crossing_times_out);
+
+    return test_result();
+}
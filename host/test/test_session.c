@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "sdkconfig.h"
+
+#include "test.h"
+#include "hal.h"
+#include "fixture.h"
+
+
+/*
+ * The firmware on the simulated board loses its connection to the host
+ * broker. The broker keeps the persistent session: the QoS 1 commands sent
+ * meanwhile are queued and delivered on the reconnection, the subscriptions
+ * are still there, and the retained snapshot shows every change soon after.
+ */
+
+#define TURN_ON_MS          (3 * CONFIG_TURN_ON_SPACING_MS + FIXTURE_SETTLE_MS)   // Three loads turned on one after the other
+#define OFFLINE_MS          1000
+#define CONSISTENT_MAX_MS   1000    // Reconnection to a snapshot with every queued command
+
+
+static int64_t now_ms(void)
+{
+    return hal_time_us() / 1000;
+}
+
+static mqtt_broker_stats_t broker_stats(void)
+{
+    mqtt_broker_stats_t stats;
+
+    mqtt_broker_stats(fixture_broker(), &stats);
+
+    return stats;
+}
+
+// Commands sent while offline are held by the broker and applied on the reconnection
+static void test_queued_commands_applied(void)
+{
+    uint32_t connects = broker_stats().connects;
+    uint32_t heater = fixture_pin_changes(FIXTURE_HEATER_PIN);
+    uint32_t light = fixture_pin_changes(FIXTURE_LIGHT_PIN);
+    int64_t start_ms;
+    int64_t online_ms;
+
+    // Every load off, the Fan off is level 1
+    TEST_CHECK(fixture_snapshot_is("0100"));
+
+    hal_host_mqtt_offline(OFFLINE_MS);
+    for(start_ms = now_ms(); broker_stats().clients > 1 && now_ms() - start_ms < OFFLINE_MS; )
+    {
+        usleep(1000);
+    }
+    TEST_EQ(broker_stats().clients, 1);
+
+    fixture_command(NULL, "Heater", "1");
+    fixture_command(NULL, "Fan", "3");
+    fixture_command(NULL, "Light", "1");
+    usleep(100 * 1000);
+    TEST_EQ(broker_stats().queued, 3);
+    TEST_EQ(fixture_pin_changes(FIXTURE_HEATER_PIN), heater);
+
+    // From the reconnection to the first snapshot with all three commands
+    for(start_ms = now_ms(); broker_stats().connects == connects; usleep(1000))
+    {
+        if(!TEST_CHECK(now_ms() - start_ms < FIXTURE_CONNECT_TIMEOUT_MS))
+        {
+            return;
+        }
+    }
+    online_ms = now_ms();
+
+    while(!fixture_snapshot_is("1310") && now_ms() - online_ms < FIXTURE_CONNECT_TIMEOUT_MS)
+    {
+        usleep(1000);
+    }
+    TEST_CHECK(fixture_snapshot_is("1310"));
+    TEST_CHECK(now_ms() - online_ms <= CONSISTENT_MAX_MS);
+    printf("time to consistent state: %lld ms after the reconnection\n", (long long)(now_ms() - online_ms));
+
+    usleep(TURN_ON_MS * 1000);
+    TEST_EQ(broker_stats().queued, 0);
+    TEST_EQ(fixture_pin_changes(FIXTURE_HEATER_PIN), heater + 1);
+    TEST_EQ(fixture_pin_changes(FIXTURE_LIGHT_PIN), light + 1);
+}
+
+// The resumed session still has the subscriptions the device made at first
+static void test_subscriptions_kept(void)
+{
+    uint32_t heater = fixture_pin_changes(FIXTURE_HEATER_PIN);
+
+    fixture_command(NULL, "Heater", "0");
+    usleep(FIXTURE_SETTLE_MS * 1000);
+
+    TEST_CHECK(fixture_snapshot_is("0310"));
+    TEST_EQ(fixture_pin_changes(FIXTURE_HEATER_PIN), heater + 1);
+    TEST_EQ(broker_stats().sessions, 2);
+}
+
+int main(void)
+{
+    const fixture_cfg_t cfg = {
+        .mac = { 0x02, 0x00, 0x00, 0x00, 0x5e, 0x55 },
+        .client_id = "session-test"
+    };
+
+    if(!TEST_CHECK(fixture_start(&cfg)))
+    {
+        return test_result();
+    }
+
+    TEST_RUN(test_queued_commands_applied);
+    TEST_RUN(test_subscriptions_kept);
+
+    fixture_stop();
+
+    return test_result();
+}
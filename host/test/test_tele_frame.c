@@ -0,0 +1,204 @@
+#include <string.h>
+
+#include "test.h"
+#include "tele_frame.h"
+
+
+#define BUF_SIZE    192
+
+
+// The frame of wqtt_client: a timestamp, the metrics and the load states
+static void frame_fill(tele_frame_t *frame, uint32_t seed)
+{
+    static const char *keys[] = { "ts", "I", "Eh", "Ef", "El", "fz", "zj", "zm", "H", "F", "L", "D" };
+
+    tele_frame_reset(frame);
+    for(uint32_t idx = 0; idx < sizeof(keys) / sizeof(keys[0]); ++idx)
+    {
+        tele_frame_add(frame, keys[idx], seed * 2654435761u >> (idx % 32));
+    }
+}
+
+static bool frames_equal(const tele_frame_t *a, const tele_frame_t *b)
+{
+    if(!TEST_EQ(a->count, b->count))
+    {
+        return false;
+    }
+
+    for(uint32_t idx = 0; idx < a->count; ++idx)
+    {
+        if(!TEST_CHECK(strcmp(a->field[idx].key, b->field[idx].key) == 0) ||
+           !TEST_EQ(a->field[idx].value, b->field[idx].value))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void round_trip(tele_frame_format_t format)
+{
+    tele_frame_t frame;
+    tele_frame_decoded_t decoded;
+    uint8_t buf[BUF_SIZE];
+    size_t len;
+
+    for(uint32_t seed = 0; seed < 1000; ++seed)
+    {
+        frame_fill(&frame, seed);
+        len = tele_frame_encode(&frame, format, buf, sizeof(buf));
+
+        if(!TEST_CHECK(len != 0) ||
+           !TEST_CHECK(tele_frame_decode(&decoded, format, buf, len)) ||
+           !frames_equal(&decoded.frame, &frame))
+        {
+            break;
+        }
+    }
+}
+
+static void test_json_round_trip(void)
+{
+    round_trip(TELE_FRAME_JSON);
+}
+
+static void test_cbor_round_trip(void)
+{
+    round_trip(TELE_FRAME_CBOR);
+}
+
+// Every CBOR argument length, and the longest key of a single header byte
+static void test_value_and_key_limits(void)
+{
+    static const uint32_t values[] = { 0, 23, 24, 255, 256, 65535, 65536, UINT32_MAX };
+    static const char key[] = "abcdefghijklmnopqrstuvw";
+    tele_frame_t frame;
+    tele_frame_decoded_t decoded;
+    uint8_t buf[BUF_SIZE];
+    uint32_t value;
+    size_t len;
+
+    for(int format = TELE_FRAME_JSON; format <= TELE_FRAME_CBOR; ++format)
+    {
+        for(size_t idx = 0; idx < sizeof(values) / sizeof(values[0]); ++idx)
+        {
+            tele_frame_reset(&frame);
+            TEST_CHECK(tele_frame_add(&frame, key, values[idx]));
+
+            len = tele_frame_encode(&frame, format, buf, sizeof(buf));
+            TEST_CHECK(tele_frame_decode(&decoded, format, buf, len));
+            TEST_CHECK(tele_frame_get(&decoded.frame, key, &value));
+            TEST_EQ(value, values[idx]);
+        }
+    }
+
+    TEST_CHECK(!tele_frame_add(&frame, "abcdefghijklmnopqrstuvwx", 1));
+    TEST_CHECK(!tele_frame_get(&frame, "I", &value));
+}
+
+static void test_empty_frame(void)
+{
+    tele_frame_t frame;
+    tele_frame_decoded_t decoded;
+    uint8_t buf[BUF_SIZE];
+    size_t len;
+
+    tele_frame_reset(&frame);
+
+    len = tele_frame_encode(&frame, TELE_FRAME_JSON, buf, sizeof(buf));
+    TEST_EQ(len, 2);
+    TEST_CHECK(tele_frame_decode(&decoded, TELE_FRAME_JSON, buf, len));
+    TEST_EQ(decoded.frame.count, 0);
+
+    len = tele_frame_encode(&frame, TELE_FRAME_CBOR, buf, sizeof(buf));
+    TEST_EQ(len, 1);
+    TEST_CHECK(tele_frame_decode(&decoded, TELE_FRAME_CBOR, buf, len));
+    TEST_EQ(decoded.frame.count, 0);
+}
+
+// Every truncation of a valid message is rejected
+static void test_truncated_rejected(void)
+{
+    tele_frame_t frame;
+    tele_frame_decoded_t decoded;
+    uint8_t buf[BUF_SIZE];
+    size_t len;
+
+    frame_fill(&frame, 7);
+
+    for(int format = TELE_FRAME_JSON; format <= TELE_FRAME_CBOR; ++format)
+    {
+        len = tele_frame_encode(&frame, format, buf, sizeof(buf));
+
+        for(size_t cut = 0; cut < len; ++cut)
+        {
+            if(!TEST_CHECK(!tele_frame_decode(&decoded, format, buf, cut)))
+            {
+                break;
+            }
+        }
+    }
+}
+
+static void test_malformed_rejected(void)
+{
+    static const char *json[] = {
+        "{\"I\":}", "{\"I\":1,}", "{\"I\" :1}", "{\"I\":-1}", "{\"I\":4294967296}",
+        "{\"I\":1\"}", "{I:1}", "[\"I\",1]", "{\"I\":1}}"
+    };
+    // A text value, a negative value, trailing bytes, a 64 bit value
+    static const uint8_t cbor[][12] = {
+        { 0xA1, 0x61, 'I', 0x61, 'x' },
+        { 0xA1, 0x61, 'I', 0x20 },
+        { 0xA1, 0x61, 'I', 0x01, 0x00 },
+        { 0xA1, 0x61, 'I', 0x1B, 0, 0, 0, 0, 0, 0, 0, 1 }
+    };
+    static const size_t cbor_len[] = { 5, 4, 5, 12 };
+    tele_frame_decoded_t decoded;
+
+    for(size_t idx = 0; idx < sizeof(json) / sizeof(json[0]); ++idx)
+    {
+        if(!TEST_CHECK(!tele_frame_decode(&decoded, TELE_FRAME_JSON, (const uint8_t *)json[idx], strlen(json[idx]))))
+        {
+            fprintf(stderr, "accepted %s\n", json[idx]);
+        }
+    }
+
+    for(size_t idx = 0; idx < sizeof(cbor) / sizeof(cbor[0]); ++idx)
+    {
+        TEST_CHECK(!tele_frame_decode(&decoded, TELE_FRAME_CBOR, cbor[idx], cbor_len[idx]));
+    }
+}
+
+// A frame with more fields than TELE_FRAME_FIELDS is not decoded
+static void test_too_many_fields(void)
+{
+    uint8_t buf[BUF_SIZE];
+    tele_frame_decoded_t decoded;
+    size_t len = 0;
+
+    buf[len++] = 0xA0 | (TELE_FRAME_FIELDS + 1);
+    for(uint32_t idx = 0; idx <= TELE_FRAME_FIELDS; ++idx)
+    {
+        buf[len++] = 0x61;
+        buf[len++] = 'a' + idx;
+        buf[len++] = idx;
+    }
+
+    TEST_CHECK(!tele_frame_decode(&decoded, TELE_FRAME_CBOR, buf, len));
+}
+
+int main(void)
+{
+    TEST_RUN(test_json_round_trip);
+    TEST_RUN(test_cbor_round_trip);
+    TEST_RUN(test_value_and_key_limits);
+    TEST_RUN(test_empty_frame);
+    TEST_RUN(test_truncated_rejected);
+    TEST_RUN(test_malformed_rejected);
+    TEST_RUN(test_too_many_fields);
+
+    return test_result();
+}
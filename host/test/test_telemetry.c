@@ -0,0 +1,54 @@
+#include "test.h"
+#include "telemetry.h"
+
+
+/*
+ * The publication policy on a made-up metric. The messages the firmware
+ * really sends with its policies are counted by test_current_telemetry.
+ */
+
+static const telemetry_cfg_t Policy = {
+    .deadband = 10,
+    .min_interval_ms = 250,
+    .max_interval_ms = 5 * 60 * 1000,
+    .qos = 0
+};
+
+
+static void test_first_sample_published(void)
+{
+    telemetry_metric_t metric = { .cfg = &Policy };
+
+    TEST_CHECK(telemetry_should_publish(&metric, 0, 12345));
+}
+
+static void test_deadband_and_intervals(void)
+{
+    telemetry_metric_t metric = { .cfg = &Policy };
+
+    telemetry_published(&metric, 1000, 0);
+
+    // Within the deadband only the heartbeat, a change of the deadband at once
+    TEST_CHECK(!telemetry_should_publish(&metric, 1009, 1000));
+    TEST_CHECK(!telemetry_should_publish(&metric, 991, 1000));
+    TEST_CHECK(telemetry_should_publish(&metric, 1010, 1000));
+    TEST_CHECK(telemetry_should_publish(&metric, 990, 1000));
+    TEST_CHECK(telemetry_should_publish(&metric, 1000, Policy.max_interval_ms));
+
+    // A step waits for the minimum interval, then goes out at once
+    TEST_CHECK(!telemetry_should_publish(&metric, 2000, Policy.min_interval_ms - 1));
+    TEST_CHECK(telemetry_should_publish(&metric, 2000, Policy.min_interval_ms));
+    TEST_CHECK(telemetry_should_publish(&metric, 950, Policy.min_interval_ms));
+
+    // Timestamps wrap
+    telemetry_published(&metric, 1000, UINT32_MAX - 100);
+    TEST_CHECK(telemetry_should_publish(&metric, 2000, Policy.min_interval_ms));
+}
+
+int main(void)
+{
+    TEST_RUN(test_first_sample_published);
+    TEST_RUN(test_deadband_and_intervals);
+
+    return test_result();
+}
@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "topic_table.h"
+
+
+static uint32_t Handled[3];
+static uint32_t Handled_value;
+
+
+static bool parse_digit(const char *data, size_t len, uint32_t *value)
+{
+    if(len != 1 || data[0] < '0' || data[0] > '9')
+    {
+        return false;
+    }
+
+    *value = (uint32_t)(data[0] - '0');
+    return true;
+}
+
+static void handle_0(uint32_t value) { Handled[0]++; Handled_value = value; }
+static void handle_1(uint32_t value) { Handled[1]++; Handled_value = value; }
+static void handle_2(uint32_t value) { Handled[2]++; Handled_value = value; }
+
+static const topic_route_t Routes[] = {
+    { "Heater",     parse_digit, handle_0 },
+    { "Heat",       parse_digit, handle_1 },
+    { "Light",      parse_digit, handle_2 }
+};
+
+
+static void test_exact_match_only(void)
+{
+    topic_table_t table;
+
+    TEST_CHECK(topic_table_init(&table, Routes, 3));
+    TEST_EQ(table.count, 3);
+
+    TEST_CHECK(topic_table_find(&table, "Heater", 6) == &Routes[0]);
+    TEST_CHECK(topic_table_find(&table, "Heat", 4) == &Routes[1]);
+    TEST_CHECK(topic_table_find(&table, "Light", 5) == &Routes[2]);
+
+    // Prefixes and extensions of a topic are other topics
+    TEST_CHECK(topic_table_find(&table, "Heate", 5) == NULL);
+    TEST_CHECK(topic_table_find(&table, "Heaters", 7) == NULL);
+    TEST_CHECK(topic_table_find(&table, "Light/set", 9) == NULL);
+    TEST_CHECK(topic_table_find(&table, "", 0) == NULL);
+
+    // Not zero terminated: only len bytes count
+    TEST_CHECK(topic_table_find(&table, "Heater/x", 6) == &Routes[0]);
+}
+
+static void test_init_rejects(void)
+{
+    topic_table_t table;
+    topic_route_t twice[2] = { Routes[0], Routes[0] };
+    static topic_route_t many[TOPIC_TABLE_SLOTS / 2 + 1];
+    static char names[TOPIC_TABLE_SLOTS / 2 + 1][8];
+
+    TEST_CHECK(!topic_table_init(&table, twice, 2));
+
+    for(size_t idx = 0; idx < TOPIC_TABLE_SLOTS / 2 + 1; ++idx)
+    {
+        snprintf(names[idx], sizeof(names[idx]), "t%u", (unsigned)idx);
+        many[idx] = (topic_route_t){ names[idx], parse_digit, handle_0 };
+    }
+
+    TEST_CHECK(topic_table_init(&table, many, TOPIC_TABLE_SLOTS / 2));
+    TEST_CHECK(!topic_table_init(&table, many, TOPIC_TABLE_SLOTS / 2 + 1));
+
+    // A half full table still finds every topic
+    TEST_CHECK(topic_table_init(&table, many, TOPIC_TABLE_SLOTS / 2));
+    for(size_t idx = 0; idx < TOPIC_TABLE_SLOTS / 2; ++idx)
+    {
+        TEST_CHECK(topic_table_find(&table, names[idx], strlen(names[idx])) == &many[idx]);
+    }
+}
+
+static void test_dispatch(void)
+{
+    topic_table_t table;
+
+    memset(Handled, 0, sizeof(Handled));
+    topic_table_init(&table, Routes, 3);
+
+    TEST_CHECK(topic_table_dispatch(&table, "Light", 5, "7", 1));
+    TEST_EQ(Handled[2], 1);
+    TEST_EQ(Handled_value, 7);
+
+    // Malformed payload: the handler does not run
+    TEST_CHECK(!topic_table_dispatch(&table, "Heater", 6, "x", 1));
+    TEST_CHECK(!topic_table_dispatch(&table, "Heater", 6, "12", 2));
+    TEST_EQ(Handled[0], 0);
+
+    TEST_CHECK(!topic_table_dispatch(&table, "Fan", 3, "1", 1));
+}
+
+int main(void)
+{
+    TEST_RUN(test_exact_match_only);
+    TEST_RUN(test_init_rejects);
+    TEST_RUN(test_dispatch);
+
+    return test_result();
+}
@@ -0,0 +1,234 @@
+#include "test.h"
+#include "turn_on_sched.h"
+
+
+#define SPACING_MS          200
+#define BUDGET_MA           100
+#define MAX_WAIT_MS         5000
+
+#define STEP_MS             10
+#define WINDOW_MS           100         // RMS window of hw_ctrl
+
+
+static void test_spacing_and_order(void)
+{
+    turn_on_sched_t sched;
+    uint32_t channel;
+    uint32_t value;
+
+    turn_on_sched_init(&sched, SPACING_MS, BUDGET_MA, MAX_WAIT_MS);
+
+    TEST_CHECK(turn_on_sched_request(&sched, 0, 1, 30, 0, 0));
+    TEST_CHECK(!turn_on_sched_request(&sched, 1, 3, 20, 0, 10));
+    TEST_CHECK(!turn_on_sched_request(&sched, 2, 1, 10, 0, 20));
+
+    // A new value of a waiting channel keeps its place
+    TEST_CHECK(!turn_on_sched_request(&sched, 1, 5, 20, 0, 30));
+
+    TEST_CHECK(!turn_on_sched_poll(&sched, 30, SPACING_MS - 1, &channel, &value));
+    TEST_CHECK(turn_on_sched_poll(&sched, 30, SPACING_MS, &channel, &value));
+    TEST_EQ(channel, 1);
+    TEST_EQ(value, 5);
+
+    // Nothing skips the queue while something waits
+    TEST_CHECK(!turn_on_sched_request(&sched, 3, 1, 1, 0, 2 * SPACING_MS + 1));
+
+    turn_on_sched_cancel(&sched, 2);
+    TEST_CHECK(turn_on_sched_poll(&sched, 50, 2 * SPACING_MS + 1, &channel, &value));
+    TEST_EQ(channel, 3);
+    TEST_CHECK(!turn_on_sched_poll(&sched, 50, 10 * SPACING_MS, &channel, &value));
+
+    // Within the spacing of the last release
+    TEST_CHECK(!turn_on_sched_request(&sched, 4, 1, 1, 0, 2 * SPACING_MS + 2));
+    turn_on_sched_cancel_all(&sched);
+    TEST_CHECK(!turn_on_sched_poll(&sched, 0, 20 * SPACING_MS, &channel, &value));
+    TEST_EQ(sched.release_cnt, 3);
+}
+
+static void test_budget_and_forced_release(void)
+{
+    turn_on_sched_t sched;
+    uint32_t channel;
+    uint32_t value;
+
+    turn_on_sched_init(&sched, SPACING_MS, BUDGET_MA, MAX_WAIT_MS);
+
+    // 80 mA drawn: a 25 mA load waits, a 20 mA one would fit
+    TEST_CHECK(!turn_on_sched_request(&sched, 0, 1, 25, 80, 0));
+    TEST_CHECK(!turn_on_sched_poll(&sched, 80, MAX_WAIT_MS - 1, &channel, &value));
+
+    // The current drops: released
+    TEST_CHECK(turn_on_sched_poll(&sched, 75, MAX_WAIT_MS - 1, &channel, &value));
+    TEST_EQ(sched.forced_cnt, 0);
+
+    // Never drops: released over the budget after max_wait_ms
+    TEST_CHECK(!turn_on_sched_request(&sched, 1, 1, 25, 100, MAX_WAIT_MS));
+    TEST_CHECK(!turn_on_sched_poll(&sched, 100, 2 * MAX_WAIT_MS - 1, &channel, &value));
+    TEST_CHECK(turn_on_sched_poll(&sched, 100, 2 * MAX_WAIT_MS, &channel, &value));
+    TEST_EQ(sched.forced_cnt, 1);
+    TEST_EQ(sched.max_wait_seen_ms, MAX_WAIT_MS);
+}
+
+/*
+ * Turn-on simulation: loads restored at boot are requested together, like
+ * hw_ctrl_init does. The board draws the real current of the switched loads
+ * and the scheduler sees it as hw_ctrl does, the mean of the last 100 ms
+ * window. Rated currents are the channel limits of hw_ctrl.c.
+ */
+typedef struct {
+    uint32_t    rated_ma;
+    uint32_t    draw_ma;
+    uint32_t    inrush_ma;          // Extra current right after the turn-on
+    uint32_t    inrush_ms;
+    bool        on;
+    uint32_t    on_ms;
+} sim_load_t;
+
+typedef struct {
+    uint32_t    release_ms[4];
+    uint32_t    max_measured_ma;
+    uint32_t    max_drawn_ma;
+    uint32_t    end_measured_ma;
+} sim_result_t;
+
+static uint32_t sim_draw(const sim_load_t *loads, size_t count, uint32_t now_ms)
+{
+    uint32_t total = 0;
+
+    for(size_t idx = 0; idx < count; ++idx)
+    {
+        if(loads[idx].on)
+        {
+            total += loads[idx].draw_ma;
+            if(now_ms - loads[idx].on_ms < loads[idx].inrush_ms)
+            {
+                total += loads[idx].inrush_ma;
+            }
+        }
+    }
+
+    return total;
+}
+
+static void sim_run(turn_on_sched_t *sched, sim_load_t *loads, size_t count, uint32_t duration_ms,
+                    sim_result_t *result)
+{
+    uint32_t measured_ma = 0;
+    uint32_t window_sum = 0;
+    uint32_t channel;
+    uint32_t value;
+
+    *result = (sim_result_t){ { 0 } };
+
+    for(size_t idx = 0; idx < count; ++idx)
+    {
+        result->release_ms[idx] = UINT32_MAX;
+        if(turn_on_sched_request(sched, idx, 1, loads[idx].rated_ma, measured_ma, 0))
+        {
+            loads[idx].on = true;
+            loads[idx].on_ms = 0;
+            result->release_ms[idx] = 0;
+        }
+    }
+
+    for(uint32_t now_ms = STEP_MS; now_ms <= duration_ms; now_ms += STEP_MS)
+    {
+        uint32_t drawn = sim_draw(loads, count, now_ms);
+
+        window_sum += drawn;
+        if(now_ms % WINDOW_MS == 0)
+        {
+            measured_ma = window_sum / (WINDOW_MS / STEP_MS);
+            window_sum = 0;
+        }
+
+        result->max_drawn_ma = (drawn > result->max_drawn_ma) ? drawn : result->max_drawn_ma;
+        result->max_measured_ma = (measured_ma > result->max_measured_ma) ? measured_ma : result->max_measured_ma;
+
+        if(turn_on_sched_poll(sched, measured_ma, now_ms, &channel, &value))
+        {
+            loads[channel].on = true;
+            loads[channel].on_ms = now_ms;
+            result->release_ms[channel] = now_ms;
+        }
+    }
+
+    result->end_measured_ma = measured_ma;
+}
+
+// The board of hw_ctrl.c: heater, fan and light within the budget
+static void test_sim_boot_restore(void)
+{
+    turn_on_sched_t sched;
+    sim_load_t loads[] = {
+        { .rated_ma = 70, .draw_ma = 60, .inrush_ma = 0,  .inrush_ms = 0 },
+        { .rated_ma = 25, .draw_ma = 20, .inrush_ma = 30, .inrush_ms = 150 },
+        { .rated_ma = 20, .draw_ma = 15, .inrush_ma = 60, .inrush_ms = 20 }
+    };
+    sim_result_t result;
+
+    turn_on_sched_init(&sched, SPACING_MS, BUDGET_MA, MAX_WAIT_MS);
+    sim_run(&sched, loads, 3, 10000, &result);
+
+    TEST_EQ(result.release_ms[0], 0);
+    TEST_EQ(result.release_ms[1], SPACING_MS);
+    TEST_CHECK(result.release_ms[2] >= 2 * SPACING_MS && result.release_ms[2] < MAX_WAIT_MS);
+    TEST_EQ(sched.forced_cnt, 0);
+
+    // Inrush passes the budget for a window at most, the loads settle within it
+    TEST_CHECK(result.end_measured_ma <= BUDGET_MA);
+
+    printf("boot restore: releases at %u, %u, %u ms, measured max %u mA, drawn max %u mA, settled %u mA\n",
+           result.release_ms[0], result.release_ms[1], result.release_ms[2],
+           result.max_measured_ma, result.max_drawn_ma, result.end_measured_ma);
+}
+
+// A second heater does not fit: it waits for max_wait_ms, then goes on
+static void test_sim_budget_holds_back(void)
+{
+    turn_on_sched_t sched;
+    sim_load_t loads[] = {
+        { .rated_ma = 70, .draw_ma = 60 },
+        { .rated_ma = 25, .draw_ma = 20 },
+        { .rated_ma = 70, .draw_ma = 60 }
+    };
+    sim_result_t result;
+
+    turn_on_sched_init(&sched, SPACING_MS, BUDGET_MA, MAX_WAIT_MS);
+    sim_run(&sched, loads, 3, 10000, &result);
+
+    TEST_EQ(result.release_ms[0], 0);
+    TEST_EQ(result.release_ms[1], SPACING_MS);
+    TEST_EQ(result.release_ms[2], MAX_WAIT_MS);
+    TEST_EQ(sched.forced_cnt, 1);
+}
+
+/* The former default budget of 16000 mA against Currents of at most about
+ * 109 mA: only the spacing is left, nothing is ever held back. */
+static void test_sim_budget_beyond_range(void)
+{
+    turn_on_sched_t sched;
+    sim_load_t loads[] = {
+        { .rated_ma = 70, .draw_ma = 60 },
+        { .rated_ma = 25, .draw_ma = 20 },
+        { .rated_ma = 70, .draw_ma = 60 }
+    };
+    sim_result_t result;
+
+    turn_on_sched_init(&sched, SPACING_MS, 16000, MAX_WAIT_MS);
+    sim_run(&sched, loads, 3, 10000, &result);
+
+    TEST_EQ(result.release_ms[2], 2 * SPACING_MS);
+    TEST_EQ(sched.forced_cnt, 0);
+}
+
+int main(void)
+{
+    TEST_RUN(test_spacing_and_order);
+    TEST_RUN(test_budget_and_forced_release);
+    TEST_RUN(test_sim_boot_restore);
+    TEST_RUN(test_sim_budget_holds_back);
+    TEST_RUN(test_sim_budget_beyond_range);
+
+    return test_result();
+}
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "sdkconfig.h"
+
+#include "test.h"
+#include "fixture.h"
+#include "lvgl_helpers.h"
+#include "smartRelay.h"
+
+
+/*
+ * The rendering of the firmware UI on the host display: the guiTask wakeups
+ * and redrawn pixels per second with the loads idle, then running with a
+ * changing current, with the table cell bindings and without them, and the
+ * time from a pen interrupt to the redraw it causes.
+ */
+
+#define MEASURE_S           3       // Statistics periods averaged per pass
+#define TURN_ON_MS          (3 * CONFIG_TURN_ON_SPACING_MS + FIXTURE_SETTLE_MS)
+
+// Per second with no change on the screen: the display refresh task only
+#define IDLE_WAKEUPS_MAX    (1000 / CONFIG_LV_DISP_DEF_REFR_PERIOD + 5)
+#define TOUCH_CNT           10
+#define TOUCH_P99_MAX_US    (100 * 1000)
+
+// Centre of the Light button, as laid out by create_controls()
+#define LIGHT_BTN_X         216
+#define LIGHT_BTN_Y         279
+#define PRESS_MS            100
+
+
+typedef struct {
+    uint32_t    wakeups;
+    uint32_t    writes;
+    uint32_t    px;
+} rates_t;
+
+static rates_t  Idle;
+static rates_t  Bound;
+static rates_t  Unbound;
+
+
+/**
+ * @brief Averages the rates of the next MEASURE_S statistics periods
+ *
+ * @param label Name of the pass, printed with the rates
+ */
+static rates_t measure(const char *label)
+{
+    rates_t sum = { 0 };
+
+    // The period in progress started before the pass
+    sleep(1);
+
+    for(int sec = 0; sec < MEASURE_S; ++sec)
+    {
+        sleep(1);
+        sum.wakeups += ui_get_wakeups_per_sec();
+        sum.writes += ui_get_invalidations_per_sec();
+        sum.px += ui_get_redrawn_px_per_sec();
+    }
+
+    sum.wakeups /= MEASURE_S;
+    sum.writes /= MEASURE_S;
+    sum.px /= MEASURE_S;
+
+    printf("%-18s %6u wakeups/s %6u cell writes/s %9u px/s\n", label, sum.wakeups, sum.writes, sum.px);
+
+    return sum;
+}
+
+// Nothing changes on the screen: guiTask sleeps until the next LVGL deadline
+static void test_idle(void)
+{
+    Idle = measure("idle");
+
+    TEST_CHECK(Idle.wakeups <= IDLE_WAKEUPS_MAX);
+    TEST_EQ(Idle.writes, 0);
+}
+
+// The current of running loads changes every RMS window
+static void test_bindings_save_redraws(void)
+{
+    fixture_command(NULL, "Heater", "1");
+    fixture_command(NULL, "Fan", "3");
+    fixture_command(NULL, "Light", "1");
+    usleep(TURN_ON_MS * 1000);
+
+    Bound = measure("loads, bound");
+
+    ui_set_cell_bindings(false);
+    Unbound = measure("loads, unbound");
+    ui_set_cell_bindings(true);
+
+    TEST_CHECK(Bound.writes < Unbound.writes);
+    TEST_CHECK(Bound.px < Unbound.px);
+    printf("bindings: %u%% of the redrawn pixels\n", (unsigned)(100ull * Bound.px / (Unbound.px ? Unbound.px : 1)));
+
+    fixture_command(NULL, "Loads", "010-");
+    usleep(FIXTURE_SETTLE_MS * 1000);
+}
+
+// Pen interrupt to the end of the redraw of the pressed button
+static void test_touch_latency(void)
+{
+    for(int touch = 0; touch < TOUCH_CNT; ++touch)
+    {
+        display_host_touch(LIGHT_BTN_X, LIGHT_BTN_Y, true);
+        usleep(PRESS_MS * 1000);
+        display_host_touch(LIGHT_BTN_X, LIGHT_BTN_Y, false);
+        usleep(FIXTURE_SETTLE_MS * 1000);
+    }
+
+    TEST_CHECK(ui_get_touch_latency_us(990) <= TOUCH_P99_MAX_US);
+    printf("touch-to-pixel: p50 %u us, p99 %u us\n", ui_get_touch_latency_us(500), ui_get_touch_latency_us(990));
+}
+
+int main(void)
+{
+    const fixture_cfg_t cfg = {
+        .mac = { 0x02, 0x00, 0x00, 0x00, 0x0d, 0x15 },
+        .client_id = "ui-render-test"
+    };
+
+    if(!TEST_CHECK(fixture_start(&cfg)))
+    {
+        return test_result();
+    }
+
+    TEST_RUN(test_idle);
+    TEST_RUN(test_bindings_save_redraws);
+    TEST_RUN(test_touch_latency);
+
+    fixture_stop();
+
+    return test_result();
+}
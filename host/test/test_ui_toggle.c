@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "sdkconfig.h"
+
+#include "test.h"
+#include "fixture.h"
+#include "lvgl_helpers.h"
+#include "wqtt_client.h"
+
+
+/*
+ * A load toggled on the touch panel: the button handler changes the store
+ * once, the device publishes the new state, and the echo of that
+ * publication is dropped instead of driving the load and the UI again.
+ */
+
+// Centres of the buttons, as laid out by create_controls()
+#define HEATER_BTN_X        216
+#define HEATER_BTN_Y        219
+#define LIGHT_BTN_X         216
+#define LIGHT_BTN_Y         279
+
+#define PRESS_MS            100     // Beyond the LVGL read period
+
+
+// Messages on the state topics of the loads, and their last payload
+typedef struct {
+    const char *    name;
+    atomic_uint     count;
+    atomic_char     last;
+} state_topic_t;
+
+static state_topic_t    States[] = {
+    { .name = "Heater" },
+    { .name = "Light" }
+};
+
+#define STATE_CNT           (sizeof(States) / sizeof(States[0]))
+
+
+static void on_message(const mqtt_lite_packet_t *pkt, const char *name, size_t name_len)
+{
+    for(size_t idx = 0; idx < STATE_CNT; ++idx)
+    {
+        if(name_len == strlen(States[idx].name) && memcmp(name, States[idx].name, name_len) == 0)
+        {
+            atomic_store(&States[idx].last, pkt->payload_len ? (char)pkt->payload[0] : '\0');
+            atomic_fetch_add(&States[idx].count, 1);
+        }
+    }
+}
+
+static void press(lv_coord_t x, lv_coord_t y)
+{
+    display_host_touch(x, y, true);
+    usleep(PRESS_MS * 1000);
+    display_host_touch(x, y, false);
+    usleep(FIXTURE_SETTLE_MS * 1000);
+}
+
+/**
+ * @brief Toggles a load on the panel and checks it is driven once
+ *
+ * @param state State topic of the load
+ * @param pin   Pin of the load
+ * @param x     Column of the button centre
+ * @param y     Row of the button centre
+ * @param value Expected state digit after the toggle
+ */
+static void toggle(state_topic_t *state, int pin, lv_coord_t x, lv_coord_t y, char value)
+{
+    uint32_t published = atomic_load(&state->count);
+    uint32_t changes = fixture_pin_changes(pin);
+    uint32_t echo = wqtt_client_get_Echo_suppressed();
+
+    press(x, y);
+
+    TEST_EQ(atomic_load(&state->count), published + 1);
+    TEST_EQ(atomic_load(&state->last), value);
+    TEST_EQ(fixture_pin_changes(pin), changes + 1);
+    TEST_EQ(wqtt_client_get_Echo_suppressed(), echo + 1);
+}
+
+static void test_heater_toggle_handled_once(void)
+{
+    toggle(&States[0], FIXTURE_HEATER_PIN, HEATER_BTN_X, HEATER_BTN_Y, '1');
+    TEST_CHECK(fixture_snapshot_is("1100"));
+
+    toggle(&States[0], FIXTURE_HEATER_PIN, HEATER_BTN_X, HEATER_BTN_Y, '0');
+    TEST_CHECK(fixture_snapshot_is("0100"));
+}
+
+static void test_light_toggle_handled_once(void)
+{
+    toggle(&States[1], FIXTURE_LIGHT_PIN, LIGHT_BTN_X, LIGHT_BTN_Y, '1');
+    TEST_CHECK(fixture_snapshot_is("0110"));
+
+    toggle(&States[1], FIXTURE_LIGHT_PIN, LIGHT_BTN_X, LIGHT_BTN_Y, '0');
+    TEST_CHECK(fixture_snapshot_is("0100"));
+}
+
+int main(void)
+{
+    const fixture_cfg_t cfg = {
+        .mac = { 0x02, 0x00, 0x00, 0x00, 0x7a, 0x11 },
+        .client_id = "ui-toggle-test",
+        .on_message = on_message
+    };
+
+    if(!TEST_CHECK(fixture_start(&cfg)))
+    {
+        return test_result();
+    }
+
+    TEST_RUN(test_heater_toggle_handled_once);
+    TEST_RUN(test_light_toggle_handled_once);
+
+    fixture_stop();
+
+    return test_result();
+}
@@ -0,0 +1,185 @@
+#include "test.h"
+#include "wifi_reconn.h"
+
+
+#define MIN_BACKOFF_MS      250
+#define MAX_BACKOFF_MS      30000
+
+#define CACHED_ASSOC_MS     150         // Probe of one channel
+#define SCAN_ASSOC_MS       2500        // All channel scan, then association
+
+
+/*
+ * Fake Wi-Fi event source: an AP that is down in [down_ms, up_ms) and may
+ * come back on another channel. It drives the state machine the way wifi.c
+ * does: attempts end in a connected or disconnected event after the
+ * association time, disconnects arm the retry timer with the returned delay.
+ */
+typedef struct {
+    uint32_t    down_ms;
+    uint32_t    up_ms;
+    bool        moved;                  // Back on another channel
+    uint32_t    attempts;
+    uint32_t    scans;
+} fake_ap_t;
+
+static bool fake_ap_up(const fake_ap_t *ap, uint32_t now_ms)
+{
+    return now_ms < ap->down_ms || now_ms >= ap->up_ms;
+}
+
+// Runs from a drop at drop_ms until connected, returns the connect time
+static uint32_t fake_run(wifi_reconn_t *reconn, fake_ap_t *ap, uint32_t drop_ms)
+{
+    uint32_t now_ms = drop_ms;
+
+    // The first attempt after a drop is immediate
+    wifi_reconn_on_disconnected(reconn, now_ms);
+
+    for(;;)
+    {
+        wifi_reconn_mode_t mode = wifi_reconn_attempt(reconn, now_ms);
+        bool cache_ok = !(ap->moved && now_ms >= ap->up_ms);
+
+        ap->attempts++;
+        if(mode == WIFI_RECONN_SCAN)
+        {
+            ap->scans++;
+            now_ms += SCAN_ASSOC_MS;
+        } else {
+            now_ms += CACHED_ASSOC_MS;
+        }
+
+        if(fake_ap_up(ap, now_ms) && (mode == WIFI_RECONN_SCAN || cache_ok))
+        {
+            wifi_reconn_on_connected(reconn, now_ms);
+            return now_ms;
+        }
+
+        now_ms += wifi_reconn_on_disconnected(reconn, now_ms);
+    }
+}
+
+
+static void test_backoff_sequence(void)
+{
+    wifi_reconn_t reconn;
+    const uint32_t expected[] = { 0, 250, 500, 1000, 2000, 4000, 8000, 16000, 30000, 30000, 30000 };
+
+    wifi_reconn_init(&reconn, MIN_BACKOFF_MS, MAX_BACKOFF_MS, false);
+    wifi_reconn_on_connected(&reconn, 0);
+
+    for(size_t idx = 0; idx < sizeof(expected) / sizeof(expected[0]); ++idx)
+    {
+        TEST_EQ(wifi_reconn_on_disconnected(&reconn, 1000), expected[idx]);
+        wifi_reconn_attempt(&reconn, 1000);
+    }
+
+    // A new connection restarts the backoff
+    wifi_reconn_on_connected(&reconn, 2000);
+    TEST_EQ(wifi_reconn_on_disconnected(&reconn, 3000), 0);
+    TEST_EQ(wifi_reconn_on_disconnected(&reconn, 3000), MIN_BACKOFF_MS);
+}
+
+static void test_cached_then_scan(void)
+{
+    wifi_reconn_t reconn;
+
+    wifi_reconn_init(&reconn, MIN_BACKOFF_MS, MAX_BACKOFF_MS, true);
+
+    TEST_EQ(wifi_reconn_attempt(&reconn, 0), WIFI_RECONN_CACHED);
+    wifi_reconn_on_disconnected(&reconn, 100);
+    TEST_EQ(wifi_reconn_attempt(&reconn, 200), WIFI_RECONN_CACHED);
+    wifi_reconn_on_disconnected(&reconn, 300);
+    TEST_EQ(wifi_reconn_attempt(&reconn, 400), WIFI_RECONN_SCAN);
+    wifi_reconn_on_disconnected(&reconn, 500);
+    TEST_EQ(wifi_reconn_attempt(&reconn, 600), WIFI_RECONN_SCAN);
+
+    // A new AP is cached: back to fast association
+    wifi_reconn_set_cache(&reconn, true);
+    TEST_EQ(wifi_reconn_attempt(&reconn, 700), WIFI_RECONN_CACHED);
+
+    wifi_reconn_init(&reconn, MIN_BACKOFF_MS, MAX_BACKOFF_MS, false);
+    TEST_EQ(wifi_reconn_attempt(&reconn, 0), WIFI_RECONN_SCAN);
+}
+
+static void test_start_up_is_first_outage(void)
+{
+    wifi_reconn_t reconn;
+
+    wifi_reconn_init(&reconn, MIN_BACKOFF_MS, MAX_BACKOFF_MS, true);
+    wifi_reconn_attempt(&reconn, 100);
+    wifi_reconn_on_connected(&reconn, 400);
+
+    TEST_EQ(reconn.outages, 1);
+    TEST_EQ(reconn.last_outage_ms, 300);
+    TEST_EQ(reconn.last_attempts, 1);
+}
+
+// A short drop with the AP in place: one cached attempt, no scan
+static void test_fast_reconnect(void)
+{
+    wifi_reconn_t reconn;
+    fake_ap_t ap = { .down_ms = 0, .up_ms = 0 };
+    uint32_t up_ms;
+
+    wifi_reconn_init(&reconn, MIN_BACKOFF_MS, MAX_BACKOFF_MS, true);
+    wifi_reconn_on_connected(&reconn, 0);
+
+    up_ms = fake_run(&reconn, &ap, 10000);
+
+    TEST_EQ(up_ms - 10000, CACHED_ASSOC_MS);
+    TEST_EQ(ap.scans, 0);
+    TEST_EQ(reconn.last_attempts, 1);
+}
+
+// An AP reboot of 3 minutes: retried without a limit, back within one backoff
+static void test_ap_reboot_never_gives_up(void)
+{
+    wifi_reconn_t reconn;
+    fake_ap_t ap = { .down_ms = 10000, .up_ms = 10000 + 3 * 60 * 1000 };
+    uint32_t up_ms;
+
+    wifi_reconn_init(&reconn, MIN_BACKOFF_MS, MAX_BACKOFF_MS, true);
+    wifi_reconn_on_connected(&reconn, 0);
+
+    up_ms = fake_run(&reconn, &ap, ap.down_ms);
+
+    TEST_CHECK(up_ms >= ap.up_ms);
+    TEST_CHECK(up_ms - ap.up_ms <= MAX_BACKOFF_MS + SCAN_ASSOC_MS);
+    TEST_CHECK(reconn.last_attempts > 5);
+    TEST_EQ(reconn.last_outage_ms, up_ms - ap.down_ms);
+    TEST_EQ(reconn.max_outage_ms, reconn.last_outage_ms);
+    TEST_EQ(reconn.outages, 1);
+    printf("AP reboot: back %u ms after the AP, %u attempts, %u scans\n",
+           up_ms - ap.up_ms, ap.attempts, ap.scans);
+}
+
+// The AP comes back on another channel: the cache fails, a scan finds it
+static void test_ap_moved(void)
+{
+    wifi_reconn_t reconn;
+    fake_ap_t ap = { .down_ms = 5000, .up_ms = 6000, .moved = true };
+    uint32_t up_ms;
+
+    wifi_reconn_init(&reconn, MIN_BACKOFF_MS, MAX_BACKOFF_MS, true);
+    wifi_reconn_on_connected(&reconn, 0);
+
+    up_ms = fake_run(&reconn, &ap, ap.down_ms);
+
+    TEST_CHECK(up_ms > ap.up_ms);
+    TEST_EQ(reconn.last_mode, WIFI_RECONN_SCAN);
+    TEST_EQ(ap.scans, 1);
+}
+
+int main(void)
+{
+    TEST_RUN(test_backoff_sequence);
+    TEST_RUN(test_cached_then_scan);
+    TEST_RUN(test_start_up_is_first_outage);
+    TEST_RUN(test_fast_reconnect);
+    TEST_RUN(test_ap_reboot_never_gives_up);
+    TEST_RUN(test_ap_moved);
+
+    return test_result();
+}
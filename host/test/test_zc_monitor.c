@@ -0,0 +1,155 @@
+#include <stdlib.h>
+
+#include "test.h"
+#include "zc_monitor.h"
+
+
+#define EDGE_JITTER_US      80
+
+
+// Edges of a mains trace, drained like hw_ctrl_task does every few half-cycles
+static void trace(zc_monitor_t *mon, uint64_t *zero_us, uint32_t half_period_us, uint32_t edges, uint32_t jitter_us)
+{
+    for(uint32_t edge = 0; edge < edges; ++edge)
+    {
+        *zero_us += half_period_us;
+        zc_monitor_capture(mon, *zero_us + (jitter_us ? (uint32_t)(rand() % (jitter_us + 1)) : 0));
+
+        if(edge % 4 == 3)
+        {
+            zc_monitor_process(mon);
+        }
+    }
+}
+
+static void test_nominal_before_edges(void)
+{
+    zc_monitor_t mon;
+    zc_stats_t stats;
+
+    zc_monitor_init(&mon);
+    TEST_EQ(zc_monitor_half_period_us(&mon), ZC_MONITOR_NOMINAL_HALF_PERIOD_US);
+    TEST_EQ(zc_monitor_last_zero_us(&mon), 0);
+
+    zc_monitor_take_stats(&mon, &stats);
+    TEST_EQ(stats.freq_mhz, 0);
+    TEST_EQ(stats.missed, 0);
+}
+
+static void test_50hz(void)
+{
+    zc_monitor_t mon;
+    zc_stats_t stats;
+    uint64_t zero_us = 0;
+
+    zc_monitor_init(&mon);
+    trace(&mon, &zero_us, 10000, 500, 0);
+    zc_monitor_take_stats(&mon, &stats);
+
+    TEST_EQ(zc_monitor_half_period_us(&mon), 10000);
+    TEST_EQ(zc_monitor_last_zero_us(&mon), zero_us);
+    TEST_EQ(stats.freq_mhz, 50000);
+    TEST_EQ(stats.jitter_max_us, 0);
+    TEST_EQ(stats.missed, 0);
+}
+
+// The half-period follows 60 Hz mains from the 50 Hz start within a few cycles
+static void test_60hz(void)
+{
+    zc_monitor_t mon;
+    zc_stats_t stats;
+    uint64_t zero_us = 0;
+
+    zc_monitor_init(&mon);
+    trace(&mon, &zero_us, 8333, 40, 0);
+    TEST_NEAR(zc_monitor_half_period_us(&mon), 8333, 3);
+
+    zc_monitor_take_stats(&mon, &stats);
+    trace(&mon, &zero_us, 8333, 600, 0);
+    zc_monitor_take_stats(&mon, &stats);
+
+    TEST_NEAR(stats.freq_mhz, 60002, 1);
+    TEST_EQ(stats.missed, 0);
+}
+
+// A slow drift is followed, the detector jitter is averaged out
+static void test_drift_with_jitter(void)
+{
+    zc_monitor_t mon;
+    zc_stats_t stats;
+    uint64_t zero_us = 0;
+
+    srand(3);
+    zc_monitor_init(&mon);
+
+    for(uint32_t half_period_us = 10000; half_period_us <= 10200; half_period_us += 20)
+    {
+        trace(&mon, &zero_us, half_period_us, 100, EDGE_JITTER_US);
+        TEST_NEAR(zc_monitor_half_period_us(&mon), half_period_us, EDGE_JITTER_US);
+    }
+
+    zc_monitor_take_stats(&mon, &stats);
+    trace(&mon, &zero_us, 10200, 1000, EDGE_JITTER_US);
+    zc_monitor_take_stats(&mon, &stats);
+
+    TEST_NEAR(stats.freq_mhz, 49020, 10);
+    TEST_CHECK(stats.jitter_p99_us <= 2 * EDGE_JITTER_US);
+    TEST_EQ(stats.missed, 0);
+}
+
+static void test_noise_and_missed_edges(void)
+{
+    zc_monitor_t mon;
+    zc_stats_t stats;
+    uint64_t zero_us = 0;
+
+    zc_monitor_init(&mon);
+    trace(&mon, &zero_us, 10000, 20, 0);
+
+    // Bounce right after the edge: rejected, the schedule stays
+    TEST_CHECK(!zc_monitor_capture(&mon, zero_us + 300));
+    TEST_EQ(zc_monitor_last_zero_us(&mon), zero_us);
+
+    // Three edges never come
+    zero_us += 3 * 10000;
+    trace(&mon, &zero_us, 10000, 20, 0);
+    zc_monitor_take_stats(&mon, &stats);
+
+    TEST_EQ(zc_monitor_half_period_us(&mon), 10000);
+    TEST_EQ(stats.noise, 1);
+    TEST_EQ(stats.missed, 3);
+    TEST_EQ(stats.freq_mhz, 50000);
+}
+
+// Edges not drained in time are lost and counted, the timing base is not
+static void test_ring_overflow(void)
+{
+    zc_monitor_t mon;
+    zc_stats_t stats;
+    uint64_t zero_us = 0;
+
+    zc_monitor_init(&mon);
+
+    for(uint32_t edge = 0; edge < ZC_MONITOR_RING_SIZE + 8; ++edge)
+    {
+        zero_us += 10000;
+        TEST_CHECK(zc_monitor_capture(&mon, zero_us));
+    }
+
+    zc_monitor_take_stats(&mon, &stats);
+    TEST_EQ(stats.overflows, 8);
+    TEST_EQ(zc_monitor_half_period_us(&mon), 10000);
+    TEST_EQ(zc_monitor_last_zero_us(&mon), zero_us);
+}
+
+int main(void)
+{
+    TEST_RUN(test_nominal_before_edges);
+    TEST_RUN(test_50hz);
+    TEST_RUN(test_60hz);
+    TEST_RUN(test_drift_with_jitter);
+    TEST_RUN(test_noise_and_missed_edges);
+    TEST_RUN(test_ring_overflow);
+
+    return test_result();
+}
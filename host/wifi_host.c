@@ -0,0 +1,63 @@
+#include <string.h>
+
+#include "wifi.h"
+#include "hal.h"
+
+
+/*******************************************************
+ LOCAL VARIABLES
+ *******************************************************/
+
+static const char *TAG = "WIFI";
+
+// The host network is up from the start
+static char Ip_addr[] = "127.0.0.1";
+
+
+/****************************************
+ EXTERNAL FUNCTIONS
+*****************************************/
+
+/**
+ * @brief Nothing to start, the host is connected already
+ */
+void wifi_start(void)
+{
+    HAL_LOGI(TAG, "Host network, got ip:%s", Ip_addr);
+}
+
+/**
+ * @brief Waits for the connection
+ *
+ * @param timeout_ms Not used
+ * @return true, always connected
+ */
+bool wifi_wait_connected(uint32_t timeout_ms)
+{
+    (void) timeout_ms;
+
+    return true;
+}
+
+/**
+ * @brief Gets the IP address
+ *
+ * @return Address as text
+ */
+char* wifi_get_ip(void)
+{
+    return Ip_addr;
+}
+
+/**
+ * @brief Gets the reconnection statistics: the start-up connection only
+ *
+ * @param stats Output: statistics
+ */
+void wifi_get_reconnect_stats(wifi_reconnect_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->reconnects = 1;
+    stats->last_attempts = 1;
+    stats->max_ms = 0;
+}
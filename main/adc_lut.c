@@ -0,0 +1,46 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "adc_lut.h"
+
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Fills the table by running the reference conversion once per raw code
+ *
+ * @param lut   Table to fill
+ * @param ref   Reference conversion, e.g. the characterization math of the ADC
+ * @param ctx   Passed to ref as is
+ */
+void adc_lut_init(adc_lut_t *lut, adc_lut_ref_t ref, const void *ctx)
+{
+    uint32_t mv;
+
+    for(uint32_t raw = 0; raw < ADC_LUT_SIZE; ++raw)
+    {
+        mv = ref(raw, ctx);
+        lut->mv[raw] = (mv > UINT16_MAX) ? UINT16_MAX : (uint16_t)mv;
+    }
+}
+
+/**
+ * @brief Converts a block of raw ADC codes to millivolts
+ *
+ * The loop has no branches: codes are masked to the table size, so a
+ * corrupted sample cannot index outside the table.
+ *
+ * @param lut   Filled table
+ * @param raw   Raw ADC codes
+ * @param mv    Output: voltages in mV, may be the same buffer as raw
+ * @param count Number of samples
+ */
+void adc_lut_convert(const adc_lut_t *lut, const uint16_t *raw, uint16_t *mv, size_t count)
+{
+    for(size_t idx = 0; idx < count; ++idx)
+    {
+        mv[idx] = lut->mv[raw[idx] & ADC_LUT_RAW_MASK];
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef _ADC_LUT_H_
+#define _ADC_LUT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**********************************
+ CONSTANTS AND MACROS
+***********************************/
+
+#define ADC_LUT_BITS        12
+#define ADC_LUT_SIZE        (1 << ADC_LUT_BITS)
+#define ADC_LUT_RAW_MASK    (ADC_LUT_SIZE - 1)
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+/**
+ * @brief Reference conversion used to fill the table
+ *
+ * @param raw   Raw ADC code
+ * @param ctx   Calibration data of the reference conversion
+ * @return Voltage in mV
+ */
+typedef uint32_t (*adc_lut_ref_t)(uint32_t raw, const void *ctx);
+
+/**
+ * @brief Calibrated millivolt value for every raw ADC code
+ */
+typedef struct {
+    uint16_t    mv[ADC_LUT_SIZE];
+} adc_lut_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+void    adc_lut_init(adc_lut_t *lut, adc_lut_ref_t ref, const void *ctx);
+void    adc_lut_convert(const adc_lut_t *lut, const uint16_t *raw, uint16_t *mv, size_t count);
+
+#endif // _ADC_LUT_H_
@@ -0,0 +1,156 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "current_rms.h"
+#include "isqrt.h"
+
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+/**
+ * @brief Computes mean and AC RMS from the running sums of a window
+ *
+ * Uses n * sum(x^2) - sum(x)^2 = n^2 * variance, so no division happens
+ * before the subtraction and the result stays exact for 16-bit samples.
+ *
+ * @param count     Number of samples
+ * @param sum       Sum of samples
+ * @param sum_sq    Sum of squared samples
+ * @param result    Output
+ */
+static void rms_from_sums(uint32_t count, uint32_t sum, uint64_t sum_sq, current_rms_result_t *result)
+{
+    uint64_t n_var;
+
+    if(count == 0)
+    {
+        result->mean = 0;
+        result->rms = 0;
+        return;
+    }
+
+    n_var = (uint64_t)count * sum_sq - (uint64_t)sum * sum;
+
+    result->mean = sum / count;
+    result->rms = isqrt64(n_var) / count;
+}
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Computes the true RMS of a complete block of samples
+ *
+ * The DC offset of the current sensor is removed, so the block should span
+ * a whole number of mains cycles.
+ *
+ * @param samples   Input samples
+ * @param count     Number of samples, up to 65536
+ * @param result    Output
+ */
+void current_rms_calc(const uint16_t *samples, size_t count, current_rms_result_t *result)
+{
+    uint32_t sum = 0;
+    uint64_t sum_sq = 0;
+
+    for(size_t idx = 0; idx < count; ++idx)
+    {
+        uint32_t sample = samples[idx];
+
+        sum += sample;
+        sum_sq += sample * sample;
+    }
+
+    rms_from_sums(count, sum, sum_sq, result);
+}
+
+/**
+ * @brief Starts a new streaming accumulator
+ *
+ * @param acc               Accumulator
+ * @param window_samples    Samples in a whole number of mains cycles, up to 65536
+ */
+void current_rms_init(current_rms_t *acc, uint32_t window_samples)
+{
+    acc->window_samples = window_samples;
+    acc->count = 0;
+    acc->sum = 0;
+    acc->sum_sq = 0;
+}
+
+/**
+ * @brief Changes the window length, e.g. to follow the mains period. Call it
+ *        between windows, after current_rms_take().
+ *
+ * @param acc               Accumulator
+ * @param window_samples    Samples in a whole number of mains cycles, up to 65536
+ */
+void current_rms_set_window(current_rms_t *acc, uint32_t window_samples)
+{
+    acc->window_samples = window_samples;
+}
+
+/**
+ * @brief Accumulates samples until the window is complete
+ *
+ * @param acc       Accumulator
+ * @param samples   Input samples
+ * @param count     Number of input samples
+ * @return Number of samples consumed. Less than count when the window got
+ *         complete: take the result and feed the rest again.
+ */
+size_t current_rms_feed(current_rms_t *acc, const uint16_t *samples, size_t count)
+{
+    size_t room = acc->window_samples - acc->count;
+    uint32_t sum = acc->sum;
+    uint64_t sum_sq = acc->sum_sq;
+
+    if(count > room)
+    {
+        count = room;
+    }
+
+    for(size_t idx = 0; idx < count; ++idx)
+    {
+        uint32_t sample = samples[idx];
+
+        sum += sample;
+        sum_sq += sample * sample;
+    }
+
+    acc->sum = sum;
+    acc->sum_sq = sum_sq;
+    acc->count += count;
+
+    return count;
+}
+
+/**
+ * @brief Tells whether the window is complete
+ *
+ * @param acc Accumulator
+ * @return true when current_rms_take() has to be called
+ */
+bool current_rms_ready(const current_rms_t *acc)
+{
+    return acc->count >= acc->window_samples;
+}
+
+/**
+ * @brief Returns the result of the complete window and starts the next one
+ *
+ * @param acc       Accumulator
+ * @param result    Output
+ */
+void current_rms_take(current_rms_t *acc, current_rms_result_t *result)
+{
+    rms_from_sums(acc->count, acc->sum, acc->sum_sq, result);
+
+    acc->count = 0;
+    acc->sum = 0;
+    acc->sum_sq = 0;
+}
@@ -0,0 +1,42 @@
+#ifndef _CURRENT_RMS_H_
+#define _CURRENT_RMS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+/**
+ * @brief Running sums of one RMS window (a whole number of mains cycles)
+ */
+typedef struct {
+    uint32_t    window_samples;     // Samples in the window
+    uint32_t    count;              // Samples accumulated so far
+    uint32_t    sum;
+    uint64_t    sum_sq;
+} current_rms_t;
+
+/**
+ * @brief Result of one window, in the units of the input samples
+ */
+typedef struct {
+    uint32_t    mean;               // DC offset of the sensor
+    uint32_t    rms;                // True RMS of the AC component
+} current_rms_result_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+void    current_rms_calc(const uint16_t *samples, size_t count, current_rms_result_t *result);
+
+void    current_rms_init(current_rms_t *acc, uint32_t window_samples);
+void    current_rms_set_window(current_rms_t *acc, uint32_t window_samples);
+size_t  current_rms_feed(current_rms_t *acc, const uint16_t *samples, size_t count);
+bool    current_rms_ready(const current_rms_t *acc);
+void    current_rms_take(current_rms_t *acc, current_rms_result_t *result);
+
+#endif // _CURRENT_RMS_H_
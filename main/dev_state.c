@@ -0,0 +1,217 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "dev_state.h"
+#include "hal.h"
+
+
+/*******************************************************
+ LOCAL VARIABLES
+ *******************************************************/
+
+/* The one copy of the load and LED states. Every change is applied to every
+ * sink under the lock, so the sinks see the changes in version order even
+ * when the UI and MQTT tasks change the state at the same time. */
+static dev_state_snapshot_t     State = {
+    .version = 0,
+    .value = {
+        [DEV_HEATER]    = HW_OFF,
+        [DEV_FAN]       = HW_LVL_OFF,
+        [DEV_LIGHT]     = HW_OFF,
+        [DEV_LED]       = HW_OFF
+    }
+};
+
+static dev_state_sink_cb_t      Sinks[DEV_SINK_CNT];
+static dev_state_flush_cb_t     Flushes[DEV_SINK_CNT];
+static hal_mutex_t              Lock = NULL;
+
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+/**
+ * @brief Checks a value against the range of its field
+ *
+ * @param field Field
+ * @param value Value
+ * @return true if the value is valid
+ */
+static bool dev_state_valid(dev_field_t field, uint32_t value)
+{
+    switch(field) {
+    case DEV_FAN:
+        return value >= HW_LVL_OFF && value <= HW_LVL_VERY_HIGH;
+
+    case DEV_HEATER:
+    case DEV_LIGHT:
+    case DEV_LED:
+        return value == HW_OFF || value == HW_ON;
+
+    default:
+        return false;
+    }
+}
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Creates the lock of the store, call before any other function
+ */
+void dev_state_init(void)
+{
+    Lock = hal_mutex_create();
+}
+
+/**
+ * @brief Attaches a sink and replays the current state to it, so a sink that
+ *        starts late begins from the same state as the others
+ *
+ * @param sink  Sink slot
+ * @param cb    Callback of every change
+ * @param flush Callback at the end of every group, may be NULL
+ */
+void dev_state_subscribe(dev_sink_t sink, dev_state_sink_cb_t cb, dev_state_flush_cb_t flush)
+{
+    if(sink >= DEV_SINK_CNT)
+    {
+        return;
+    }
+
+    hal_mutex_lock(Lock);
+
+    Sinks[sink] = cb;
+    Flushes[sink] = flush;
+
+    // The replay is one group
+    for(int field = 0; field < DEV_FIELD_CNT; ++field)
+    {
+        cb((dev_field_t)field, State.value[field], DEV_ORIGIN_RESTORE);
+    }
+
+    if(flush != NULL)
+    {
+        flush();
+    }
+
+    hal_mutex_unlock(Lock);
+}
+
+/**
+ * @brief Changes one field and delivers the change once to every sink.
+ *        Not callable from an ISR.
+ *
+ * @param field     Field
+ * @param value     New value
+ * @param origin    Source of the change
+ * @return true     if the value changed
+ * @return false    if it is invalid or equal to the current one
+ */
+bool dev_state_set(dev_field_t field, uint32_t value, dev_origin_t origin)
+{
+    const dev_change_t change = {
+        .field = field,
+        .value = value
+    };
+
+    return dev_state_set_group(&change, 1, origin) != 0;
+}
+
+/**
+ * @brief Changes several fields as one version. Every sink gets the changed
+ *        fields, then its flush, so e.g. the HW sink switches grouped loads
+ *        in the same instant. Not callable from an ISR.
+ *
+ * @param changes   Changes, invalid and unchanged ones are skipped
+ * @param count     Number of changes
+ * @param origin    Source of the changes
+ * @return Number of fields that changed
+ */
+size_t dev_state_set_group(const dev_change_t *changes, size_t count, dev_origin_t origin)
+{
+    uint8_t previous[DEV_FIELD_CNT];
+    size_t changed = 0;
+
+    hal_mutex_lock(Lock);
+
+    memcpy(previous, State.value, sizeof(previous));
+
+    // A field listed twice takes its last valid value
+    for(size_t idx = 0; idx < count; ++idx)
+    {
+        if(dev_state_valid(changes[idx].field, changes[idx].value))
+        {
+            State.value[changes[idx].field] = (uint8_t)changes[idx].value;
+        }
+    }
+
+    for(int field = 0; field < DEV_FIELD_CNT; ++field)
+    {
+        changed += (State.value[field] != previous[field]);
+    }
+
+    if(changed == 0)
+    {
+        hal_mutex_unlock(Lock);
+        return 0;
+    }
+
+    State.version++;
+
+    for(int sink = 0; sink < DEV_SINK_CNT; ++sink)
+    {
+        if(Sinks[sink] == NULL)
+        {
+            continue;
+        }
+
+        for(int field = 0; field < DEV_FIELD_CNT; ++field)
+        {
+            if(State.value[field] != previous[field])
+            {
+                Sinks[sink]((dev_field_t)field, State.value[field], origin);
+            }
+        }
+
+        if(Flushes[sink] != NULL)
+        {
+            Flushes[sink]();
+        }
+    }
+
+    hal_mutex_unlock(Lock);
+
+    return changed;
+}
+
+/**
+ * @brief Reads one field without locking
+ *
+ * @param field Field
+ * @return Value
+ */
+uint32_t dev_state_get(dev_field_t field)
+{
+    if(field >= DEV_FIELD_CNT)
+    {
+        return 0;
+    }
+
+    return State.value[field];
+}
+
+/**
+ * @brief Copies the whole state with its version
+ *
+ * @param snap Output
+ */
+void dev_state_snapshot(dev_state_snapshot_t *snap)
+{
+    hal_mutex_lock(Lock);
+    memcpy(snap, &State, sizeof(*snap));
+    hal_mutex_unlock(Lock);
+}
@@ -0,0 +1,80 @@
+#ifndef _DEV_STATE_H_
+#define _DEV_STATE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "hw_ctrl.h"
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+// User controlled device state
+typedef enum {
+    DEV_HEATER = 0,     // hw_state_t
+    DEV_FAN,            // hw_electr_lvl_t
+    DEV_LIGHT,          // hw_state_t
+    DEV_LED,            // hw_state_t
+    DEV_FIELD_CNT
+} dev_field_t;
+
+// Where a change comes from, so a sink can skip its own changes
+typedef enum {
+    DEV_ORIGIN_RESTORE = 0,     // NVS at boot, or the replay to a new sink
+    DEV_ORIGIN_UI,
+    DEV_ORIGIN_MQTT,
+    DEV_ORIGIN_TRIP             // Loads opened by the overcurrent protection
+} dev_origin_t;
+
+// Sinks are called in this order for every change
+typedef enum {
+    DEV_SINK_HW = 0,
+    DEV_SINK_MQTT,
+    DEV_SINK_UI,
+    DEV_SINK_CNT
+} dev_sink_t;
+
+/**
+ * @brief Applies one change. Runs in the context of the task changing the
+ *        state, with the store locked: it must not block for long and must
+ *        not call dev_state_set().
+ */
+typedef void (*dev_state_sink_cb_t)(dev_field_t field, uint32_t value, dev_origin_t origin);
+
+/**
+ * @brief Optional end of a group of changes, so a sink can apply all the
+ *        changes of a group at once. Same rules as dev_state_sink_cb_t.
+ */
+typedef void (*dev_state_flush_cb_t)(void);
+
+/**
+ * @brief One change of a group
+ */
+typedef struct {
+    dev_field_t field;
+    uint32_t    value;
+} dev_change_t;
+
+/**
+ * @brief Consistent copy of the whole state
+ */
+typedef struct {
+    uint32_t    version;                    // Incremented by every change or group of changes
+    uint8_t     value[DEV_FIELD_CNT];
+} dev_state_snapshot_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+void        dev_state_init(void);
+void        dev_state_subscribe(dev_sink_t sink, dev_state_sink_cb_t cb, dev_state_flush_cb_t flush);
+
+bool        dev_state_set(dev_field_t field, uint32_t value, dev_origin_t origin);
+size_t      dev_state_set_group(const dev_change_t *changes, size_t count, dev_origin_t origin);
+uint32_t    dev_state_get(dev_field_t field);
+void        dev_state_snapshot(dev_state_snapshot_t *snap);
+
+#endif // _DEV_STATE_H_
@@ -0,0 +1,173 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "energy_meter.h"
+
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Clears all totals and sets the checkpoint policy
+ *
+ * @param meter             Meter state
+ * @param checkpoint_wh     Unsaved energy of any channel that triggers a checkpoint
+ * @param checkpoint_min    Age of unsaved energy that triggers a checkpoint
+ * @param now_ms            Current time
+ */
+void energy_meter_init(energy_meter_t *meter, uint32_t checkpoint_wh, uint32_t checkpoint_min, uint32_t now_ms)
+{
+    for(uint32_t ch = 0; ch < ENERGY_METER_CHANNELS; ++ch)
+    {
+        meter->total_uj[ch] = 0;
+        meter->saved_uj[ch] = 0;
+    }
+
+    meter->checkpoint_uj = (uint64_t)checkpoint_wh * ENERGY_METER_UJ_PER_WH;
+    meter->checkpoint_ms = checkpoint_min * 60 * 1000;
+    meter->last_save_ms = now_ms;
+}
+
+/**
+ * @brief Loads the totals of the last checkpoint
+ *
+ * @param meter     Meter state
+ * @param total_uj  ENERGY_METER_CHANNELS totals in uJ
+ */
+void energy_meter_restore(energy_meter_t *meter, const uint64_t *total_uj)
+{
+    for(uint32_t ch = 0; ch < ENERGY_METER_CHANNELS; ++ch)
+    {
+        meter->total_uj[ch] = total_uj[ch];
+        meter->saved_uj[ch] = total_uj[ch];
+    }
+}
+
+/**
+ * @brief Integrates power over one measurement interval
+ *
+ * @param meter     Meter state
+ * @param channel   0 .. ENERGY_METER_CHANNELS - 1
+ * @param power_mw  Average power in the interval
+ * @param dt_ms     Length of the interval
+ */
+void energy_meter_add(energy_meter_t *meter, uint32_t channel, uint32_t power_mw, uint32_t dt_ms)
+{
+    if(channel >= ENERGY_METER_CHANNELS)
+    {
+        return;
+    }
+
+    meter->total_uj[channel] += (uint64_t)power_mw * dt_ms;
+}
+
+/**
+ * @brief Splits the power of one measurement interval between the channels
+ *        in proportion to their weights
+ *
+ * The rounding rest goes to the last weighted channel, the sum of the
+ * channels gets the whole energy. Nothing is added if every weight is 0.
+ *
+ * @param meter     Meter state
+ * @param weight    ENERGY_METER_CHANNELS weights, 0 for a channel that is off
+ * @param power_mw  Average power in the interval
+ * @param dt_ms     Length of the interval
+ */
+void energy_meter_add_shared(energy_meter_t *meter, const uint32_t *weight, uint32_t power_mw, uint32_t dt_ms)
+{
+    uint64_t energy_uj = (uint64_t)power_mw * dt_ms;
+    uint64_t rest_uj = energy_uj;
+    uint64_t weight_sum = 0;
+    uint32_t last = ENERGY_METER_CHANNELS;
+
+    for(uint32_t ch = 0; ch < ENERGY_METER_CHANNELS; ++ch)
+    {
+        weight_sum += weight[ch];
+        if(weight[ch] != 0)
+        {
+            last = ch;
+        }
+    }
+
+    if(weight_sum == 0)
+    {
+        return;
+    }
+
+    for(uint32_t ch = 0; ch < last; ++ch)
+    {
+        uint64_t share_uj = energy_uj * weight[ch] / weight_sum;
+
+        meter->total_uj[ch] += share_uj;
+        rest_uj -= share_uj;
+    }
+
+    meter->total_uj[last] += rest_uj;
+}
+
+/**
+ * @brief Gets the total energy of a channel
+ *
+ * @param meter     Meter state
+ * @param channel   0 .. ENERGY_METER_CHANNELS - 1
+ * @return Energy in Wh
+ */
+uint32_t energy_meter_get_wh(const energy_meter_t *meter, uint32_t channel)
+{
+    if(channel >= ENERGY_METER_CHANNELS)
+    {
+        return 0;
+    }
+
+    return (uint32_t)(meter->total_uj[channel] / ENERGY_METER_UJ_PER_WH);
+}
+
+/**
+ * @brief Decides whether the totals have to be written to flash now
+ *
+ * A checkpoint is due when any channel has accumulated checkpoint_wh since the
+ * last one, or when unsaved energy is older than checkpoint_min. An idle
+ * meter never asks for a write.
+ *
+ * @param meter     Meter state
+ * @param now_ms    Current time
+ * @return true if the caller has to persist the totals
+ */
+bool energy_meter_checkpoint_due(const energy_meter_t *meter, uint32_t now_ms)
+{
+    bool dirty = false;
+
+    for(uint32_t ch = 0; ch < ENERGY_METER_CHANNELS; ++ch)
+    {
+        uint64_t unsaved_uj = meter->total_uj[ch] - meter->saved_uj[ch];
+
+        if(unsaved_uj >= meter->checkpoint_uj)
+        {
+            return true;
+        }
+
+        if(unsaved_uj != 0)
+        {
+            dirty = true;
+        }
+    }
+
+    return dirty && (uint32_t)(now_ms - meter->last_save_ms) >= meter->checkpoint_ms;
+}
+
+/**
+ * @brief Marks the current totals as persisted
+ *
+ * @param meter     Meter state
+ * @param now_ms    Current time
+ */
+void energy_meter_checkpoint_done(energy_meter_t *meter, uint32_t now_ms)
+{
+    for(uint32_t ch = 0; ch < ENERGY_METER_CHANNELS; ++ch)
+    {
+        meter->saved_uj[ch] = meter->total_uj[ch];
+    }
+
+    meter->last_save_ms = now_ms;
+}
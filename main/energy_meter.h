@@ -0,0 +1,47 @@
+#ifndef _ENERGY_METER_H_
+#define _ENERGY_METER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**********************************
+ CONSTANTS AND MACROS
+***********************************/
+
+#define ENERGY_METER_CHANNELS   3
+#define ENERGY_METER_UJ_PER_WH  3600000000ULL
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+/**
+ * @brief Energy totals of all load channels and their checkpoint state
+ *
+ * Energy is kept in uJ (mW * ms) so short integration steps do not lose
+ * precision. The totals at the last checkpoint tell how much would be lost
+ * on a power cut and drive the checkpoint decision.
+ */
+typedef struct {
+    uint64_t    total_uj[ENERGY_METER_CHANNELS];
+    uint64_t    saved_uj[ENERGY_METER_CHANNELS];
+    uint64_t    checkpoint_uj;          // Unsaved energy that forces a checkpoint
+    uint32_t    checkpoint_ms;          // Age of unsaved energy that forces a checkpoint
+    uint32_t    last_save_ms;
+} energy_meter_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+void        energy_meter_init(energy_meter_t *meter, uint32_t checkpoint_wh, uint32_t checkpoint_min, uint32_t now_ms);
+void        energy_meter_restore(energy_meter_t *meter, const uint64_t *total_uj);
+
+void        energy_meter_add(energy_meter_t *meter, uint32_t channel, uint32_t power_mw, uint32_t dt_ms);
+void        energy_meter_add_shared(energy_meter_t *meter, const uint32_t *weight, uint32_t power_mw, uint32_t dt_ms);
+uint32_t    energy_meter_get_wh(const energy_meter_t *meter, uint32_t channel);
+
+bool        energy_meter_checkpoint_due(const energy_meter_t *meter, uint32_t now_ms);
+void        energy_meter_checkpoint_done(energy_meter_t *meter, uint32_t now_ms);
+
+#endif // _ENERGY_METER_H_
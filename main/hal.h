@@ -0,0 +1,229 @@
+#ifndef _HAL_H_
+#define _HAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "adc_lut.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#else
+#include <pthread.h>
+#endif
+
+/**********************************
+ CONSTANTS AND MACROS
+***********************************/
+
+#define HAL_ADC_FRAME_SAMPLES   256     // Most samples returned by one hal_adc_read()
+
+#define HAL_WAIT_FOREVER        UINT32_MAX
+#define HAL_CORE_ANY            (-1)    // Task runs on any core
+
+/* Logging, the placement of interrupt handlers and the ISR safe lock map to
+ * ESP-IDF on the target. Elsewhere the log goes through hal_log() and the
+ * lock is a mutex, the simulated interrupts run in threads. */
+#ifdef ESP_PLATFORM
+
+#define HAL_LOGE(tag, ...)          ESP_LOGE(tag, __VA_ARGS__)
+#define HAL_LOGW(tag, ...)          ESP_LOGW(tag, __VA_ARGS__)
+#define HAL_LOGI(tag, ...)          ESP_LOGI(tag, __VA_ARGS__)
+#define HAL_LOGD(tag, ...)          ESP_LOGD(tag, __VA_ARGS__)
+
+#define HAL_ISR_ATTR                IRAM_ATTR   // Code run from interrupt handlers
+
+#define HAL_SPINLOCK_INITIALIZER    portMUX_INITIALIZER_UNLOCKED
+
+#else
+
+#define HAL_LOGE(tag, ...)          hal_log(HAL_LOG_ERROR, tag, __VA_ARGS__)
+#define HAL_LOGW(tag, ...)          hal_log(HAL_LOG_WARN, tag, __VA_ARGS__)
+#define HAL_LOGI(tag, ...)          hal_log(HAL_LOG_INFO, tag, __VA_ARGS__)
+#define HAL_LOGD(tag, ...)          hal_log(HAL_LOG_DEBUG, tag, __VA_ARGS__)
+
+#define HAL_ISR_ATTR
+
+#define HAL_SPINLOCK_INITIALIZER    PTHREAD_MUTEX_INITIALIZER
+
+#endif
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+typedef enum {
+    HAL_EDGE_RISING = 0,
+    HAL_EDGE_FALLING
+} hal_edge_t;
+
+// Same values as esp_log_level_t
+typedef enum {
+    HAL_LOG_NONE = 0,
+    HAL_LOG_ERROR,
+    HAL_LOG_WARN,
+    HAL_LOG_INFO,
+    HAL_LOG_DEBUG,
+    HAL_LOG_VERBOSE
+} hal_log_level_t;
+
+/**
+ * @brief GPIO edge handler, runs in interrupt context
+ */
+typedef void (*hal_gpio_isr_t)(void *arg);
+
+/**
+ * @brief Phase timer alarm handler, runs in interrupt context
+ *
+ * @return true if a higher priority task was woken
+ */
+typedef bool (*hal_timer_isr_t)(void *arg);
+
+/**
+ * @brief Periodic timer callback, runs in the timer task
+ */
+typedef void (*hal_timer_cb_t)(void *arg);
+
+/**
+ * @brief Task entry point
+ */
+typedef void (*hal_task_fn_t)(void *arg);
+
+#ifdef ESP_PLATFORM
+typedef portMUX_TYPE            hal_spinlock_t;
+#else
+typedef pthread_mutex_t         hal_spinlock_t;
+#endif
+
+typedef struct hal_task *       hal_task_t;
+typedef struct hal_mutex *      hal_mutex_t;
+typedef struct hal_signal *     hal_signal_t;
+
+// MQTT client events
+typedef enum {
+    HAL_MQTT_CONNECTED = 0,
+    HAL_MQTT_DISCONNECTED,
+    HAL_MQTT_SUBSCRIBED,
+    HAL_MQTT_PUBLISHED,         // QoS 1 message acknowledged by the broker
+    HAL_MQTT_DATA,
+    HAL_MQTT_ERROR
+} hal_mqtt_event_id_t;
+
+/**
+ * @brief MQTT client event. The topic and the data are not terminated and
+ *        are valid during the handler call only.
+ */
+typedef struct {
+    hal_mqtt_event_id_t id;
+    int             msg_id;             // SUBSCRIBED, PUBLISHED
+    bool            session_present;    // CONNECTED: the broker kept the session
+    const char *    topic;              // DATA
+    int             topic_len;
+    const char *    data;               // DATA
+    int             data_len;
+} hal_mqtt_event_t;
+
+/**
+ * @brief MQTT event handler, runs in the MQTT client task
+ */
+typedef void (*hal_mqtt_handler_t)(const hal_mqtt_event_t *event);
+
+typedef struct {
+    const char *    uri;                // "mqtt://host"
+    uint16_t        port;
+    const char *    username;
+    const char *    password;
+    const char *    client_id;
+    bool            clean_session;      // false: the broker keeps the session across connections
+} hal_mqtt_cfg_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+/*
+ * Board access used by the application. hal_esp32.c implements it with the
+ * ESP-IDF drivers, another implementation can run the same application code
+ * against simulated pins, sensor samples and mains zero crossings.
+ * Functions marked "ISR safe" may be called from interrupt handlers.
+ */
+
+// GPIO
+void        hal_gpio_output(int pin);
+void        hal_gpio_input(int pin);
+void        hal_gpio_set_level(int pin, uint32_t level);                // ISR safe
+void        hal_gpio_write_mask(uint64_t set_mask, uint64_t clear_mask);    // ISR safe
+int         hal_gpio_get_level(int pin);                                // ISR safe
+void        hal_gpio_isr(int pin, hal_edge_t edge, hal_gpio_isr_t isr, void *arg);
+
+// PWM outputs
+void        hal_pwm_init(int channel, int pin, uint32_t freq_hz);
+void        hal_pwm_set(int channel, uint32_t duty_permille);
+
+// Monotonic time since boot
+int64_t     hal_time_us(void);                                          // ISR safe
+uint32_t    hal_time_ms(void);
+uint32_t    hal_cpu_cycles(void);                                       // ISR safe, wraps
+
+// Current sensor, sampled continuously
+bool        hal_adc_calibrate(adc_lut_t *lut);
+void        hal_adc_start(uint32_t sample_rate_hz);
+size_t      hal_adc_read(uint16_t *samples, size_t max_samples);
+
+// Free running 1 us timer with a one-shot alarm, used for phase control
+void        hal_phase_timer_init(hal_timer_isr_t isr, void *arg);
+uint64_t    hal_phase_timer_now_us(void);                               // ISR safe
+void        hal_phase_timer_alarm(uint64_t alarm_us);                   // ISR safe
+
+// Second one-shot timer, used for zero-cross aligned relay switching
+void        hal_relay_timer_init(hal_timer_isr_t isr, void *arg);
+void        hal_relay_timer_alarm_after(uint32_t delay_us);             // ISR safe
+
+// Periodic callbacks in the timer task
+void        hal_timer_periodic(hal_timer_cb_t cb, void *arg, const char *name, uint32_t period_us);
+
+// Tasks
+hal_task_t  hal_task_create(hal_task_fn_t fn, const char *name, uint32_t stack_bytes, int priority, int core);
+hal_task_t  hal_task_self(void);
+void        hal_task_notify(hal_task_t task);
+void        hal_task_notify_from_isr(hal_task_t task);                  // ISR safe
+bool        hal_task_wait(uint32_t timeout_ms);
+void        hal_task_exit(void);
+
+// Locks: mutexes between tasks, spinlocks between tasks and interrupt handlers
+hal_mutex_t hal_mutex_create(void);
+void        hal_mutex_lock(hal_mutex_t mutex);
+void        hal_mutex_unlock(hal_mutex_t mutex);
+void        hal_spin_lock(hal_spinlock_t *lock);                        // ISR safe
+void        hal_spin_unlock(hal_spinlock_t *lock);                      // ISR safe
+
+// One-time events between tasks
+hal_signal_t hal_signal_create(void);
+void        hal_signal_give(hal_signal_t signal);
+bool        hal_signal_wait(hal_signal_t signal, uint32_t timeout_ms);
+
+// Non-volatile storage, the writes are committed
+void        hal_nvs_init(void);
+bool        hal_nvs_get_u32(const char *space, const char *key, uint32_t *value);
+bool        hal_nvs_set_u32(const char *space, const char *key, uint32_t value);
+bool        hal_nvs_get_blob(const char *space, const char *key, void *data, size_t size);
+bool        hal_nvs_set_blob(const char *space, const char *key, const void *data, size_t size);
+
+// System
+void        hal_on_shutdown(void (*handler)(void));
+void        hal_read_mac(uint8_t mac[6]);
+void *      hal_malloc_dma(size_t size);
+void        hal_log_level_set(const char *tag, hal_log_level_t level);
+#ifndef ESP_PLATFORM
+void        hal_log(hal_log_level_t level, const char *tag, const char *fmt, ...);
+#endif
+
+// MQTT client, one per application
+bool        hal_mqtt_start(const hal_mqtt_cfg_t *cfg, hal_mqtt_handler_t handler);
+int         hal_mqtt_publish(const char *topic, const void *data, size_t len, int qos, bool retain);
+int         hal_mqtt_subscribe(const char *filter, int qos);
+
+#endif // _HAL_H_
@@ -0,0 +1,1002 @@
+#include <string.h>
+#include <stdatomic.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_adc_cal.h"
+#include "esp_cpu.h"
+#include "esp_system.h"
+#include "esp_mac.h"
+#include "esp_heap_caps.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "mqtt_client.h"
+
+#include "driver/adc.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "driver/timer.h"
+#include "soc/gpio_struct.h"
+
+#include "hal.h"
+
+
+/*******************************************************
+ CONSTANTS
+ *******************************************************/
+
+// Current sensor
+#define ADC1_CURRENT_CHANNEL    ADC1_CHANNEL_4
+#define ADC_CURRENT_ATTEN       ADC_ATTEN_DB_11
+#define ADC_CALI_SCHEME         ESP_ADC_CAL_VAL_EFUSE_VREF
+#define ADC_NOMINAL_VREF_MV     1100
+
+// DMA frames
+#define ADC_FRAME_BYTES         (HAL_ADC_FRAME_SAMPLES * SOC_ADC_DIGI_RESULT_BYTES)
+#define ADC_BUFFER_BYTES        (ADC_FRAME_BYTES * 8)
+
+// PWM outputs share one LEDC timer
+#define PWM_SPEED_MODE          LEDC_HIGH_SPEED_MODE
+#define PWM_TIMER               LEDC_TIMER_0
+#define PWM_RESOLUTION          LEDC_TIMER_10_BIT
+#define PWM_DUTY_MAX            ((1 << 10) - 1)
+
+// Phase control timer: free running, 1 us per tick
+#define PHASE_TIMER_GROUP       TIMER_GROUP_1
+#define PHASE_TIMER_IDX         TIMER_0
+#define PHASE_TIMER_DIVIDER     80      // 80 MHz APB clock / 80 = 1 MHz
+
+// Relay switching timer, same clock as the phase control timer
+#define RELAY_TIMER_GROUP       TIMER_GROUP_1
+#define RELAY_TIMER_IDX         TIMER_1
+
+// GPIO ISR service, installed by the first hal_gpio_isr() call
+#define GPIO_ISR_NONE           0
+#define GPIO_ISR_INSTALLING     1
+#define GPIO_ISR_INSTALLED      2
+
+/*******************************************************
+ FUNCTION PROTOTYPES
+ *******************************************************/
+
+static uint32_t adc_cal_raw_to_mv(uint32_t raw, const void *ctx);
+static void hal_timer_start(timer_group_t group, timer_idx_t idx, hal_timer_isr_t isr, void *arg);
+static void log_error_if_nonzero(const char *message, int error_code);
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
+
+/*******************************************************
+ LOCAL VARIABLES
+ *******************************************************/
+
+static const char *TAG = "HAL";
+
+static esp_adc_cal_characteristics_t adc1_chars;
+static atomic_int Gpio_isr_service = GPIO_ISR_NONE;
+
+static esp_mqtt_client_handle_t Mqtt_client = NULL;
+static hal_mqtt_handler_t   Mqtt_handler = NULL;
+
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+/**
+ * @brief Reference conversion for the calibration table
+ *
+ * @param raw Raw ADC code
+ * @param ctx ADC characteristics
+ * @return Voltage in mV
+ */
+static uint32_t adc_cal_raw_to_mv(uint32_t raw, const void *ctx)
+{
+    return esp_adc_cal_raw_to_voltage(raw, (const esp_adc_cal_characteristics_t *)ctx);
+}
+
+/**
+ * The function logs an error message if the error code is non-zero.
+ * 
+ * @param message The message parameter is a string that describes the error or the context in which
+ * the error occurred. It is used to provide additional information about the error in the log message.
+ * @param error_code The error code that needs to be checked.
+ */
+static void log_error_if_nonzero(const char *message, int error_code)
+{
+    if (error_code != 0) {
+        ESP_LOGE(TAG, "Last error %s: 0x%x", message, error_code);
+    }
+}
+
+/**
+ * @brief Event handler registered to receive MQTT events, hands them to the
+ *        application handler
+ *
+ *  This function is called by the MQTT client event loop.
+ *
+ * @param handler_args user data registered to the event.
+ * @param base Event base for the handler(always MQTT Base in this example).
+ * @param event_id The id for the received event.
+ * @param event_data The data for the event, esp_mqtt_event_handle_t.
+ */
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    ESP_LOGD(TAG, "Event dispatched from event loop base=%s, event_id=%d", base, event_id);
+    esp_mqtt_event_handle_t event = event_data;
+    hal_mqtt_event_t hal_event = {
+        .msg_id = event->msg_id
+    };
+
+    switch ((esp_mqtt_event_id_t)event_id) {
+    case MQTT_EVENT_CONNECTED:
+        hal_event.id = HAL_MQTT_CONNECTED;
+        hal_event.session_present = event->session_present;
+        break;
+
+    case MQTT_EVENT_DISCONNECTED:
+        hal_event.id = HAL_MQTT_DISCONNECTED;
+        break;
+
+    case MQTT_EVENT_SUBSCRIBED:
+        hal_event.id = HAL_MQTT_SUBSCRIBED;
+        break;
+
+    case MQTT_EVENT_PUBLISHED:
+        hal_event.id = HAL_MQTT_PUBLISHED;
+        break;
+
+    case MQTT_EVENT_DATA:
+        hal_event.id = HAL_MQTT_DATA;
+        hal_event.topic = event->topic;
+        hal_event.topic_len = event->topic_len;
+        hal_event.data = event->data;
+        hal_event.data_len = event->data_len;
+        break;
+
+    case MQTT_EVENT_ERROR:
+        hal_event.id = HAL_MQTT_ERROR;
+        if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
+            log_error_if_nonzero("reported from esp-tls", event->error_handle->esp_tls_last_esp_err);
+            log_error_if_nonzero("reported from tls stack", event->error_handle->esp_tls_stack_err);
+            log_error_if_nonzero("captured as transport's socket errno",  event->error_handle->esp_transport_sock_errno);
+            ESP_LOGI(TAG, "Last errno string (%s)", strerror(event->error_handle->esp_transport_sock_errno));
+
+        }
+        break;
+
+    default:
+        ESP_LOGI(TAG, "Other event id:%d", event->event_id);
+        return;
+    }
+
+    if(Mqtt_handler != NULL)
+    {
+        Mqtt_handler(&hal_event);
+    }
+}
+
+/****************************************
+ EXTERNAL FUNCTIONS
+*****************************************/
+
+/**
+ * @brief Configures a pin as a push/pull output
+ *
+ * @param pin GPIO number
+ */
+void hal_gpio_output(int pin)
+{
+    gpio_reset_pin(pin);
+    gpio_set_direction(pin, GPIO_MODE_OUTPUT);
+}
+
+/**
+ * @brief Configures a pin as an input
+ *
+ * @param pin GPIO number
+ */
+void hal_gpio_input(int pin)
+{
+    gpio_reset_pin(pin);
+    gpio_set_direction(pin, GPIO_MODE_INPUT);
+}
+
+/**
+ * @brief Drives an output pin
+ *
+ * @param pin   GPIO number
+ * @param level 0 or 1
+ */
+void IRAM_ATTR hal_gpio_set_level(int pin, uint32_t level)
+{
+    gpio_set_level(pin, level);
+}
+
+/**
+ * @brief Drives several output pins at once through the W1TS/W1TC registers.
+ *        Pins in set_mask change in one write, pins in clear_mask in the next.
+ *
+ * @param set_mask      Pins to drive high, bit N is GPIO N
+ * @param clear_mask    Pins to drive low
+ */
+void IRAM_ATTR hal_gpio_write_mask(uint64_t set_mask, uint64_t clear_mask)
+{
+    if((uint32_t)set_mask != 0)
+    {
+        GPIO.out_w1ts = (uint32_t)set_mask;
+    }
+    if((set_mask >> 32) != 0)
+    {
+        GPIO.out1_w1ts.val = (uint32_t)(set_mask >> 32);
+    }
+
+    if((uint32_t)clear_mask != 0)
+    {
+        GPIO.out_w1tc = (uint32_t)clear_mask;
+    }
+    if((clear_mask >> 32) != 0)
+    {
+        GPIO.out1_w1tc.val = (uint32_t)(clear_mask >> 32);
+    }
+}
+
+/**
+ * @brief Reads a pin
+ *
+ * @param pin GPIO number
+ * @return 0 or 1
+ */
+int IRAM_ATTR hal_gpio_get_level(int pin)
+{
+    return gpio_get_level(pin);
+}
+
+/**
+ * @brief Attaches an edge interrupt handler to a pin
+ *
+ * @param pin   GPIO number
+ * @param edge  Edge that triggers the handler
+ * @param isr   Handler
+ * @param arg   Handler argument
+ */
+void hal_gpio_isr(int pin, hal_edge_t edge, hal_gpio_isr_t isr, void *arg)
+{
+    int state = GPIO_ISR_NONE;
+    esp_err_t ret;
+
+    // Tasks on both cores attach handlers, only the first one installs the
+    // service. Its interrupt is allocated on the core of that task, so every
+    // GPIO handler runs on the same core.
+    if(atomic_compare_exchange_strong(&Gpio_isr_service, &state, GPIO_ISR_INSTALLING))
+    {
+        ret = gpio_install_isr_service(0);
+
+        // ESP_ERR_INVALID_STATE: installed outside the HAL already
+        if(ret != ESP_OK && ret != ESP_ERR_INVALID_STATE)
+        {
+            ESP_LOGE(TAG, "GPIO ISR service not installed: %s", esp_err_to_name(ret));
+            atomic_store(&Gpio_isr_service, GPIO_ISR_NONE);
+            return;
+        }
+
+        atomic_store(&Gpio_isr_service, GPIO_ISR_INSTALLED);
+    }
+
+    while(atomic_load(&Gpio_isr_service) == GPIO_ISR_INSTALLING)
+    {
+        vTaskDelay(1);
+    }
+
+    if(atomic_load(&Gpio_isr_service) != GPIO_ISR_INSTALLED)
+    {
+        ESP_LOGE(TAG, "No GPIO ISR service, pin %d has no handler", pin);
+        return;
+    }
+
+    gpio_set_intr_type(pin, (edge == HAL_EDGE_RISING) ? GPIO_INTR_POSEDGE : GPIO_INTR_NEGEDGE);
+    ESP_ERROR_CHECK(gpio_isr_handler_add(pin, isr, arg));
+}
+
+/**
+ * @brief Configures a PWM output with 0 duty
+ *
+ * @param channel   LEDC channel
+ * @param pin       GPIO number
+ * @param freq_hz   PWM frequency, the same for all channels
+ */
+void hal_pwm_init(int channel, int pin, uint32_t freq_hz)
+{
+    const ledc_timer_config_t timer_cfg = {
+        .speed_mode = PWM_SPEED_MODE,
+        .duty_resolution = PWM_RESOLUTION,
+        .timer_num = PWM_TIMER,
+        .freq_hz = freq_hz,
+        .clk_cfg = LEDC_AUTO_CLK
+    };
+
+    const ledc_channel_config_t channel_cfg = {
+        .gpio_num = pin,
+        .speed_mode = PWM_SPEED_MODE,
+        .channel = channel,
+        .intr_type = LEDC_INTR_DISABLE,
+        .timer_sel = PWM_TIMER,
+        .duty = 0,
+        .hpoint = 0
+    };
+
+    ESP_ERROR_CHECK(ledc_timer_config(&timer_cfg));
+    ESP_ERROR_CHECK(ledc_channel_config(&channel_cfg));
+}
+
+/**
+ * @brief Sets the duty of a PWM output
+ *
+ * @param channel       LEDC channel
+ * @param duty_permille 0 .. 1000
+ */
+void hal_pwm_set(int channel, uint32_t duty_permille)
+{
+    if(duty_permille > 1000)
+    {
+        duty_permille = 1000;
+    }
+
+    ledc_set_duty(PWM_SPEED_MODE, channel, duty_permille * PWM_DUTY_MAX / 1000);
+    ledc_update_duty(PWM_SPEED_MODE, channel);
+}
+
+/**
+ * @brief Time since boot
+ *
+ * @return Time in us
+ */
+int64_t IRAM_ATTR hal_time_us(void)
+{
+    return esp_timer_get_time();
+}
+
+/**
+ * @brief Time since boot, wraps after 49 days
+ *
+ * @return Time in ms
+ */
+uint32_t hal_time_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+/**
+ * @brief CPU cycle counter of the calling core, for timing short code paths
+ *
+ * @return Cycle count
+ */
+uint32_t IRAM_ATTR hal_cpu_cycles(void)
+{
+    return esp_cpu_get_ccount();
+}
+
+/**
+ * @brief Characterizes the current sensor ADC and builds its raw-to-mV table.
+ *        Without eFuse calibration data the table holds the characterization
+ *        from the nominal 1100 mV reference, so samples are always converted.
+ *
+ * @param lut Output: calibration table
+ * @return true     if the eFuse calibration is available
+ * @return false    if the table holds the nominal transfer
+ */
+bool hal_adc_calibrate(adc_lut_t *lut)
+{
+    esp_err_t ret;
+    bool cali_enable = false;
+
+    ret = esp_adc_cal_check_efuse(ADC_CALI_SCHEME);
+    if (ret == ESP_ERR_NOT_SUPPORTED) {
+        ESP_LOGW(TAG, "Calibration scheme not supported, nominal ADC reference");
+    } else if (ret == ESP_ERR_INVALID_VERSION) {
+        ESP_LOGW(TAG, "eFuse not burnt, nominal ADC reference");
+    } else if (ret == ESP_OK) {
+        cali_enable = true;
+    } else {
+        ESP_LOGE(TAG, "Invalid arg");
+    }
+
+    // Falls back to ADC_NOMINAL_VREF_MV when the eFuse holds no reference
+    esp_adc_cal_characterize(ADC_UNIT_1, ADC_CURRENT_ATTEN, ADC_WIDTH_BIT_DEFAULT, ADC_NOMINAL_VREF_MV, &adc1_chars);
+
+    // Sample blocks are converted by table lookup instead of per sample math
+    adc_lut_init(lut, adc_cal_raw_to_mv, &adc1_chars);
+
+    return cali_enable;
+}
+
+/**
+ * @brief Starts continuous DMA sampling of the current sensor channel
+ *
+ * @param sample_rate_hz Sample rate, 20 kHz at least on the ESP32
+ */
+void hal_adc_start(uint32_t sample_rate_hz)
+{
+    adc_digi_init_config_t adc_dma_config = {
+        .max_store_buf_size = ADC_BUFFER_BYTES,
+        .conv_num_each_intr = ADC_FRAME_BYTES,
+        .adc1_chan_mask = BIT(ADC1_CURRENT_CHANNEL),
+        .adc2_chan_mask = 0,
+    };
+
+    adc_digi_pattern_config_t adc_pattern = {
+        .atten = ADC_CURRENT_ATTEN,
+        .channel = ADC1_CURRENT_CHANNEL,
+        .unit = 0,      // ADC1
+        .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+    };
+
+    adc_digi_configuration_t dig_cfg = {
+        .conv_limit_en = true,
+        .conv_limit_num = 250,
+        .pattern_num = 1,
+        .adc_pattern = &adc_pattern,
+        .sample_freq_hz = sample_rate_hz,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+    };
+
+    ESP_ERROR_CHECK(adc_digi_initialize(&adc_dma_config));
+    ESP_ERROR_CHECK(adc_digi_controller_configure(&dig_cfg));
+    ESP_ERROR_CHECK(adc_digi_start());
+}
+
+/**
+ * @brief Waits for the next DMA frame and unpacks the current channel codes
+ *
+ * @param samples       Output: raw ADC codes
+ * @param max_samples   Room in samples, up to HAL_ADC_FRAME_SAMPLES are used
+ * @return Number of samples written, 0 on a read error
+ */
+size_t hal_adc_read(uint16_t *samples, size_t max_samples)
+{
+    static uint8_t frame[ADC_FRAME_BYTES];
+    uint32_t length;
+    size_t count = 0;
+    esp_err_t ret;
+
+    ret = adc_digi_read_bytes(frame, ADC_FRAME_BYTES, &length, ADC_MAX_DELAY);
+
+    // ESP_ERR_INVALID_STATE reports an overrun, the frame itself is still valid
+    if(ret != ESP_OK && ret != ESP_ERR_INVALID_STATE)
+    {
+        return 0;
+    }
+
+    for(uint32_t idx = 0; idx + SOC_ADC_DIGI_RESULT_BYTES <= length && count < max_samples; idx += SOC_ADC_DIGI_RESULT_BYTES)
+    {
+        const adc_digi_output_data_t *data = (const adc_digi_output_data_t *)&frame[idx];
+
+        if(data->type1.channel == ADC1_CURRENT_CHANNEL)
+        {
+            samples[count++] = data->type1.data;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * @brief Starts a free running 1 us timer with the alarm disabled
+ *
+ * @param group Timer group
+ * @param idx   Timer
+ * @param isr   Alarm handler
+ * @param arg   Handler argument
+ */
+static void hal_timer_start(timer_group_t group, timer_idx_t idx, hal_timer_isr_t isr, void *arg)
+{
+    const timer_config_t timer_cfg = {
+        .divider = PHASE_TIMER_DIVIDER,
+        .counter_dir = TIMER_COUNT_UP,
+        .counter_en = TIMER_PAUSE,
+        .alarm_en = TIMER_ALARM_DIS,
+        .auto_reload = TIMER_AUTORELOAD_DIS,
+    };
+
+    ESP_ERROR_CHECK(timer_init(group, idx, &timer_cfg));
+    ESP_ERROR_CHECK(timer_set_counter_value(group, idx, 0));
+    ESP_ERROR_CHECK(timer_isr_callback_add(group, idx, isr, arg, 0));
+    ESP_ERROR_CHECK(timer_enable_intr(group, idx));
+    ESP_ERROR_CHECK(timer_start(group, idx));
+}
+
+/**
+ * @brief Starts the free running phase timer with the alarm disabled
+ *
+ * @param isr Alarm handler
+ * @param arg Handler argument
+ */
+void hal_phase_timer_init(hal_timer_isr_t isr, void *arg)
+{
+    hal_timer_start(PHASE_TIMER_GROUP, PHASE_TIMER_IDX, isr, arg);
+}
+
+/**
+ * @brief Reads the phase timer
+ *
+ * @return Time in us since hal_phase_timer_init()
+ */
+uint64_t IRAM_ATTR hal_phase_timer_now_us(void)
+{
+    return timer_group_get_counter_value_in_isr(PHASE_TIMER_GROUP, PHASE_TIMER_IDX);
+}
+
+/**
+ * @brief Arms the one-shot alarm of the phase timer
+ *
+ * @param alarm_us Absolute phase timer time
+ */
+void IRAM_ATTR hal_phase_timer_alarm(uint64_t alarm_us)
+{
+    timer_group_set_alarm_value_in_isr(PHASE_TIMER_GROUP, PHASE_TIMER_IDX, alarm_us);
+    timer_group_enable_alarm_in_isr(PHASE_TIMER_GROUP, PHASE_TIMER_IDX);
+}
+
+/**
+ * @brief Starts the relay switching timer with the alarm disabled
+ *
+ * @param isr Alarm handler
+ * @param arg Handler argument
+ */
+void hal_relay_timer_init(hal_timer_isr_t isr, void *arg)
+{
+    hal_timer_start(RELAY_TIMER_GROUP, RELAY_TIMER_IDX, isr, arg);
+}
+
+/**
+ * @brief Arms the one-shot alarm of the relay timer. The timer has its own
+ *        counter, so the alarm is given relative to now.
+ *
+ * @param delay_us Time from now
+ */
+void IRAM_ATTR hal_relay_timer_alarm_after(uint32_t delay_us)
+{
+    uint64_t now_us = timer_group_get_counter_value_in_isr(RELAY_TIMER_GROUP, RELAY_TIMER_IDX);
+
+    timer_group_set_alarm_value_in_isr(RELAY_TIMER_GROUP, RELAY_TIMER_IDX, now_us + delay_us);
+    timer_group_enable_alarm_in_isr(RELAY_TIMER_GROUP, RELAY_TIMER_IDX);
+}
+
+/**
+ * @brief Calls a function periodically from the esp_timer task
+ *
+ * @param cb        Callback, must not block
+ * @param arg       Callback argument
+ * @param name      Timer name
+ * @param period_us Period
+ */
+void hal_timer_periodic(hal_timer_cb_t cb, void *arg, const char *name, uint32_t period_us)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = cb,
+        .arg = arg,
+        .name = name
+    };
+    esp_timer_handle_t timer;
+
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(timer, period_us));
+}
+
+/**
+ * @brief Creates a task
+ *
+ * @param fn            Task function, called with a NULL argument
+ * @param name          Task name
+ * @param stack_bytes   Stack size
+ * @param priority      FreeRTOS priority
+ * @param core          Core the task is pinned to, or HAL_CORE_ANY
+ * @return Task, NULL if it can't be created
+ */
+hal_task_t hal_task_create(hal_task_fn_t fn, const char *name, uint32_t stack_bytes, int priority, int core)
+{
+    TaskHandle_t task = NULL;
+
+    if(xTaskCreatePinnedToCore(fn, name, stack_bytes, NULL, priority, &task,
+                               (core == HAL_CORE_ANY) ? tskNO_AFFINITY : core) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Task %s not created", name);
+        return NULL;
+    }
+
+    return (hal_task_t)task;
+}
+
+/**
+ * @brief Gets the calling task
+ *
+ * @return Task
+ */
+hal_task_t hal_task_self(void)
+{
+    return (hal_task_t)xTaskGetCurrentTaskHandle();
+}
+
+/**
+ * @brief Wakes a task waiting in hal_task_wait(). Notifications given while
+ *        the task runs are not lost, they end its next wait at once.
+ *
+ * @param task Task
+ */
+void hal_task_notify(hal_task_t task)
+{
+    xTaskNotifyGive((TaskHandle_t)task);
+}
+
+/**
+ * @brief hal_task_notify() for interrupt handlers
+ *
+ * @param task Task
+ */
+void IRAM_ATTR hal_task_notify_from_isr(hal_task_t task)
+{
+    BaseType_t woken = pdFALSE;
+
+    vTaskNotifyGiveFromISR((TaskHandle_t)task, &woken);
+
+    if(woken == pdTRUE)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+
+/**
+ * @brief Waits for a notification of the calling task
+ *
+ * @param timeout_ms Longest wait, rounded up to whole ticks, or HAL_WAIT_FOREVER
+ * @return true if notified, false on timeout
+ */
+bool hal_task_wait(uint32_t timeout_ms)
+{
+    TickType_t ticks = portMAX_DELAY;
+
+    if(timeout_ms != HAL_WAIT_FOREVER)
+    {
+        ticks = (timeout_ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+    }
+
+    return ulTaskNotifyTake(pdTRUE, ticks) != 0;
+}
+
+/**
+ * @brief Ends the calling task
+ */
+void hal_task_exit(void)
+{
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Creates a mutex with priority inheritance
+ *
+ * @return Mutex
+ */
+hal_mutex_t hal_mutex_create(void)
+{
+    return (hal_mutex_t)xSemaphoreCreateMutex();
+}
+
+/**
+ * @brief Takes a mutex, waiting as long as needed
+ *
+ * @param mutex Mutex
+ */
+void hal_mutex_lock(hal_mutex_t mutex)
+{
+    xSemaphoreTake((SemaphoreHandle_t)mutex, portMAX_DELAY);
+}
+
+/**
+ * @brief Gives a mutex back
+ *
+ * @param mutex Mutex
+ */
+void hal_mutex_unlock(hal_mutex_t mutex)
+{
+    xSemaphoreGive((SemaphoreHandle_t)mutex);
+}
+
+/**
+ * @brief Enters a critical section shared by tasks and interrupt handlers
+ *        of both cores. Interrupts of the calling core stay masked until
+ *        hal_spin_unlock().
+ *
+ * @param lock Lock
+ */
+void IRAM_ATTR hal_spin_lock(hal_spinlock_t *lock)
+{
+    portENTER_CRITICAL_SAFE(lock);
+}
+
+/**
+ * @brief Leaves a critical section
+ *
+ * @param lock Lock
+ */
+void IRAM_ATTR hal_spin_unlock(hal_spinlock_t *lock)
+{
+    portEXIT_CRITICAL_SAFE(lock);
+}
+
+/**
+ * @brief Creates a binary event, not given yet
+ *
+ * @return Event
+ */
+hal_signal_t hal_signal_create(void)
+{
+    return (hal_signal_t)xSemaphoreCreateBinary();
+}
+
+/**
+ * @brief Gives an event
+ *
+ * @param signal Event
+ */
+void hal_signal_give(hal_signal_t signal)
+{
+    xSemaphoreGive((SemaphoreHandle_t)signal);
+}
+
+/**
+ * @brief Waits for an event and takes it
+ *
+ * @param signal        Event
+ * @param timeout_ms    Longest wait or HAL_WAIT_FOREVER
+ * @return true if given, false on timeout
+ */
+bool hal_signal_wait(hal_signal_t signal, uint32_t timeout_ms)
+{
+    TickType_t ticks = (timeout_ms == HAL_WAIT_FOREVER) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+
+    return xSemaphoreTake((SemaphoreHandle_t)signal, ticks) == pdTRUE;
+}
+
+/**
+ * @brief Initializes NVS, erasing it if the layout is outdated
+ */
+void hal_nvs_init(void)
+{
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+      ESP_ERROR_CHECK(nvs_flash_erase());
+      ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(ret);
+}
+
+/**
+ * @brief Reads a number from NVS
+ *
+ * @param space NVS namespace
+ * @param key   Key
+ * @param value Output: stored number
+ * @return true if the key is stored
+ */
+bool hal_nvs_get_u32(const char *space, const char *key, uint32_t *value)
+{
+    nvs_handle_t nvs;
+    esp_err_t ret;
+
+    if(nvs_open(space, NVS_READONLY, &nvs) != ESP_OK)
+    {
+        return false;
+    }
+
+    ret = nvs_get_u32(nvs, key, value);
+    nvs_close(nvs);
+
+    return ret == ESP_OK;
+}
+
+/**
+ * @brief Writes and commits a number to NVS
+ *
+ * @param space NVS namespace
+ * @param key   Key
+ * @param value Number
+ * @return true if committed
+ */
+bool hal_nvs_set_u32(const char *space, const char *key, uint32_t value)
+{
+    nvs_handle_t nvs;
+    esp_err_t ret;
+
+    ret = nvs_open(space, NVS_READWRITE, &nvs);
+    if(ret == ESP_OK)
+    {
+        ret = nvs_set_u32(nvs, key, value);
+        if(ret == ESP_OK)
+        {
+            ret = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+
+    if(ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "NVS %s/%s not written: %s", space, key, esp_err_to_name(ret));
+    }
+
+    return ret == ESP_OK;
+}
+
+/**
+ * @brief Reads a blob of a known size from NVS
+ *
+ * @param space NVS namespace
+ * @param key   Key
+ * @param data  Output: stored blob
+ * @param size  Size of the blob
+ * @return true if a blob of this size is stored
+ */
+bool hal_nvs_get_blob(const char *space, const char *key, void *data, size_t size)
+{
+    nvs_handle_t nvs;
+    size_t length = size;
+    esp_err_t ret;
+
+    if(nvs_open(space, NVS_READONLY, &nvs) != ESP_OK)
+    {
+        return false;
+    }
+
+    ret = nvs_get_blob(nvs, key, data, &length);
+    nvs_close(nvs);
+
+    return ret == ESP_OK && length == size;
+}
+
+/**
+ * @brief Writes and commits a blob to NVS
+ *
+ * @param space NVS namespace
+ * @param key   Key
+ * @param data  Blob
+ * @param size  Size of the blob
+ * @return true if committed
+ */
+bool hal_nvs_set_blob(const char *space, const char *key, const void *data, size_t size)
+{
+    nvs_handle_t nvs;
+    esp_err_t ret;
+
+    ret = nvs_open(space, NVS_READWRITE, &nvs);
+    if(ret == ESP_OK)
+    {
+        ret = nvs_set_blob(nvs, key, data, size);
+        if(ret == ESP_OK)
+        {
+            ret = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+
+    if(ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "NVS %s/%s not written: %s", space, key, esp_err_to_name(ret));
+    }
+
+    return ret == ESP_OK;
+}
+
+/**
+ * @brief Registers a function called on a software restart
+ *
+ * @param handler Handler
+ */
+void hal_on_shutdown(void (*handler)(void))
+{
+    ESP_ERROR_CHECK(esp_register_shutdown_handler(handler));
+}
+
+/**
+ * @brief Reads the Wi-Fi station MAC address, unique per device
+ *
+ * @param mac Output: address
+ */
+void hal_read_mac(uint8_t mac[6])
+{
+    ESP_ERROR_CHECK(esp_read_mac(mac, ESP_MAC_WIFI_STA));
+}
+
+/**
+ * @brief Allocates memory a peripheral can read by DMA, e.g. a display buffer
+ *
+ * @param size Size in bytes
+ * @return Memory, NULL if none is left
+ */
+void *hal_malloc_dma(size_t size)
+{
+    return heap_caps_malloc(size, MALLOC_CAP_DMA);
+}
+
+/**
+ * @brief Sets the log level of a tag, "*" for all of them
+ *
+ * @param tag   Log tag
+ * @param level Most verbose level printed
+ */
+void hal_log_level_set(const char *tag, hal_log_level_t level)
+{
+    esp_log_level_set(tag, (esp_log_level_t)level);
+}
+
+/**
+ * @brief Creates and starts the MQTT client. It connects in the background
+ *        and reconnects by itself, the handler gets its events.
+ *
+ * @param cfg       Broker and session
+ * @param handler   Event handler
+ * @return true if the client started
+ */
+bool hal_mqtt_start(const hal_mqtt_cfg_t *cfg, hal_mqtt_handler_t handler)
+{
+    const esp_mqtt_client_config_t mqtt_cfg = {
+        .uri = cfg->uri,
+        .username = cfg->username,
+        .password = cfg->password,
+        .port = cfg->port,
+        .client_id = cfg->client_id,
+        .disable_clean_session = !cfg->clean_session
+    };
+
+    Mqtt_handler = handler;
+
+    Mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
+    if(Mqtt_client == NULL)
+    {
+        ESP_LOGE(TAG, "MQTT client not created");
+        return false;
+    }
+
+    esp_mqtt_client_register_event(Mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+
+    return esp_mqtt_client_start(Mqtt_client) == ESP_OK;
+}
+
+/**
+ * @brief Queues a message for the broker
+ *
+ * @param topic     Full topic
+ * @param data      Payload
+ * @param len       Payload length
+ * @param qos       MQTT QoS
+ * @param retain    Retain flag
+ * @return Message id, 0 for QoS 0, negative when not queued
+ */
+int hal_mqtt_publish(const char *topic, const void *data, size_t len, int qos, bool retain)
+{
+    if(Mqtt_client == NULL)
+    {
+        return -1;
+    }
+
+    return esp_mqtt_client_publish(Mqtt_client, topic, (const char *)data, len, qos, retain);
+}
+
+/**
+ * @brief Subscribes to a topic filter
+ *
+ * @param filter    Topic filter, wildcards allowed
+ * @param qos       Highest QoS of the deliveries
+ * @return Message id, negative on error
+ */
+int hal_mqtt_subscribe(const char *filter, int qos)
+{
+    if(Mqtt_client == NULL)
+    {
+        return -1;
+    }
+
+    return esp_mqtt_client_subscribe(Mqtt_client, filter, qos);
+}
@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "histogram.h"
+
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Clears all buckets
+ *
+ * @param hist Histogram
+ */
+void histogram_reset(histogram_t *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+/**
+ * @brief Adds one value
+ *
+ * @param hist  Histogram
+ * @param value Value, e.g. a duration in us
+ */
+void histogram_add(histogram_t *hist, uint32_t value)
+{
+    uint32_t idx = 0;
+
+    if(value != 0)
+    {
+        idx = 32 - __builtin_clz(value);
+        if(idx >= HISTOGRAM_BUCKETS)
+        {
+            idx = HISTOGRAM_BUCKETS - 1;
+        }
+    }
+
+    hist->bucket[idx]++;
+    hist->count++;
+
+    if(value > hist->max)
+    {
+        hist->max = value;
+    }
+}
+
+/**
+ * @brief Estimates a percentile as the upper bound of its bucket
+ *
+ * @param hist      Histogram
+ * @param permille  500 for p50, 990 for p99
+ * @return Percentile value, never above the observed maximum
+ */
+uint32_t histogram_percentile(const histogram_t *hist, uint32_t permille)
+{
+    uint64_t rank = ((uint64_t)hist->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+    uint32_t upper;
+
+    if(hist->count == 0)
+    {
+        return 0;
+    }
+
+    for(uint32_t idx = 0; idx < HISTOGRAM_BUCKETS; ++idx)
+    {
+        seen += hist->bucket[idx];
+
+        if(seen >= rank)
+        {
+            upper = (idx == 0) ? 0 : ((1UL << idx) - 1);
+            return (upper < hist->max) ? upper : hist->max;
+        }
+    }
+
+    return hist->max;
+}
@@ -0,0 +1,34 @@
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdint.h>
+
+/**********************************
+ CONSTANTS AND MACROS
+***********************************/
+
+// Bucket N holds values in [2^(N-1), 2^N), bucket 0 holds 0
+#define HISTOGRAM_BUCKETS   24
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+/**
+ * @brief Log2 histogram of durations, cheap enough to fill from a timer callback
+ */
+typedef struct {
+    uint32_t    bucket[HISTOGRAM_BUCKETS];
+    uint32_t    count;
+    uint32_t    max;
+} histogram_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+void        histogram_reset(histogram_t *hist);
+void        histogram_add(histogram_t *hist, uint32_t value);
+uint32_t    histogram_percentile(const histogram_t *hist, uint32_t permille);
+
+#endif // _HISTOGRAM_H_
@@ -1,29 +1,70 @@
-#include "esp_log.h"
-#include "esp_adc_cal.h"
-#include "esp_system.h"
-
-#include "driver/adc.h"
-#include "driver/gpio.h"
-
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
+#include "sdkconfig.h"
 
 #include "hw_ctrl.h"
+#include "hal.h"
+#include "dev_state.h"
+#include "zc_monitor.h"
+#include "phase_ctrl.h"
+#include "relay_sched.h"
+#include "turn_on_sched.h"
+#include "current_rms.h"
+#include "overcurrent.h"
+#include "adc_lut.h"
+#include "energy_meter.h"
+#include "histogram.h"
+#include "pin_mask.h"
 #include "wqtt_client.h"
+#include "smartRelay.h"
 
 
 /*******************************************************
  CONSTANTS
  *******************************************************/
 
-#define CURRENT_COEFF           1 / 10
-#define ADC1_CURRENT_CHANNEL    ADC1_CHANNEL_4
+// Current sensor on the ADC at 11 dB, its output centred on half scale
+#define ADC_FULL_SCALE_MV       3100
+#define SENSOR_SWING_MV         (ADC_FULL_SCALE_MV / 2)
+#define SENSOR_PEAK_MAX_MV      (SENSOR_SWING_MV * 95 / 100)    // Highest peak limit, below clipping
+#define SENSOR_RMS_MAX_MV       (SENSOR_SWING_MV * 707 / 1000)  // RMS of a sine at full swing
+
+#define CURRENT_MA(sensor_mv)   ((sensor_mv) * 1000 / CONFIG_CURRENT_SENSOR_MV_PER_A)
+#define SENSOR_MV(current_ma)   ((current_ma) * CONFIG_CURRENT_SENSOR_MV_PER_A / 1000)
+#define CURRENT_MAX_MA          CURRENT_MA(SENSOR_RMS_MAX_MV)   // Largest measurable RMS current
+
+// Continuous ADC sampling of the current sensor
+#define ADC_SAMPLE_RATE_HZ      20000   // Lowest rate of the ESP32 ADC DMA mode
+
+// True RMS window: a whole number of cycles of the measured mains period,
+// the overcurrent protection checks every half-cycle of it
+#define RMS_WINDOW_CYCLES       5
+#define RMS_WINDOW_MS           (ZC_MONITOR_NOMINAL_HALF_PERIOD_US * 2 * RMS_WINDOW_CYCLES / 1000)  // Nominal
+#define HALF_CYCLE_SAMPLES(half_period_us)  \
+    ((uint32_t)(((uint64_t)ADC_SAMPLE_RATE_HZ * (half_period_us) + 500000) / 1000000))
+#define RMS_WINDOW_SAMPLES(half_period_us)  \
+    ((uint32_t)(((uint64_t)ADC_SAMPLE_RATE_HZ * (half_period_us) * 2 * RMS_WINDOW_CYCLES + 500000) / 1000000))
+
+// A window ending later than this after the last one follows a stall, the
+// current of the gap is unknown and not metered
+#define ENERGY_MAX_STEP_US      (4 * RMS_WINDOW_MS * 1000)
 
-//ADC Attenuation
-#define ADC_EXAMPLE_ATTEN       ADC_ATTEN_DB_11
+// A load switched off still draws until its relay opens, at the next aligned
+// zero crossing or after the timeout, and its samples leave the half-cycle
+#define TRIP_LIMIT_SETTLE_MS    (CONFIG_RELAY_ZC_TIMEOUT_MS + CONFIG_RELAY_RELEASE_US / 1000 + \
+                                 2 * ZC_MONITOR_NOMINAL_HALF_PERIOD_US / 1000)
 
-//ADC Calibration
-#define ADC_EXAMPLE_CALI_SCHEME ESP_ADC_CAL_VAL_EFUSE_VREF
+// Telemetry sampling, the WQTT client decides what is worth publishing
+#define TELEMETRY_PERIOD_MS     RMS_WINDOW_MS
+
+// esp_timer callback jitter is logged once per this many RMS windows (1 min)
+#define JITTER_LOG_WINDOWS      (60 * 1000 / RMS_WINDOW_MS)
+
+// Mains health is reported once per this many RMS windows (10 s)
+#define MAINS_STATS_WINDOWS     (10 * 1000 / RMS_WINDOW_MS)
+
+// Energy totals in NVS
+#define HW_CTRL_NVS_NAMESPACE   "hw_ctrl"
+#define ENERGY_NVS_KEY          "energy"
+#define LOADS_NVS_KEY           "loads"
 
 // Pin assignments
 #define LED4_GPIO               27
@@ -32,27 +73,106 @@
 #define LOAD3_PIN               17      // RELAY
 #define ZERO_PIN                16
 
+// PWM channels
+#define PWM_FREQ_HZ             1000
+
 /*******************************************************
- MACROS
+ TYPES
  *******************************************************/
 
-#define LED_ON()       gpio_set_level(LED4_GPIO, 0)
-#define LED_OFF()      gpio_set_level(LED4_GPIO, 1)
+typedef enum {
+    HW_CH_SWITCH = 0,       // Relay, SSR or LED: on/off through the GPIO mask write
+    HW_CH_RELAY,            // Relay switched at a zero crossing, one channel at most
+    HW_CH_PHASE,            // TRIAC fired by the phase control engine
+    HW_CH_PWM               // LEDC duty from the power level
+} hw_ch_type_t;
 
-#define LOAD1_ON()     gpio_set_level(LOAD1_PIN, 1)
-#define LOAD1_OFF()    gpio_set_level(LOAD1_PIN, 0)
+/**
+ * @brief Output channel driven by a field of the state store. Several
+ *        channels may follow the same field.
+ */
+typedef struct {
+    dev_field_t     field;
+    hw_ch_type_t    type;
+    uint8_t         pin;
+    bool            active_low;
+    uint8_t         pwm_channel;    // HW_CH_PWM only
+    uint32_t        limit_ma;       // Rated RMS current of a mains load in the scale of Current, 0 if not protected
+} hw_channel_t;
+
+/*******************************************************
+ CHANNELS
+ *******************************************************/
+
+/* Switch channels of one group of changes are written together: the pins
+ * turning on in one register write, the pins turning off in the next one.
+ * There is a single current sensor, so the trip limit is the sum of the
+ * limits of the loads that are on and a trip opens all of them. Loads with
+ * a limit are switched on one at a time by the turn-on scheduler, the limit
+ * is their expected current for its budget. Limits the sensor can't
+ * measure are clamped to CURRENT_MAX_MA when the channels are set up.
+ * There is a single phase control timer and a single relay timer, so one
+ * HW_CH_PHASE and one HW_CH_RELAY channel at most. */
+static const hw_channel_t Channels[] = {
+    { .field = DEV_HEATER,  .type = HW_CH_SWITCH,   .pin = LOAD1_PIN,   .limit_ma = 70 },
+    { .field = DEV_FAN,     .type = HW_CH_PHASE,    .pin = LOAD2_PIN,   .limit_ma = 25 },
+    { .field = DEV_LIGHT,   .type = HW_CH_RELAY,    .pin = LOAD3_PIN,   .limit_ma = 20 },
+    { .field = DEV_LED,     .type = HW_CH_SWITCH,   .pin = LED4_GPIO, .active_low = true }
+};
+
+#define HW_CHANNEL_CNT          (sizeof(Channels) / sizeof(Channels[0]))
+
+// PWM duty (1/1000) of every power level
+static const uint16_t Level_duty_permille[] = {
+    [HW_LVL_OFF]        = 0,
+    [HW_LVL_LOW]        = 250,
+    [HW_LVL_MEDIUM]     = 500,
+    [HW_LVL_HIGH]       = 750,
+    [HW_LVL_VERY_HIGH]  = 1000
+};
+
+/*******************************************************
+ MACROS
+ *******************************************************/
+
+// TRIAC gate of the phase controlled load
+#define LOAD2_ON()     hal_gpio_set_level(LOAD2_PIN, 1)
+#define LOAD2_OFF()    hal_gpio_set_level(LOAD2_PIN, 0)
 
-// RELAY
-#define LOAD3_ON()     gpio_set_level(LOAD3_PIN, 1)
-#define LOAD3_OFF()    gpio_set_level(LOAD3_PIN, 0)
 
 
 /*******************************************************
  FUNCTION PROTOTYPES
  *******************************************************/
 
-static bool adc_calibration_init(void);
+static void current_rms_update(const current_rms_result_t *result);
+static void limits_init(void);
+static void energy_restore(void);
+static void energy_save(void);
+static void energy_update(uint32_t current_ma);
+static void timer_jitter_log(void);
+static void mains_stats_update(void);
+static uint32_t loads_pack(void);
+static void loads_restore(void);
+static void loads_save(void);
+static void channel_mask_add(pin_mask_t *mask, const hw_channel_t *ch, bool on);
+static void channel_apply(const hw_channel_t *ch, uint32_t value);
+static void channel_request(size_t idx, uint32_t value);
+static void pins_write(void);
+static void turn_on_poll(void);
+static bool channel_is_on(const hw_channel_t *ch, uint32_t value);
+static uint32_t trip_limit_calc(void);
+static uint32_t trip_limit_settled(uint32_t limit_ma);
+static void trip_open_loads(const overcurrent_trip_t *trip);
+static void hw_ctrl_apply(dev_field_t field, uint32_t value, dev_origin_t origin);
+static void hw_ctrl_flush(void);
 static void update_current_value(void *arg);
+static void phase_ctrl_hw_init(void);
+static void zero_cross_isr(void *arg);
+static bool phase_timer_isr(void *arg);
+static bool relay_timer_isr(void *arg);
+static void relay_drive(bool on);
+static void relay_poll(void);
 
 /*******************************************************
  LOCAL VARIABLES
@@ -62,16 +182,55 @@ static const char *TAG = "HW CTRL";
 
 static uint32_t voltage = 0;
 
-static esp_adc_cal_characteristics_t adc1_chars;
-static uint16_t current_value = 0;
+static adc_lut_t adc1_lut;
+static current_rms_t current_acc;
+static overcurrent_t overcurrent;
 
 
-static hw_electr_lvl_t  Load2_level = HW_LVL_OFF;
-static hw_state_t       Load1_state = HW_OFF;
-static hw_state_t       Load3_state = HW_OFF;
 static uint32_t         Current = 0;
 
-static hw_state_t       LED_state = HW_OFF;
+static uint32_t         Saved_loads = 0;    // Load states as stored in NVS
+static volatile bool    Loads_dirty = false;    // Saved by hw_ctrl_task, out of the store lock
+
+static zc_monitor_t     Zero_cross;     // Mains timing base of the phase control and the relay
+static histogram_t      zc_isr_cost;    // CPU cycles of the zero-cross ISR
+static hal_spinlock_t   Zc_cost_lock = HAL_SPINLOCK_INITIALIZER;   // zc_isr_cost, filled by the ISR
+static zc_stats_t       Mains_stats;    // Last reported window
+
+// Phase controlled Load2, shared by the zero-cross and timer ISRs and the task
+static phase_ctrl_t     Load2_phase;
+static hal_spinlock_t   Phase_lock = HAL_SPINLOCK_INITIALIZER;
+static bool             Load2_actuate = false; // A new Load2 level waits for its first half-cycle
+
+// Zero-cross aligned relay, shared by the task and the timer ISRs
+static relay_sched_t    Load3_relay;
+static const hw_channel_t * Relay_channel = NULL;
+static hal_spinlock_t   Relay_lock = HAL_SPINLOCK_INITIALIZER;
+static bool             Relay_aligned = false;  // Zero-cross timers are running
+static histogram_t      relay_error;    // us, contact switching time minus the aimed point
+
+// Overcurrent protection
+static uint32_t         Limit_ma[HW_CHANNEL_CNT];  // Channel limits within the sensor range
+static bool             Limit_clamped = false;      // The summed limit is beyond the sensor range
+static volatile uint32_t Trip_limit_ma = 0; // Sum of the limits of the loads that are on
+static volatile uint32_t Trip_ma = 0;       // Current of the last trip until a load is switched on again
+
+static histogram_t      timer_jitter;   // us, filled by the esp_timer task
+static hal_spinlock_t   Timer_jitter_lock = HAL_SPINLOCK_INITIALIZER;
+static volatile int64_t Actuated_us = 0;    // Last change of an output driven by a command
+
+// Switch pins of the current group of changes
+static pin_mask_t       Pending;
+
+/* The state store sink and the turn-on releases of hw_ctrl_task both switch
+ * channels, this lock serializes them. Taken inside the store lock by the
+ * sink, never the other way round. */
+static hal_mutex_t      Channel_lock = NULL;
+static turn_on_sched_t  Turn_on;
+static uint32_t         Channel_on = 0;     // Channel bits applied with a value that lets current flow
+
+static energy_meter_t   energy;
+static uint32_t         Energy_Wh[HW_LOAD_CNT];
 
 
 
@@ -83,192 +242,946 @@ static hw_state_t       LED_state = HW_OFF;
 
 static void hw_ctrl_task(void *pvParameter)
 {
-    bool cali_enable = adc_calibration_init();
-    static int adc_raw;
-
-    //ADC1 config
-    ESP_ERROR_CHECK(adc1_config_width(ADC_WIDTH_BIT_DEFAULT));
-    ESP_ERROR_CHECK(adc1_config_channel_atten(ADC1_CURRENT_CHANNEL, ADC_EXAMPLE_ATTEN));
-
-    // Configure LED4 pin for output
-    gpio_reset_pin(LED4_GPIO);
-    gpio_set_direction(LED4_GPIO, GPIO_MODE_OUTPUT);    // Set the GPIO as a push/pull output
-
-    // Configure Load1 pin for output
-    gpio_reset_pin(LOAD1_PIN);
-    gpio_set_direction(LOAD1_PIN, GPIO_MODE_OUTPUT);    // Set the GPIO as a push/pull output
-    
-    // Configure Load2 (variable power) pin for output
-    gpio_reset_pin(LOAD2_PIN);
-    gpio_set_direction(LOAD2_PIN, GPIO_MODE_OUTPUT);    // Set the GPIO as a push/pull output
-    
-    // Configure Load3 (RELAY) pin for output
-    gpio_reset_pin(LOAD3_PIN);
-    gpio_set_direction(LOAD3_PIN, GPIO_MODE_OUTPUT);    // Set the GPIO as a push/pull output
-    
-    // Configure ZERO sensor pin for input
-    gpio_reset_pin(ZERO_PIN);
-    gpio_set_direction(ZERO_PIN, GPIO_MODE_INPUT);    // Set the GPIO as input
-
-    LED_OFF();
+    bool cali_enable = hal_adc_calibrate(&adc1_lut);
+    static uint16_t adc_samples[HAL_ADC_FRAME_SAMPLES];
+    current_rms_result_t rms_result;
+    overcurrent_trip_t trip;
+    uint32_t limit_mv;
+    uint32_t peak_mv;
+    size_t sample_cnt;
+    size_t pos;
 
-    /* Create and start a periodic timer interrupt to call update_current_value() */
-    const esp_timer_create_args_t periodic_timer_args = {
-        .callback = &update_current_value,
-        .name = "periodic_current"
-    };
+    // Protection and metering must run: without eFuse data on the nominal transfer
+    if(!cali_enable)
+    {
+        HAL_LOGE(TAG, "ADC not calibrated: currents from the nominal transfer, expect up to 10%% error");
+    }
+
+    hal_adc_start(ADC_SAMPLE_RATE_HZ);
+    current_rms_init(&current_acc, RMS_WINDOW_SAMPLES(ZC_MONITOR_NOMINAL_HALF_PERIOD_US));
+    overcurrent_init(&overcurrent, HALF_CYCLE_SAMPLES(ZC_MONITOR_NOMINAL_HALF_PERIOD_US));
 
-    esp_timer_handle_t periodic_timer;
-    ESP_ERROR_CHECK(esp_timer_create(&periodic_timer_args, &periodic_timer));
-    ESP_ERROR_CHECK(esp_timer_start_periodic(periodic_timer, LV_TICK_PERIOD_MS * 1000000));
+    // Energy totals survive reboots, the last checkpoint is written on restart
+    energy_restore();
+    hal_on_shutdown(energy_save);
+    hal_on_shutdown(loads_save);
+
+    phase_ctrl_hw_init();
+
+    /* Create and start a periodic timer interrupt to call update_current_value() */
+    hal_timer_periodic(update_current_value, NULL, "periodic_current", TELEMETRY_PERIOD_MS * 1000);
 
 
     while(1)
     {
-        adc_raw = adc1_get_raw(ADC1_CURRENT_CHANNEL);
-        ESP_LOGI(TAG, "Current raw data: %d", adc_raw);
-        if (cali_enable)
+        sample_cnt = hal_adc_read(adc_samples, HAL_ADC_FRAME_SAMPLES);
+
+        // Every DMA frame, ~13 ms
+        relay_poll();
+        turn_on_poll();
+        zc_monitor_process(&Zero_cross);
+
+        if(Loads_dirty)
+        {
+            Loads_dirty = false;
+            loads_save();
+        }
+
+        if(sample_cnt == 0)
         {
-            voltage = esp_adc_cal_raw_to_voltage(adc_raw, &adc1_chars);
-            ESP_LOGI(TAG, ">>>>>>>>>> cali data: %d mV", voltage);
+            continue;
+        }
+
+        adc_lut_convert(&adc1_lut, adc_samples, adc_samples, sample_cnt);
+
+        // Protection first: the loads open before the frame is metered
+        limit_mv = SENSOR_MV(trip_limit_settled(Trip_limit_ma));
+        peak_mv = limit_mv * CONFIG_OVERCURRENT_PEAK_PERCENT / 100;
+        overcurrent_set_limits(&overcurrent, (peak_mv < SENSOR_PEAK_MAX_MV) ? peak_mv : SENSOR_PEAK_MAX_MV, limit_mv);
+
+        for(pos = 0; pos < sample_cnt; )
+        {
+            pos += overcurrent_feed(&overcurrent, &adc_samples[pos], sample_cnt - pos);
+
+            if(overcurrent_tripped(&overcurrent))
+            {
+                overcurrent_take(&overcurrent, &trip);
+                trip_open_loads(&trip);
 
-            Current = voltage * CURRENT_COEFF;
+                // The loads are open, no new limit until the next frame
+                overcurrent_set_limits(&overcurrent, 0, 0);
+            }
         }
 
-        vTaskDelay(pdMS_TO_TICKS(1000));          // 1s
+        for(pos = 0; pos < sample_cnt; )
+        {
+            pos += current_rms_feed(&current_acc, &adc_samples[pos], sample_cnt - pos);
+
+            if(current_rms_ready(&current_acc))
+            {
+                current_rms_take(&current_acc, &rms_result);
+                current_rms_update(&rms_result);
+            }
+        }
     }
 }
 
+/**
+ * @brief Converts the RMS of one window into the Current value in mA, then
+ *        fits the next window and the protection half-cycle to the mains
+ *        period measured by the zero-cross monitor
+ *
+ * @param result RMS window result in mV
+ */
+static void current_rms_update(const current_rms_result_t *result)
+{
+    uint32_t half_period_us = zc_monitor_half_period_us(&Zero_cross);
+
+    voltage = result->rms;
+    HAL_LOGD(TAG, "Current RMS: mean %d mV, rms %d mV", result->mean, result->rms);
+
+    overcurrent_set_offset(&overcurrent, result->mean);
+    current_rms_set_window(&current_acc, RMS_WINDOW_SAMPLES(half_period_us));
+    overcurrent_set_half_cycle(&overcurrent, HALF_CYCLE_SAMPLES(half_period_us));
+
+    Current = CURRENT_MA(voltage);
+
+    energy_update(Current);
+    mains_stats_update();
+    timer_jitter_log();
+}
 
 /**
- * @brief Updates the value of Current for WQTT cloud
+ * @brief Clamps the channel limits to the range of the current sensor
+ */
+static void limits_init(void)
+{
+    for(size_t idx = 0; idx < HW_CHANNEL_CNT; ++idx)
+    {
+        Limit_ma[idx] = Channels[idx].limit_ma;
+
+        if(Limit_ma[idx] > CURRENT_MAX_MA)
+        {
+            HAL_LOGW(TAG, "Load on pin %u: limit %u mA beyond the sensor range, clamped to %u mA",
+                     Channels[idx].pin, Limit_ma[idx], CURRENT_MAX_MA);
+            Limit_ma[idx] = CURRENT_MAX_MA;
+        }
+    }
+}
+
+/**
+ * @brief Reports the mains frequency and zero-cross health once per
+ *        MAINS_STATS_WINDOWS windows
+ */
+static void mains_stats_update(void)
+{
+    static uint32_t windows = 0;
+
+    if(++windows < MAINS_STATS_WINDOWS)
+    {
+        return;
+    }
+    windows = 0;
+
+    zc_monitor_take_stats(&Zero_cross, &Mains_stats);
+
+    wqtt_client_set_Mains(WQTT_MAINS_FREQUENCY, Mains_stats.freq_mhz);
+    wqtt_client_set_Mains(WQTT_MAINS_JITTER, Mains_stats.jitter_p99_us);
+    wqtt_client_set_Mains(WQTT_MAINS_MISSED, Mains_stats.missed);
+}
+
+/**
+ * @brief Logs the esp_timer callback jitter once per JITTER_LOG_WINDOWS windows
+ */
+static void timer_jitter_log(void)
+{
+    static uint32_t windows = 0;
+    histogram_t jitter;
+    histogram_t isr_cost;
+
+    if(++windows < JITTER_LOG_WINDOWS)
+    {
+        return;
+    }
+    windows = 0;
+
+    // The timer callback keeps adding: take the histogram and restart it in one step
+    hal_spin_lock(&Timer_jitter_lock);
+    jitter = timer_jitter;
+    histogram_reset(&timer_jitter);
+    hal_spin_unlock(&Timer_jitter_lock);
+
+    HAL_LOGI(TAG, "esp_timer jitter: n=%u p50=%u p99=%u max=%u us, telemetry dropped %u",
+             jitter.count,
+             histogram_percentile(&jitter, 500),
+             histogram_percentile(&jitter, 990),
+             jitter.max,
+             wqtt_client_get_Telemetry_dropped());
+
+    // The ISR keeps adding: take the histogram and restart it in one step
+    hal_spin_lock(&Zc_cost_lock);
+    isr_cost = zc_isr_cost;
+    histogram_reset(&zc_isr_cost);
+    hal_spin_unlock(&Zc_cost_lock);
+
+    HAL_LOGI(TAG, "Mains: %u mHz, jitter p99=%u max=%u us, missed %u, noise %u, lost %u, ISR p50=%u p99=%u max=%u cycles",
+             Mains_stats.freq_mhz,
+             Mains_stats.jitter_p99_us,
+             Mains_stats.jitter_max_us,
+             Mains_stats.missed,
+             Mains_stats.noise,
+             Mains_stats.overflows,
+             histogram_percentile(&isr_cost, 500),
+             histogram_percentile(&isr_cost, 990),
+             isr_cost.max);
+
+    HAL_LOGI(TAG, "Turn-on: released %u, over budget %u, longest wait %u ms",
+             Turn_on.release_cnt,
+             Turn_on.forced_cnt,
+             Turn_on.max_wait_seen_ms);
+
+    if(relay_error.count != 0)
+    {
+        HAL_LOGI(TAG, "Relay alignment error: n=%u p50=%u p99=%u max=%u us",
+                 relay_error.count,
+                 histogram_percentile(&relay_error, 500),
+                 histogram_percentile(&relay_error, 990),
+                 relay_error.max);
+
+        histogram_reset(&relay_error);
+    }
+}
+
+/**
+ * @brief Integrates the measured current of one RMS window into the energy totals
+ *
+ * There is a single current sensor, so the power is split between the loads
+ * that are on in proportion to their rated current Limit_ma. The window lasts
+ * as long as the measured mains period makes it, the time since the last
+ * window is integrated, not the nominal length. Totals are written to NVS
+ * only at checkpoints.
+ *
+ * @param current_ma Current of the window in mA
+ */
+static void energy_update(uint32_t current_ma)
+{
+    static int64_t last_us = 0;
+    static uint32_t rest_us = 0;        // Below 1 ms, carried to the next window
+    int64_t now_us = hal_time_us();
+    uint32_t step_us;
+    uint32_t dt_ms;
+    // The first channels are the loads, in hw_load_t order
+    uint32_t weight_ma[HW_LOAD_CNT] = {
+        [HW_LOAD1] = (dev_state_get(DEV_HEATER) == HW_ON)  ? Limit_ma[HW_LOAD1] : 0,
+        [HW_LOAD2] = (dev_state_get(DEV_FAN) > HW_LVL_OFF) ? Limit_ma[HW_LOAD2] : 0,
+        [HW_LOAD3] = (dev_state_get(DEV_LIGHT) == HW_ON)   ? Limit_ma[HW_LOAD3] : 0
+    };
+    uint32_t power_mw = current_ma * CONFIG_NOMINAL_VOLTAGE;
+
+    step_us = (last_us == 0 || now_us - last_us > ENERGY_MAX_STEP_US) ? RMS_WINDOW_MS * 1000
+                                                                      : (uint32_t)(now_us - last_us);
+    last_us = now_us;
+    step_us += rest_us;
+    dt_ms = step_us / 1000;
+    rest_us = step_us % 1000;
+
+    // With every load off the reading is sensor noise and nothing is added
+    energy_meter_add_shared(&energy, weight_ma, power_mw, dt_ms);
+
+    for(int load = 0; load < HW_LOAD_CNT; ++load)
+    {
+        Energy_Wh[load] = energy_meter_get_wh(&energy, load);
+    }
+
+    if(energy_meter_checkpoint_due(&energy, hal_time_ms()))
+    {
+        energy_save();
+    }
+}
+
+/**
+ * @brief Loads the energy totals of the last checkpoint from NVS
+ */
+static void energy_restore(void)
+{
+    uint64_t total_uj[ENERGY_METER_CHANNELS];
+
+    energy_meter_init(&energy, CONFIG_ENERGY_CHECKPOINT_WH, CONFIG_ENERGY_CHECKPOINT_MIN, hal_time_ms());
+
+    if(hal_nvs_get_blob(HW_CTRL_NVS_NAMESPACE, ENERGY_NVS_KEY, total_uj, sizeof(total_uj)))
+    {
+        energy_meter_restore(&energy, total_uj);
+
+        for(int load = 0; load < HW_LOAD_CNT; ++load)
+        {
+            Energy_Wh[load] = energy_meter_get_wh(&energy, load);
+        }
+    }
+}
+
+/**
+ * @brief Writes an energy checkpoint to NVS
+ *
+ * Also registered as a shutdown handler, so a restart does not lose the
+ * energy accumulated since the last checkpoint.
+ */
+static void energy_save(void)
+{
+    if(hal_nvs_set_blob(HW_CTRL_NVS_NAMESPACE, ENERGY_NVS_KEY, energy.total_uj, sizeof(energy.total_uj)))
+    {
+        energy_meter_checkpoint_done(&energy, hal_time_ms());
+    } else {
+        HAL_LOGE(TAG, "Energy checkpoint failed");
+    }
+}
+
+/**
+ * @brief Updates the values of Current and Energy for WQTT cloud
  * 
  * @param arg Arguments
  */
 static void update_current_value(void *arg)
 {
+    static int64_t last_call_us = 0;
+    int64_t now_us = hal_time_us();
+    int64_t jitter_us;
+
+    // Lateness of the callback shows how busy the esp_timer task is
+    if(last_call_us != 0)
+    {
+        jitter_us = now_us - last_call_us - TELEMETRY_PERIOD_MS * 1000;
+        hal_spin_lock(&Timer_jitter_lock);
+        histogram_add(&timer_jitter, (uint32_t)(jitter_us < 0 ? -jitter_us : jitter_us));
+        hal_spin_unlock(&Timer_jitter_lock);
+    }
+    last_call_us = now_us;
+
     wqtt_client_set_current( Current );
+
+    for(int load = 0; load < HW_LOAD_CNT; ++load)
+    {
+        wqtt_client_set_Energy(load, Energy_Wh[load]);
+    }
 }
 
 
 /**
- * The function `adc_calibration_init` checks if the ADC calibration scheme is supported and if the
- * eFuse is burnt, and then characterizes the ADC if both conditions are met.
- * 
- * @return a boolean value, which indicates whether the ADC calibration initialization was successful
- * or not. If the calibration was successful, the function returns true. Otherwise, it returns false.
- */
-static bool adc_calibration_init(void)
-{
-    esp_err_t ret;
-    bool cali_enable = false;
-
-    ret = esp_adc_cal_check_efuse(ADC_EXAMPLE_CALI_SCHEME);
-    if (ret == ESP_ERR_NOT_SUPPORTED) {
-        ESP_LOGW(TAG, "Calibration scheme not supported, skip software calibration");
-    } else if (ret == ESP_ERR_INVALID_VERSION) {
-        ESP_LOGW(TAG, "eFuse not burnt, skip software calibration");
-    } else if (ret == ESP_OK) {
-        cali_enable = true;
-        esp_adc_cal_characterize(ADC_UNIT_1, ADC_EXAMPLE_ATTEN, ADC_WIDTH_BIT_DEFAULT, 0, &adc1_chars);
+ * @brief Sets up the zero-cross interrupt, the one-shot firing timer for Load2
+ *        and the relay switching timer for Load3
+ */
+static void phase_ctrl_hw_init(void)
+{
+    hal_phase_timer_init(phase_timer_isr, NULL);
+    hal_relay_timer_init(relay_timer_isr, NULL);
+    hal_gpio_isr(ZERO_PIN, HAL_EDGE_RISING, zero_cross_isr, NULL);
+
+    // Relay changes are aligned from now on
+    hal_spin_lock(&Relay_lock);
+    Relay_aligned = true;
+    hal_spin_unlock(&Relay_lock);
+}
+
+/**
+ * @brief Zero-cross edge: releases the TRIAC gate, captures the edge and arms
+ *        the firing point, then schedules a pending relay switching
+ *
+ * @param arg Not used
+ */
+static void HAL_ISR_ATTR zero_cross_isr(void *arg)
+{
+    uint32_t start_cycles = hal_cpu_cycles();
+    uint64_t now_us = hal_phase_timer_now_us();
+    uint64_t alarm_us;
+    uint32_t half_period_us;
+    uint32_t cost_cycles;
+    bool phase_armed;
+    bool relay_armed;
+
+    LOAD2_OFF();
+
+    // Noise keeps the schedule of the last crossing
+    if(zc_monitor_capture(&Zero_cross, now_us))
+    {
+        half_period_us = zc_monitor_half_period_us(&Zero_cross);
+
+        hal_spin_lock(&Phase_lock);
+        phase_armed = phase_ctrl_on_zero_cross(&Load2_phase, now_us, half_period_us, &alarm_us);
+        if(!phase_armed && Load2_actuate)
+        {
+            // Switched off: the gate is not fired from this half-cycle on
+            Load2_actuate = false;
+            Actuated_us = hal_time_us();
+        }
+        hal_spin_unlock(&Phase_lock);
+
+        if(phase_armed)
+        {
+            hal_phase_timer_alarm(alarm_us);
+        }
+
+        hal_spin_lock(&Relay_lock);
+        relay_armed = relay_sched_on_zero_cross(&Load3_relay, now_us, half_period_us, &alarm_us);
+        hal_spin_unlock(&Relay_lock);
+
+        if(relay_armed)
+        {
+            hal_relay_timer_alarm_after((uint32_t)(alarm_us - now_us));
+        }
+    }
+
+    cost_cycles = hal_cpu_cycles() - start_cycles;
+    hal_spin_lock(&Zc_cost_lock);
+    histogram_add(&zc_isr_cost, cost_cycles);
+    hal_spin_unlock(&Zc_cost_lock);
+}
+
+/**
+ * @brief One-shot alarm: starts or ends the TRIAC gate pulse
+ *
+ * @param arg Not used
+ * @return false, no higher priority task is woken
+ */
+static bool HAL_ISR_ATTR phase_timer_isr(void *arg)
+{
+    uint64_t now_us = hal_phase_timer_now_us();
+    uint64_t alarm_us;
+    bool gate_on;
+    bool armed;
+
+    hal_spin_lock(&Phase_lock);
+    armed = phase_ctrl_on_alarm(&Load2_phase, now_us, &gate_on, &alarm_us);
+    if(gate_on)
+    {
+        LOAD2_ON();
+        if(Load2_actuate)
+        {
+            Load2_actuate = false;
+            Actuated_us = hal_time_us();
+        }
     } else {
-        ESP_LOGE(TAG, "Invalid arg");
+        LOAD2_OFF();
     }
+    hal_spin_unlock(&Phase_lock);
 
-    return cali_enable;
+    if(armed)
+    {
+        hal_phase_timer_alarm(alarm_us);
+    }
+
+    return false;
 }
 
-/****************************************
- EXTERNAL FUNCTIONS
-*****************************************/
+/**
+ * @brief Relay alarm: switches the coil ahead of the aimed zero crossing
+ *
+ * @param arg Not used
+ * @return false, no higher priority task is woken
+ */
+static bool HAL_ISR_ATTR relay_timer_isr(void *arg)
+{
+    bool fire;
+    bool on;
+
+    hal_spin_lock(&Relay_lock);
+    fire = relay_sched_on_alarm(&Load3_relay, hal_phase_timer_now_us(), &on);
+    hal_spin_unlock(&Relay_lock);
+
+    if(fire)
+    {
+        relay_drive(on);
+    }
+
+    return false;
+}
 
 /**
- * The function "hw_ctrl_start" creates a task called "hw_ctrl_task" with a stack size of 4096*2 and a
- * priority of 10.
+ * @brief Drives the relay coil
+ *
+ * @param on Coil state
  */
-void hw_ctrl_start(void)
+static void HAL_ISR_ATTR relay_drive(bool on)
 {
-    xTaskCreate(hw_ctrl_task, "hw_ctrl_task", 4096*2, NULL, 10, NULL);
+    if(Relay_channel != NULL)
+    {
+        hal_gpio_set_level(Relay_channel->pin, on != Relay_channel->active_low);
+        Actuated_us = hal_time_us();
+    }
 }
 
 /**
- * @brief   Set level for Load2 within 0 .. 100%
- * 
- * @param level 0..100 (%)
+ * @brief Switches a relay request that got no zero crossing in time and
+ *        collects the alignment error of the last switching
  */
-void hw_ctrl_set_Load2_level(hw_electr_lvl_t level)
+static void relay_poll(void)
 {
-    if(level > HW_LVL_VERY_HIGH )
+    bool fire;
+    bool on;
+    bool error_ready;
+    int32_t error_us;
+
+    hal_spin_lock(&Relay_lock);
+    fire = relay_sched_poll(&Load3_relay, hal_phase_timer_now_us(), &on);
+    error_ready = relay_sched_take_error(&Load3_relay, &error_us);
+    hal_spin_unlock(&Relay_lock);
+
+    if(fire)
     {
-        level = HW_LVL_VERY_HIGH;
+        HAL_LOGW(TAG, "No zero crossing, relay switched unaligned");
+        relay_drive(on);
     }
 
-    Load2_level = level;
+    if(error_ready)
+    {
+        histogram_add(&relay_error, (uint32_t)(error_us < 0 ? -error_us : error_us));
+    }
 }
 
 /**
- * @brief   Get Load2 level
- * 
- * @return uint8_t Level of 2 ( 0 .. 100% )
+ * @brief Adds the pin level that switches a channel on or off to a group
+ *
+ * @param mask  Group of pin changes
+ * @param ch    Switch or relay channel
+ * @param on    Load state
  */
-hw_electr_lvl_t hw_ctrl_get_Load2_level(void)
+static void channel_mask_add(pin_mask_t *mask, const hw_channel_t *ch, bool on)
 {
-    return Load2_level;
+    pin_mask_add(mask, ch->pin, on != ch->active_low);
 }
 
 /**
- * @brief   Set Load1 state
+ * @brief Applies a new value to one channel. Switch pins are only collected
+ *        and written by hw_ctrl_flush().
  * 
- * @param state HW_ON, HW_OFF
+ * @param ch    Channel
+ * @param value hw_state_t or hw_electr_lvl_t of the field
  */
-void hw_ctrl_set_Load1_state(hw_state_t state)
+static void channel_apply(const hw_channel_t *ch, uint32_t value)
 {
-    Load1_state = state;
+    switch(ch->type) {
+    case HW_CH_SWITCH:
+        channel_mask_add(&Pending, ch, value == HW_ON);
+        break;
+
+    case HW_CH_RELAY:
+        hal_spin_lock(&Relay_lock);
+        if(Relay_aligned)
+        {
+            relay_sched_request(&Load3_relay, value == HW_ON, hal_phase_timer_now_us());
+            hal_spin_unlock(&Relay_lock);
+            break;
+        }
+        // No zero-cross timing before hw_ctrl_start(): switch with the group
+        relay_sched_init(&Load3_relay, CONFIG_RELAY_OFFSET_US, CONFIG_RELAY_OPERATE_US, CONFIG_RELAY_RELEASE_US,
+                         CONFIG_RELAY_ZC_TIMEOUT_MS * 1000, value == HW_ON);
+        hal_spin_unlock(&Relay_lock);
+
+        channel_mask_add(&Pending, ch, value == HW_ON);
+        break;
+
+    case HW_CH_PHASE:
+        // The engine picks the new firing angle at the next zero crossing
+        hal_spin_lock(&Phase_lock);
+        phase_ctrl_set_level(&Load2_phase, (hw_electr_lvl_t)value);
+        Load2_actuate = true;
+        hal_spin_unlock(&Phase_lock);
+        break;
 
-    if(Load1_state == HW_ON)
+    case HW_CH_PWM:
+        if(value <= HW_LVL_VERY_HIGH)
+        {
+            hal_pwm_set(ch->pwm_channel, Level_duty_permille[value]);
+            Actuated_us = hal_time_us();
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Tells whether a channel value lets current flow
+ *
+ * @param ch    Channel
+ * @param value hw_state_t or hw_electr_lvl_t of the field
+ * @return true if the load is on
+ */
+static bool channel_is_on(const hw_channel_t *ch, uint32_t value)
+{
+    if(ch->type == HW_CH_PHASE || ch->type == HW_CH_PWM)
     {
-        LOAD1_ON();
-    } else {
-        LOAD1_OFF();
+        return value > HW_LVL_OFF;
     }
 
+    return value == HW_ON;
 }
 
 /**
- * @brief   Get Load1 level
- * 
- * @return hw_state_t HW_ON, HW_OFF
+ * @brief Sums the limits of the protected loads that are switched on, loads
+ *        waiting for the turn-on scheduler do not count. Channel_lock is held.
+ *
+ * A sum beyond the sensor range is clamped to it, the RMS limit then only
+ * trips on a clipped waveform.
+ *
+ * @return Trip limit in mA, 0 with every load off
+ */
+static uint32_t trip_limit_calc(void)
+{
+    uint32_t limit_ma = 0;
+    bool clamped;
+
+    for(size_t idx = 0; idx < HW_CHANNEL_CNT; ++idx)
+    {
+        if(Channel_on & (1UL << idx))
+        {
+            limit_ma += Limit_ma[idx];
+        }
+    }
+
+    clamped = (limit_ma > CURRENT_MAX_MA);
+    if(clamped && !Limit_clamped)
+    {
+        HAL_LOGW(TAG, "Trip limit %u mA beyond the sensor range, clamped to %u mA", limit_ma, CURRENT_MAX_MA);
+    }
+    Limit_clamped = clamped;
+
+    return clamped ? CURRENT_MAX_MA : limit_ma;
+}
+
+/**
+ * @brief Follows a raised trip limit at once, a lowered one only once the
+ *        loads switched off have stopped drawing. Called by hw_ctrl_task.
+ *
+ * @param limit_ma Trip limit of the loads that are on
+ * @return Trip limit for the protection
+ */
+static uint32_t trip_limit_settled(uint32_t limit_ma)
+{
+    static uint32_t held_ma = 0;
+    static uint32_t target_ma = 0;
+    static uint32_t lowered_ms = 0;
+    uint32_t now_ms = hal_time_ms();
+
+    if(limit_ma >= held_ma)
+    {
+        held_ma = limit_ma;
+        target_ma = limit_ma;
+        return held_ma;
+    }
+
+    // Every new switch-off restarts the settle time
+    if(limit_ma != target_ma)
+    {
+        target_ma = limit_ma;
+        lowered_ms = now_ms;
+    }
+
+    if(now_ms - lowered_ms >= TRIP_LIMIT_SETTLE_MS)
+    {
+        held_ma = limit_ma;
+    }
+
+    return held_ma;
+}
+
+/**
+ * @brief Opens every protected load right away, bypassing the zero-cross
+ *        alignment, then records the trip in the state store and reports it
+ *
+ * @param trip Trip from the detector, in mV around the sensor offset
+ */
+static void trip_open_loads(const overcurrent_trip_t *trip)
+{
+    dev_change_t changes[HW_CHANNEL_CNT];
+    size_t change_cnt = 0;
+    pin_mask_t off;
+
+    pin_mask_init(&off);
+    hal_mutex_lock(Channel_lock);
+
+    // Nothing waiting is switched on after the trip
+    turn_on_sched_cancel_all(&Turn_on);
+
+    for(size_t idx = 0; idx < HW_CHANNEL_CNT; ++idx)
+    {
+        const hw_channel_t *ch = &Channels[idx];
+
+        if(ch->limit_ma == 0)
+        {
+            continue;
+        }
+
+        Channel_on &= ~(1UL << idx);
+
+        switch(ch->type) {
+        case HW_CH_RELAY:
+            // A switching armed for a zero crossing is cancelled
+            hal_spin_lock(&Relay_lock);
+            relay_sched_init(&Load3_relay, CONFIG_RELAY_OFFSET_US, CONFIG_RELAY_OPERATE_US, CONFIG_RELAY_RELEASE_US,
+                             CONFIG_RELAY_ZC_TIMEOUT_MS * 1000, false);
+            hal_spin_unlock(&Relay_lock);
+            // fall through
+
+        case HW_CH_SWITCH:
+            channel_mask_add(&off, ch, false);
+            changes[change_cnt].value = HW_OFF;
+            break;
+
+        case HW_CH_PHASE:
+            // The TRIAC stops conducting at the next zero crossing
+            hal_spin_lock(&Phase_lock);
+            phase_ctrl_set_level(&Load2_phase, HW_LVL_OFF);
+            LOAD2_OFF();
+            hal_spin_unlock(&Phase_lock);
+            changes[change_cnt].value = HW_LVL_OFF;
+            break;
+
+        case HW_CH_PWM:
+            hal_pwm_set(ch->pwm_channel, 0);
+            changes[change_cnt].value = HW_LVL_OFF;
+            break;
+        }
+
+        changes[change_cnt].field = ch->field;
+        change_cnt++;
+    }
+
+    hal_gpio_write_mask(off.set, off.clear);
+    Trip_limit_ma = 0;
+
+    hal_mutex_unlock(Channel_lock);
+
+    Trip_ma = CURRENT_MA(trip->value);
+    HAL_LOGE(TAG, "Overcurrent trip: %s %u mA after %u samples of the half-cycle",
+             (trip->kind == OVERCURRENT_PEAK) ? "peak" : "RMS", Trip_ma, trip->samples);
+
+    dev_state_set_group(changes, change_cnt, DEV_ORIGIN_TRIP);
+
+    wqtt_client_set_trip(Trip_ma);
+    ui_set_trip(Trip_ma);
+}
+
+/**
+ * @brief Applies a new value to a channel or, when it switches a protected
+ *        load on, hands it to the turn-on scheduler. Channel_lock is held.
+ *
+ * @param idx   Channel index
+ * @param value hw_state_t or hw_electr_lvl_t of the field
+ */
+static void channel_request(size_t idx, uint32_t value)
+{
+    const hw_channel_t *ch = &Channels[idx];
+    uint32_t bit = 1UL << idx;
+    bool on = channel_is_on(ch, value);
+
+    // A new level of a load that is already on is not a turn-on
+    if(on && Limit_ma[idx] != 0 && !(Channel_on & bit) &&
+       !turn_on_sched_request(&Turn_on, idx, value, Limit_ma[idx], Current, hal_time_ms()))
+    {
+        return;
+    }
+
+    if(!on)
+    {
+        turn_on_sched_cancel(&Turn_on, idx);
+    }
+
+    channel_apply(ch, value);
+    Channel_on = on ? (Channel_on | bit) : (Channel_on & ~bit);
+}
+
+/**
+ * @brief Writes the collected switch pins. Channel_lock is held.
  */
-hw_state_t hw_ctrl_get_Load1_state(void)
+static void pins_write(void)
 {
-    return Load1_state;
+    if(!pin_mask_empty(&Pending))
+    {
+        hal_gpio_write_mask(Pending.set, Pending.clear);
+        pin_mask_init(&Pending);
+        Actuated_us = hal_time_us();
+    }
+
+    Trip_limit_ma = trip_limit_calc();
+}
+
+/**
+ * @brief Switches on the next waiting load once the spacing and the current
+ *        budget allow it
+ */
+static void turn_on_poll(void)
+{
+    uint32_t idx;
+    uint32_t value;
+
+    hal_mutex_lock(Channel_lock);
+
+    if(turn_on_sched_poll(&Turn_on, Current, hal_time_ms(), &idx, &value))
+    {
+        channel_apply(&Channels[idx], value);
+        Channel_on |= 1UL << idx;
+        pins_write();
+    }
+
+    hal_mutex_unlock(Channel_lock);
 }
 
 /**
- * @brief   Get Load3 level
+ * @brief State store sink: applies a changed field to its channels
  * 
- * @param state     HW_ON, HW_OFF
+ * @param field     Changed field
+ * @param value     New value
+ * @param origin    The outputs follow every change, the trip is cleared by
+ *                  a user command only
  */
-void hw_ctrl_set_Load3_state(hw_state_t state)
+static void hw_ctrl_apply(dev_field_t field, uint32_t value, dev_origin_t origin)
 {
-    Load3_state = state;
+    bool load_on = false;
 
-    if(Load3_state == HW_ON)
+    hal_mutex_lock(Channel_lock);
+
+    for(size_t idx = 0; idx < HW_CHANNEL_CNT; ++idx)
     {
-        LOAD3_ON();
-    } else {
-        LOAD3_OFF();
+        if(Channels[idx].field == field)
+        {
+            channel_request(idx, value);
+            load_on |= (Channels[idx].limit_ma != 0 && channel_is_on(&Channels[idx], value));
+        }
     }
+
+    hal_mutex_unlock(Channel_lock);
+
+    // Switching a load on again by the user acknowledges the trip
+    if(Trip_ma != 0 && load_on && (origin == DEV_ORIGIN_UI || origin == DEV_ORIGIN_MQTT))
+    {
+        Trip_ma = 0;
+        wqtt_client_set_trip(0);
+        ui_set_trip(0);
+    }
+}
+
+/**
+ * @brief State store flush: switches all pins of the group at once and
+ *        updates the trip limit. The NVS write would hold the store lock for
+ *        milliseconds, the states are saved by hw_ctrl_task instead.
+ */
+static void hw_ctrl_flush(void)
+{
+    hal_mutex_lock(Channel_lock);
+    pins_write();
+    hal_mutex_unlock(Channel_lock);
+
+    Loads_dirty = true;
 }
 
 /**
- * @brief   Get Load3 state
+ * @brief Packs the load and LED states, one byte each
  * 
- * @return hw_state_t HW_ON, HW_OFF
+ * @return Packed states
  */
-hw_state_t hw_ctrl_get_Load3_state(void)
+static uint32_t loads_pack(void)
 {
-    return Load3_state;
+    return (dev_state_get(DEV_HEATER)) |
+           (dev_state_get(DEV_FAN) << 8) |
+           (dev_state_get(DEV_LIGHT) << 16) |
+           (dev_state_get(DEV_LED) << 24);
+}
+
+/**
+ * @brief Loads the load and LED states saved before the restart
+ */
+static void loads_restore(void)
+{
+    uint32_t packed;
+
+    if(hal_nvs_get_u32(HW_CTRL_NVS_NAMESPACE, LOADS_NVS_KEY, &packed))
+    {
+        // Out of range values are rejected by the store and stay at their defaults
+        dev_state_set(DEV_HEATER, (packed & 0xFF) ? HW_ON : HW_OFF, DEV_ORIGIN_RESTORE);
+        dev_state_set(DEV_FAN, (packed >> 8) & 0xFF, DEV_ORIGIN_RESTORE);
+        dev_state_set(DEV_LIGHT, ((packed >> 16) & 0xFF) ? HW_ON : HW_OFF, DEV_ORIGIN_RESTORE);
+        dev_state_set(DEV_LED, ((packed >> 24) & 0xFF) ? HW_ON : HW_OFF, DEV_ORIGIN_RESTORE);
+        Saved_loads = loads_pack();
+    }
+}
+
+/**
+ * @brief Saves the load and LED states if they differ from the saved ones.
+ *        States change only on user commands, so the flash wear is low.
+ *        Runs in hw_ctrl_task and on restart, never under the store lock.
+ */
+static void loads_save(void)
+{
+    uint32_t packed = loads_pack();
+
+    if(packed == Saved_loads)
+    {
+        return;
+    }
+
+    if(hal_nvs_set_u32(HW_CTRL_NVS_NAMESPACE, LOADS_NVS_KEY, packed))
+    {
+        Saved_loads = packed;
+    }
+}
+
+/****************************************
+ EXTERNAL FUNCTIONS
+*****************************************/
+
+/**
+ * @brief Configures the load pins and drives them to the states saved before
+ *        the restart. Needs only NVS and the state store, so it runs first
+ *        during the boot.
+ */
+void hw_ctrl_init(void)
+{
+    uint32_t turn_on_budget_ma;
+
+    limits_init();
+    loads_restore();
+
+    for(size_t idx = 0; idx < HW_CHANNEL_CNT; ++idx)
+    {
+        if(Channels[idx].type == HW_CH_PWM)
+        {
+            hal_pwm_init(Channels[idx].pwm_channel, Channels[idx].pin, PWM_FREQ_HZ);
+        } else {
+            hal_gpio_output(Channels[idx].pin);
+        }
+
+        if(Channels[idx].type == HW_CH_RELAY)
+        {
+            Relay_channel = &Channels[idx];
+        }
+    }
+    hal_gpio_input(ZERO_PIN);       // Zero-cross sensor
+
+    LOAD2_OFF();
+
+    // Load2 is fired by the phase control engine once hw_ctrl_start() runs
+    zc_monitor_init(&Zero_cross);
+    phase_ctrl_init(&Load2_phase);
+
+    // Restored loads are switched on one by one once hw_ctrl_task runs
+    Channel_lock = hal_mutex_create();
+    turn_on_budget_ma = CONFIG_TURN_ON_BUDGET_MA;
+    if(turn_on_budget_ma > CURRENT_MAX_MA)
+    {
+        HAL_LOGW(TAG, "Turn-on budget %u mA beyond the sensor range, clamped to %u mA", turn_on_budget_ma, CURRENT_MAX_MA);
+        turn_on_budget_ma = CURRENT_MAX_MA;
+    }
+    turn_on_sched_init(&Turn_on, CONFIG_TURN_ON_SPACING_MS, turn_on_budget_ma, CONFIG_TURN_ON_MAX_WAIT_MS);
+
+    // Drives the pins to the restored states, then follows every change
+    dev_state_subscribe(DEV_SINK_HW, hw_ctrl_apply, hw_ctrl_flush);
+}
+
+/**
+ * @brief Starts current sampling, overcurrent protection, energy metering and
+ *        the zero-cross timed loads. Call after hw_ctrl_init(), the loads
+ *        keep their restored states until then.
+ */
+void hw_ctrl_start(void)
+{
+    hal_task_create(hw_ctrl_task, "hw_ctrl_task", 4096*2, 10, HAL_CORE_ANY);
 }
 
 /**
@@ -282,28 +1195,30 @@ uint32_t hw_ctrl_get_Current(void)
 }
 
 /**
- * @brief Sets LED state
+ * @brief Gets the energy consumed by a load
  * 
- * @param LED_new_state: HW_ON, HW_OFF
+ * @param load HW_LOAD1 .. HW_LOAD3
+ * @return Energy in Wh
  */
-void hw_ctrl_set_LED_state(hw_state_t LED_new_state)
+uint32_t hw_ctrl_get_Energy(hw_load_t load)
 {
-    LED_state = LED_new_state;
-
-    if(LED_state == HW_ON)
+    if(load >= HW_LOAD_CNT)
     {
-        LED_ON();
-    } else {
-        LED_OFF();
+        return 0;
     }
+
+    return Energy_Wh[load];
 }
 
 /**
- * @brief Get Lamp3 state
+ * @brief Gets the time an output last changed for a command: the write of
+ *        the switch pins, the relay coil switched at its aimed point and the
+ *        first gate pulse of a new Load2 level, or the zero crossing it stops
+ *        firing at. A command that changes no pin leaves it unchanged.
  * 
- * @return HW_ON, HW_OFF
+ * @return Time in us since boot
  */
-hw_state_t  hw_ctrl_get_LED_state(void)
+int64_t hw_ctrl_get_Actuated_us(void)
 {
-    return LED_state;
+    return Actuated_us;
 }
\ No newline at end of file
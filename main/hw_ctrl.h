@@ -2,6 +2,7 @@
 #define _HW_CTRL_H_
 
 #include <stdlib.h>
+#include <stdint.h>
 
 /**********************************
  CONSTANTS AND MACROS
@@ -9,13 +10,10 @@
 
 #define LV_TICK_PERIOD_MS   1
 
-// Covers for function names according to functional intention
-#define hw_ctrl_set_Heater_state    hw_ctrl_set_Load1_state
-#define hw_ctrl_set_Fan_level       hw_ctrl_set_Load2_level
-#define hw_ctrl_set_Light_state     hw_ctrl_set_Load3_state
-#define hw_ctrl_get_Heater_state    hw_ctrl_get_Load1_state
-#define hw_ctrl_get_Fan_level       hw_ctrl_get_Load2_level
-#define hw_ctrl_get_Light_state     hw_ctrl_get_Load3_state
+// Load channels for per-load values
+#define HW_HEATER                   HW_LOAD1
+#define HW_FAN                      HW_LOAD2
+#define HW_LIGHT                    HW_LOAD3
 
 /**********************************
  TYPES DEFINITIONS
@@ -35,24 +33,22 @@ typedef enum {
 
 } hw_electr_lvl_t;
 
+typedef enum {
+    HW_LOAD1 = 0,
+    HW_LOAD2 = 1,
+    HW_LOAD3 = 2,
+    HW_LOAD_CNT
+} hw_load_t;
+
 /**********************************
  FUNCTION PROTTOTYPES
 ***********************************/
 
-void            hw_ctrl_start();
-
-void            hw_ctrl_set_Load2_level(hw_electr_lvl_t level);
-hw_electr_lvl_t hw_ctrl_get_Load2_level(void);
-
-void            hw_ctrl_set_Load1_state(hw_state_t state);
-hw_state_t      hw_ctrl_get_Load1_state(void);
-
-void            hw_ctrl_set_Load3_state(hw_state_t state);
-hw_state_t      hw_ctrl_get_Load3_state(void);
+void            hw_ctrl_init(void);
+void            hw_ctrl_start(void);
 
 uint32_t        hw_ctrl_get_Current(void);
-
-void            hw_ctrl_set_LED_state(hw_state_t LED_new_state);
-hw_state_t      hw_ctrl_get_LED_state(void);
+uint32_t        hw_ctrl_get_Energy(hw_load_t load);
+int64_t         hw_ctrl_get_Actuated_us(void);
 
 #endif // _HW_CTRL_H_
\ No newline at end of file
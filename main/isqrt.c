@@ -0,0 +1,40 @@
+#include <stdint.h>
+
+#include "isqrt.h"
+
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Integer square root, rounded down. Bit by bit, so it needs no FPU
+ *        and runs in constant time.
+ *
+ * @param value Radicand
+ * @return floor(sqrt(value))
+ */
+uint32_t isqrt64(uint64_t value)
+{
+    uint64_t result = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+
+    while(bit > value)
+    {
+        bit >>= 2;
+    }
+
+    while(bit != 0)
+    {
+        if(value >= result + bit)
+        {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint32_t)result;
+}
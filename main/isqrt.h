@@ -0,0 +1,12 @@
+#ifndef _ISQRT_H_
+#define _ISQRT_H_
+
+#include <stdint.h>
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+uint32_t    isqrt64(uint64_t value);
+
+#endif // _ISQRT_H_
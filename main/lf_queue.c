@@ -0,0 +1,101 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "lf_queue.h"
+
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Adds an item
+ *
+ * @param queue Queue
+ * @param item  Item to copy into the queue
+ * @return true     on success
+ * @return false    if the queue is full
+ */
+bool lf_queue_push(lf_queue_t *queue, const lf_queue_item_t *item)
+{
+    unsigned pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    lf_queue_cell_t *cell;
+
+    while(1)
+    {
+        cell = &queue->cells[pos & queue->mask];
+
+        unsigned seq = atomic_load_explicit(&cell->seq, memory_order_acquire) + (pos & queue->mask);
+        int diff = (int)(seq - pos);
+
+        if(diff == 0)
+        {
+            // The cell is free at this lap, try to claim it
+            if(atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1,
+                                                     memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if(diff < 0)
+        {
+            // The cell still holds an item of the previous lap
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
+
+    cell->item = *item;
+    atomic_store_explicit(&cell->seq, pos + 1 - (pos & queue->mask), memory_order_release);
+
+    return true;
+}
+
+/**
+ * @brief Removes the oldest item
+ *
+ * @param queue Queue
+ * @param item  Output
+ * @return true     on success
+ * @return false    if the queue is empty
+ */
+bool lf_queue_pop(lf_queue_t *queue, lf_queue_item_t *item)
+{
+    unsigned pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    lf_queue_cell_t *cell;
+
+    while(1)
+    {
+        cell = &queue->cells[pos & queue->mask];
+
+        unsigned seq = atomic_load_explicit(&cell->seq, memory_order_acquire) + (pos & queue->mask);
+        int diff = (int)(seq - (pos + 1));
+
+        if(diff == 0)
+        {
+            // The cell is filled at this lap, try to claim it
+            if(atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+                                                     memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if(diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+
+    *item = cell->item;
+    atomic_store_explicit(&cell->seq, pos + queue->mask + 1 - (pos & queue->mask), memory_order_release);
+
+    return true;
+}
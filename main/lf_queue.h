@@ -0,0 +1,61 @@
+#ifndef _LF_QUEUE_H_
+#define _LF_QUEUE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/**********************************
+ CONSTANTS AND MACROS
+***********************************/
+
+/**
+ * @brief Static initializer of an empty queue
+ *
+ * @param cells_array   Zero-initialized lf_queue_cell_t array, its size a power of two
+ */
+#define LF_QUEUE_INITIALIZER(cells_array)   \
+    { .cells = (cells_array), .mask = (sizeof(cells_array) / sizeof((cells_array)[0])) - 1 }
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+/**
+ * @brief Typed event carried by the queue
+ */
+typedef struct {
+    uint16_t    type;
+    uint16_t    arg;
+    uint32_t    value;
+} lf_queue_item_t;
+
+typedef struct {
+    atomic_uint     seq;        // Sequence number minus the cell index, so zeroed cells are empty
+    lf_queue_item_t item;
+} lf_queue_cell_t;
+
+/**
+ * @brief Bounded multi-producer multi-consumer queue without locks
+ *
+ * Every cell carries a sequence number telling whether it is free for the
+ * producer or filled for the consumer at the current lap, so producers and
+ * consumers only contend on one compare-and-swap. Push and pop never block
+ * and may be called from any task or ISR. A zeroed queue with cells and mask
+ * set is valid, so queues need no run-time initialization.
+ */
+typedef struct {
+    lf_queue_cell_t *   cells;
+    uint32_t            mask;
+    atomic_uint         head;       // Next position to push
+    atomic_uint         tail;       // Next position to pop
+} lf_queue_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+bool    lf_queue_push(lf_queue_t *queue, const lf_queue_item_t *item);
+bool    lf_queue_pop(lf_queue_t *queue, lf_queue_item_t *item);
+
+#endif // _LF_QUEUE_H_
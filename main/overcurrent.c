@@ -0,0 +1,178 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "overcurrent.h"
+#include "isqrt.h"
+
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+/**
+ * @brief Starts the next half-cycle
+ *
+ * @param oc Detector
+ */
+static void half_cycle_reset(overcurrent_t *oc)
+{
+    oc->count = 0;
+    oc->sum_sq = 0;
+    oc->peak = 0;
+}
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Starts a disabled detector
+ *
+ * @param oc                    Detector
+ * @param half_cycle_samples    Samples in one mains half-cycle
+ */
+void overcurrent_init(overcurrent_t *oc, uint32_t half_cycle_samples)
+{
+    oc->half_cycle_samples = half_cycle_samples;
+    oc->offset = 0;
+    oc->peak_limit = 0;
+    oc->rms_limit = 0;
+    oc->tripped = OVERCURRENT_NONE;
+    oc->trip_value = 0;
+    oc->trip_samples = 0;
+
+    half_cycle_reset(oc);
+}
+
+/**
+ * @brief Changes the half-cycle length, e.g. to follow the mains period. The
+ *        running half-cycle completes at the new length.
+ *
+ * @param oc                    Detector
+ * @param half_cycle_samples    Samples in one mains half-cycle
+ */
+void overcurrent_set_half_cycle(overcurrent_t *oc, uint32_t half_cycle_samples)
+{
+    oc->half_cycle_samples = half_cycle_samples;
+}
+
+/**
+ * @brief Updates the DC offset of the sensor, measured over whole mains cycles
+ *
+ * @param oc        Detector
+ * @param offset    Mean of the samples
+ */
+void overcurrent_set_offset(overcurrent_t *oc, uint32_t offset)
+{
+    oc->offset = offset;
+}
+
+/**
+ * @brief Sets the limits. The running half-cycle is checked against the new
+ *        limits when it completes.
+ *
+ * @param oc            Detector
+ * @param peak_limit    Largest allowed sample around the offset, 0 disables the detector
+ * @param rms_limit     Largest allowed half-cycle RMS
+ */
+void overcurrent_set_limits(overcurrent_t *oc, uint32_t peak_limit, uint32_t rms_limit)
+{
+    oc->peak_limit = peak_limit;
+    oc->rms_limit = rms_limit;
+}
+
+/**
+ * @brief Checks samples until a trip
+ *
+ * Samples are only counted while the detector is disabled or the offset is
+ * not measured yet, so half-cycles stay aligned to the sample stream.
+ *
+ * @param oc        Detector
+ * @param samples   Input samples
+ * @param count     Number of input samples
+ * @return Number of samples consumed. Less than count on a trip: take the
+ *         trip and feed the rest again.
+ */
+size_t overcurrent_feed(overcurrent_t *oc, const uint16_t *samples, size_t count)
+{
+    bool enabled = (oc->peak_limit != 0 && oc->offset != 0);
+    uint64_t rms_limit_sq = (uint64_t)oc->rms_limit * oc->rms_limit;
+
+    if(oc->tripped != OVERCURRENT_NONE)
+    {
+        return 0;
+    }
+
+    for(size_t idx = 0; idx < count; ++idx)
+    {
+        int32_t delta = (int32_t)samples[idx] - (int32_t)oc->offset;
+        uint32_t magnitude = (uint32_t)(delta < 0 ? -delta : delta);
+
+        oc->count++;
+
+        if(enabled)
+        {
+            oc->sum_sq += (uint64_t)magnitude * magnitude;
+
+            if(magnitude > oc->peak)
+            {
+                oc->peak = magnitude;
+            }
+
+            if(magnitude > oc->peak_limit)
+            {
+                oc->tripped = OVERCURRENT_PEAK;
+                oc->trip_value = magnitude;
+                oc->trip_samples = oc->count;
+                half_cycle_reset(oc);
+                return idx + 1;
+            }
+        }
+
+        if(oc->count < oc->half_cycle_samples)
+        {
+            continue;
+        }
+
+        // sum_sq / n > limit^2 without the division
+        if(enabled && oc->sum_sq > rms_limit_sq * oc->count)
+        {
+            oc->tripped = OVERCURRENT_RMS;
+            oc->trip_value = isqrt64(oc->sum_sq / oc->count);
+            oc->trip_samples = oc->count;
+            half_cycle_reset(oc);
+            return idx + 1;
+        }
+
+        half_cycle_reset(oc);
+    }
+
+    return count;
+}
+
+/**
+ * @brief Tells whether the detector tripped
+ *
+ * @param oc Detector
+ * @return true when overcurrent_take() has to be called
+ */
+bool overcurrent_tripped(const overcurrent_t *oc)
+{
+    return oc->tripped != OVERCURRENT_NONE;
+}
+
+/**
+ * @brief Returns the trip and re-arms the detector
+ *
+ * @param oc    Detector
+ * @param trip  Output
+ */
+void overcurrent_take(overcurrent_t *oc, overcurrent_trip_t *trip)
+{
+    trip->kind = oc->tripped;
+    trip->value = oc->trip_value;
+    trip->samples = oc->trip_samples;
+
+    oc->tripped = OVERCURRENT_NONE;
+}
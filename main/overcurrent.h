@@ -0,0 +1,61 @@
+#ifndef _OVERCURRENT_H_
+#define _OVERCURRENT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+typedef enum {
+    OVERCURRENT_NONE = 0,
+    OVERCURRENT_PEAK,               // A single sample beyond the peak limit
+    OVERCURRENT_RMS                 // RMS of a half-cycle beyond the RMS limit
+} overcurrent_kind_t;
+
+/**
+ * @brief Half-cycle overcurrent detector.
+ *
+ * Every sample is checked against the peak limit, the RMS of every
+ * half-cycle against the RMS limit. Both are taken around the DC offset of
+ * the sensor, all values are in the units of the input samples. Like the RMS
+ * accumulator it only sees samples: the caller opens the loads.
+ */
+typedef struct {
+    uint32_t            half_cycle_samples;
+    uint32_t            offset;         // DC offset of the sensor, 0 while not measured yet
+    uint32_t            peak_limit;     // 0 disables the detector
+    uint32_t            rms_limit;
+    uint32_t            count;          // Samples of the current half-cycle
+    uint64_t            sum_sq;
+    uint32_t            peak;
+    overcurrent_kind_t  tripped;
+    uint32_t            trip_value;     // Peak or RMS that tripped
+    uint32_t            trip_samples;   // Samples of the half-cycle until the trip
+} overcurrent_t;
+
+/**
+ * @brief One trip
+ */
+typedef struct {
+    overcurrent_kind_t  kind;
+    uint32_t            value;          // Peak or RMS, around the DC offset
+    uint32_t            samples;        // Samples of the half-cycle until the trip
+} overcurrent_trip_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+void    overcurrent_init(overcurrent_t *oc, uint32_t half_cycle_samples);
+void    overcurrent_set_half_cycle(overcurrent_t *oc, uint32_t half_cycle_samples);
+void    overcurrent_set_offset(overcurrent_t *oc, uint32_t offset);
+void    overcurrent_set_limits(overcurrent_t *oc, uint32_t peak_limit, uint32_t rms_limit);
+
+size_t  overcurrent_feed(overcurrent_t *oc, const uint16_t *samples, size_t count);
+bool    overcurrent_tripped(const overcurrent_t *oc);
+void    overcurrent_take(overcurrent_t *oc, overcurrent_trip_t *trip);
+
+#endif // _OVERCURRENT_H_
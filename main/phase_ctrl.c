@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "phase_ctrl.h"
+
+
+/*******************************************************
+ CONSTANTS
+ *******************************************************/
+
+/* Firing delay as a fraction (1/1000) of the half-period for every level.
+ * The values solve P(a) = 1 - a/pi + sin(2a)/(2pi) for 25, 50, 75 and 100%
+ * of the full RMS power of a resistive load. */
+static const uint16_t level_delay_permille[] = {
+    [HW_LVL_OFF]        = 1000,
+    [HW_LVL_LOW]        = 632,
+    [HW_LVL_MEDIUM]     = 500,
+    [HW_LVL_HIGH]       = 368,
+    [HW_LVL_VERY_HIGH]  = 0
+};
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Resets the engine with the load off
+ *
+ * @param ctrl Engine state
+ */
+void phase_ctrl_init(phase_ctrl_t *ctrl)
+{
+    ctrl->level = HW_LVL_OFF;
+    ctrl->stage = PHASE_STAGE_IDLE;
+}
+
+/**
+ * @brief Sets the power level applied from the next half-cycle on
+ *
+ * @param ctrl  Engine state
+ * @param level HW_LVL_OFF .. HW_LVL_VERY_HIGH
+ */
+void phase_ctrl_set_level(phase_ctrl_t *ctrl, hw_electr_lvl_t level)
+{
+    if(level < HW_LVL_OFF)
+    {
+        level = HW_LVL_OFF;
+    }
+    else if(level > HW_LVL_VERY_HIGH)
+    {
+        level = HW_LVL_VERY_HIGH;
+    }
+
+    ctrl->level = level;
+}
+
+/**
+ * @brief Maps a power level to the firing delay after the zero crossing
+ *
+ * @param level             HW_LVL_OFF .. HW_LVL_VERY_HIGH
+ * @param half_period_us    Current mains half-period
+ * @return Delay in us, 0 when the load must not be fired in this half-cycle
+ */
+uint32_t phase_ctrl_level_to_delay_us(hw_electr_lvl_t level, uint32_t half_period_us)
+{
+    uint32_t delay_us;
+
+    if(level <= HW_LVL_OFF || level > HW_LVL_VERY_HIGH)
+    {
+        return 0;
+    }
+
+    delay_us = (half_period_us * level_delay_permille[level]) / 1000;
+
+    if(delay_us < PHASE_CTRL_MIN_DELAY_US)
+    {
+        delay_us = PHASE_CTRL_MIN_DELAY_US;
+    }
+
+    if(delay_us > half_period_us - PHASE_CTRL_GUARD_US)
+    {
+        delay_us = half_period_us - PHASE_CTRL_GUARD_US;
+    }
+
+    return delay_us;
+}
+
+/**
+ * @brief Handles a zero crossing accepted by the zero-cross monitor: schedules
+ *        firing
+ *
+ * The gate is always released at the zero crossing, so the caller must drive
+ * the gate pin low before applying the result.
+ *
+ * @param ctrl              Engine state
+ * @param now_us            Timestamp of the edge
+ * @param half_period_us    Current mains half-period
+ * @param alarm_us          Output: absolute time of the firing point
+ * @return true     if an alarm has to be armed at alarm_us
+ * @return false    if the load stays off for this half-cycle
+ */
+bool phase_ctrl_on_zero_cross(phase_ctrl_t *ctrl, uint64_t now_us, uint32_t half_period_us, uint64_t *alarm_us)
+{
+    uint32_t delay_us;
+
+    ctrl->stage = PHASE_STAGE_IDLE;
+
+    delay_us = phase_ctrl_level_to_delay_us(ctrl->level, half_period_us);
+    if(delay_us == 0)
+    {
+        return false;
+    }
+
+    ctrl->stage = PHASE_STAGE_ARMED;
+    *alarm_us = now_us + delay_us;
+
+    return true;
+}
+
+/**
+ * @brief Handles the one-shot timer alarm armed by the engine
+ *
+ * @param ctrl      Engine state
+ * @param now_us    Timestamp of the alarm
+ * @param gate_on   Output: level to drive on the gate pin
+ * @param alarm_us  Output: absolute time of the next alarm
+ * @return true     if the next alarm has to be armed at alarm_us
+ * @return false    if nothing else is scheduled in this half-cycle
+ */
+bool phase_ctrl_on_alarm(phase_ctrl_t *ctrl, uint64_t now_us, bool *gate_on, uint64_t *alarm_us)
+{
+    if(ctrl->stage == PHASE_STAGE_ARMED)
+    {
+        ctrl->stage = PHASE_STAGE_GATE_ON;
+        *gate_on = true;
+        *alarm_us = now_us + PHASE_CTRL_GATE_PULSE_US;
+
+        return true;
+    }
+
+    ctrl->stage = PHASE_STAGE_IDLE;
+    *gate_on = false;
+
+    return false;
+}
@@ -0,0 +1,52 @@
+#ifndef _PHASE_CTRL_H_
+#define _PHASE_CTRL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hw_ctrl.h"
+
+/**********************************
+ CONSTANTS AND MACROS
+***********************************/
+
+#define PHASE_CTRL_MIN_DELAY_US             150     // TRIAC needs some voltage across it to latch
+#define PHASE_CTRL_GUARD_US                 400     // Latest firing point before the next zero crossing
+#define PHASE_CTRL_GATE_PULSE_US            100     // Width of the TRIAC gate pulse
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+typedef enum {
+    PHASE_STAGE_IDLE = 0,       // Nothing scheduled in this half-cycle
+    PHASE_STAGE_ARMED,          // Alarm is set for the firing point
+    PHASE_STAGE_GATE_ON         // Gate pulse is active, alarm is set for its end
+} phase_stage_t;
+
+/**
+ * @brief State of the phase-angle firing engine.
+ *
+ * The engine knows nothing about the hardware: the caller feeds it zero-cross
+ * and alarm timestamps (in microseconds of any monotonic clock) with the mains
+ * half-period tracked by the zero-cross monitor, and applies the returned gate
+ * level and alarm time to the real pin and timer.
+ */
+typedef struct {
+    volatile hw_electr_lvl_t    level;
+    phase_stage_t               stage;
+} phase_ctrl_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+void        phase_ctrl_init(phase_ctrl_t *ctrl);
+void        phase_ctrl_set_level(phase_ctrl_t *ctrl, hw_electr_lvl_t level);
+
+uint32_t    phase_ctrl_level_to_delay_us(hw_electr_lvl_t level, uint32_t half_period_us);
+
+bool        phase_ctrl_on_zero_cross(phase_ctrl_t *ctrl, uint64_t now_us, uint32_t half_period_us, uint64_t *alarm_us);
+bool        phase_ctrl_on_alarm(phase_ctrl_t *ctrl, uint64_t now_us, bool *gate_on, uint64_t *alarm_us);
+
+#endif // _PHASE_CTRL_H_
@@ -0,0 +1,52 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pin_mask.h"
+
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Starts an empty group
+ *
+ * @param mask Group
+ */
+void pin_mask_init(pin_mask_t *mask)
+{
+    mask->set = 0;
+    mask->clear = 0;
+}
+
+/**
+ * @brief Adds the level of one pin, replacing an earlier level of that pin
+ *
+ * @param mask  Group
+ * @param pin   GPIO number, below 64
+ * @param level Level to drive
+ */
+void pin_mask_add(pin_mask_t *mask, uint32_t pin, bool level)
+{
+    uint64_t bit = 1ULL << pin;
+
+    if(level)
+    {
+        mask->set |= bit;
+        mask->clear &= ~bit;
+    } else {
+        mask->clear |= bit;
+        mask->set &= ~bit;
+    }
+}
+
+/**
+ * @brief Tells whether the group drives no pin
+ *
+ * @param mask Group
+ * @return true if there is nothing to write
+ */
+bool pin_mask_empty(const pin_mask_t *mask)
+{
+    return mask->set == 0 && mask->clear == 0;
+}
@@ -0,0 +1,29 @@
+#ifndef _PIN_MASK_H_
+#define _PIN_MASK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+/**
+ * @brief Pin levels of a group of changes, written at once by one set and
+ *        one clear register write. Bit N is GPIO N. A pin is in one mask at
+ *        most, its last level wins.
+ */
+typedef struct {
+    uint64_t    set;
+    uint64_t    clear;
+} pin_mask_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+void    pin_mask_init(pin_mask_t *mask);
+void    pin_mask_add(pin_mask_t *mask, uint32_t pin, bool level);
+bool    pin_mask_empty(const pin_mask_t *mask);
+
+#endif // _PIN_MASK_H_
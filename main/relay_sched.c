@@ -0,0 +1,212 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "relay_sched.h"
+
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+/**
+ * @brief Gets the time the contacts take to follow the coil
+ *
+ * @param sched Scheduler state
+ * @param on    Coil state switched to
+ * @return Operate time to close, release time to open
+ */
+static uint32_t switch_time_us(const relay_sched_t *sched, bool on)
+{
+    return on ? sched->operate_us : sched->release_us;
+}
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Resets the scheduler with the coil in a known state
+ *
+ * @param sched         Scheduler state
+ * @param offset_us     Contact switching point after the zero crossing
+ * @param operate_us    Measured operate time of the relay
+ * @param release_us    Measured release time of the relay
+ * @param timeout_us    Longest wait for a zero crossing
+ * @param on            Current coil state
+ */
+void relay_sched_init(relay_sched_t *sched, uint32_t offset_us, uint32_t operate_us, uint32_t release_us,
+                      uint32_t timeout_us, bool on)
+{
+    sched->offset_us = offset_us;
+    sched->operate_us = operate_us;
+    sched->release_us = release_us;
+    sched->timeout_us = timeout_us;
+    sched->stage = RELAY_STAGE_IDLE;
+    sched->on = on;
+    sched->target_on = on;
+    sched->request_us = 0;
+    sched->last_zero_us = 0;
+    sched->target_zero_us = 0;
+    sched->fired_us = 0;
+    sched->check_pending = false;
+    sched->error_ready = false;
+    sched->error_us = 0;
+}
+
+/**
+ * @brief Requests a new coil state, switched at the next suitable zero crossing
+ *
+ * @param sched     Scheduler state
+ * @param on        Requested state
+ * @param now_us    Time of the request
+ * @return true     if a switching is scheduled
+ * @return false    if the coil is already in that state, a pending opposite
+ *                  switching is cancelled
+ */
+bool relay_sched_request(relay_sched_t *sched, bool on, uint64_t now_us)
+{
+    if(sched->stage != RELAY_STAGE_IDLE && sched->target_on == on)
+    {
+        return true;
+    }
+
+    sched->target_on = on;
+
+    if(sched->on == on)
+    {
+        sched->stage = RELAY_STAGE_IDLE;
+        return false;
+    }
+
+    sched->stage = RELAY_STAGE_PENDING;
+    sched->request_us = now_us;
+
+    return true;
+}
+
+/**
+ * @brief Handles a zero-cross edge: measures the alignment of the last
+ *        switching and schedules a pending one
+ *
+ * @param sched             Scheduler state
+ * @param now_us            Timestamp of the edge
+ * @param half_period_us    Current mains half-period
+ * @param alarm_us          Output: absolute time to switch the coil
+ * @return true     if an alarm has to be armed at alarm_us
+ * @return false    if nothing is pending
+ */
+bool relay_sched_on_zero_cross(relay_sched_t *sched, uint64_t now_us, uint32_t half_period_us, uint64_t *alarm_us)
+{
+    int64_t lead_us = (int64_t)sched->offset_us - switch_time_us(sched, sched->target_on);
+    uint32_t cycles = 0;
+
+    if(sched->check_pending && now_us + half_period_us / 2 >= sched->target_zero_us)
+    {
+        sched->check_pending = false;
+
+        // Only the crossing the switching was aimed at tells the error
+        if(now_us <= sched->target_zero_us + half_period_us / 2)
+        {
+            sched->error_us = (int32_t)((int64_t)(sched->fired_us + switch_time_us(sched, sched->on)) -
+                                        (int64_t)(now_us + sched->offset_us));
+            sched->error_ready = true;
+        }
+    }
+
+    sched->last_zero_us = now_us;
+
+    if(sched->stage != RELAY_STAGE_PENDING)
+    {
+        return false;
+    }
+
+    // First zero crossing the coil can still be switched for
+    while((int64_t)cycles * half_period_us + lead_us < RELAY_SCHED_MIN_LEAD_US)
+    {
+        cycles++;
+    }
+
+    sched->target_zero_us = now_us + (uint64_t)cycles * half_period_us;
+    sched->stage = RELAY_STAGE_ARMED;
+    *alarm_us = (uint64_t)((int64_t)now_us + (int64_t)cycles * half_period_us + lead_us);
+
+    return true;
+}
+
+/**
+ * @brief Handles the alarm armed by the scheduler
+ *
+ * @param sched     Scheduler state
+ * @param now_us    Timestamp of the alarm
+ * @param on        Output: coil state to drive
+ * @return true     if the coil has to be switched
+ * @return false    if the switching was cancelled meanwhile
+ */
+bool relay_sched_on_alarm(relay_sched_t *sched, uint64_t now_us, bool *on)
+{
+    if(sched->stage != RELAY_STAGE_ARMED)
+    {
+        return false;
+    }
+
+    sched->stage = RELAY_STAGE_IDLE;
+    sched->on = sched->target_on;
+    sched->fired_us = now_us;
+    *on = sched->on;
+
+    // Aimed at the crossing that armed the alarm: only the alarm latency counts
+    if(sched->target_zero_us <= sched->last_zero_us)
+    {
+        sched->error_us = (int32_t)((int64_t)(now_us + switch_time_us(sched, sched->on)) -
+                                    (int64_t)(sched->target_zero_us + sched->offset_us));
+        sched->error_ready = true;
+    } else {
+        sched->check_pending = true;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Switches a pending request that got no zero crossing in time
+ *
+ * @param sched     Scheduler state
+ * @param now_us    Current time
+ * @param on        Output: coil state to drive
+ * @return true     if the coil has to be switched now
+ * @return false    otherwise
+ */
+bool relay_sched_poll(relay_sched_t *sched, uint64_t now_us, bool *on)
+{
+    if(sched->stage != RELAY_STAGE_PENDING || now_us - sched->request_us < sched->timeout_us)
+    {
+        return false;
+    }
+
+    sched->stage = RELAY_STAGE_IDLE;
+    sched->on = sched->target_on;
+    sched->check_pending = false;
+    *on = sched->on;
+
+    return true;
+}
+
+/**
+ * @brief Takes the alignment error of the last aligned switching
+ *
+ * @param sched     Scheduler state
+ * @param error_us  Output: contact switching time minus the aimed point
+ * @return true     if a new error was measured
+ */
+bool relay_sched_take_error(relay_sched_t *sched, int32_t *error_us)
+{
+    if(!sched->error_ready)
+    {
+        return false;
+    }
+
+    sched->error_ready = false;
+    *error_us = sched->error_us;
+
+    return true;
+}
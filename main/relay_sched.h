@@ -0,0 +1,61 @@
+#ifndef _RELAY_SCHED_H_
+#define _RELAY_SCHED_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**********************************
+ CONSTANTS AND MACROS
+***********************************/
+
+#define RELAY_SCHED_MIN_LEAD_US     200     // Shortest time from a zero crossing to the coil switching
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+typedef enum {
+    RELAY_STAGE_IDLE = 0,       // Coil follows the requested state
+    RELAY_STAGE_PENDING,        // Waiting for a zero crossing to schedule the switching
+    RELAY_STAGE_ARMED           // Alarm is set for the coil switching
+} relay_stage_t;
+
+/**
+ * @brief Zero-cross aligned relay switching.
+ *
+ * The coil is switched operate_us (release_us to open) before the point
+ * offset_us after a zero crossing, so the contacts move at that point. Like the phase control engine
+ * it knows nothing about the hardware: the caller feeds zero-cross, alarm and
+ * poll timestamps of one monotonic clock and drives the coil as told.
+ */
+typedef struct {
+    uint32_t        offset_us;          // Contact switching point after the zero crossing
+    uint32_t        operate_us;         // Coil energized to contacts closed
+    uint32_t        release_us;         // Coil released to contacts open
+    uint32_t        timeout_us;         // Switch anyway when no zero crossing comes
+    relay_stage_t   stage;
+    bool            on;                 // Coil state
+    bool            target_on;          // Requested state
+    uint64_t        request_us;
+    uint64_t        last_zero_us;
+    uint64_t        target_zero_us;     // Zero crossing the switching is aimed at
+    uint64_t        fired_us;           // Time the coil was switched
+    bool            check_pending;      // Alignment error is measured at the target zero crossing
+    bool            error_ready;
+    int32_t         error_us;           // Contact switching time minus the aimed point
+} relay_sched_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+void    relay_sched_init(relay_sched_t *sched, uint32_t offset_us, uint32_t operate_us, uint32_t release_us,
+                         uint32_t timeout_us, bool on);
+bool    relay_sched_request(relay_sched_t *sched, bool on, uint64_t now_us);
+
+bool    relay_sched_on_zero_cross(relay_sched_t *sched, uint64_t now_us, uint32_t half_period_us, uint64_t *alarm_us);
+bool    relay_sched_on_alarm(relay_sched_t *sched, uint64_t now_us, bool *on);
+bool    relay_sched_poll(relay_sched_t *sched, uint64_t now_us, bool *on);
+bool    relay_sched_take_error(relay_sched_t *sched, int32_t *error_us);
+
+#endif // _RELAY_SCHED_H_
@@ -4,26 +4,70 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include "esp_log.h"
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "esp_freertos_hooks.h"
-#include "freertos/semphr.h"
-#include "freertos/queue.h"
+#include <string.h>
+#include <stdatomic.h>
+#include <assert.h>
 
-#include "driver/gpio.h"
-#include "esp_system.h"
-
-#include "nvs_flash.h"
-#include "mqtt_client.h"
+#include "sdkconfig.h"
 
 #include "lvgl.h"
 #include "lvgl_helpers.h"
 
 #include "wifi.h"
 #include "hw_ctrl.h"
+#include "hal.h"
 #include "wqtt_client.h"
 #include "smartRelay.h"
+#include "dev_state.h"
+#include "lf_queue.h"
+#include "histogram.h"
+
+/********************************************************
+ *  CONSTANTS AND TYPES
+ ********************************************************/
+
+#define UI_QUEUE_SIZE   32      // Power of two
+#define UI_CELL_TEXT    48      // Longest text of a bound table cell
+#define UI_STATS_MS     1000    // Period of the rendering statistics
+#define UI_STATS_LOG_MS (60 * 1000) // Period of their log
+#define UI_MAX_SLEEP_MS 500     // Longest sleep of guiTask, bounds the age of polled values
+#define BOOT_FRAME_MS   2000    // Longest wait for the first frame during the boot
+
+// Touch controller pen interrupt: wakes guiTask and gates the touch read task
+#if defined(CONFIG_LV_TOUCH_CONTROLLER_XPT2046) && defined(CONFIG_LV_TOUCH_DETECT_IRQ)
+#define UI_TOUCH_IRQ_PIN        CONFIG_LV_TOUCH_PIN_IRQ
+#define UI_TOUCH_RELEASE_MS     100     // Keep reading after release to deliver the release event
+#endif
+
+// Commands posted to guiTask by the state store sink and the ui_set_* functions
+typedef enum {
+    UI_CMD_FAN_SPEED = 0,
+    UI_CMD_LIGHT_STATE,
+    UI_CMD_HEATER_STATE,
+    UI_CMD_CURRENT_VALUE,
+    UI_CMD_TRIP,
+    UI_CMD_CNT
+} ui_cmd_type_t;
+
+/**
+ * @brief Table cell bound to a value: LVGL is touched only when the text changes
+ */
+typedef struct {
+    uint16_t    row;
+    uint16_t    col;
+    bool        rendered;
+    char        text[UI_CELL_TEXT];
+} ui_cell_binding_t;
+
+/**
+ * @brief Rendering statistics
+ */
+typedef struct {
+    uint32_t    cell_writes;        // Table cells rewritten (each one invalidates the table)
+    uint32_t    cell_skips;         // Bound updates that did not change the text
+    uint32_t    redrawn_px;         // Pixels redrawn by LVGL
+    uint32_t    wakeups;            // guiTask loop iterations
+} ui_stats_t;
 
 /********************************************************
  *  STATIC PROTOTYPES
@@ -32,14 +76,26 @@
 static void lv_tick_task(void *arg);
 static void guiTask(void *pvParameter);
 static void create_controls(void);
+static void boot_phase(const char *phase);
+static void ui_post(ui_cmd_type_t type, uint32_t value);
+static void ui_apply_state(dev_field_t field, uint32_t value, dev_origin_t origin);
+static void ui_apply_command(ui_cmd_type_t type, uint32_t value);
+static void ui_apply_commands(void);
+static void ui_bind_text(ui_cell_binding_t *cell, const char *text);
+static void ui_monitor_cb(lv_disp_drv_t *disp_drv, uint32_t time, uint32_t px);
+static void ui_stats_update(void);
+static uint32_t ui_sleep_ms(uint32_t time_till_next);
+static void ui_wake(void);
+#ifdef UI_TOUCH_IRQ_PIN
+static void ui_touch_init(lv_indev_t *indev);
+static void ui_touch_gate(void);
+static void ui_touch_isr(void *arg);
+#endif
 
 /*******************************************************
  *  STATIC VARIABLES
  *******************************************************/
 
-static uint32_t     fan_speed = HW_LVL_LOW;
-static hw_state_t   light_state = HW_OFF;
-static hw_state_t   heater_state = HW_OFF;
 static uint32_t     current = 0;
 
 // Control objects
@@ -50,10 +106,41 @@ static lv_obj_t*    light_btn;
 
 static const char *TAG = "SMART RELAY";
 
-/* Creates a semaphore to handle concurrent call to lvgl stuff
- * If you wish to call *any* lvgl function from other threads/tasks
- * you should lock on the very same semaphore! */
-SemaphoreHandle_t xGuiSemaphore;
+/* LVGL is only touched by guiTask. State changes and other UI updates are
+ * posted into this queue, guiTask applies them right before
+ * lv_task_handler(). The controls change the state store only, their
+ * look follows the store like for changes from MQTT. */
+static lf_queue_cell_t  ui_cells[UI_QUEUE_SIZE];
+static lf_queue_t       ui_queue = LF_QUEUE_INITIALIZER(ui_cells);
+
+/* Every command sets a value, so only the last one of a type matters. When
+ * the queue is full the value waits in the slot of its type instead, and
+ * later values of the type follow it there until guiTask applies it. */
+static atomic_uint      ui_latest[UI_CMD_CNT];
+static atomic_uint      ui_latest_dirty = 0;       // Bit per type with a value in its slot
+
+// Value cells of the status table
+static ui_cell_binding_t    wifi_cell    = { .row = 0, .col = 1 };
+static ui_cell_binding_t    current_cell = { .row = 1, .col = 1 };
+static ui_cell_binding_t    energy_cell  = { .row = 2, .col = 1 };
+static ui_cell_binding_t    trip_cell    = { .row = 3, .col = 1 };
+
+static ui_stats_t           ui_stats;           // Running counts
+static ui_stats_t           ui_stats_rate;      // Counts of the last UI_STATS_MS period
+static ui_stats_t           ui_stats_log;       // Counts since the last log
+static volatile bool        ui_cell_bindings = true;    // false: every update rewrites its cell
+
+static hal_task_t           gui_task_handle = NULL;
+static hal_signal_t         first_frame_sem = NULL;     // Given after the first redraw
+static histogram_t          touch_latency;      // us from pen interrupt to the end of the next redraw
+static volatile int64_t     touch_irq_us = 0;   // Pen interrupt not yet followed by a redraw
+
+#ifdef UI_TOUCH_IRQ_PIN
+static lv_task_t *          touch_read_task = NULL;
+static volatile bool        touch_irq = false;
+static bool                 touch_active = false;
+static uint32_t             touch_last_pressed = 0;
+#endif
 
 /*******************************************************
  *   LVGL CONTROLS HANDLING
@@ -63,27 +150,17 @@ SemaphoreHandle_t xGuiSemaphore;
 
 static void lv_spinbox_increment_event_cb(lv_obj_t * btn, lv_event_t e)
 {
-    hw_electr_lvl_t fan_speed_lvl;
-   
     if(e == LV_EVENT_PRESSED ) {
         lv_spinbox_increment(spinbox);
-
-        fan_speed_lvl = (hw_electr_lvl_t )(lv_spinbox_get_value(spinbox));
-        wqtt_client_set_Fan_level(fan_speed_lvl);
-        hw_ctrl_set_Fan_level(fan_speed_lvl);
+        dev_state_set(DEV_FAN, lv_spinbox_get_value(spinbox), DEV_ORIGIN_UI);
     }
 }
 
 static void lv_spinbox_decrement_event_cb(lv_obj_t * btn, lv_event_t e)
 {
-    hw_electr_lvl_t fan_speed_lvl;
-
     if(e == LV_EVENT_PRESSED ) {
         lv_spinbox_decrement(spinbox);
-
-        fan_speed_lvl = (hw_electr_lvl_t )(lv_spinbox_get_value(spinbox));
-        wqtt_client_set_Fan_level(fan_speed_lvl);
-        hw_ctrl_set_Fan_level(fan_speed_lvl);
+        dev_state_set(DEV_FAN, lv_spinbox_get_value(spinbox), DEV_ORIGIN_UI);
     }
 }
 
@@ -94,18 +171,7 @@ static void heater_event_handler(lv_obj_t * obj, lv_event_t event)
 {   
     if(event == LV_EVENT_PRESSED ) 
     {
-        if(heater_state == HW_ON)
-        {
-            heater_state = HW_OFF;
-            lv_obj_set_style_local_value_str(obj, LV_BTN_PART_MAIN, LV_STATE_DEFAULT, LV_SYMBOL_EYE_CLOSE);
-            wqtt_client_set_Heater_state(HW_OFF);
-            hw_ctrl_set_Heater_state(HW_OFF);
-        } else {
-            heater_state = HW_ON;
-            lv_obj_set_style_local_value_str(obj, LV_BTN_PART_MAIN, LV_STATE_DEFAULT, LV_SYMBOL_EYE_OPEN);
-            wqtt_client_set_Heater_state(HW_ON);
-            hw_ctrl_set_Heater_state(HW_ON);
-        }
+        dev_state_set(DEV_HEATER, (dev_state_get(DEV_HEATER) == HW_ON) ? HW_OFF : HW_ON, DEV_ORIGIN_UI);
     }
 
 }
@@ -116,18 +182,7 @@ static void light_event_handler(lv_obj_t * obj, lv_event_t event)
 {
     if(event == LV_EVENT_PRESSED ) 
     {
-        if(light_state == HW_ON)
-        {
-            light_state = HW_OFF;
-            lv_obj_set_style_local_value_str(obj, LV_BTN_PART_MAIN, LV_STATE_DEFAULT, LV_SYMBOL_EYE_CLOSE);
-            wqtt_client_set_Light_state(HW_OFF);
-            hw_ctrl_set_Light_state(HW_OFF);
-        } else {
-            light_state = HW_ON;
-            lv_obj_set_style_local_value_str(obj, LV_BTN_PART_MAIN, LV_STATE_DEFAULT, LV_SYMBOL_EYE_OPEN);
-            wqtt_client_set_Light_state(HW_ON);
-            hw_ctrl_set_Light_state(HW_ON);
-        }
+        dev_state_set(DEV_LIGHT, (dev_state_get(DEV_LIGHT) == HW_ON) ? HW_OFF : HW_ON, DEV_ORIGIN_UI);
     }
 } 
 
@@ -141,12 +196,14 @@ static void create_controls(void)
 
     table = lv_table_create(lv_scr_act(), NULL);
     lv_table_set_col_cnt(table, 2);
-    lv_table_set_row_cnt(table, 2);
+    lv_table_set_row_cnt(table, 4);
     lv_obj_align(table, NULL, LV_ALIGN_IN_TOP_MID, 0, 0);
 
     // Align the price values to the right in the 2nd column
     lv_table_set_cell_align(table, 0, 1, LV_LABEL_ALIGN_RIGHT);
     lv_table_set_cell_align(table, 1, 1, LV_LABEL_ALIGN_RIGHT);
+    lv_table_set_cell_align(table, 2, 1, LV_LABEL_ALIGN_RIGHT);
+    lv_table_set_cell_align(table, 3, 1, LV_LABEL_ALIGN_RIGHT);
 
     lv_table_set_cell_type(table, 0, 0, 2);
     lv_table_set_cell_type(table, 0, 1, 2);
@@ -155,10 +212,14 @@ static void create_controls(void)
     // Fill the first column
     lv_table_set_cell_value(table, 0, 0, "Wi-Fi");
     lv_table_set_cell_value(table, 1, 0, "Current");
+    lv_table_set_cell_value(table, 2, 0, "Energy H/F/L");
+    lv_table_set_cell_value(table, 3, 0, "Protection");
 
     //Fill the second column
-    lv_table_set_cell_value(table, 0, 1, "Not connected");
-    lv_table_set_cell_value(table, 1, 1, "1A");
+    ui_bind_text(&wifi_cell, "Not connected");
+    ui_bind_text(&current_cell, "0");
+    ui_bind_text(&energy_cell, "0/0/0 Wh");
+    ui_bind_text(&trip_cell, "OK");
 
     lv_table_ext_t * ext = lv_obj_get_ext_attr(table);
     ext->row_h[0] = 20;
@@ -227,21 +288,22 @@ static void create_controls(void)
 
 static void guiTask(void *pvParameter) 
 {
-    char str[32];
-    esp_err_t ret = ESP_OK;
+    char str[48];
+
+    uint32_t time_till_next;
 
     (void) pvParameter;
-    xGuiSemaphore = xSemaphoreCreateMutex();
+    gui_task_handle = hal_task_self();
 
     lv_init();
 
     /* Initialize SPI or I2C bus used by the drivers */
     lvgl_driver_init();
 
-    lv_color_t* buf1 = heap_caps_malloc(DISP_BUF_SIZE * sizeof(lv_color_t), MALLOC_CAP_DMA);
+    lv_color_t* buf1 = hal_malloc_dma(DISP_BUF_SIZE * sizeof(lv_color_t));
     assert(buf1 != NULL);
 
-    lv_color_t* buf2 = heap_caps_malloc(DISP_BUF_SIZE * sizeof(lv_color_t), MALLOC_CAP_DMA);
+    lv_color_t* buf2 = hal_malloc_dma(DISP_BUF_SIZE * sizeof(lv_color_t));
     assert(buf2 != NULL);
 
     static lv_disp_buf_t disp_buf;
@@ -255,6 +317,7 @@ static void guiTask(void *pvParameter)
     lv_disp_drv_t disp_drv;
     lv_disp_drv_init(&disp_drv);
     disp_drv.flush_cb = disp_driver_flush;
+    disp_drv.monitor_cb = ui_monitor_cb;
 
 
     disp_drv.buffer = &disp_buf;
@@ -266,45 +329,50 @@ static void guiTask(void *pvParameter)
     lv_indev_drv_init(&indev_drv);
     indev_drv.read_cb = touch_driver_read;
     indev_drv.type = LV_INDEV_TYPE_POINTER;
-    lv_indev_drv_register(&indev_drv);
+    lv_indev_t *indev = lv_indev_drv_register(&indev_drv);
+#ifdef UI_TOUCH_IRQ_PIN
+    ui_touch_init(indev);
+#else
+    (void) indev;
+#endif
 #endif
 
     /* Create and start a periodic timer interrupt to call lv_tick_inc */
-    const esp_timer_create_args_t periodic_timer_args = {
-        .callback = &lv_tick_task,
-        .name = "periodic_gui"
-    };
-    esp_timer_handle_t periodic_timer;
-    ESP_ERROR_CHECK(esp_timer_create(&periodic_timer_args, &periodic_timer));
-    ESP_ERROR_CHECK(esp_timer_start_periodic(periodic_timer, LV_TICK_PERIOD_MS * 1000));
+    hal_timer_periodic(lv_tick_task, NULL, "periodic_gui", LV_TICK_PERIOD_MS * 1000);
 
     create_controls();
 
     while (1) {
-        // Delay 1 tick (assumes FreeRTOS tick is 10ms
-        vTaskDelay(pdMS_TO_TICKS(10));
+#ifdef UI_TOUCH_IRQ_PIN
+        ui_touch_gate();
+#endif
 
-        // Try to take the semaphore, call lvgl related function on success
-        if (pdTRUE == xSemaphoreTake(xGuiSemaphore, portMAX_DELAY)) 
-        {
-            lv_task_handler();
-        
-            xSemaphoreGive(xGuiSemaphore);
-        }
+        // Apply UI updates posted by other tasks, then render
+        ui_apply_commands();
+        time_till_next = lv_task_handler();
 
         // Update Current value on the screen
         current = hw_ctrl_get_Current();
         sprintf(str, "%d", current);
-        lv_table_set_cell_value(table, 1, 1, str);
+        ui_bind_text(&current_cell, str);
+
+        // Update consumed energy
+        sprintf(str, "%u/%u/%u Wh", hw_ctrl_get_Energy(HW_HEATER), hw_ctrl_get_Energy(HW_FAN), hw_ctrl_get_Energy(HW_LIGHT));
+        ui_bind_text(&energy_cell, str);
 
         // Update Wifi connection IP address
-        lv_table_set_cell_value(table, 0, 1, wifi_get_ip() );
+        ui_bind_text(&wifi_cell, wifi_get_ip());
+
+        ui_stats_update();
 
+        // Sleep until the next LVGL deadline, UI commands and touches wake up earlier
+        hal_task_wait(ui_sleep_ms(time_till_next));
+        ui_stats.wakeups++;
     }
 
     free(buf1);
     free(buf2);
-    vTaskDelete(NULL);
+    hal_task_exit();
 }
 
 
@@ -314,45 +382,71 @@ static void guiTask(void *pvParameter)
  **********************/
 
 
+/**
+ * @brief Logs the time since reset at the end of a boot phase
+ * 
+ * @param phase Name of the finished phase
+ */
+static void boot_phase(const char *phase)
+{
+    HAL_LOGI(TAG, "Boot: %s at %lld ms", phase, hal_time_us() / 1000);
+}
+
+/**
+ * @brief Staged boot: loads first, then the first frame, then networking.
+ *        Nothing before the network stage waits for Wi-Fi.
+ */
 void app_main(void)
 {
+    hal_log_level_set("*", HAL_LOG_INFO);
+    hal_log_level_set("MQTT_CLIENT", HAL_LOG_VERBOSE);
+    hal_log_level_set("MQTT_EXAMPLE", HAL_LOG_VERBOSE);
+    hal_log_level_set("TRANSPORT_BASE", HAL_LOG_VERBOSE);
+    hal_log_level_set("esp-tls", HAL_LOG_VERBOSE);
+    hal_log_level_set("TRANSPORT", HAL_LOG_VERBOSE);
+    hal_log_level_set("OUTBOX", HAL_LOG_VERBOSE);
+
+    // Stage 1: loads in the state they had before the restart
+    hal_nvs_init();
+    dev_state_init();
+    hw_ctrl_init();
+    boot_phase("loads restored");
+
+    // Stage 2: first frame. UI commands posted before guiTask runs are applied before the first render.
+    dev_state_subscribe(DEV_SINK_UI, ui_apply_state, NULL);
+    ui_set_current_value(0);
+
+    hal_signal_t frame_sem = hal_signal_create();
+    first_frame_sem = frame_sem;
+
     /* If you want to use a task to create the graphic, you NEED to create a Pinned task
      * Otherwise there can be problem such as memory corruption and so on.
      * NOTE: When not using Wi-Fi nor Bluetooth you can pin the guiTask to core 0 */
-    xTaskCreatePinnedToCore(guiTask, "gui", 4096*2, NULL, 0, NULL, 1);
+    hal_task_create(guiTask, "gui", 4096*2, 0, 1);
 
-    wifi_start();
+    hw_ctrl_start();
 
-    esp_log_level_set("*", ESP_LOG_INFO);
-    esp_log_level_set("MQTT_CLIENT", ESP_LOG_VERBOSE);
-    esp_log_level_set("MQTT_EXAMPLE", ESP_LOG_VERBOSE);
-    esp_log_level_set("TRANSPORT_BASE", ESP_LOG_VERBOSE);
-    esp_log_level_set("esp-tls", ESP_LOG_VERBOSE);
-    esp_log_level_set("TRANSPORT", ESP_LOG_VERBOSE);
-    esp_log_level_set("OUTBOX", ESP_LOG_VERBOSE);
+    if (hal_signal_wait(frame_sem, BOOT_FRAME_MS)) {
+        boot_phase("first frame");
+    } else {
+        HAL_LOGW(TAG, "No frame after %d ms, starting the network anyway", BOOT_FRAME_MS);
+    }
 
-    ESP_LOGI(TAG, "Connecting to WiFi..");
+    // Stage 3: networking in the background
+    HAL_LOGI(TAG, "Connecting to WiFi..");
+    wifi_start();
+    boot_phase("Wi-Fi started");
 
-    while( wifi_get_ip()[0] == 'N')
-    {
-        vTaskDelay(pdMS_TO_TICKS(10));        
+    if (!wifi_wait_connected(UINT32_MAX)) {
+        HAL_LOGE(TAG, "No Wi-Fi, MQTT is not started");
+        return;
     }
 
-    ESP_LOGI(TAG, "IP address=%s", wifi_get_ip() );
+    HAL_LOGI(TAG, "IP address=%s", wifi_get_ip() );
+    boot_phase("IP address");
 
-    hw_ctrl_start();
     wqtt_client_start();
-
-    // Initiazlize UI controls
-    ui_set_fan_speed(HW_LVL_OFF);
-    ui_set_current_value(0);
-    ui_set_heater_state(HW_OFF);
-    ui_set_light_state(HW_OFF);
-
-    // Initialize HW
-    hw_ctrl_set_Fan_level(HW_LVL_OFF);
-    hw_ctrl_set_Heater_state(HW_OFF);
-    hw_ctrl_set_Light_state(HW_LVL_OFF);
+    boot_phase("MQTT started");
 }
 
 
@@ -372,7 +466,60 @@ static void lv_tick_task(void *arg) {
  UI FUNCTIONS
  **********************************************************/
 
-void ui_set_fan_speed(uint32_t new_fan_speed)
+/**
+ * @brief Posts a UI update to guiTask. Never blocks, callable from any task.
+ * 
+ * @param type  Command
+ * @param value Command argument
+ */
+static void ui_post(ui_cmd_type_t type, uint32_t value)
+{
+    lf_queue_item_t cmd = {
+        .type = type,
+        .value = value
+    };
+
+    // Behind a value in the slot, the queue would apply this one first
+    if((atomic_load(&ui_latest_dirty) & (1u << type)) != 0 || !lf_queue_push(&ui_queue, &cmd))
+    {
+        atomic_store(&ui_latest[type], value);
+        atomic_fetch_or(&ui_latest_dirty, 1u << type);
+    }
+
+    ui_wake();
+}
+
+/**
+ * @brief State store sink: posts changes of the loads to guiTask
+ * 
+ * @param field     Changed field
+ * @param value     New value
+ * @param origin    Not used, a change made on the screen is rendered the same way
+ */
+static void ui_apply_state(dev_field_t field, uint32_t value, dev_origin_t origin)
+{
+    (void) origin;
+
+    switch(field) {
+    case DEV_HEATER:
+        ui_post(UI_CMD_HEATER_STATE, value);
+        break;
+
+    case DEV_FAN:
+        ui_post(UI_CMD_FAN_SPEED, value);
+        break;
+
+    case DEV_LIGHT:
+        ui_post(UI_CMD_LIGHT_STATE, value);
+        break;
+
+    default:
+        // The LED has no UI part
+        break;
+    }
+}
+
+static void ui_apply_fan_speed(uint32_t new_fan_speed)
 {
     if(new_fan_speed > 5) {
         new_fan_speed = 5;
@@ -381,36 +528,356 @@ void ui_set_fan_speed(uint32_t new_fan_speed)
     lv_spinbox_set_value(spinbox, new_fan_speed);
 }
 
-void ui_set_light_state(hw_state_t new_state)
+static void ui_apply_light_state(hw_state_t new_state)
 {
     if(new_state == HW_OFF)
     {
-        light_state = HW_OFF;
         lv_obj_set_style_local_value_str(light_btn, LV_BTN_PART_MAIN, LV_STATE_DEFAULT, LV_SYMBOL_EYE_CLOSE);
     } else {
-        light_state = HW_ON;
         lv_obj_set_style_local_value_str(light_btn, LV_BTN_PART_MAIN, LV_STATE_DEFAULT, LV_SYMBOL_EYE_OPEN);
     }
 }
 
-void ui_set_heater_state(hw_state_t new_state)
+static void ui_apply_heater_state(hw_state_t new_state)
 {
     if(new_state == HW_OFF)
     {
-        heater_state = HW_OFF;
         lv_obj_set_style_local_value_str(heater_btn, LV_BTN_PART_MAIN, LV_STATE_DEFAULT, LV_SYMBOL_EYE_CLOSE);
     } else {
-        heater_state = HW_ON;
         lv_obj_set_style_local_value_str(heater_btn, LV_BTN_PART_MAIN, LV_STATE_DEFAULT, LV_SYMBOL_EYE_OPEN);
     }
 
 }
 
-void ui_set_current_value(uint32_t new_current_value)
+static void ui_apply_current_value(uint32_t new_current_value)
 {
     char str[16];
 
     current = new_current_value;
     sprintf(str, "%d", current);
-    lv_table_set_cell_value(table, 1, 1, str);
+    ui_bind_text(&current_cell, str);
+}
+
+static void ui_apply_trip(uint32_t trip_ma)
+{
+    char str[UI_CELL_TEXT];
+
+    if(trip_ma == 0)
+    {
+        ui_bind_text(&trip_cell, "OK");
+        return;
+    }
+
+    snprintf(str, sizeof(str), "TRIP %u mA", trip_ma);
+    ui_bind_text(&trip_cell, str);
+}
+
+/**
+ * @brief Renders a new text into a bound table cell if it differs from the
+ *        rendered one. Every lv_table_set_cell_value() reallocates the cell,
+ *        recalculates the table size and invalidates the whole table.
+ * 
+ * @param cell  Bound cell
+ * @param text  New text
+ */
+static void ui_bind_text(ui_cell_binding_t *cell, const char *text)
+{
+    if(ui_cell_bindings && cell->rendered && strncmp(cell->text, text, sizeof(cell->text)) == 0)
+    {
+        ui_stats.cell_skips++;
+        return;
+    }
+
+    strncpy(cell->text, text, sizeof(cell->text) - 1);
+    cell->text[sizeof(cell->text) - 1] = '\0';
+    cell->rendered = true;
+
+    lv_table_set_cell_value(table, cell->row, cell->col, cell->text);
+    ui_stats.cell_writes++;
+}
+
+/**
+ * @brief Called by LVGL after every refresh with the number of redrawn pixels
+ * 
+ * @param disp_drv  Display driver
+ * @param time      Refresh time in ms
+ * @param px        Redrawn pixels
+ */
+static void ui_monitor_cb(lv_disp_drv_t *disp_drv, uint32_t time, uint32_t px)
+{
+    int64_t irq_us = touch_irq_us;
+
+    (void) disp_drv;
+    (void) time;
+
+    ui_stats.redrawn_px += px;
+
+    if(first_frame_sem != NULL)
+    {
+        hal_signal_give(first_frame_sem);
+        first_frame_sem = NULL;
+    }
+
+    if(irq_us != 0)
+    {
+        histogram_add(&touch_latency, (uint32_t)(hal_time_us() - irq_us));
+        touch_irq_us = 0;
+    }
+}
+
+/**
+ * @brief Converts the LVGL deadline into a guiTask sleep, at least one tick
+ * 
+ * @param time_till_next Return value of lv_task_handler() in ms
+ * @return ms to sleep, hal_task_wait() rounds them up to ticks
+ */
+static uint32_t ui_sleep_ms(uint32_t time_till_next)
+{
+    if(time_till_next > UI_MAX_SLEEP_MS)
+    {
+        time_till_next = UI_MAX_SLEEP_MS;
+    }
+
+    return (time_till_next == 0) ? 1 : time_till_next;
+}
+
+/**
+ * @brief Wakes guiTask before its LVGL deadline
+ */
+static void ui_wake(void)
+{
+    hal_task_t task = gui_task_handle;
+
+    if(task != NULL)
+    {
+        hal_task_notify(task);
+    }
+}
+
+#ifdef UI_TOUCH_IRQ_PIN
+/**
+ * @brief Pauses the touch read task and enables the pen interrupt. LVGL then
+ *        reads the controller only while the panel is touched.
+ * 
+ * @param indev Touch input device
+ */
+static void ui_touch_init(lv_indev_t *indev)
+{
+    touch_read_task = indev->driver.read_task;
+    lv_task_set_prio(touch_read_task, LV_TASK_PRIO_OFF);
+
+    hal_gpio_isr(UI_TOUCH_IRQ_PIN, HAL_EDGE_FALLING, ui_touch_isr, NULL);
+}
+
+/**
+ * @brief Resumes the touch read task on a pen interrupt and pauses it again
+ *        UI_TOUCH_RELEASE_MS after release
+ */
+static void ui_touch_gate(void)
+{
+    if(touch_irq)
+    {
+        touch_irq = false;
+        touch_active = true;
+        touch_last_pressed = lv_tick_get();
+
+        lv_task_set_prio(touch_read_task, LV_TASK_PRIO_HIGH);
+        lv_task_ready(touch_read_task);
+    }
+    else if(touch_active)
+    {
+        // Pen interrupt line is low while the panel is touched
+        if(hal_gpio_get_level(UI_TOUCH_IRQ_PIN) == 0)
+        {
+            touch_last_pressed = lv_tick_get();
+        }
+        else if(lv_tick_elaps(touch_last_pressed) > UI_TOUCH_RELEASE_MS)
+        {
+            touch_active = false;
+            lv_task_set_prio(touch_read_task, LV_TASK_PRIO_OFF);
+        }
+    }
+}
+
+/**
+ * @brief Pen interrupt of the touch controller
+ * 
+ * @param arg Not used
+ */
+static void HAL_ISR_ATTR ui_touch_isr(void *arg)
+{
+    (void) arg;
+
+    if(touch_irq_us == 0)
+    {
+        touch_irq_us = hal_time_us();
+    }
+    touch_irq = true;
+
+    if(gui_task_handle != NULL)
+    {
+        hal_task_notify_from_isr(gui_task_handle);
+    }
+}
+#endif
+
+/**
+ * @brief Closes a statistics period every UI_STATS_MS, logs the average
+ *        rates every UI_STATS_LOG_MS
+ */
+static void ui_stats_update(void)
+{
+    static uint32_t period_start = 0;
+    static uint32_t periods = 0;
+
+    if(lv_tick_elaps(period_start) < UI_STATS_MS)
+    {
+        return;
+    }
+
+    period_start = lv_tick_get();
+    ui_stats_rate = ui_stats;
+    memset(&ui_stats, 0, sizeof(ui_stats));
+
+    ui_stats_log.wakeups += ui_stats_rate.wakeups;
+    ui_stats_log.cell_writes += ui_stats_rate.cell_writes;
+    ui_stats_log.cell_skips += ui_stats_rate.cell_skips;
+    ui_stats_log.redrawn_px += ui_stats_rate.redrawn_px;
+
+    if(++periods < UI_STATS_LOG_MS / UI_STATS_MS)
+    {
+        return;
+    }
+
+    HAL_LOGI(TAG, "UI: %u wakeups/s, %u cell writes/s, %u skipped/s, %u px redrawn/s, touch-to-pixel p50=%u p99=%u max=%u us",
+             ui_stats_log.wakeups / periods, ui_stats_log.cell_writes / periods,
+             ui_stats_log.cell_skips / periods, ui_stats_log.redrawn_px / periods,
+             histogram_percentile(&touch_latency, 500),
+             histogram_percentile(&touch_latency, 990),
+             touch_latency.max);
+
+    memset(&ui_stats_log, 0, sizeof(ui_stats_log));
+    periods = 0;
+}
+
+/**
+ * @brief Gets the number of guiTask wakeups in the last second
+ * 
+ * @return Wakeups per second
+ */
+uint32_t ui_get_wakeups_per_sec(void)
+{
+    return ui_stats_rate.wakeups;
+}
+
+/**
+ * @brief Gets the number of table cell rewrites (whole table invalidations)
+ *        in the last second
+ * 
+ * @return Invalidations per second
+ */
+uint32_t ui_get_invalidations_per_sec(void)
+{
+    return ui_stats_rate.cell_writes;
+}
+
+/**
+ * @brief Gets the number of pixels LVGL redrew in the last second
+ * 
+ * @return Pixels per second
+ */
+uint32_t ui_get_redrawn_px_per_sec(void)
+{
+    return ui_stats_rate.redrawn_px;
+}
+
+/**
+ * @brief Gets a percentile of the time from a pen interrupt to the end of
+ *        the next redraw, over every touch so far
+ * 
+ * @param permille Percentile, 500 for the median
+ * @return Latency in us
+ */
+uint32_t ui_get_touch_latency_us(uint32_t permille)
+{
+    return histogram_percentile(&touch_latency, permille);
+}
+
+/**
+ * @brief Turns the table cell bindings off or on. Without them every update
+ *        rewrites its cell, to measure the redraws the bindings save.
+ * 
+ * @param enabled false to rewrite the cells on every update
+ */
+void ui_set_cell_bindings(bool enabled)
+{
+    ui_cell_bindings = enabled;
+}
+
+/**
+ * @brief Applies one UI update. Runs in guiTask only.
+ * 
+ * @param type  Command
+ * @param value Command argument
+ */
+static void ui_apply_command(ui_cmd_type_t type, uint32_t value)
+{
+    switch(type) {
+    case UI_CMD_FAN_SPEED:
+        ui_apply_fan_speed(value);
+        break;
+
+    case UI_CMD_LIGHT_STATE:
+        ui_apply_light_state((hw_state_t)value);
+        break;
+
+    case UI_CMD_HEATER_STATE:
+        ui_apply_heater_state((hw_state_t)value);
+        break;
+
+    case UI_CMD_CURRENT_VALUE:
+        ui_apply_current_value(value);
+        break;
+
+    case UI_CMD_TRIP:
+        ui_apply_trip(value);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Applies all posted UI updates, the queued ones first as the slots
+ *        hold newer values. Runs in guiTask only.
+ */
+static void ui_apply_commands(void)
+{
+    lf_queue_item_t cmd;
+    uint32_t dirty;
+
+    while(lf_queue_pop(&ui_queue, &cmd))
+    {
+        ui_apply_command((ui_cmd_type_t)cmd.type, cmd.value);
+    }
+
+    dirty = atomic_exchange(&ui_latest_dirty, 0);
+    for(uint32_t type = 0; type < UI_CMD_CNT; ++type)
+    {
+        if((dirty & (1u << type)) != 0)
+        {
+            ui_apply_command((ui_cmd_type_t)type, atomic_load(&ui_latest[type]));
+        }
+    }
+}
+
+void ui_set_current_value(uint32_t new_current_value)
+{
+    ui_post(UI_CMD_CURRENT_VALUE, new_current_value);
+}
+
+void ui_set_trip(uint32_t trip_ma)
+{
+    ui_post(UI_CMD_TRIP, trip_ma);
 }
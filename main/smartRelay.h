@@ -3,14 +3,20 @@
 #define _SMART_RELAY_H_
 
 #include <stdlib.h>
+#include <stdbool.h>
 
 #include "hw_ctrl.h"
 
 
-void ui_set_fan_speed(uint32_t new_fan_speed);
-void ui_set_light_state(hw_state_t new_state);
-void ui_set_heater_state(hw_state_t new_state);
 void ui_set_current_value(uint32_t new_current_value);
+void ui_set_trip(uint32_t trip_ma);
+
+uint32_t ui_get_invalidations_per_sec(void);
+uint32_t ui_get_redrawn_px_per_sec(void);
+uint32_t ui_get_wakeups_per_sec(void);
+uint32_t ui_get_touch_latency_us(uint32_t permille);
+
+void ui_set_cell_bindings(bool enabled);
 
 
 
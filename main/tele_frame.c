@@ -0,0 +1,436 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tele_frame.h"
+
+
+// CBOR major types, in the top 3 bits of the initial byte
+#define CBOR_UINT               0x00
+#define CBOR_TEXT               0x60
+#define CBOR_MAP                0xA0
+
+// Additional information: the argument follows in 1, 2 or 4 bytes
+#define CBOR_ARG_1              24
+#define CBOR_ARG_2              25
+#define CBOR_ARG_4              26
+
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+/**
+ * @brief Writes a CBOR initial byte with its argument in the shortest form
+ *
+ * @return Written length, 0 if the buffer is too small
+ */
+static size_t cbor_head(uint8_t major, uint32_t arg, uint8_t *buf, size_t size)
+{
+    size_t len;
+
+    if(arg < CBOR_ARG_1)
+    {
+        len = 1;
+    } else if(arg <= 0xFF) {
+        len = 2;
+    } else if(arg <= 0xFFFF) {
+        len = 3;
+    } else {
+        len = 5;
+    }
+
+    if(len > size)
+    {
+        return 0;
+    }
+
+    switch(len) {
+    case 1:
+        buf[0] = major | arg;
+        break;
+
+    case 2:
+        buf[0] = major | CBOR_ARG_1;
+        buf[1] = arg;
+        break;
+
+    case 3:
+        buf[0] = major | CBOR_ARG_2;
+        buf[1] = arg >> 8;
+        buf[2] = arg;
+        break;
+
+    default:
+        buf[0] = major | CBOR_ARG_4;
+        buf[1] = arg >> 24;
+        buf[2] = arg >> 16;
+        buf[3] = arg >> 8;
+        buf[4] = arg;
+        break;
+    }
+
+    return len;
+}
+
+/**
+ * @brief Encodes a frame as compact JSON
+ */
+static size_t encode_json(const tele_frame_t *frame, uint8_t *buf, size_t size)
+{
+    char *str = (char *)buf;
+    size_t len = 0;
+    int written;
+
+    if(size < 3)
+    {
+        return 0;
+    }
+
+    str[len++] = '{';
+
+    for(uint32_t idx = 0; idx < frame->count; ++idx)
+    {
+        written = snprintf(str + len, size - len, "%s\"%s\":%u",
+                           (idx == 0) ? "" : ",", frame->field[idx].key, frame->field[idx].value);
+        if(written < 0 || (size_t)written >= size - len)
+        {
+            return 0;
+        }
+        len += written;
+    }
+
+    if(len + 2 > size)
+    {
+        return 0;
+    }
+
+    str[len++] = '}';
+    str[len] = '\0';
+
+    return len;
+}
+
+/**
+ * @brief Encodes a frame as a CBOR map
+ */
+static size_t encode_cbor(const tele_frame_t *frame, uint8_t *buf, size_t size)
+{
+    size_t len;
+    size_t written;
+
+    len = cbor_head(CBOR_MAP, frame->count, buf, size);
+    if(len == 0)
+    {
+        return 0;
+    }
+
+    for(uint32_t idx = 0; idx < frame->count; ++idx)
+    {
+        size_t key_len = strlen(frame->field[idx].key);
+
+        written = cbor_head(CBOR_TEXT, key_len, buf + len, size - len);
+        if(written == 0 || len + written + key_len > size)
+        {
+            return 0;
+        }
+        len += written;
+
+        memcpy(buf + len, frame->field[idx].key, key_len);
+        len += key_len;
+
+        written = cbor_head(CBOR_UINT, frame->field[idx].value, buf + len, size - len);
+        if(written == 0)
+        {
+            return 0;
+        }
+        len += written;
+    }
+
+    return len;
+}
+
+/**
+ * @brief Reads a CBOR initial byte of the expected major type and its argument
+ *
+ * @return Read length, 0 if malformed, truncated or of another type
+ */
+static size_t cbor_read_head(uint8_t major, const uint8_t *buf, size_t len, uint32_t *arg)
+{
+    uint8_t info;
+
+    if(len == 0 || (buf[0] & 0xE0) != major)
+    {
+        return 0;
+    }
+
+    info = buf[0] & 0x1F;
+
+    if(info < CBOR_ARG_1)
+    {
+        *arg = info;
+        return 1;
+    }
+
+    switch(info) {
+    case CBOR_ARG_1:
+        if(len < 2)
+        {
+            return 0;
+        }
+        *arg = buf[1];
+        return 2;
+
+    case CBOR_ARG_2:
+        if(len < 3)
+        {
+            return 0;
+        }
+        *arg = ((uint32_t)buf[1] << 8) | buf[2];
+        return 3;
+
+    case CBOR_ARG_4:
+        if(len < 5)
+        {
+            return 0;
+        }
+        *arg = ((uint32_t)buf[1] << 24) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 8) | buf[4];
+        return 5;
+
+    default:
+        // 64 bit arguments and indefinite lengths are never encoded
+        return 0;
+    }
+}
+
+/**
+ * @brief Copies a key into the storage of a decoded frame and adds its field
+ *
+ * @return false if the frame is full or the key too long
+ */
+static bool decoded_add(tele_frame_decoded_t *decoded, const char *key, size_t key_len, uint32_t value)
+{
+    uint32_t idx = decoded->frame.count;
+
+    if(idx >= TELE_FRAME_FIELDS || key_len > TELE_FRAME_KEY_MAX)
+    {
+        return false;
+    }
+
+    memcpy(decoded->keys[idx], key, key_len);
+    decoded->keys[idx][key_len] = '\0';
+
+    return tele_frame_add(&decoded->frame, decoded->keys[idx], value);
+}
+
+/**
+ * @brief Decodes a frame written by encode_json(). Only that subset is
+ *        accepted: no white space, no escapes, unsigned integer values.
+ */
+static bool decode_json(tele_frame_decoded_t *decoded, const char *str, size_t len)
+{
+    size_t pos = 1;
+
+    if(len < 2 || str[0] != '{' || str[len - 1] != '}')
+    {
+        return false;
+    }
+
+    // Empty frame
+    if(len == 2)
+    {
+        return true;
+    }
+
+    while(pos < len)
+    {
+        const char *key;
+        size_t key_len;
+        uint64_t value = 0;
+        size_t digits = 0;
+
+        if(str[pos++] != '"')
+        {
+            return false;
+        }
+
+        key = &str[pos];
+        while(pos < len && str[pos] != '"')
+        {
+            pos++;
+        }
+        key_len = &str[pos] - key;
+
+        if(pos + 2 >= len || str[pos + 1] != ':')
+        {
+            return false;
+        }
+        pos += 2;
+
+        while(pos < len && str[pos] >= '0' && str[pos] <= '9' && digits <= 10)
+        {
+            value = value * 10 + (str[pos++] - '0');
+            digits++;
+        }
+
+        if(digits == 0 || digits > 10 || value > UINT32_MAX || pos >= len ||
+           !decoded_add(decoded, key, key_len, (uint32_t)value))
+        {
+            return false;
+        }
+
+        // Separator, or the closing brace as the last character
+        if(str[pos] == '}')
+        {
+            return pos == len - 1;
+        }
+
+        if(str[pos++] != ',')
+        {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Decodes a CBOR map of text keys to unsigned integers
+ */
+static bool decode_cbor(tele_frame_decoded_t *decoded, const uint8_t *buf, size_t len)
+{
+    uint32_t count;
+    size_t pos;
+    size_t read;
+
+    pos = cbor_read_head(CBOR_MAP, buf, len, &count);
+    if(pos == 0)
+    {
+        return false;
+    }
+
+    for(uint32_t idx = 0; idx < count; ++idx)
+    {
+        uint32_t key_len;
+        uint32_t value;
+        const char *key;
+
+        read = cbor_read_head(CBOR_TEXT, buf + pos, len - pos, &key_len);
+        if(read == 0 || key_len > len - pos - read)
+        {
+            return false;
+        }
+        pos += read;
+        key = (const char *)buf + pos;
+        pos += key_len;
+
+        read = cbor_read_head(CBOR_UINT, buf + pos, len - pos, &value);
+        if(read == 0 || !decoded_add(decoded, key, key_len, value))
+        {
+            return false;
+        }
+        pos += read;
+    }
+
+    // Nothing after the map
+    return pos == len;
+}
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Empties a frame
+ *
+ * @param frame Frame
+ */
+void tele_frame_reset(tele_frame_t *frame)
+{
+    frame->count = 0;
+}
+
+/**
+ * @brief Adds a metric
+ *
+ * @param frame Frame
+ * @param key   Short static name, without characters JSON would escape
+ * @param value Value
+ * @return false if the frame is full or the key too long
+ */
+bool tele_frame_add(tele_frame_t *frame, const char *key, uint32_t value)
+{
+    if(frame->count >= TELE_FRAME_FIELDS || strlen(key) > TELE_FRAME_KEY_MAX)
+    {
+        return false;
+    }
+
+    frame->field[frame->count].key = key;
+    frame->field[frame->count].value = value;
+    frame->count++;
+
+    return true;
+}
+
+/**
+ * @brief Encodes a frame
+ *
+ * @param frame     Frame
+ * @param format    TELE_FRAME_JSON or TELE_FRAME_CBOR
+ * @param buf       Output buffer
+ * @param size      Buffer size
+ * @return Encoded length, 0 if the buffer is too small. A JSON frame is
+ *         also terminated, not counting the terminator.
+ */
+size_t tele_frame_encode(const tele_frame_t *frame, tele_frame_format_t format, uint8_t *buf, size_t size)
+{
+    if(format == TELE_FRAME_CBOR)
+    {
+        return encode_cbor(frame, buf, size);
+    }
+
+    return encode_json(frame, buf, size);
+}
+
+/**
+ * @brief Decodes a frame, e.g. on the side of a controller or in a test
+ *
+ * @param decoded   Output: the frame and the storage of its keys
+ * @param format    TELE_FRAME_JSON or TELE_FRAME_CBOR
+ * @param buf       Message, a JSON one not necessarily terminated
+ * @param len       Message length
+ * @return false if the message is malformed or has more fields than a frame
+ */
+bool tele_frame_decode(tele_frame_decoded_t *decoded, tele_frame_format_t format, const uint8_t *buf, size_t len)
+{
+    tele_frame_reset(&decoded->frame);
+
+    if(format == TELE_FRAME_CBOR)
+    {
+        return decode_cbor(decoded, buf, len);
+    }
+
+    return decode_json(decoded, (const char *)buf, len);
+}
+
+/**
+ * @brief Finds the value of a key
+ *
+ * @param frame Frame
+ * @param key   Key
+ * @param value Output: value of the first field with the key
+ * @return false if the key is not in the frame
+ */
+bool tele_frame_get(const tele_frame_t *frame, const char *key, uint32_t *value)
+{
+    for(uint32_t idx = 0; idx < frame->count; ++idx)
+    {
+        if(strcmp(frame->field[idx].key, key) == 0)
+        {
+            *value = frame->field[idx].value;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,58 @@
+#ifndef _TELE_FRAME_H_
+#define _TELE_FRAME_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**********************************
+ CONSTANTS AND MACROS
+***********************************/
+
+#define TELE_FRAME_FIELDS       16      // Most metrics in one frame
+#define TELE_FRAME_KEY_MAX      23      // Longest key, a single CBOR header byte
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+typedef enum {
+    TELE_FRAME_JSON = 0,        // {"key":value,...}
+    TELE_FRAME_CBOR             // RFC 8949 map of text keys to unsigned integers
+} tele_frame_format_t;
+
+typedef struct {
+    const char *    key;        // Static string
+    uint32_t        value;
+} tele_frame_field_t;
+
+/**
+ * @brief Several metrics packed into one message
+ *
+ * Only collects key/value pairs and encodes them, the caller decides what
+ * goes in a frame and when it is sent.
+ */
+typedef struct {
+    tele_frame_field_t  field[TELE_FRAME_FIELDS];
+    uint32_t            count;
+} tele_frame_t;
+
+/**
+ * @brief Frame decoded from a message, the keys point into its own storage
+ */
+typedef struct {
+    tele_frame_t        frame;
+    char                keys[TELE_FRAME_FIELDS][TELE_FRAME_KEY_MAX + 1];
+} tele_frame_decoded_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+void    tele_frame_reset(tele_frame_t *frame);
+bool    tele_frame_add(tele_frame_t *frame, const char *key, uint32_t value);
+size_t  tele_frame_encode(const tele_frame_t *frame, tele_frame_format_t format, uint8_t *buf, size_t size);
+bool    tele_frame_decode(tele_frame_decoded_t *decoded, tele_frame_format_t format, const uint8_t *buf, size_t len);
+bool    tele_frame_get(const tele_frame_t *frame, const char *key, uint32_t *value);
+
+#endif // _TELE_FRAME_H_
@@ -0,0 +1,62 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "telemetry.h"
+
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Decides whether a new sample of the metric has to be published
+ *
+ * A sample goes out when it differs from the last published value by at
+ * least the deadband, or when the heartbeat interval has passed. Nothing goes
+ * out before min_interval_ms since the last message; the caller samples
+ * periodically, so a held back change is sent as soon as the interval ends.
+ *
+ * @param metric    Metric state
+ * @param value     New sample
+ * @param now_ms    Current time
+ * @return true if the sample has to be published
+ */
+bool telemetry_should_publish(const telemetry_metric_t *metric, uint32_t value, uint32_t now_ms)
+{
+    const telemetry_cfg_t *cfg = metric->cfg;
+    uint32_t elapsed_ms;
+    uint32_t change;
+
+    if(!metric->published)
+    {
+        return true;
+    }
+
+    elapsed_ms = now_ms - metric->last_ms;
+    if(elapsed_ms < cfg->min_interval_ms)
+    {
+        return false;
+    }
+
+    change = (value > metric->last_value) ? (value - metric->last_value) : (metric->last_value - value);
+    if(change != 0 && change >= cfg->deadband)
+    {
+        return true;
+    }
+
+    return cfg->max_interval_ms != 0 && elapsed_ms >= cfg->max_interval_ms;
+}
+
+/**
+ * @brief Records a published sample
+ *
+ * @param metric    Metric state
+ * @param value     Published sample
+ * @param now_ms    Time of publication
+ */
+void telemetry_published(telemetry_metric_t *metric, uint32_t value, uint32_t now_ms)
+{
+    metric->last_value = value;
+    metric->last_ms = now_ms;
+    metric->published = true;
+}
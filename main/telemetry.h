@@ -0,0 +1,39 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+/**
+ * @brief Publication policy of one metric
+ */
+typedef struct {
+    uint32_t    deadband;           // Change from the last published value that is worth a message
+    uint32_t    min_interval_ms;    // No two messages closer than this
+    uint32_t    max_interval_ms;    // Heartbeat of an unchanged value, 0 - never
+    int         qos;                // MQTT QoS of the messages
+} telemetry_cfg_t;
+
+/**
+ * @brief Publication state of one metric, statically initialized with its
+ *        policy: { .cfg = &policy }. The first sample is always published.
+ */
+typedef struct {
+    const telemetry_cfg_t * cfg;
+    uint32_t                last_value;
+    uint32_t                last_ms;
+    bool                    published;
+} telemetry_metric_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+bool    telemetry_should_publish(const telemetry_metric_t *metric, uint32_t value, uint32_t now_ms);
+void    telemetry_published(telemetry_metric_t *metric, uint32_t value, uint32_t now_ms);
+
+#endif // _TELEMETRY_H_
@@ -0,0 +1,127 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "topic_table.h"
+
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+/**
+ * @brief FNV-1a hash of a topic
+ *
+ * @param topic Topic, not necessarily zero terminated
+ * @param len   Topic length
+ * @return Hash
+ */
+static uint32_t topic_hash(const char *topic, size_t len)
+{
+    uint32_t hash = 2166136261u;
+
+    for(size_t idx = 0; idx < len; ++idx)
+    {
+        hash ^= (uint8_t)topic[idx];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Builds the table from a route list
+ *
+ * @param table     Table
+ * @param routes    Routes, must outlive the table
+ * @param count     Number of routes, up to TOPIC_TABLE_SLOTS / 2
+ * @return true     on success
+ * @return false    if the table is too small or a topic is listed twice
+ */
+bool topic_table_init(topic_table_t *table, const topic_route_t *routes, size_t count)
+{
+    memset(table, 0, sizeof(*table));
+
+    if(count > TOPIC_TABLE_SLOTS / 2)
+    {
+        return false;
+    }
+
+    for(size_t idx = 0; idx < count; ++idx)
+    {
+        size_t len = strlen(routes[idx].topic);
+        uint32_t pos = topic_hash(routes[idx].topic, len) & (TOPIC_TABLE_SLOTS - 1);
+
+        if(topic_table_find(table, routes[idx].topic, len) != NULL)
+        {
+            return false;
+        }
+
+        while(table->slot[pos].route != NULL)
+        {
+            pos = (pos + 1) & (TOPIC_TABLE_SLOTS - 1);
+        }
+
+        table->slot[pos].route = &routes[idx];
+        table->slot[pos].len = (uint16_t)len;
+        table->count++;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Looks up the route of an exact topic
+ *
+ * @param table Table
+ * @param topic Topic, not necessarily zero terminated
+ * @param len   Topic length
+ * @return Route, NULL if the topic is unknown
+ */
+const topic_route_t *topic_table_find(const topic_table_t *table, const char *topic, size_t len)
+{
+    uint32_t pos = topic_hash(topic, len) & (TOPIC_TABLE_SLOTS - 1);
+
+    // The table is at most half full, so an empty slot ends every probe
+    while(table->slot[pos].route != NULL)
+    {
+        if(table->slot[pos].len == len && memcmp(table->slot[pos].route->topic, topic, len) == 0)
+        {
+            return table->slot[pos].route;
+        }
+        pos = (pos + 1) & (TOPIC_TABLE_SLOTS - 1);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Parses a payload and runs the handler of its topic
+ *
+ * @param table     Table
+ * @param topic     Topic
+ * @param topic_len Topic length
+ * @param data      Payload
+ * @param data_len  Payload length
+ * @return true     if a handler ran
+ * @return false    if the topic is unknown or the payload is malformed
+ */
+bool topic_table_dispatch(const topic_table_t *table, const char *topic, size_t topic_len,
+                          const char *data, size_t data_len)
+{
+    const topic_route_t *route = topic_table_find(table, topic, topic_len);
+    uint32_t value;
+
+    if(route == NULL || !route->parse(data, data_len, &value))
+    {
+        return false;
+    }
+
+    route->handle(value);
+
+    return true;
+}
@@ -0,0 +1,65 @@
+#ifndef _TOPIC_TABLE_H_
+#define _TOPIC_TABLE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**********************************
+ CONSTANTS AND MACROS
+***********************************/
+
+#define TOPIC_TABLE_SLOTS   128     // Power of two, at least twice the number of routes
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+/**
+ * @brief Converts a payload into a value
+ *
+ * @return false if the payload is malformed and the handler must not run
+ */
+typedef bool (*topic_parser_t)(const char *data, size_t len, uint32_t *value);
+
+/**
+ * @brief Applies a parsed value
+ */
+typedef void (*topic_handler_t)(uint32_t value);
+
+/**
+ * @brief Incoming topic with its payload parser and handler
+ */
+typedef struct {
+    const char *        topic;
+    topic_parser_t      parse;
+    topic_handler_t     handle;
+} topic_route_t;
+
+typedef struct {
+    const topic_route_t *   route;
+    uint16_t                len;        // Topic length, compared before the bytes
+} topic_slot_t;
+
+/**
+ * @brief Open addressing hash table from topic to route
+ *
+ * Built once from a constant route list, so a lookup costs one hash of the
+ * incoming topic and, as the table is kept at most half full, usually a single
+ * length check and memcmp whatever the number of routes.
+ */
+typedef struct {
+    topic_slot_t    slot[TOPIC_TABLE_SLOTS];
+    uint32_t        count;
+} topic_table_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+bool                    topic_table_init(topic_table_t *table, const topic_route_t *routes, size_t count);
+const topic_route_t *   topic_table_find(const topic_table_t *table, const char *topic, size_t len);
+bool                    topic_table_dispatch(const topic_table_t *table, const char *topic, size_t topic_len,
+                                             const char *data, size_t data_len);
+
+#endif // _TOPIC_TABLE_H_
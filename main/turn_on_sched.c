@@ -0,0 +1,196 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "turn_on_sched.h"
+
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+/**
+ * @brief Tells whether a load may be switched on now
+ *
+ * @param sched         Scheduler state
+ * @param load_ma       Rated current of the load
+ * @param waited_ms     Time the request is waiting
+ * @param measured_ma   Current drawn now
+ * @param now_ms        Current time
+ * @return true if the spacing elapsed and the budget allows it
+ */
+static bool release_allowed(const turn_on_sched_t *sched, uint32_t load_ma, uint32_t waited_ms,
+                            uint32_t measured_ma, uint32_t now_ms)
+{
+    if(sched->released && now_ms - sched->last_release_ms < sched->spacing_ms)
+    {
+        return false;
+    }
+
+    return (measured_ma + load_ma <= sched->budget_ma) || (waited_ms >= sched->max_wait_ms);
+}
+
+/**
+ * @brief Records a release
+ *
+ * @param sched         Scheduler state
+ * @param load_ma       Rated current of the released load
+ * @param waited_ms     Time the request was waiting
+ * @param measured_ma   Current drawn at the release
+ * @param now_ms        Current time
+ */
+static void release_done(turn_on_sched_t *sched, uint32_t load_ma, uint32_t waited_ms,
+                         uint32_t measured_ma, uint32_t now_ms)
+{
+    sched->last_release_ms = now_ms;
+    sched->released = true;
+    sched->release_cnt++;
+
+    if(measured_ma + load_ma > sched->budget_ma)
+    {
+        sched->forced_cnt++;
+    }
+
+    if(waited_ms > sched->max_wait_seen_ms)
+    {
+        sched->max_wait_seen_ms = waited_ms;
+    }
+}
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Starts a scheduler with nothing waiting
+ *
+ * @param sched         Scheduler state
+ * @param spacing_ms    Shortest time between two turn-ons
+ * @param budget_ma     Largest total current after a turn-on
+ * @param max_wait_ms   Longest wait of a request for the budget
+ */
+void turn_on_sched_init(turn_on_sched_t *sched, uint32_t spacing_ms, uint32_t budget_ma, uint32_t max_wait_ms)
+{
+    sched->spacing_ms = spacing_ms;
+    sched->budget_ma = budget_ma;
+    sched->max_wait_ms = max_wait_ms;
+    sched->pending = 0;
+    sched->last_release_ms = 0;
+    sched->released = false;
+    sched->release_cnt = 0;
+    sched->forced_cnt = 0;
+    sched->max_wait_seen_ms = 0;
+}
+
+/**
+ * @brief Requests to switch a load on
+ *
+ * A load may be switched on right away only when nothing else is waiting, so
+ * the requests keep their order. A new value of a waiting channel replaces
+ * its old value and keeps its place.
+ *
+ * @param sched         Scheduler state
+ * @param channel       Channel index, below TURN_ON_SCHED_CHANNELS
+ * @param value         Value to apply on release
+ * @param load_ma       Rated current of the load
+ * @param measured_ma   Current drawn now
+ * @param now_ms        Current time
+ * @return true     if the caller has to switch the load on now
+ * @return false    if the request waits for turn_on_sched_poll()
+ */
+bool turn_on_sched_request(turn_on_sched_t *sched, uint32_t channel, uint32_t value, uint32_t load_ma,
+                           uint32_t measured_ma, uint32_t now_ms)
+{
+    uint32_t bit;
+
+    if(channel >= TURN_ON_SCHED_CHANNELS)
+    {
+        return true;
+    }
+    bit = 1UL << channel;
+
+    if(sched->pending & bit)
+    {
+        sched->value[channel] = value;
+        return false;
+    }
+
+    if(sched->pending == 0 && release_allowed(sched, load_ma, 0, measured_ma, now_ms))
+    {
+        release_done(sched, load_ma, 0, measured_ma, now_ms);
+        return true;
+    }
+
+    sched->pending |= bit;
+    sched->value[channel] = value;
+    sched->load_ma[channel] = load_ma;
+    sched->request_ms[channel] = now_ms;
+
+    return false;
+}
+
+/**
+ * @brief Drops a waiting request, the load was switched off meanwhile
+ *
+ * @param sched     Scheduler state
+ * @param channel   Channel index
+ */
+void turn_on_sched_cancel(turn_on_sched_t *sched, uint32_t channel)
+{
+    if(channel < TURN_ON_SCHED_CHANNELS)
+    {
+        sched->pending &= ~(1UL << channel);
+    }
+}
+
+/**
+ * @brief Drops every waiting request
+ *
+ * @param sched Scheduler state
+ */
+void turn_on_sched_cancel_all(turn_on_sched_t *sched)
+{
+    sched->pending = 0;
+}
+
+/**
+ * @brief Releases the oldest waiting request once the spacing and the budget
+ *        allow it
+ *
+ * @param sched         Scheduler state
+ * @param measured_ma   Current drawn now
+ * @param now_ms        Current time
+ * @param channel       Output: channel to switch on
+ * @param value         Output: value to apply
+ * @return true     if a load has to be switched on now
+ * @return false    otherwise
+ */
+bool turn_on_sched_poll(turn_on_sched_t *sched, uint32_t measured_ma, uint32_t now_ms,
+                        uint32_t *channel, uint32_t *value)
+{
+    uint32_t oldest = TURN_ON_SCHED_CHANNELS;
+    uint32_t waited_ms = 0;
+
+    for(uint32_t idx = 0; idx < TURN_ON_SCHED_CHANNELS; ++idx)
+    {
+        if((sched->pending & (1UL << idx)) && (oldest == TURN_ON_SCHED_CHANNELS ||
+                                               now_ms - sched->request_ms[idx] > waited_ms))
+        {
+            oldest = idx;
+            waited_ms = now_ms - sched->request_ms[idx];
+        }
+    }
+
+    if(oldest == TURN_ON_SCHED_CHANNELS ||
+       !release_allowed(sched, sched->load_ma[oldest], waited_ms, measured_ma, now_ms))
+    {
+        return false;
+    }
+
+    release_done(sched, sched->load_ma[oldest], waited_ms, measured_ma, now_ms);
+    sched->pending &= ~(1UL << oldest);
+
+    *channel = oldest;
+    *value = sched->value[oldest];
+
+    return true;
+}
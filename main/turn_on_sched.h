@@ -0,0 +1,57 @@
+#ifndef _TURN_ON_SCHED_H_
+#define _TURN_ON_SCHED_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**********************************
+ CONSTANTS AND MACROS
+***********************************/
+
+#define TURN_ON_SCHED_CHANNELS      8       // Most channels the scheduler can hold
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+/**
+ * @brief Staggered turn-on of loads under a total current budget.
+ *
+ * Turn-on requests are released one at a time, oldest first, at least
+ * spacing_ms apart and only while the measured current plus the rated current
+ * of the load stays within the budget. A request waiting longer than
+ * max_wait_ms is released anyway. Like the other engines it knows nothing
+ * about the hardware: the caller passes times and the measured current and
+ * switches the released channels.
+ */
+typedef struct {
+    uint32_t    spacing_ms;
+    uint32_t    budget_ma;
+    uint32_t    max_wait_ms;
+    uint32_t    pending;                            // Channel bits waiting to be switched on
+    uint32_t    value[TURN_ON_SCHED_CHANNELS];      // Value to apply on release
+    uint32_t    load_ma[TURN_ON_SCHED_CHANNELS];    // Rated current of the waiting load
+    uint32_t    request_ms[TURN_ON_SCHED_CHANNELS];
+    uint32_t    last_release_ms;
+    bool        released;                           // last_release_ms is valid
+
+    // Statistics
+    uint32_t    release_cnt;
+    uint32_t    forced_cnt;                         // Released over the budget after max_wait_ms
+    uint32_t    max_wait_seen_ms;
+} turn_on_sched_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+void    turn_on_sched_init(turn_on_sched_t *sched, uint32_t spacing_ms, uint32_t budget_ma, uint32_t max_wait_ms);
+
+bool    turn_on_sched_request(turn_on_sched_t *sched, uint32_t channel, uint32_t value, uint32_t load_ma,
+                              uint32_t measured_ma, uint32_t now_ms);
+void    turn_on_sched_cancel(turn_on_sched_t *sched, uint32_t channel);
+void    turn_on_sched_cancel_all(turn_on_sched_t *sched);
+bool    turn_on_sched_poll(turn_on_sched_t *sched, uint32_t measured_ma, uint32_t now_ms,
+                           uint32_t *channel, uint32_t *value);
+
+#endif // _TURN_ON_SCHED_H_
@@ -9,6 +9,8 @@
 */
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -17,11 +19,17 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
-#include "nvs_flash.h"
+#include "esp_timer.h"
+
+#include "nvs.h"
 
 #include "lwip/err.h"
 #include "lwip/sys.h"
 
+#include "wifi.h"
+#include "wifi_reconn.h"
+#include "hal.h"
+
 /* The examples use WiFi configuration that you can set via project configuration menu
 
    If you'd rather not, just change the below entries to strings with
@@ -29,50 +37,231 @@
 */
 #define EXAMPLE_ESP_WIFI_SSID      CONFIG_ESP_WIFI_SSID
 #define EXAMPLE_ESP_WIFI_PASS      CONFIG_ESP_WIFI_PASSWORD
-#define EXAMPLE_ESP_MAXIMUM_RETRY  CONFIG_ESP_MAXIMUM_RETRY
+
+// AP of the last connection, for association without a full scan
+#define WIFI_NVS_NAMESPACE         "wifi"
+#define WIFI_AP_NVS_KEY            "ap"
 
 /* FreeRTOS event group to signal when we are connected*/
 static EventGroupHandle_t s_wifi_event_group;
 
-/* The event group allows multiple bits for each event, but we only care about two events:
+/* The event group allows multiple bits for each event, but we only care about one event:
  * - we are connected to the AP with an IP
- * - we failed to connect after the maximum amount of retries */
+ * The station retries without a limit, so there is no failure bit. */
 #define WIFI_CONNECTED_BIT BIT0
-#define WIFI_FAIL_BIT      BIT1
+
+/**
+ * @brief AP cached in NVS
+ */
+typedef struct {
+    uint8_t     bssid[6];
+    uint8_t     channel;
+} wifi_ap_cache_t;
 
 static const char *TAG = "wifi station";
 
-static int s_retry_num = 0;
 static char ip_addr[32]={ 'N', 'o', 't', ' ', 'c', 'o', 'n', 'n', 'e', 'c', 't', 'e', 'd', '\0'};
 
+/* Private event posted by the retry timer. The timer callback runs in the
+ * esp_timer task, so it only posts the event: the attempt is made by the
+ * event handler in the default event loop task, which is the only one that
+ * touches the reconnect state machine. */
+ESP_EVENT_DEFINE_BASE(WIFI_RETRY_EVENT);
+#define WIFI_RETRY_EVENT_DUE       0
+#define WIFI_RETRY_POST_TIMEOUT_MS 10
+
+static wifi_reconn_t        Reconn;
+static wifi_ap_cache_t      Ap_cache;
+static esp_timer_handle_t   Retry_timer;
+
+static void wifi_connect_attempt(void);
+static void wifi_retry_later(uint32_t delay_ms);
+static void wifi_retry_cb(void *arg);
+static bool ap_cache_load(void);
+static void ap_cache_store(const uint8_t *bssid, uint8_t channel);
+
+/**
+ * @brief Configures the association for the next attempt and starts it.
+ *        Runs in the event loop task.
+ *
+ * A driver that refuses the attempt, e.g. with ESP_ERR_WIFI_STATE while it
+ * is still busy with the last one, gets another one after the minimum
+ * backoff instead of an abort.
+ */
+static void wifi_connect_attempt(void)
+{
+    wifi_config_t wifi_config;
+    esp_err_t err;
+
+    err = esp_wifi_get_config(WIFI_IF_STA, &wifi_config);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "get config failed: %s", esp_err_to_name(err));
+        wifi_retry_later(CONFIG_WIFI_BACKOFF_MIN_MS);
+        return;
+    }
+
+    if (wifi_reconn_attempt(&Reconn, hal_time_ms()) == WIFI_RECONN_CACHED) {
+        // Probes a single channel instead of scanning all of them
+        memcpy(wifi_config.sta.bssid, Ap_cache.bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.bssid_set = true;
+        wifi_config.sta.channel = Ap_cache.channel;
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+    } else {
+        // The AP may have moved: take the strongest one of the SSID
+        wifi_config.sta.bssid_set = false;
+        wifi_config.sta.channel = 0;
+        wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    }
+
+    err = esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    if (err == ESP_OK) {
+        err = esp_wifi_connect();
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "connect attempt %u refused: %s", Reconn.attempts, esp_err_to_name(err));
+        wifi_retry_later(CONFIG_WIFI_BACKOFF_MIN_MS);
+        return;
+    }
+
+    ESP_LOGI(TAG, "connect attempt %u, %s", Reconn.attempts,
+             wifi_config.sta.bssid_set ? "cached AP" : "full scan");
+}
+
+/**
+ * @brief Starts the backoff timer of the next attempt
+ *
+ * @param delay_ms Delay of the attempt
+ */
+static void wifi_retry_later(uint32_t delay_ms)
+{
+    // Restarts it if it is already running
+    esp_timer_stop(Retry_timer);
+    esp_timer_start_once(Retry_timer, (uint64_t)delay_ms * 1000);
+}
+
+/**
+ * @brief Backoff timer expired: hands the attempt over to the event loop
+ *        task. Runs in the esp_timer task.
+ *
+ * @param arg Not used
+ */
+static void wifi_retry_cb(void *arg)
+{
+    if (esp_event_post(WIFI_RETRY_EVENT, WIFI_RETRY_EVENT_DUE, NULL, 0,
+                       pdMS_TO_TICKS(WIFI_RETRY_POST_TIMEOUT_MS)) != ESP_OK) {
+        // Event queue full, the attempt must not be lost
+        esp_timer_start_once(Retry_timer, (uint64_t)CONFIG_WIFI_BACKOFF_MIN_MS * 1000);
+    }
+}
+
+/**
+ * @brief Loads the AP of the last connection from NVS
+ *
+ * @return true if an AP is cached
+ */
+static bool ap_cache_load(void)
+{
+    size_t length = sizeof(Ap_cache);
+    nvs_handle_t nvs;
+    bool valid = false;
+
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+
+    if (nvs_get_blob(nvs, WIFI_AP_NVS_KEY, &Ap_cache, &length) == ESP_OK && length == sizeof(Ap_cache)) {
+        valid = (Ap_cache.channel != 0);
+    }
+
+    nvs_close(nvs);
+
+    return valid;
+}
+
+/**
+ * @brief Caches the AP of a new connection in NVS if it differs from the
+ *        cached one
+ *
+ * @param bssid     BSSID of the AP
+ * @param channel   Primary channel of the AP
+ */
+static void ap_cache_store(const uint8_t *bssid, uint8_t channel)
+{
+    nvs_handle_t nvs;
+
+    if (Reconn.cache_valid && Ap_cache.channel == channel &&
+        memcmp(Ap_cache.bssid, bssid, sizeof(Ap_cache.bssid)) == 0) {
+        return;
+    }
+
+    memcpy(Ap_cache.bssid, bssid, sizeof(Ap_cache.bssid));
+    Ap_cache.channel = channel;
+    wifi_reconn_set_cache(&Reconn, true);
+
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+
+    if (nvs_set_blob(nvs, WIFI_AP_NVS_KEY, &Ap_cache, sizeof(Ap_cache)) == ESP_OK) {
+        nvs_commit(nvs);
+    }
+
+    nvs_close(nvs);
+}
+
 static void event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data)
 {
+    uint32_t delay_ms;
+
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
+        wifi_connect_attempt();
+    } else if (event_base == WIFI_RETRY_EVENT && event_id == WIFI_RETRY_EVENT_DUE) {
+        wifi_connect_attempt();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        wifi_event_sta_connected_t* event = (wifi_event_sta_connected_t*) event_data;
+        ap_cache_store(event->bssid, event->channel);
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        if (s_retry_num < EXAMPLE_ESP_MAXIMUM_RETRY) {
-            esp_wifi_connect();
-            s_retry_num++;
-            ESP_LOGI(TAG, "retry to connect to the AP");
+        wifi_event_sta_disconnected_t* event = (wifi_event_sta_disconnected_t*) event_data;
+
+        xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        strcpy(ip_addr, "Not connected");
+
+        delay_ms = wifi_reconn_on_disconnected(&Reconn, hal_time_ms());
+        ESP_LOGI(TAG, "connect to the AP fail, reason %d, retry in %u ms", event->reason, delay_ms);
+
+        if (delay_ms == 0) {
+            wifi_connect_attempt();
         } else {
-            xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+            // Up to 25% of jitter, so devices behind a rebooted AP do not retry in step
+            delay_ms += esp_random() % (delay_ms / 4 + 1);
+            wifi_retry_later(delay_ms);
         }
-        ESP_LOGI(TAG,"connect to the AP fail");
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
         sprintf( ip_addr, IPSTR, IP2STR(&event->ip_info.ip));
 
-        s_retry_num = 0;
+        wifi_reconn_on_connected(&Reconn, hal_time_ms());
+        ESP_LOGI(TAG, "connected after %u ms, %u attempts", Reconn.last_outage_ms, Reconn.last_attempts);
+
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
     }
 }
 
 void wifi_init_sta(void)
 {
+    const esp_timer_create_args_t retry_timer_args = {
+        .callback = &wifi_retry_cb,
+        .name = "wifi_retry"
+    };
+
     s_wifi_event_group = xEventGroupCreate();
 
+    wifi_reconn_init(&Reconn, CONFIG_WIFI_BACKOFF_MIN_MS, CONFIG_WIFI_BACKOFF_MAX_MS, ap_cache_load());
+    ESP_ERROR_CHECK(esp_timer_create(&retry_timer_args, &Retry_timer));
+
     ESP_ERROR_CHECK(esp_netif_init());
 
     ESP_ERROR_CHECK(esp_event_loop_create_default());
@@ -83,6 +272,7 @@ void wifi_init_sta(void)
 
     esp_event_handler_instance_t instance_any_id;
     esp_event_handler_instance_t instance_got_ip;
+    esp_event_handler_instance_t instance_retry;
     ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
                                                         ESP_EVENT_ANY_ID,
                                                         &event_handler,
@@ -93,6 +283,11 @@ void wifi_init_sta(void)
                                                         &event_handler,
                                                         NULL,
                                                         &instance_got_ip));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_RETRY_EVENT,
+                                                        WIFI_RETRY_EVENT_DUE,
+                                                        &event_handler,
+                                                        NULL,
+                                                        &instance_retry));
 
     wifi_config_t wifi_config = {
         .sta = {
@@ -108,46 +303,55 @@ void wifi_init_sta(void)
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
     ESP_ERROR_CHECK(esp_wifi_start() );
 
+    /* Association goes on in the background, the event handler stays registered and
+     * reports the result through s_wifi_event_group, see wifi_wait_connected() */
     ESP_LOGI(TAG, "wifi_init_sta finished.");
+}
 
-    /* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or connection failed for the maximum
-     * number of re-tries (WIFI_FAIL_BIT). The bits are set by event_handler() (see above) */
+/**
+ * @brief Starts the Wi-Fi station without waiting for the connection.
+ *        NVS must be initialized before.
+ */
+void wifi_start(void)
+{
+    ESP_LOGI(TAG, "ESP_WIFI_MODE_STA");
+    wifi_init_sta();
+}
+
+/**
+ * @brief Waits until the station gets an IP address
+ * 
+ * @param timeout_ms Time to wait
+ * @return true     if connected
+ * @return false    on timeout
+ */
+bool wifi_wait_connected(uint32_t timeout_ms)
+{
     EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-            WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
+            WIFI_CONNECTED_BIT,
             pdFALSE,
             pdFALSE,
-            portMAX_DELAY);
+            (timeout_ms == UINT32_MAX) ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms));
 
-    /* xEventGroupWaitBits() returns the bits before the call returned, hence we can test which event actually
-     * happened. */
     if (bits & WIFI_CONNECTED_BIT) {
-        ESP_LOGI(TAG, "connected to ap SSID:%s password:%s",
-                 EXAMPLE_ESP_WIFI_SSID, EXAMPLE_ESP_WIFI_PASS);
-    } else if (bits & WIFI_FAIL_BIT) {
-        ESP_LOGI(TAG, "Failed to connect to SSID:%s, password:%s",
-                 EXAMPLE_ESP_WIFI_SSID, EXAMPLE_ESP_WIFI_PASS);
-    } else {
-        ESP_LOGE(TAG, "UNEXPECTED EVENT");
+        ESP_LOGI(TAG, "connected to ap SSID:%s", EXAMPLE_ESP_WIFI_SSID);
+        return true;
     }
 
-    /* The event will not be processed after unregister */
-    ESP_ERROR_CHECK(esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, instance_got_ip));
-    ESP_ERROR_CHECK(esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, instance_any_id));
-    vEventGroupDelete(s_wifi_event_group);
+    return false;
 }
 
-void wifi_start(void)
+/**
+ * @brief Gets the statistics of the reconnections
+ *
+ * @param stats Output
+ */
+void wifi_get_reconnect_stats(wifi_reconnect_stats_t *stats)
 {
-    //Initialize NVS
-    esp_err_t ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-      ESP_ERROR_CHECK(nvs_flash_erase());
-      ret = nvs_flash_init();
-    }
-    ESP_ERROR_CHECK(ret);
-
-    ESP_LOGI(TAG, "ESP_WIFI_MODE_STA");
-    wifi_init_sta();
+    stats->reconnects = Reconn.outages;
+    stats->last_ms = Reconn.last_outage_ms;
+    stats->max_ms = Reconn.max_outage_ms;
+    stats->last_attempts = Reconn.last_attempts;
 }
 
 
@@ -1,7 +1,22 @@
 #ifndef _WIFI_H_
 #define _WIFI_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Reconnection statistics, the start-up connection counts as the first one
+ */
+typedef struct {
+    uint32_t    reconnects;         // Outages ended by a connection
+    uint32_t    last_ms;            // Duration of the last outage
+    uint32_t    max_ms;             // Longest outage
+    uint32_t    last_attempts;      // Attempts of the last outage
+} wifi_reconnect_stats_t;
+
 void    wifi_start(void);
+bool    wifi_wait_connected(uint32_t timeout_ms);
 char*   wifi_get_ip(void);
+void    wifi_get_reconnect_stats(wifi_reconnect_stats_t *stats);
 
 #endif
@@ -0,0 +1,142 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wifi_reconn.h"
+
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Starts the state machine disconnected, before the first attempt
+ *
+ * @param reconn            State machine
+ * @param min_backoff_ms    Delay after the first failed retry
+ * @param max_backoff_ms    Longest delay between attempts
+ * @param cache_valid       An AP is cached from an earlier connection
+ */
+void wifi_reconn_init(wifi_reconn_t *reconn, uint32_t min_backoff_ms, uint32_t max_backoff_ms, bool cache_valid)
+{
+    reconn->min_backoff_ms = min_backoff_ms;
+    reconn->max_backoff_ms = max_backoff_ms;
+    reconn->backoff_ms = 0;
+    reconn->connected = false;
+    reconn->down = false;
+    reconn->down_ms = 0;
+    reconn->attempts = 0;
+    reconn->cache_valid = cache_valid;
+    reconn->cache_failures = 0;
+    reconn->last_mode = WIFI_RECONN_SCAN;
+
+    reconn->outages = 0;
+    reconn->last_outage_ms = 0;
+    reconn->max_outage_ms = 0;
+    reconn->last_attempts = 0;
+}
+
+/**
+ * @brief Tells whether an AP is cached, after it was stored or dropped
+ *
+ * @param reconn    State machine
+ * @param valid     An AP is cached
+ */
+void wifi_reconn_set_cache(wifi_reconn_t *reconn, bool valid)
+{
+    reconn->cache_valid = valid;
+    reconn->cache_failures = 0;
+}
+
+/**
+ * @brief Starts an attempt
+ *
+ * @param reconn    State machine
+ * @param now_ms    Current time
+ * @return How to associate
+ */
+wifi_reconn_mode_t wifi_reconn_attempt(wifi_reconn_t *reconn, uint32_t now_ms)
+{
+    if(!reconn->down)
+    {
+        reconn->down = true;
+        reconn->down_ms = now_ms;
+    }
+
+    reconn->attempts++;
+    reconn->last_mode = (reconn->cache_valid && reconn->cache_failures < WIFI_RECONN_CACHE_ATTEMPTS) ?
+                        WIFI_RECONN_CACHED : WIFI_RECONN_SCAN;
+
+    return reconn->last_mode;
+}
+
+/**
+ * @brief Handles a lost connection or a failed attempt
+ *
+ * @param reconn    State machine
+ * @param now_ms    Current time
+ * @return Delay before the next attempt in ms, 0 to retry right away
+ */
+uint32_t wifi_reconn_on_disconnected(wifi_reconn_t *reconn, uint32_t now_ms)
+{
+    uint32_t delay_ms;
+
+    if(reconn->connected)
+    {
+        // Dropped: the AP is most likely back on the same channel
+        reconn->connected = false;
+        reconn->down = true;
+        reconn->down_ms = now_ms;
+        reconn->attempts = 0;
+        reconn->backoff_ms = 0;
+    }
+    else if(reconn->last_mode == WIFI_RECONN_CACHED)
+    {
+        reconn->cache_failures++;
+    }
+
+    delay_ms = reconn->backoff_ms;
+
+    if(reconn->backoff_ms == 0)
+    {
+        reconn->backoff_ms = reconn->min_backoff_ms;
+    }
+    else if(reconn->backoff_ms < reconn->max_backoff_ms / 2)
+    {
+        reconn->backoff_ms *= 2;
+    } else {
+        reconn->backoff_ms = reconn->max_backoff_ms;
+    }
+
+    return delay_ms;
+}
+
+/**
+ * @brief Handles a usable connection and records the outage it ended
+ *
+ * @param reconn    State machine
+ * @param now_ms    Current time
+ */
+void wifi_reconn_on_connected(wifi_reconn_t *reconn, uint32_t now_ms)
+{
+    uint32_t outage_ms;
+
+    if(reconn->down)
+    {
+        outage_ms = now_ms - reconn->down_ms;
+
+        reconn->outages++;
+        reconn->last_outage_ms = outage_ms;
+        reconn->last_attempts = reconn->attempts;
+
+        if(outage_ms > reconn->max_outage_ms)
+        {
+            reconn->max_outage_ms = outage_ms;
+        }
+    }
+
+    reconn->connected = true;
+    reconn->down = false;
+    reconn->attempts = 0;
+    reconn->backoff_ms = 0;
+    reconn->cache_failures = 0;
+}
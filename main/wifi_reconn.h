@@ -0,0 +1,61 @@
+#ifndef _WIFI_RECONN_H_
+#define _WIFI_RECONN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**********************************
+ CONSTANTS AND MACROS
+***********************************/
+
+#define WIFI_RECONN_CACHE_ATTEMPTS  2       // Failed attempts on the cached AP before a full scan
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+typedef enum {
+    WIFI_RECONN_SCAN = 0,           // Scan all channels for the SSID
+    WIFI_RECONN_CACHED              // Associate with the cached BSSID on its channel
+} wifi_reconn_mode_t;
+
+/**
+ * @brief Wi-Fi reconnect state machine.
+ *
+ * Retries without a limit: the first attempt after a drop is immediate, then
+ * the delay doubles from min_backoff_ms up to max_backoff_ms. Attempts use
+ * the cached AP until it failed WIFI_RECONN_CACHE_ATTEMPTS times in a row.
+ * It knows nothing about the Wi-Fi driver: the caller feeds the driver
+ * events with timestamps and makes the attempts it is told to.
+ */
+typedef struct {
+    uint32_t    min_backoff_ms;
+    uint32_t    max_backoff_ms;
+    uint32_t    backoff_ms;         // Delay before the next attempt
+    bool        connected;
+    bool        down;               // An outage is running
+    uint32_t    down_ms;            // Start of the outage
+    uint32_t    attempts;           // Attempts of the running outage
+    bool        cache_valid;
+    uint32_t    cache_failures;
+    wifi_reconn_mode_t last_mode;
+
+    // Statistics, the start-up connection counts as the first outage
+    uint32_t    outages;            // Outages ended by a connection
+    uint32_t    last_outage_ms;
+    uint32_t    max_outage_ms;
+    uint32_t    last_attempts;      // Attempts of the last outage
+} wifi_reconn_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+void                wifi_reconn_init(wifi_reconn_t *reconn, uint32_t min_backoff_ms, uint32_t max_backoff_ms, bool cache_valid);
+void                wifi_reconn_set_cache(wifi_reconn_t *reconn, bool valid);
+
+wifi_reconn_mode_t  wifi_reconn_attempt(wifi_reconn_t *reconn, uint32_t now_ms);
+uint32_t            wifi_reconn_on_disconnected(wifi_reconn_t *reconn, uint32_t now_ms);
+void                wifi_reconn_on_connected(wifi_reconn_t *reconn, uint32_t now_ms);
+
+#endif // _WIFI_RECONN_H_
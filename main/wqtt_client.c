@@ -1,225 +1,681 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include "esp_log.h"
-
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-
-#include "mqtt_client.h"
+#include "sdkconfig.h"
 
 #include "wqtt_client.h"
 #include "hw_ctrl.h"
+#include "hal.h"
 #include "smartRelay.h"
+#include "dev_state.h"
+#include "telemetry.h"
+#include "lf_queue.h"
+#include "histogram.h"
+#include "topic_table.h"
+#include "wifi.h"
+#include "tele_frame.h"
 
 
 
+/**********************
+ *  TYPES
+ **********************/
+
+// Events posted to the publisher task
+typedef enum {
+    WQTT_EVT_FAN = 0,
+    WQTT_EVT_HEATER,
+    WQTT_EVT_LIGHT,
+    WQTT_EVT_LED,
+    WQTT_EVT_STATE_CNT,     // Events above are load states echoed by the broker
+    WQTT_EVT_CURRENT = WQTT_EVT_STATE_CNT,
+    WQTT_EVT_ENERGY,        // arg: hw_load_t
+    WQTT_EVT_TRIP,
+    WQTT_EVT_MAINS,         // arg: wqtt_mains_metric_t
+    WQTT_EVT_WIFI,          // Reconnection statistics, read when published
+    WQTT_EVT_SNAPSHOT,      // Retained snapshot of the state store, read when published
+    WQTT_EVT_PONG,          // Answer to a Ping
+    WQTT_EVT_TRAFFIC        // Message rates, read when published
+} wqtt_evt_type_t;
+
+// Metric of the telemetry frame
+typedef struct {
+    const char *            key;
+    const char *            topic;      // Topic of the same metric as a message of its own
+    telemetry_metric_t *    metric;
+    const uint32_t *        value;
+} frame_metric_t;
+
 /**********************
  *  FUNCTION PROTOTYPES
  **********************/
 
+static void post_event(lf_queue_t *queue, wqtt_evt_type_t type, uint16_t arg, uint32_t value);
+static void command_latency_add(int64_t rx_us);
+static bool echo_expected(wqtt_evt_type_t type, uint32_t value);
+static void state_command(dev_field_t field, uint32_t value);
+static bool parse_state(const char *data, size_t len, uint32_t *value);
+static bool parse_level(const char *data, size_t len, uint32_t *value);
+static bool parse_loads(const char *data, size_t len, uint32_t *value);
+static bool parse_number(const char *data, size_t len, uint32_t *value);
+static void heater_command(uint32_t value);
+static void fan_command(uint32_t value);
+static void light_command(uint32_t value);
+static void led_command(uint32_t value);
+static void loads_command(uint32_t value);
+static void ping_command(uint32_t value);
+static void publish_pong(uint32_t value);
+static void publish_traffic(void);
+static void traffic_timer_cb(void *arg);
+static void mqtt_event_handler(const hal_mqtt_event_t *event);
+static const char *command_name(const char *topic, size_t len, size_t *name_len);
+static void add_namespace(const char *fmt, const char *name);
+static void wqtt_client_apply(dev_field_t field, uint32_t value, dev_origin_t origin);
+static void publish_trip(uint32_t trip_ma);
+static void publish_wifi_stats(void);
+static void publish_snapshot(void);
+static int wqtt_publish(const char *name, const char *data, int qos, int retain);
+static int wqtt_publish_data(const char *name, const char *data, int len, int qos, int retain);
+static void publish_frame(void);
+static void frame_add(tele_frame_t *frame, const char *key, const char *topic, uint32_t value, uint32_t *separate_bytes);
+static void wqtt_client_flush(void);
+
+
+/**********************
+ *  CONSTANTS
+ **********************/
+
+#define CONTROL_QUEUE_SIZE      16      // Power of two
+#define TELEMETRY_QUEUE_SIZE    32      // Power of two
+#define ECHO_QUEUE_SIZE         4       // Power of two, published states awaiting their echo
+
+// Topics
+#define WQTT_TOPIC_MAX          64      // Longest full topic, prefix included
+#define WQTT_CLIENT_ID_MAX      (sizeof("smartRelay-") + WQTT_DEVICE_ID_MAX)
+#define WQTT_DEVICE_ID_MAX      24
+#define WQTT_GROUP_MAX          24
+#define WQTT_NAMESPACE_CNT      3       // Device, group, broadcast
+
+// Telemetry frames: with a frame format selected the metrics that are due
+// are sent together in one frame instead of one message each
+#if defined(CONFIG_TELE_FRAME_JSON)
+#define FRAME_ENABLED           1
+#define FRAME_FORMAT            TELE_FRAME_JSON
+#elif defined(CONFIG_TELE_FRAME_CBOR)
+#define FRAME_ENABLED           1
+#define FRAME_FORMAT            TELE_FRAME_CBOR
+#else
+#define FRAME_ENABLED           0
+#define FRAME_FORMAT            TELE_FRAME_JSON
+#endif
+#define FRAME_SIZE              192
+#define FRAME_LOG_COUNT         64      // Frame size and encoding cost are logged once per this many frames
+
+// Message rates are published once per this period
+#define TRAFFIC_PERIOD_MS       (60 * 1000)
+
+// Loads command: one 4 bit value per field, this one keeps the field unchanged
+#define LOADS_KEEP              0xF
+
+// Command-to-actuation latency is logged once per this many commands
+#define COMMAND_LATENCY_LOG_COUNT   32
+
+// Telemetry publication policies
+static const telemetry_cfg_t Current_telemetry = {
+    .deadband = 6,                      // mA, above the sensor noise, below the smallest load
+    .min_interval_ms = 250,
+    .max_interval_ms = 5 * 60 * 1000,
+    .qos = 0
+};
+
+static const telemetry_cfg_t Energy_telemetry = {
+    .deadband = 1,                      // Wh
+    .min_interval_ms = 10 * 1000,
+    .max_interval_ms = 60 * 60 * 1000,
+    .qos = 1
+};
+
+static const telemetry_cfg_t Mains_frequency_telemetry = {
+    .deadband = 50,                     // mHz
+    .min_interval_ms = 10 * 1000,
+    .max_interval_ms = 30 * 60 * 1000,
+    .qos = 0
+};
+
+static const telemetry_cfg_t Zero_cross_telemetry = {
+    .deadband = 50,                     // us or missed half-cycles
+    .min_interval_ms = 10 * 1000,
+    .max_interval_ms = 30 * 60 * 1000,
+    .qos = 0
+};
+
+// Publisher events of the state store fields
+static const wqtt_evt_type_t State_events[DEV_FIELD_CNT] = {
+    [DEV_HEATER]    = WQTT_EVT_HEATER,
+    [DEV_FAN]       = WQTT_EVT_FAN,
+    [DEV_LIGHT]     = WQTT_EVT_LIGHT,
+    [DEV_LED]       = WQTT_EVT_LED
+};
+
+// Subscribed topics, new channels only add a line here
+static const topic_route_t Command_routes[] = {
+    { Heater_topic, parse_state, heater_command },
+    { Fan_topic,    parse_level, fan_command },
+    { Light_topic,  parse_state, light_command },
+    { LED_topic,    parse_state, led_command },
+    { Loads_topic,  parse_loads, loads_command },
+    { Ping_topic,   parse_number, ping_command }
+};
+
+// Valid Loads values of the fields
+static const uint8_t Loads_max[DEV_FIELD_CNT] = {
+    [DEV_HEATER]    = HW_ON,
+    [DEV_FAN]       = HW_LVL_VERY_HIGH,
+    [DEV_LIGHT]     = HW_ON,
+    [DEV_LED]       = HW_ON
+};
 
 /**********************
  *  VARIABLES
  **********************/
 
-static esp_mqtt_client_handle_t client;
 static const char *TAG = "WQTT";
 
 
-static hw_state_t       Heater_state = HW_OFF;
-static hw_state_t       Light_state = HW_OFF;
-static hw_state_t       LED_state = HW_OFF;
 static uint32_t         Current_value = 0;
-static hw_electr_lvl_t  Fan_speed = HW_LVL_OFF;
+static uint32_t         Energy_value[HW_LOAD_CNT];
+static uint32_t         Mains_value[WQTT_MAINS_CNT];
+
+static bool             Frame_pending = false;  // A metric is due, written by the publisher task only
+static int              Frame_qos = 0;          // Highest QoS of the due metrics, written by the publisher task only
+static histogram_t      Frame_encode_cost;      // CPU cycles
+
+// Control events are always drained before telemetry
+static lf_queue_cell_t  Control_cells[CONTROL_QUEUE_SIZE];
+static lf_queue_cell_t  Telemetry_cells[TELEMETRY_QUEUE_SIZE];
+static lf_queue_t       Control_queue = LF_QUEUE_INITIALIZER(Control_cells);
+static lf_queue_t       Telemetry_queue = LF_QUEUE_INITIALIZER(Telemetry_cells);
+static hal_task_t       Publisher_task = NULL;
+
+// The device subscribes to the topics it publishes, so the broker sends every
+// local change back. Published states wait here until their echo is dropped.
+static lf_queue_cell_t  Echo_cells[WQTT_EVT_STATE_CNT][ECHO_QUEUE_SIZE];
+static lf_queue_t       Echo_queue[WQTT_EVT_STATE_CNT] = {
+    [WQTT_EVT_FAN]      = LF_QUEUE_INITIALIZER(Echo_cells[WQTT_EVT_FAN]),
+    [WQTT_EVT_HEATER]   = LF_QUEUE_INITIALIZER(Echo_cells[WQTT_EVT_HEATER]),
+    [WQTT_EVT_LIGHT]    = LF_QUEUE_INITIALIZER(Echo_cells[WQTT_EVT_LIGHT]),
+    [WQTT_EVT_LED]      = LF_QUEUE_INITIALIZER(Echo_cells[WQTT_EVT_LED])
+};
+static uint32_t         Echo_suppressed = 0;
+static uint32_t         Telemetry_dropped = 0;
+static uint32_t         Telemetry_sent = 0;
+
+static topic_table_t    Topic_table;
+
+// Persistent session: the broker keeps the subscriptions and queues QoS 1
+// commands while the device is offline
+static char             Client_id[WQTT_CLIENT_ID_MAX];
+static char             Device_id[WQTT_DEVICE_ID_MAX];
+static char             Group[WQTT_GROUP_MAX] = CONFIG_WQTT_GROUP;
+
+// Command namespaces, the device one first. Each is subscribed as "<ns>+".
+static struct {
+    char    topic[WQTT_TOPIC_MAX];      // "<prefix>/.../"
+    size_t  len;
+} Namespace[WQTT_NAMESPACE_CNT];
+static size_t           Namespace_cnt = 0;
+static bool             Device_scope;       // Command being dispatched is addressed to this device only
+static dev_field_t      Command_field = DEV_FIELD_CNT;  // Field whose own state topic carries the command being applied
+
+// Time to consistent state: from the connection to the broker ack of the snapshot
+static volatile int64_t Connected_us = 0;
+static volatile int     Snapshot_msg_id = -1;
+
+static histogram_t      Command_latency;    // us, MQTT_EVENT_DATA to the pin write
+
+// Broker traffic of the device, to size a broker from the per-device rates
+static uint32_t         Msg_out = 0;        // Queued by the client, written by the publisher task only
+static uint32_t         Bytes_out = 0;
+static uint32_t         Msg_in = 0;         // Received, written by the MQTT task only
+static uint32_t         Bytes_in = 0;
+
+static telemetry_metric_t   Current_metric = { .cfg = &Current_telemetry };
+static telemetry_metric_t   Energy_metric[HW_LOAD_CNT] = {
+    [HW_HEATER] = { .cfg = &Energy_telemetry },
+    [HW_FAN]    = { .cfg = &Energy_telemetry },
+    [HW_LIGHT]  = { .cfg = &Energy_telemetry }
+};
+
+static const char *     Energy_topics[HW_LOAD_CNT] = {
+    [HW_HEATER] = Heater_energy_topic,
+    [HW_FAN]    = Fan_energy_topic,
+    [HW_LIGHT]  = Light_energy_topic
+};
+
+static telemetry_metric_t   Mains_metric[WQTT_MAINS_CNT] = {
+    [WQTT_MAINS_FREQUENCY]  = { .cfg = &Mains_frequency_telemetry },
+    [WQTT_MAINS_JITTER]     = { .cfg = &Zero_cross_telemetry },
+    [WQTT_MAINS_MISSED]     = { .cfg = &Zero_cross_telemetry }
+};
+
+static const char *     Mains_topics[WQTT_MAINS_CNT] = {
+    [WQTT_MAINS_FREQUENCY]  = Mains_frequency_topic,
+    [WQTT_MAINS_JITTER]     = Zero_cross_jitter_topic,
+    [WQTT_MAINS_MISSED]     = Zero_cross_missed_topic
+};
+
+// The metrics in a frame are marked published only once the frame is out
+static const frame_metric_t Frame_metrics[] = {
+    { "I",  Current_topic,              &Current_metric,                        &Current_value },
+    { "Eh", Heater_energy_topic,        &Energy_metric[HW_HEATER],              &Energy_value[HW_HEATER] },
+    { "Ef", Fan_energy_topic,           &Energy_metric[HW_FAN],                 &Energy_value[HW_FAN] },
+    { "El", Light_energy_topic,         &Energy_metric[HW_LIGHT],               &Energy_value[HW_LIGHT] },
+    { "fz", Mains_frequency_topic,      &Mains_metric[WQTT_MAINS_FREQUENCY],    &Mains_value[WQTT_MAINS_FREQUENCY] },
+    { "zj", Zero_cross_jitter_topic,    &Mains_metric[WQTT_MAINS_JITTER],       &Mains_value[WQTT_MAINS_JITTER] },
+    { "zm", Zero_cross_missed_topic,    &Mains_metric[WQTT_MAINS_MISSED],       &Mains_value[WQTT_MAINS_MISSED] }
+};
+
+#define FRAME_METRIC_CNT        (sizeof(Frame_metrics) / sizeof(Frame_metrics[0]))
 
 /***********************
  *  FUNCTION DEFINITIONS
  ***********************/
 
 /**
- * The function logs an error message if the error code is non-zero.
+ * @brief Parses an on/off payload
+ * 
+ * @param data  Payload, "0" or "1"
+ * @param len   Payload length
+ * @param value Output: HW_OFF or HW_ON
+ * @return true if the payload is valid
+ */
+static bool parse_state(const char *data, size_t len, uint32_t *value)
+{
+    if(len != 1 || (data[0] != '0' && data[0] != '1'))
+    {
+        return false;
+    }
+
+    *value = (data[0] == '1') ? HW_ON : HW_OFF;
+    return true;
+}
+
+/**
+ * @brief Parses a power level payload
  * 
- * @param message The message parameter is a string that describes the error or the context in which
- * the error occurred. It is used to provide additional information about the error in the log message.
- * @param error_code The error code that needs to be checked.
+ * @param data  Payload, a single digit HW_LVL_OFF .. HW_LVL_VERY_HIGH
+ * @param len   Payload length
+ * @param value Output: level
+ * @return true if the payload is valid
  */
-static void log_error_if_nonzero(const char *message, int error_code)
+static bool parse_level(const char *data, size_t len, uint32_t *value)
 {
-    if (error_code != 0) {
-        ESP_LOGE(TAG, "Last error %s: 0x%x", message, error_code);
+    if(len != 1 || data[0] < '0' + HW_LVL_OFF || data[0] > '0' + HW_LVL_VERY_HIGH)
+    {
+        return false;
     }
+
+    *value = data[0] - '0';
+    return true;
 }
 
 /**
- * @brief Detects if the topic name coming from the event corresponds to the sample topic name
+ * @brief Tells whether a received state is the echo of our own publication
+ * 
+ * The broker keeps the order of the publications, so echoes arrive in the
+ * order the states were published. Expected values skipped over belong to
+ * echoes that were lost and are dropped as well.
  * 
- * @param event_topic_name 
- * @param topic_len 
- * @param topic_name_to_compare_with 
- * @return true     topic names match
- * @return false    if topic names did not match
+ * @param type  WQTT_EVT_FAN .. WQTT_EVT_LED
+ * @param value Received state or level
+ * @return true     if the value was published by this device and must not
+ *                  drive the HW and the UI again
+ * @return false    if the command comes from elsewhere
  */
-static bool is_topic_equals(char* event_topic_name, int topic_len, char* topic_name_to_compare_with)
+static bool echo_expected(wqtt_evt_type_t type, uint32_t value)
 {
-    for(int idx = 0; idx < topic_len; ++idx)
+    lf_queue_item_t expected;
+
+    // Only the device namespace carries the published states back
+    if(!Device_scope)
     {
-        if(event_topic_name[idx] != topic_name_to_compare_with[idx])
+        return false;
+    }
+
+    while(lf_queue_pop(&Echo_queue[type], &expected))
+    {
+        if(expected.value == value)
         {
-            return false;
+            Echo_suppressed++;
+            return true;
         }
     }
 
-    return true;
+    return false;
 }
 
 /**
- * @brief Event handler registered to receive MQTT events
+ * @brief Applies a command on the topic of one field
  *
- *  This function is called by the MQTT client event loop.
+ * A command on the device topic of the field already is its state there and
+ * is not published again. Group and broadcast commands are: the state topics
+ * of the device must follow them.
  *
- * @param handler_args user data registered to the event.
- * @param base Event base for the handler(always MQTT Base in this example).
- * @param event_id The id for the received event.
- * @param event_data The data for the event, esp_mqtt_event_handle_t.
+ * @param field Field of the command
+ * @param value New value
  */
-static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+static void state_command(dev_field_t field, uint32_t value)
 {
-    ESP_LOGD(TAG, "Event dispatched from event loop base=%s, event_id=%d", base, event_id);
-    esp_mqtt_event_handle_t event = event_data;
-    esp_mqtt_client_handle_t client = event->client;
-    int msg_id;
-    hw_electr_lvl_t fan_value;
+    Command_field = Device_scope ? field : DEV_FIELD_CNT;
+    dev_state_set(field, value, DEV_ORIGIN_MQTT);
+    Command_field = DEV_FIELD_CNT;
+}
 
-    switch ((esp_mqtt_event_id_t)event_id) {
-    case MQTT_EVENT_CONNECTED:
-        ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+/**
+ * @brief Applies a Heater command
+ * 
+ * @param value HW_ON, HW_OFF
+ */
+static void heater_command(uint32_t value)
+{
+    if(echo_expected(WQTT_EVT_HEATER, value))
+    {
+        return;
+    }
 
-        msg_id = esp_mqtt_client_subscribe(client, LED_topic, 0);
-        ESP_LOGI(TAG, LED_topic " subscribe successful, msg_id=%d", msg_id);
+    HAL_LOGI(TAG, "Heater %s", (value == HW_ON) ? "ON" : "OFF");
 
-        msg_id = esp_mqtt_client_subscribe(client, Heater_topic, 0);
-        ESP_LOGI(TAG, Heater_topic " subscribe successful, msg_id=%d", msg_id);
+    state_command(DEV_HEATER, value);
+}
 
-        msg_id = esp_mqtt_client_subscribe(client, Fan_topic, 0);
-        ESP_LOGI(TAG, Fan_topic " subscribe successful, msg_id=%d", msg_id);
+/**
+ * @brief Applies a Fan command
+ * 
+ * @param value HW_LVL_OFF .. HW_LVL_VERY_HIGH
+ */
+static void fan_command(uint32_t value)
+{
+    if(echo_expected(WQTT_EVT_FAN, value))
+    {
+        return;
+    }
 
-        msg_id = esp_mqtt_client_subscribe(client, Light_topic, 0);
-        ESP_LOGI(TAG, Light_topic " subscribe successful, msg_id=%d", msg_id);
+    state_command(DEV_FAN, value);
+}
 
-        break;
+/**
+ * @brief Applies a Light command
+ * 
+ * @param value HW_ON, HW_OFF
+ */
+static void light_command(uint32_t value)
+{
+    if(echo_expected(WQTT_EVT_LIGHT, value))
+    {
+        return;
+    }
 
-    case MQTT_EVENT_DISCONNECTED:
-        ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
-        break;
+    HAL_LOGI(TAG, "Light %s", (value == HW_ON) ? "ON" : "OFF");
 
-    case MQTT_EVENT_SUBSCRIBED:
-        ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
+    state_command(DEV_LIGHT, value);
+}
 
-        break;
+/**
+ * @brief Applies a LED command
+ * 
+ * @param value HW_ON, HW_OFF
+ */
+static void led_command(uint32_t value)
+{
+    if(echo_expected(WQTT_EVT_LED, value))
+    {
+        return;
+    }
 
-    case MQTT_EVENT_UNSUBSCRIBED:
-        ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
-        break;
+    HAL_LOGI(TAG, "LED %s", (value == HW_ON) ? "ON" : "OFF");
 
-    case MQTT_EVENT_PUBLISHED:
-        ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
-        break;
-        
-    case MQTT_EVENT_DATA:
-        ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-        printf("TOPIC=%.*s  ", event->topic_len, event->topic);
-        printf("DATA=%.*s\r\n", event->data_len, event->data);
+    state_command(DEV_LED, value);
+}
 
+/**
+ * @brief Parses a Loads payload, one character per field in the store order:
+ *        its value digit or '-' to keep the field
+ * 
+ * @param value Output: LOADS_KEEP or the value of each field, 4 bits per field
+ */
+static bool parse_loads(const char *data, size_t len, uint32_t *value)
+{
+    uint32_t loads = 0;
 
-        if(is_topic_equals(event->topic, event->topic_len, Heater_topic) == true )
-        {
-            if(event->data[0] == '1')
-            {
-                ESP_LOGI(TAG, "Heater ON");
-                // HW
-                hw_ctrl_set_Load1_state(HW_ON);
-
-                // UI
-                ui_set_heater_state(HW_ON);
-            } 
-            else if (event->data[0] == '0')
-            {
-                ESP_LOGI(TAG, "Heater Off");
-                // HW
-                hw_ctrl_set_Load1_state(HW_OFF);
+    if(len != DEV_FIELD_CNT)
+    {
+        return false;
+    }
 
-                // UI
-                ui_set_heater_state(HW_OFF);
-            }
-        } 
-        else if (is_topic_equals(event->topic, event->topic_len, Fan_topic) == true)
+    for(int field = 0; field < DEV_FIELD_CNT; ++field)
+    {
+        uint32_t field_value;
+
+        if(data[field] == '-')
         {
-            fan_value = (hw_electr_lvl_t)(event->data[0] - '0');
+            field_value = LOADS_KEEP;
+        } else if(data[field] >= '0' && data[field] <= '0' + Loads_max[field]) {
+            field_value = data[field] - '0';
+        } else {
+            return false;
+        }
+
+        loads |= field_value << (field * 4);
+    }
 
-            // HW
-            hw_ctrl_set_Load2_level(fan_value);
+    *value = loads;
+    return true;
+}
+
+/**
+ * @brief Parses an unsigned decimal payload
+ * 
+ * @param value Output: parsed number
+ */
+static bool parse_number(const char *data, size_t len, uint32_t *value)
+{
+    uint64_t number = 0;
 
-            // UI
-            ui_set_fan_speed(fan_value);
+    if(len == 0 || len > 10)
+    {
+        return false;
+    }
 
+    for(size_t idx = 0; idx < len; ++idx)
+    {
+        if(data[idx] < '0' || data[idx] > '9')
+        {
+            return false;
         }
-        else if (is_topic_equals(event->topic, event->topic_len, Light_topic) == true)
+        number = number * 10 + (data[idx] - '0');
+    }
+
+    if(number > UINT32_MAX)
+    {
+        return false;
+    }
+
+    *value = (uint32_t)number;
+    return true;
+}
+
+/**
+ * @brief Answers a Ping on the Pong topic, so a client can time the round
+ *        trip through the broker and the publisher task
+ * 
+ * @param value Ping payload, sent back unchanged
+ */
+static void ping_command(uint32_t value)
+{
+    post_event(&Control_queue, WQTT_EVT_PONG, 0, value);
+}
+
+/**
+ * @brief Applies a Loads command as one group of changes, so the hardware
+ *        and the snapshot see all the fields change together. The changed
+ *        fields are published on their state topics.
+ * 
+ * @param value Fields packed by parse_loads()
+ */
+static void loads_command(uint32_t value)
+{
+    dev_change_t changes[DEV_FIELD_CNT];
+    size_t count = 0;
+
+    for(int field = 0; field < DEV_FIELD_CNT; ++field)
+    {
+        uint32_t field_value = (value >> (field * 4)) & 0xF;
+
+        if(field_value != LOADS_KEEP)
         {
-            if(event->data[0] == '1')
-            {
-                ESP_LOGI(TAG, "Light ON");
+            changes[count].field = (dev_field_t)field;
+            changes[count].value = field_value;
+            count++;
+        }
+    }
 
-                // HW
-                hw_ctrl_set_Load3_state(HW_ON);
+    HAL_LOGI(TAG, "Loads %u fields", (unsigned)count);
 
-                // UI
-                ui_set_light_state(HW_ON);
-            } 
-            else if (event->data[0] == '0')
-            {
-                ESP_LOGI(TAG, "Light OFF");
-                // HW
-                hw_ctrl_set_Load3_state(HW_OFF);
+    dev_state_set_group(changes, count, DEV_ORIGIN_MQTT);
+}
 
-                // UI
-                ui_set_light_state(HW_OFF);
-            }
+/**
+ * @brief Finds the command of a received topic in the command namespaces
+ * 
+ * @param topic     Received topic, not terminated
+ * @param len       Topic length
+ * @param name_len  Output: command length
+ * @return Command, the last topic level, or NULL if no namespace matches
+ */
+static const char *command_name(const char *topic, size_t len, size_t *name_len)
+{
+    for(size_t idx = 0; idx < Namespace_cnt; ++idx)
+    {
+        if(len > Namespace[idx].len && memcmp(topic, Namespace[idx].topic, Namespace[idx].len) == 0)
+        {
+            Device_scope = (idx == 0);
+            *name_len = len - Namespace[idx].len;
+            return topic + Namespace[idx].len;
         }
-        else if (is_topic_equals(event->topic, event->topic_len, LED_topic) == true)
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Adds a command namespace
+ * 
+ * @param fmt   Format of the namespace below the prefix, with one %s
+ * @param name  Device id or group name
+ */
+static void add_namespace(const char *fmt, const char *name)
+{
+    char level[WQTT_TOPIC_MAX];
+    int len;
+
+    snprintf(level, sizeof(level), fmt, name);
+    len = snprintf(Namespace[Namespace_cnt].topic, WQTT_TOPIC_MAX, "%s/%s/", CONFIG_WQTT_TOPIC_PREFIX, level);
+
+    if(len <= 0 || len >= WQTT_TOPIC_MAX - 1)
+    {
+        HAL_LOGE(TAG, "Namespace %s too long", level);
+        return;
+    }
+
+    Namespace[Namespace_cnt].len = len;
+    Namespace_cnt++;
+}
+
+/**
+ * @brief Event handler registered to receive MQTT events
+ *
+ *  This function is called by the MQTT client task.
+ *
+ * @param event The event, its topic and data are valid during the call only.
+ */
+static void mqtt_event_handler(const hal_mqtt_event_t *event)
+{
+    int msg_id;
+    int64_t rx_us;
+    const char *name;
+    size_t name_len;
+
+    switch (event->id) {
+    case HAL_MQTT_CONNECTED:
+        HAL_LOGI(TAG, "MQTT_EVENT_CONNECTED, session present %d", event->session_present);
+        Connected_us = hal_time_us();
+
+        // The retained snapshot brings every dashboard up to date
+        post_event(&Control_queue, WQTT_EVT_SNAPSHOT, 0, 0);
+
+        // Back online: report how long the way back took
+        post_event(&Control_queue, WQTT_EVT_WIFI, 0, 0);
+
+        // A resumed session still has the subscriptions
+        if(!event->session_present)
         {
-            //HW
-            if(event->data[0] == '1')
-            {
-                ESP_LOGI(TAG, "LED ON");
-                hw_ctrl_set_LED_state(HW_ON);
-            } 
-            else if (event->data[0] == '0')
+            for(size_t idx = 0; idx < Namespace_cnt; ++idx)
             {
-                ESP_LOGI(TAG, "LED OFF");
+                char filter[WQTT_TOPIC_MAX + 1];
 
-                hw_ctrl_set_LED_state(HW_OFF);
+                memcpy(filter, Namespace[idx].topic, Namespace[idx].len);
+                filter[Namespace[idx].len] = '+';
+                filter[Namespace[idx].len + 1] = '\0';
+                msg_id = hal_mqtt_subscribe(filter, 1);
+                HAL_LOGI(TAG, "%s subscribe successful, msg_id=%d", filter, msg_id);
             }
-
-            //No UI part
         }
 
+        break;
+
+    case HAL_MQTT_DISCONNECTED:
+        HAL_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        break;
+
+    case HAL_MQTT_SUBSCRIBED:
+        HAL_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
+
+        break;
 
+    case HAL_MQTT_PUBLISHED:
+        HAL_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
 
+        if(event->msg_id == Snapshot_msg_id && Connected_us != 0)
+        {
+            HAL_LOGI(TAG, "State consistent %lld ms after the connection", (hal_time_us() - Connected_us) / 1000);
+            Connected_us = 0;
+        }
         break;
-    case MQTT_EVENT_ERROR:
-        ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
-        if (event->error_handle->error_type == MQTT_ERROR_TYPE_TCP_TRANSPORT) {
-            log_error_if_nonzero("reported from esp-tls", event->error_handle->esp_tls_last_esp_err);
-            log_error_if_nonzero("reported from tls stack", event->error_handle->esp_tls_stack_err);
-            log_error_if_nonzero("captured as transport's socket errno",  event->error_handle->esp_transport_sock_errno);
-            ESP_LOGI(TAG, "Last errno string (%s)", strerror(event->error_handle->esp_transport_sock_errno));
+        
+    case HAL_MQTT_DATA:
+        rx_us = hal_time_us();
+        Msg_in++;
+        Bytes_in += event->topic_len + event->data_len;
 
+        HAL_LOGI(TAG, "MQTT_EVENT_DATA");
+        printf("TOPIC=%.*s  ", event->topic_len, event->topic);
+        printf("DATA=%.*s\r\n", event->data_len, event->data);
+
+        // The routes hold the last level, whatever the namespace
+        name = command_name(event->topic, event->topic_len, &name_len);
+        if(name == NULL ||
+           !topic_table_dispatch(&Topic_table, name, name_len, event->data, event->data_len))
+        {
+            HAL_LOGW(TAG, "Unknown topic or invalid payload");
+            break;
         }
+
+        command_latency_add(rx_us);
         break;
-    default:
-        ESP_LOGI(TAG, "Other event id:%d", event->event_id);
+    case HAL_MQTT_ERROR:
+        HAL_LOGI(TAG, "MQTT_EVENT_ERROR");
         break;
     }
 }
@@ -227,127 +683,657 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 
 
 /**
- * Initializes and starts an MQTT client, registers an event handler, and
- * creates a periodic timer to call the `update_current_value` function.
+ * @brief Records the time from the reception of a command to its pin write
+ *
+ * The latency is logged with the number of telemetry messages sent in the
+ * meantime, so the idle and the loaded cases can be told apart. Only outputs
+ * changed before the handler returns are seen here: a relay or a Load2 level
+ * switched at a later zero crossing is measured by host/latency_harness.
+ *
+ * @param rx_us Time the MQTT_EVENT_DATA handling started
  */
-void wqtt_client_start(void)
+static void command_latency_add(int64_t rx_us)
 {
-    esp_mqtt_client_config_t mqtt_cfg = {
-        .uri = "mqtt://m3.wqtt.ru",
-        .username = "u_BFZH1K",
-        .password = "3vGW4o04",
-        .port = 8817
-    };
+    static uint32_t telemetry_base = 0;
+    int64_t actuated_us = hw_ctrl_get_Actuated_us();
+
+    // Unknown topic or invalid payload: nothing was driven
+    if(actuated_us < rx_us)
+    {
+        return;
+    }
+
+    histogram_add(&Command_latency, (uint32_t)(actuated_us - rx_us));
+
+    if(Command_latency.count < COMMAND_LATENCY_LOG_COUNT)
+    {
+        return;
+    }
 
-    client = esp_mqtt_client_init(&mqtt_cfg);
-    /* The last argument may be used to pass data to the event handler, in this example mqtt_event_handler */
-    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
-    esp_mqtt_client_start(client);
+    HAL_LOGI(TAG, "Command latency: n=%u p50=%u p99=%u max=%u us, telemetry sent %u, echoes dropped %u",
+             Command_latency.count,
+             histogram_percentile(&Command_latency, 500),
+             histogram_percentile(&Command_latency, 990),
+             Command_latency.max,
+             Telemetry_sent - telemetry_base,
+             Echo_suppressed);
 
+    telemetry_base = Telemetry_sent;
+    histogram_reset(&Command_latency);
 }
-/**************************************************
- * GET / SET FUNCTIONS
- **************************************************/
 
 /**
- * @brief   Sets the Current value for WQTT cloud
+ * @brief   Publishes a telemetry sample if its policy asks for it
  * 
- * @param current Value of the current in mA
+ * @param metric    Metric state
+ * @param topic     Topic of the metric
+ * @param value     New sample
  */
-void wqtt_client_set_current( uint32_t current )
+static void publish_telemetry(telemetry_metric_t *metric, const char *topic, uint32_t value)
 {
+    uint32_t now_ms = hal_time_ms();
     int msg_id;
-    char str[32];
+    char str[16];
 
-    sprintf( str, "%d", current );
+    if(!telemetry_should_publish(metric, value, now_ms))
+    {
+        return;
+    }
 
-    msg_id = esp_mqtt_client_publish(client, Current_topic, str, 0, 1, 0);
-    ESP_LOGI(TAG, Current_topic " publish successful, msg_id=%d", msg_id);
-}
+    if(FRAME_ENABLED)
+    {
+        // Sent with the other metrics once the queues are drained, at the
+        // QoS of the most demanding one: an Energy total must not be lost
+        Frame_pending = true;
+        if(metric->cfg->qos > Frame_qos)
+        {
+            Frame_qos = metric->cfg->qos;
+        }
+        return;
+    }
+
+    sprintf( str, "%u", value );
 
+    msg_id = wqtt_publish(topic, str, metric->cfg->qos, 0);
+    if(msg_id < 0)
+    {
+        // Not connected: keep the metric pending
+        return;
+    }
+
+    telemetry_published(metric, value, now_ms);
+    Telemetry_sent++;
+    HAL_LOGD(TAG, "%s publish successful, msg_id=%d", topic, msg_id);
+}
 
 /**
- * @brief   Sets the Fan speed level
+ * @brief Publishes the state of a load or LED as a single digit
  * 
- * @param   HW_ON, HW_OFF
+ * @param type  WQTT_EVT_FAN .. WQTT_EVT_LED
+ * @param topic Topic of the load
+ * @param value State or level
  */
-void wqtt_client_set_Fan_level(hw_electr_lvl_t level)
+static void publish_state(wqtt_evt_type_t type, const char *topic, uint32_t value)
 {
+    lf_queue_item_t expected = {
+        .type = type,
+        .value = value
+    };
     int msg_id;
     char param[] = { ' ', '\0'};
 
-    Fan_speed = level;
-    param[0] = level + '0';
+    param[0] = value + '0';
+
+    // Expected before it is sent, a fast broker may echo it before the
+    // publish returns. A full queue only means the echo drives the same
+    // state once more.
+    lf_queue_push(&Echo_queue[type], &expected);
+
+    msg_id = wqtt_publish(topic, param, 1, 0);
+    HAL_LOGI(TAG, "%s publish successful, msg_id=%d", topic, msg_id);
 
-    msg_id = esp_mqtt_client_publish(client, Fan_topic, param, 0, 1, 0);
-    ESP_LOGI(TAG, Fan_topic " publish successful, msg_id=%d", msg_id);
+    // No echo will come: take the value out again, with the older expected
+    // values in front of it like echo_expected() does
+    if(msg_id < 0)
+    {
+        lf_queue_item_t dropped;
+
+        while(lf_queue_pop(&Echo_queue[type], &dropped))
+        {
+            if(dropped.value == value)
+            {
+                break;
+            }
+        }
+    }
 }
 
+/**
+ * @brief Publishes an overcurrent trip. Retained, so a client connecting
+ *        later still sees why the loads are off.
+ * 
+ * @param trip_ma Current of the trip in mA, 0 when acknowledged
+ */
+static void publish_trip(uint32_t trip_ma)
+{
+    int msg_id;
+    char str[16];
+
+    sprintf( str, "%u", trip_ma );
+
+    msg_id = wqtt_publish(Trip_topic, str, 1, 1);
+    HAL_LOGI(TAG, "%s publish successful, msg_id=%d", Trip_topic, msg_id);
+}
 
 /**
- * @brief   Gets the level of Fan speed
+ * @brief Publishes under the topic prefix of the device
  * 
- * @return  HW_LVL_OFF .. HW_LVL_VERY_HIGH 
+ * @param name      Topic below the prefix
+ * @param data      Payload string
+ * @param qos       MQTT QoS
+ * @param retain    Retain flag
+ * @return Message id, negative when not queued
  */
-hw_electr_lvl_t wqtt_client_get_Fan_level(void)
+static int wqtt_publish(const char *name, const char *data, int qos, int retain)
 {
-    return Fan_speed;
+    return wqtt_publish_data(name, data, strlen(data), qos, retain);
 }
 
 /**
- * @brief   Sets Heater state
+ * @brief Publishes a binary payload under the topic prefix of the device
  * 
- * @param   HW_ON, WH_OFF
+ * @param name      Topic below the prefix
+ * @param data      Payload
+ * @param len       Payload length
+ * @param qos       MQTT QoS
+ * @param retain    Retain flag
+ * @return Message id, negative when not queued
  */
-void wqtt_client_set_Heater_state(hw_state_t state)
+static int wqtt_publish_data(const char *name, const char *data, int len, int qos, int retain)
 {
+    char topic[WQTT_TOPIC_MAX];
     int msg_id;
-    char param[] = { ' ', '\0'};
 
-    Heater_state = state;
-    param[0] = state + '0';
+    snprintf(topic, sizeof(topic), "%s%s", Namespace[0].topic, name);
 
-    msg_id = esp_mqtt_client_publish(client, Heater_topic, param, 0, 1, 0);
-    ESP_LOGI(TAG, Heater_topic " publish successful, msg_id=%d", msg_id);
+    msg_id = hal_mqtt_publish(topic, data, len, qos, retain);
+    if(msg_id >= 0)
+    {
+        Msg_out++;
+        Bytes_out += strlen(topic) + len;
+    }
+
+    return msg_id;
 }
 
 /**
- * @brief   Gets the Heater state
+ * @brief Adds a metric to a frame and the size it would take as a message
+ *        of its own
  * 
- * @return  HW_ON, HW_OFF
+ * @param frame             Frame
+ * @param key               Key in the frame
+ * @param topic             Topic of the separate message
+ * @param value             Value
+ * @param separate_bytes    Output: incremented by the topic and payload size
  */
-hw_state_t  wqtt_client_get_Heater_state(void)
+static void frame_add(tele_frame_t *frame, const char *key, const char *topic, uint32_t value, uint32_t *separate_bytes)
 {
-    return Heater_state;
+    char str[16];
+
+    tele_frame_add(frame, key, value);
+    *separate_bytes += Namespace[0].len + strlen(topic) + sprintf( str, "%u", value );
 }
 
 /**
- * @brief   Sets the Light state
+ * @brief Publishes all the metrics and the load states in one frame. The
+ *        metrics stay due until the frame is queued by the client.
+ */
+static void publish_frame(void)
+{
+    static uint32_t frames = 0;
+    tele_frame_t frame;
+    dev_state_snapshot_t snap;
+    uint8_t buf[FRAME_SIZE];
+    uint32_t value[FRAME_METRIC_CNT];
+    uint32_t separate_bytes = 0;
+    uint32_t now_ms = hal_time_ms();
+    uint32_t start;
+    size_t len;
+
+    dev_state_snapshot(&snap);
+
+    tele_frame_reset(&frame);
+    tele_frame_add(&frame, "ts", now_ms);     // Separate messages carry no timestamp
+    for(size_t idx = 0; idx < FRAME_METRIC_CNT; ++idx)
+    {
+        value[idx] = *Frame_metrics[idx].value;
+        frame_add(&frame, Frame_metrics[idx].key, Frame_metrics[idx].topic, value[idx], &separate_bytes);
+    }
+    frame_add(&frame, "H",  Heater_topic, snap.value[DEV_HEATER], &separate_bytes);
+    frame_add(&frame, "F",  Fan_topic, snap.value[DEV_FAN], &separate_bytes);
+    frame_add(&frame, "L",  Light_topic, snap.value[DEV_LIGHT], &separate_bytes);
+    frame_add(&frame, "D",  LED_topic, snap.value[DEV_LED], &separate_bytes);
+
+    start = hal_cpu_cycles();
+    len = tele_frame_encode(&frame, FRAME_FORMAT, buf, sizeof(buf));
+    histogram_add(&Frame_encode_cost, hal_cpu_cycles() - start);
+
+    if(len == 0)
+    {
+        HAL_LOGE(TAG, "Telemetry frame too large");
+        Frame_pending = false;
+        Frame_qos = 0;
+        return;
+    }
+
+    if(wqtt_publish_data(Frame_topic, (const char *)buf, len, Frame_qos, 0) < 0)
+    {
+        // Not connected: retried with the next telemetry
+        return;
+    }
+
+    for(size_t idx = 0; idx < FRAME_METRIC_CNT; ++idx)
+    {
+        telemetry_published(Frame_metrics[idx].metric, value[idx], now_ms);
+    }
+
+    Frame_pending = false;
+    Frame_qos = 0;
+    Telemetry_sent++;
+
+    if(++frames < FRAME_LOG_COUNT)
+    {
+        return;
+    }
+    frames = 0;
+
+    HAL_LOGI(TAG, "Telemetry frame: %u bytes for %u metrics, %u bytes as separate messages, encoding p50=%u p99=%u max=%u cycles",
+             (uint32_t)(len + Namespace[0].len + strlen(Frame_topic)),
+             frame.count,
+             separate_bytes,
+             histogram_percentile(&Frame_encode_cost, 500),
+             histogram_percentile(&Frame_encode_cost, 990),
+             Frame_encode_cost.max);
+
+    histogram_reset(&Frame_encode_cost);
+}
+
+/**
+ * @brief Publishes a Ping answer
  * 
- * @param   HW_ON, HW_OFF
+ * @param value Ping payload
+ */
+static void publish_pong(uint32_t value)
+{
+    char str[16];
+
+    sprintf( str, "%u", value );
+    wqtt_publish(Pong_topic, str, 0, 0);
+}
+
+/**
+ * @brief Publishes the message rates of the device since the last report,
+ *        scaled to one minute
+ */
+static void publish_traffic(void)
+{
+    static uint32_t last_ms = 0;
+    static uint32_t base_msg_out = 0;
+    static uint32_t base_msg_in = 0;
+    static uint32_t base_bytes_out = 0;
+    static uint32_t base_bytes_in = 0;
+    uint32_t now_ms = hal_time_ms();
+    uint32_t period_ms = now_ms - last_ms;
+    uint32_t msg_out = Msg_out;
+    uint32_t msg_in = Msg_in;
+    uint32_t bytes_out = Bytes_out;
+    uint32_t bytes_in = Bytes_in;
+    char str[48];
+
+    if(period_ms == 0)
+    {
+        return;
+    }
+
+    // The report itself is counted in the next period
+    sprintf( str, "%u,%u,%u,%u",
+             (uint32_t)((uint64_t)(msg_out - base_msg_out) * 60000 / period_ms),
+             (uint32_t)((uint64_t)(msg_in - base_msg_in) * 60000 / period_ms),
+             (uint32_t)((uint64_t)(bytes_out - base_bytes_out) * 60000 / period_ms),
+             (uint32_t)((uint64_t)(bytes_in - base_bytes_in) * 60000 / period_ms) );
+
+    if(wqtt_publish(Traffic_topic, str, 0, 0) < 0)
+    {
+        // Not connected: the next report covers this period too
+        return;
+    }
+
+    HAL_LOGI(TAG, "Traffic per minute out,in,bytes out,bytes in: %s", str);
+
+    last_ms = now_ms;
+    base_msg_out = msg_out;
+    base_msg_in = msg_in;
+    base_bytes_out = bytes_out;
+    base_bytes_in = bytes_in;
+}
+
+/**
+ * @brief Periodic timer callback of the traffic report
+ * 
+ * @param arg Not used
+ */
+static void traffic_timer_cb(void *arg)
+{
+    post_event(&Telemetry_queue, WQTT_EVT_TRAFFIC, 0, 0);
+}
+
+/**
+ * @brief Publishes the retained snapshot of the state store:
+ *        "<version>:<heater><fan><light><led>", one digit per field
  */
-void wqtt_client_set_Light_state(hw_state_t state)
+static void publish_snapshot(void)
 {
+    dev_state_snapshot_t snap;
+    char str[16 + DEV_FIELD_CNT];
+    int len;
     int msg_id;
-    char param[] = { ' ', '\0'};
 
-    Light_state = state;
-    param[0] = state + '0';
+    dev_state_snapshot(&snap);
+
+    len = sprintf( str, "%u:", snap.version );
+    for(int field = 0; field < DEV_FIELD_CNT; ++field)
+    {
+        str[len++] = snap.value[field] + '0';
+    }
+    str[len] = '\0';
+
+    msg_id = wqtt_publish(State_topic, str, 1, 1);
+    Snapshot_msg_id = msg_id;
+    HAL_LOGI(TAG, "%s %s publish successful, msg_id=%d", State_topic, str, msg_id);
+}
+
+/**
+ * @brief Publishes the Wi-Fi reconnection statistics
+ */
+static void publish_wifi_stats(void)
+{
+    wifi_reconnect_stats_t stats;
+    char str[16];
+
+    wifi_get_reconnect_stats(&stats);
+    HAL_LOGI(TAG, "Wi-Fi reconnects %u, last %u ms in %u attempts, longest %u ms",
+             stats.reconnects, stats.last_ms, stats.last_attempts, stats.max_ms);
 
-    msg_id = esp_mqtt_client_publish(client, Light_topic, param, 0, 1, 0);
-    ESP_LOGI(TAG, Light_topic " publish successful, msg_id=%d", msg_id);
+    sprintf( str, "%u", stats.reconnects );
+    wqtt_publish(Wifi_reconnects_topic, str, 1, 0);
+
+    sprintf( str, "%u", stats.last_ms );
+    wqtt_publish(Wifi_reconnect_ms_topic, str, 1, 0);
+
+    sprintf( str, "%u", stats.max_ms );
+    wqtt_publish(Wifi_reconnect_max_topic, str, 1, 0);
 }
 
 /**
- * @brief   Gets Light state
+ * @brief Publishes one event taken from the queues
  * 
- * @return  HW_ON, HW_OFF 
+ * @param evt Event
  */
-hw_state_t wqtt_client_get_Light_state(void)
+static void publish_event(const lf_queue_item_t *evt)
 {
-    return Light_state;
+    switch((wqtt_evt_type_t)evt->type) {
+    case WQTT_EVT_FAN:
+        publish_state(WQTT_EVT_FAN, Fan_topic, evt->value);
+        break;
+
+    case WQTT_EVT_HEATER:
+        publish_state(WQTT_EVT_HEATER, Heater_topic, evt->value);
+        break;
+
+    case WQTT_EVT_LIGHT:
+        publish_state(WQTT_EVT_LIGHT, Light_topic, evt->value);
+        break;
+
+    case WQTT_EVT_LED:
+        publish_state(WQTT_EVT_LED, LED_topic, evt->value);
+        break;
+
+    case WQTT_EVT_CURRENT:
+        publish_telemetry(&Current_metric, Current_topic, evt->value);
+        break;
+
+    case WQTT_EVT_ENERGY:
+        if(evt->arg < HW_LOAD_CNT)
+        {
+            publish_telemetry(&Energy_metric[evt->arg], Energy_topics[evt->arg], evt->value);
+        }
+        break;
+
+    case WQTT_EVT_TRIP:
+        publish_trip(evt->value);
+        break;
+
+    case WQTT_EVT_WIFI:
+        publish_wifi_stats();
+        break;
+
+    case WQTT_EVT_SNAPSHOT:
+        publish_snapshot();
+        break;
+
+    case WQTT_EVT_PONG:
+        publish_pong(evt->value);
+        break;
+
+    case WQTT_EVT_TRAFFIC:
+        publish_traffic();
+        break;
+
+    case WQTT_EVT_MAINS:
+        if(evt->arg < WQTT_MAINS_CNT)
+        {
+            publish_telemetry(&Mains_metric[evt->arg], Mains_topics[evt->arg], evt->value);
+        }
+        break;
+    }
 }
 
+/**
+ * @brief Task that owns all publishing, so a slow broker only delays this task
+ * 
+ * @param pvParameter Not used
+ */
+static void publisher_task(void *pvParameter)
+{
+    lf_queue_item_t evt;
+
+    while(1)
+    {
+        // Control events first, then one telemetry event at a time
+        while(lf_queue_pop(&Control_queue, &evt) || lf_queue_pop(&Telemetry_queue, &evt))
+        {
+            publish_event(&evt);
+        }
+
+        // Everything that came due while draining goes out together
+        if(Frame_pending)
+        {
+            publish_frame();
+        }
+
+        hal_task_wait(HAL_WAIT_FOREVER);
+    }
+}
+
+/**
+ * @brief Posts an event to the publisher task without blocking
+ * 
+ * @param queue Control_queue or Telemetry_queue
+ * @param type  Event type
+ * @param arg   Event argument
+ * @param value Value to publish
+ */
+static void post_event(lf_queue_t *queue, wqtt_evt_type_t type, uint16_t arg, uint32_t value)
+{
+    lf_queue_item_t evt = {
+        .type = type,
+        .arg = arg,
+        .value = value
+    };
+    hal_task_t task = Publisher_task;
+
+    if(!lf_queue_push(queue, &evt))
+    {
+        if(queue == &Telemetry_queue)
+        {
+            // A newer sample follows shortly
+            Telemetry_dropped++;
+        } else {
+            HAL_LOGE(TAG, "Control queue full, event %d lost", type);
+        }
+        return;
+    }
+
+    // Events posted before the start are sent once the task runs
+    if(task != NULL)
+    {
+        hal_task_notify(task);
+    }
+}
+
+/**
+ * @brief State store sink: publishes the changes of the loads and the LED
+ * 
+ * @param field     Changed field
+ * @param value     New value
+ * @param origin    A command received on the state topic of the field is
+ *                  not sent back, any other change is published
+ */
+static void wqtt_client_apply(dev_field_t field, uint32_t value, dev_origin_t origin)
+{
+    // MQTT changes are applied by the MQTT task, the only one to set Command_field
+    if(field >= DEV_FIELD_CNT || (origin == DEV_ORIGIN_MQTT && field == Command_field))
+    {
+        return;
+    }
+
+    post_event(&Control_queue, State_events[field], 0, value);
+}
+
+/**
+ * @brief State store flush: refreshes the retained snapshot once per group
+ *        of changes, whatever their origin
+ */
+static void wqtt_client_flush(void)
+{
+    post_event(&Control_queue, WQTT_EVT_SNAPSHOT, 0, 0);
+}
+
+/**
+ * @brief Gets the number of telemetry samples dropped on a full queue
+ * 
+ * @return Number of dropped samples
+ */
+uint32_t wqtt_client_get_Telemetry_dropped(void)
+{
+    return Telemetry_dropped;
+}
+
+/**
+ * @brief Gets the number of received states dropped as echoes of our own
+ *        publications
+ * 
+ * @return Number of dropped echoes
+ */
+uint32_t wqtt_client_get_Echo_suppressed(void)
+{
+    return Echo_suppressed;
+}
+
+/**
+ * @brief Sets the group of the device in place of CONFIG_WQTT_GROUP, e.g. one
+ *        given by a fleet. Call before wqtt_client_start().
+ * 
+ * @param group Group name, "" for none
+ */
+void wqtt_client_set_group(const char *group)
+{
+    snprintf(Group, sizeof(Group), "%s", group);
+}
+
+/**
+ * Initializes and starts an MQTT client with a persistent session, registers
+ * an event handler, creates the publisher task that drains the event queues
+ * and attaches the client to the state store.
+ */
+void wqtt_client_start(void)
+{
+    uint8_t mac[6];
+
+    // The session is found again by a client id stable across restarts, the
+    // MAC also names the device unless a fleet gives it its own id
+    hal_read_mac(mac);
+    snprintf(Device_id, sizeof(Device_id), "%02x%02x%02x%02x%02x%02x",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    snprintf(Client_id, sizeof(Client_id), "smartRelay-%s", Device_id);
+
+    if(CONFIG_WQTT_DEVICE_ID[0] != '\0')
+    {
+        snprintf(Device_id, sizeof(Device_id), "%s", CONFIG_WQTT_DEVICE_ID);
+    }
+
+    add_namespace("%s", Device_id);
+    if(Group[0] != '\0')
+    {
+        add_namespace(Group_namespace "/%s", Group);
+    }
+    add_namespace("%s", Broadcast_namespace);
+
+    HAL_LOGI(TAG, "Device %s, %u command namespaces", Namespace[0].topic, (unsigned)Namespace_cnt);
+
+    const hal_mqtt_cfg_t mqtt_cfg = {
+        .uri = "mqtt://m3.wqtt.ru",
+        .username = "u_BFZH1K",
+        .password = "3vGW4o04",
+        .port = 8817,
+        .client_id = Client_id,
+        .clean_session = false
+    };
+
+    if(!topic_table_init(&Topic_table, Command_routes, sizeof(Command_routes) / sizeof(Command_routes[0])))
+    {
+        HAL_LOGE(TAG, "Topic table too small or duplicate topic");
+    }
+
+    if(!hal_mqtt_start(&mqtt_cfg, mqtt_event_handler))
+    {
+        HAL_LOGE(TAG, "MQTT client not started");
+    }
+
+    Publisher_task = hal_task_create(publisher_task, "wqtt_publisher", 4096, 5, HAL_CORE_ANY);
+
+    hal_timer_periodic(traffic_timer_cb, NULL, "wqtt_traffic", TRAFFIC_PERIOD_MS * 1000);
+
+    // The current states are published first, then every local change
+    dev_state_subscribe(DEV_SINK_MQTT, wqtt_client_apply, wqtt_client_flush);
+}
+/**************************************************
+ * GET / SET FUNCTIONS
+ **************************************************/
+
+/**
+ * @brief   Sets the Current value for WQTT cloud. It is published only on a
+ *          significant change or as a rare heartbeat.
+ * 
+ * @param current Value of the current in mA
+ */
+void wqtt_client_set_current( uint32_t current )
+{
+    Current_value = current;
+    post_event(&Telemetry_queue, WQTT_EVT_CURRENT, 0, current);
+}
+
+
 /**
  * @brief   Gets the Current value in mA
  * 
@@ -359,28 +1345,63 @@ uint32_t wqtt_client_get_Current(void)
 }
 
 /**
- * @brief   Sets new state for LED
+ * @brief   Sets the energy consumed by a load for WQTT cloud
  * 
- * @param   WH_ON, HW_OFF
+ * @param   load        HW_HEATER, HW_FAN, HW_LIGHT
+ * @param   energy_wh   Energy in Wh
  */
-void wqtt_client_set_LED_state(hw_state_t LED_new_state)
+void wqtt_client_set_Energy(hw_load_t load, uint32_t energy_wh)
 {
-    int msg_id;
-    char param[] = { ' ', '\0'};
+    if(load >= HW_LOAD_CNT)
+    {
+        return;
+    }
 
-    LED_state = LED_new_state;
-    param[0] = LED_new_state + '0';
+    Energy_value[load] = energy_wh;
+    post_event(&Telemetry_queue, WQTT_EVT_ENERGY, load, energy_wh);
+}
 
-    msg_id = esp_mqtt_client_publish(client, LED_topic, param, 0, 1, 0);
-    ESP_LOGI(TAG, LED_topic " publish successful, msg_id=%d", msg_id);
+/**
+ * @brief   Reports an overcurrent trip. Sent with the load states, ahead of
+ *          the telemetry.
+ * 
+ * @param   trip_ma Current of the trip in mA, 0 when the trip is acknowledged
+ */
+void wqtt_client_set_trip(uint32_t trip_ma)
+{
+    post_event(&Control_queue, WQTT_EVT_TRIP, 0, trip_ma);
 }
 
 /**
- * @brief   Gets LED state
+ * @brief   Sets a mains health metric for WQTT cloud. It is published only on a
+ *          significant change or as a rare heartbeat.
  * 
- * @return HW_ON, HW_OFF
+ * @param   metric  WQTT_MAINS_FREQUENCY .. WQTT_MAINS_MISSED
+ * @param   value   New value
  */
-hw_state_t  wqtt_client_get_LED_state(void)
+void wqtt_client_set_Mains(wqtt_mains_metric_t metric, uint32_t value)
 {
-    return LED_state;
+    if(metric >= WQTT_MAINS_CNT)
+    {
+        return;
+    }
+
+    Mains_value[metric] = value;
+    post_event(&Telemetry_queue, WQTT_EVT_MAINS, metric, value);
+}
+
+/**
+ * @brief   Gets the last energy value of a load
+ * 
+ * @param   load HW_HEATER, HW_FAN, HW_LIGHT
+ * @return  Energy in Wh
+ */
+uint32_t wqtt_client_get_Energy(hw_load_t load)
+{
+    if(load >= HW_LOAD_CNT)
+    {
+        return 0;
+    }
+
+    return Energy_value[load];
 }
@@ -9,35 +9,73 @@
  CONSTANTS AND MACROS
 ***********************************/
 
-// WQTT topic names
+/* WQTT topic names. Commands are received in three namespaces:
+ *   <prefix>/<device id>/<command>     this device only
+ *   <prefix>/group/<group>/<command>   every device of a group
+ *   <prefix>/all/<command>             every device on the broker
+ * The device publishes in its own namespace only, the load topics as its
+ * state and everything else one level deeper, under "tele/". */
 #define Heater_topic    "Heater"
 #define Fan_topic       "Fan"
 #define Light_topic     "Light"
-#define Current_topic   "Current"
 #define LED_topic       "LED"
+#define Loads_topic     "Loads"         // All fields at once, "<H><F><L><D>", '-' keeps a field
+#define Ping_topic      "Ping"          // Number, sent back on Pong_topic to time the round trip
+
+#define Current_topic   "tele/Current"
+#define Trip_topic      "tele/Trip"
+#define State_topic     "tele/State"    // Retained snapshot of the load states
+#define Pong_topic      "tele/Pong"
+#define Traffic_topic   "tele/Traffic"  // "<msgs out>,<msgs in>,<bytes out>,<bytes in>" per minute
+#define Frame_topic     "tele/Frame"    // All the metrics in one JSON or CBOR message
+
+#define Heater_energy_topic "tele/HeaterEnergy"
+#define Fan_energy_topic    "tele/FanEnergy"
+#define Light_energy_topic  "tele/LightEnergy"
+
+#define Mains_frequency_topic   "tele/MainsFrequency"
+#define Zero_cross_jitter_topic "tele/ZeroCrossJitter"
+#define Zero_cross_missed_topic "tele/ZeroCrossMissed"
+
+#define Wifi_reconnects_topic   "tele/WifiReconnects"
+#define Wifi_reconnect_ms_topic "tele/WifiReconnectMs"
+#define Wifi_reconnect_max_topic "tele/WifiReconnectMaxMs"
+
+#define Group_namespace     "group"
+#define Broadcast_namespace "all"
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+// Mains health metrics from the zero-cross monitor
+typedef enum {
+    WQTT_MAINS_FREQUENCY = 0,   // mHz
+    WQTT_MAINS_JITTER,          // us, p99 of the half-period deviation
+    WQTT_MAINS_MISSED,          // Missed half-cycles since boot
+    WQTT_MAINS_CNT
+} wqtt_mains_metric_t;
 
 /**********************************
  FUNCTION PROTTOTYPES
 ***********************************/
 
 
+void            wqtt_client_set_group(const char *group);
 void            wqtt_client_start( void );
 
 void            wqtt_client_set_current( uint32_t Current );
 
-void            wqtt_client_set_Fan_level(hw_electr_lvl_t level);
-hw_electr_lvl_t wqtt_client_get_Fan_level(void);
-
-void            wqtt_client_set_Heater_state(hw_state_t state);
-hw_state_t      wqtt_client_get_Heater_state(void);
+uint32_t        wqtt_client_get_Current(void);
 
-void            wqtt_client_set_Light_state(hw_state_t state);
-hw_state_t      wqtt_client_get_Light_state(void);
+void            wqtt_client_set_Energy(hw_load_t load, uint32_t energy_wh);
+uint32_t        wqtt_client_get_Energy(hw_load_t load);
 
-uint32_t        wqtt_client_get_Current(void);
+void            wqtt_client_set_trip(uint32_t trip_ma);
+void            wqtt_client_set_Mains(wqtt_mains_metric_t metric, uint32_t value);
 
-void            wqtt_client_set_LED_state(hw_state_t LED_new_state);
-hw_state_t      wqtt_client_get_LED_state(void);
+uint32_t        wqtt_client_get_Telemetry_dropped(void);
+uint32_t        wqtt_client_get_Echo_suppressed(void);
 
 
 #endif // _WQTT_CLIENT_H_
\ No newline at end of file
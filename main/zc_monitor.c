@@ -0,0 +1,167 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "zc_monitor.h"
+
+
+/*******************************************************
+ STATIC FUNCTION DEFINITIONS
+ *******************************************************/
+
+/**
+ * @brief Adds one interval between accepted edges to the statistics
+ *
+ * @param mon           Monitor
+ * @param interval_us   Time between two accepted edges
+ */
+static void interval_add(zc_monitor_t *mon, uint32_t interval_us)
+{
+    uint32_t half_period_us = mon->half_period_us;
+    int32_t deviation_us;
+
+    // A gap of several half-periods: count the edges that never came
+    if(interval_us > ZC_MONITOR_MAX_HALF_PERIOD_US)
+    {
+        mon->missed += (interval_us + half_period_us / 2) / half_period_us - 1;
+        return;
+    }
+
+    mon->period_sum_us += interval_us;
+    mon->period_cnt++;
+
+    deviation_us = (int32_t)interval_us - (int32_t)half_period_us;
+    histogram_add(&mon->jitter, (uint32_t)(deviation_us < 0 ? -deviation_us : deviation_us));
+}
+
+/*******************************************************
+ EXTERNAL FUNCTIONS
+ *******************************************************/
+
+/**
+ * @brief Resets the monitor to the nominal mains period with no edge seen
+ *
+ * @param mon Monitor
+ */
+void zc_monitor_init(zc_monitor_t *mon)
+{
+    memset(mon, 0, sizeof(*mon));
+
+    mon->half_period_us = ZC_MONITOR_NOMINAL_HALF_PERIOD_US;
+    mon->ring.cells = mon->cells;
+    mon->ring.mask = ZC_MONITOR_RING_SIZE - 1;
+}
+
+/**
+ * @brief Captures a zero-cross edge. Called from the edge ISR.
+ *
+ * @param mon       Monitor
+ * @param now_us    Timestamp of the edge
+ * @return true     if the edge is a zero crossing
+ * @return false    if it came too early and is treated as noise: the
+ *                  schedule of the last crossing stays valid
+ */
+bool zc_monitor_capture(zc_monitor_t *mon, uint64_t now_us)
+{
+    lf_queue_item_t edge = {
+        .value = (uint32_t)now_us
+    };
+    uint32_t interval_us;
+
+    if(mon->zero_seen)
+    {
+        interval_us = (uint32_t)(now_us - mon->last_zero_us);
+
+        // Contact bounce or noise right after an edge
+        if(interval_us < ZC_MONITOR_MIN_HALF_PERIOD_US)
+        {
+            mon->noise_edges++;
+            return false;
+        }
+
+        // Follow slow mains drift with a 1/4 IIR, ignore gaps from missed edges
+        if(interval_us <= ZC_MONITOR_MAX_HALF_PERIOD_US)
+        {
+            mon->half_period_us = (3 * mon->half_period_us + interval_us) / 4;
+        }
+    }
+
+    mon->last_zero_us = now_us;
+    mon->zero_seen = true;
+
+    if(!lf_queue_push(&mon->ring, &edge))
+    {
+        mon->overflows++;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Gets the filtered mains half-period
+ *
+ * @param mon Monitor
+ * @return Half-period in us, nominal until edges are seen
+ */
+uint32_t zc_monitor_half_period_us(const zc_monitor_t *mon)
+{
+    return mon->half_period_us;
+}
+
+/**
+ * @brief Gets the timestamp of the last accepted zero crossing
+ *
+ * @param mon Monitor
+ * @return Timestamp, 0 before the first edge
+ */
+uint64_t zc_monitor_last_zero_us(const zc_monitor_t *mon)
+{
+    return mon->last_zero_us;
+}
+
+/**
+ * @brief Drains the captured edges into the statistics. Call at least once
+ *        per ZC_MONITOR_RING_SIZE half-cycles.
+ *
+ * @param mon Monitor
+ */
+void zc_monitor_process(zc_monitor_t *mon)
+{
+    lf_queue_item_t edge;
+
+    while(lf_queue_pop(&mon->ring, &edge))
+    {
+        // 32-bit differences stay valid across the wrap of the low bits
+        if(mon->prev_seen)
+        {
+            interval_add(mon, edge.value - mon->prev_edge_us);
+        }
+
+        mon->prev_edge_us = edge.value;
+        mon->prev_seen = true;
+    }
+}
+
+/**
+ * @brief Returns the statistics of the window and starts the next one
+ *
+ * @param mon   Monitor
+ * @param stats Output
+ */
+void zc_monitor_take_stats(zc_monitor_t *mon, zc_stats_t *stats)
+{
+    zc_monitor_process(mon);
+
+    // f = 1 / (2 * mean half-period)
+    stats->freq_mhz = (mon->period_sum_us != 0) ?
+                      (uint32_t)(500000000ULL * mon->period_cnt / mon->period_sum_us) : 0;
+    stats->jitter_p99_us = histogram_percentile(&mon->jitter, 990);
+    stats->jitter_max_us = mon->jitter.max;
+    stats->missed = mon->missed;
+    stats->noise = mon->noise_edges;
+    stats->overflows = mon->overflows;
+
+    mon->period_sum_us = 0;
+    mon->period_cnt = 0;
+    histogram_reset(&mon->jitter);
+}
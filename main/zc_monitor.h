@@ -0,0 +1,77 @@
+#ifndef _ZC_MONITOR_H_
+#define _ZC_MONITOR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "lf_queue.h"
+#include "histogram.h"
+
+/**********************************
+ CONSTANTS AND MACROS
+***********************************/
+
+#define ZC_MONITOR_NOMINAL_HALF_PERIOD_US   10000   // 50 Hz mains
+#define ZC_MONITOR_MIN_HALF_PERIOD_US       7000    // ~71 Hz, shorter intervals are treated as noise
+#define ZC_MONITOR_MAX_HALF_PERIOD_US       13000   // ~38 Hz, longer intervals mean missed edges
+#define ZC_MONITOR_RING_SIZE                32      // Power of two, edges not yet processed
+
+/**********************************
+ TYPES DEFINITIONS
+***********************************/
+
+/**
+ * @brief Zero-cross capture and mains health statistics.
+ *
+ * zc_monitor_capture() runs in the edge ISR: it rejects noise, tracks the
+ * half-period and queues the edge timestamp. That half-period and the last
+ * edge are the timing base of the phase control and relay engines.
+ * zc_monitor_process() drains the queued edges in task context into the
+ * frequency, jitter and missed-cycle statistics. Like the engines it only
+ * sees timestamps of one monotonic clock.
+ */
+typedef struct {
+    // Capture side, written by the ISR only
+    volatile uint32_t   half_period_us;     // Filtered mains half-period
+    volatile uint64_t   last_zero_us;       // Last accepted edge
+    bool                zero_seen;
+    volatile uint32_t   noise_edges;        // Edges rejected as noise
+    volatile uint32_t   overflows;          // Edges lost on a full ring
+    lf_queue_cell_t     cells[ZC_MONITOR_RING_SIZE];
+    lf_queue_t          ring;               // Low 32 bits of the accepted edges
+
+    // Statistics side, task only
+    uint32_t            prev_edge_us;
+    bool                prev_seen;
+    uint64_t            period_sum_us;      // Valid half-periods of the window
+    uint32_t            period_cnt;
+    uint32_t            missed;             // Missed half-cycles since the start
+    histogram_t         jitter;             // us, half-period deviation from the filtered one
+} zc_monitor_t;
+
+/**
+ * @brief Statistics of one reporting window
+ */
+typedef struct {
+    uint32_t    freq_mhz;           // Mains frequency in mHz, 0 without a valid half-period
+    uint32_t    jitter_p99_us;
+    uint32_t    jitter_max_us;
+    uint32_t    missed;             // Missed half-cycles since the start
+    uint32_t    noise;              // Rejected edges since the start
+    uint32_t    overflows;          // Edges lost since the start
+} zc_stats_t;
+
+/**********************************
+ FUNCTION PROTTOTYPES
+***********************************/
+
+void        zc_monitor_init(zc_monitor_t *mon);
+
+bool        zc_monitor_capture(zc_monitor_t *mon, uint64_t now_us);
+uint32_t    zc_monitor_half_period_us(const zc_monitor_t *mon);
+uint64_t    zc_monitor_last_zero_us(const zc_monitor_t *mon);
+
+void        zc_monitor_process(zc_monitor_t *mon);
+void        zc_monitor_take_stats(zc_monitor_t *mon, zc_stats_t *stats);
+
+#endif // _ZC_MONITOR_H_